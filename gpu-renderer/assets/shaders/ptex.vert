@@ -1,19 +1,29 @@
 #version 330 core
 
+// See ptex_packed_vertex_t. The position is unorm16 within the mesh bounds,
+// the bounds are folded into mvp.
 layout (location = 0) in vec3 aPos;
-layout (location = 1) in vec3 aNormal;
-layout (location = 2) in vec2 aUV;
-layout (location = 3) in int aFaceID;
+// Octahedral, none of the methods read it yet.
+layout (location = 1) in vec2 aNormal;
+// Corner in the low 2 bits, face id above.
+layout (location = 2) in uint aCornerFace;
 
 out vec2 UV;
 flat out int faceID;
+flat out vec4 placeholder;
 
 uniform mat4 mvp;
 
+// Set while the model's textures are streaming in.
+uniform bool usePlaceholders;
+uniform samplerBuffer facePlaceholders;
+
 void main()
 {
-	UV = aUV;
-	faceID = aFaceID;
+	uint corner = aCornerFace & 3u;
+	UV = vec2(corner == 1u || corner == 2u ? 1.0 : 0.0, corner >= 2u ? 1.0 : 0.0);
+	faceID = int(aCornerFace >> 2u);
+	// Alpha is 0 for faces whose data hasn't been uploaded yet.
+	placeholder = usePlaceholders ? texelFetch(facePlaceholders, faceID) : vec4(0, 0, 0, 1);
 	gl_Position = mvp * vec4(aPos.x, aPos.y, aPos.z, 1.0);
 }
-
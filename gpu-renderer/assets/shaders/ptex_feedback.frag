@@ -0,0 +1,17 @@
+#version 330 core
+
+in vec2 UV;
+flat in int faceID;
+
+// Read back by update_ptex_residency to find the faces and mip levels that are seen.
+layout (location = 0) out uint outFaceID;
+// log2 of the largest screen space derivative of u and of v.
+layout (location = 1) out vec2 outUVLog2;
+
+void main()
+{
+	outFaceID = uint(faceID) + 1u;
+
+	vec2 footprint = max(abs(dFdx(UV)), abs(dFdy(UV)));
+	outUVLog2 = log2(max(footprint, vec2(1e-8)));
+}
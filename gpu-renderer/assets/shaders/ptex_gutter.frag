@@ -0,0 +1,42 @@
+#version 330 core
+
+in vec2 UV;
+flat in int faceID;
+
+out vec4 FragColor;
+
+// The face table, two RGBA32UI texels per face (see TexIndex in ptex_utils.hh),
+// only the texture index and slice in the first one are used here.
+uniform usamplerBuffer faceData;
+
+uvec2 face_tex_slice(uint faceID)
+{
+    return texelFetch(faceData, int(faceID) * 2).xy;
+}
+
+#define NUM_TEX 32
+
+// Every slice has a border of gutterWidth texels copied from the neighboring faces,
+// so a single bilinear (or trilinear) fetch is enough.
+uniform sampler2DArray aTex[NUM_TEX];
+uniform int gutterWidth;
+
+vec4 ptexture_gutter(sampler2DArray tex[NUM_TEX], vec2 uv, int faceID)
+{
+    uvec2 texIDsliceID = face_tex_slice(uint(faceID));
+    uint texID = texIDsliceID.x;
+    uint sliceID = texIDsliceID.y;
+
+    // Map the face's uv into the part of the slice inside the border.
+    vec2 size = vec2(textureSize(tex[texID], 0).xy);
+    vec2 padded_uv = (uv * (size - 2.0 * gutterWidth) + gutterWidth) / size;
+
+    return texture(tex[texID], vec3(padded_uv, sliceID));
+}
+
+void main()
+{
+    vec3 color = ptexture_gutter(aTex, UV, faceID).rgb;
+
+    FragColor = vec4(color, 1);
+}
@@ -2,23 +2,78 @@
 
 in vec2 UV;
 flat in int faceID;
+flat in vec4 placeholder;
 
 out vec4 FragColor;
 
-struct FaceData 
+// The face table, two RGBA32UI texels per face (see TexIndex in ptex_utils.hh),
+// only the texture index, slice and atlas tile in the first one are used here.
+uniform usamplerBuffer faceData;
+
+// Texture index, slice and atlas tile.
+uvec3 face_location(uint faceID)
+{
+    return texelFetch(faceData, int(faceID) * 2).xyw;
+}
+
+// A face packed into an atlas page, tile has its size and position in the page (see make_ptex_tile
+// in ptex_utils.hh). The page's coarser levels mix faces, so the lod is limited to the levels where
+// the face is at least a texel and the uv is clamped half a texel inside the face. coverage is the
+// weight CLAMP_TO_BORDER would have given the face's texels.
+vec4 ptexture_tile(sampler2DArray tex, vec2 uv, uint sliceID, uint tile, out float coverage)
+{
+    uvec2 shift = uvec2(tile & 0xFu, (tile >> 4) & 0xFu);
+    vec2 index = vec2(uvec2((tile >> 8) & 0xFFFu, tile >> 20));
+
+    vec2 scale = vec2(1.0) / vec2(uvec2(1u) << shift);
+    vec2 face_size = vec2(textureSize(tex, 0).xy) * scale;
+
+    vec2 dx = dFdx(uv * face_size);
+    vec2 dy = dFdy(uv * face_size);
+    float lod = 0.5 * log2(max(dot(dx, dx), dot(dy, dy)));
+    lod = clamp(lod, 0.0, log2(min(face_size.x, face_size.y)));
+
+    // Clamped for the coarser of the two levels trilinear filtering reads.
+    vec2 coarse_size = face_size / exp2(ceil(lod));
+    vec2 clamped = clamp(uv, 0.5 / coarse_size, 1.0 - 0.5 / coarse_size);
+
+    vec2 edge = clamp(min(uv, 1.0 - uv) * (face_size / exp2(lod)) + 0.5, 0.0, 1.0);
+    coverage = edge.x * edge.y;
+
+    return textureLod(tex, vec3((index + clamped) * scale, sliceID), lod);
+}
+
+#define CONSTANT_FACE 0xFFFFFFFFu
+
+// Color of a constant face, it's kept as RGBA8 in the slice field of the face table.
+vec4 constant_color(uint color)
+{
+    return vec4(uvec4(color, color >> 8, color >> 16, color >> 24) & 0xFFu) / 255.0;
+}
+
+// A constant face has no texture, tile has the log2 of its size instead. The coverage is
+// computed like ptexture_tile does so it still blends with its neighbors at the edges.
+vec4 ptexture_constant(vec2 uv, uint color, uint tile, out float coverage)
 {
-	uint texIDsliceID;
-};
+    vec2 face_size = vec2(uvec2(1u) << uvec2(tile & 0xFu, (tile >> 4) & 0xFu));
+
+    vec2 dx = dFdx(uv * face_size);
+    vec2 dy = dFdy(uv * face_size);
+    float lod = 0.5 * log2(max(dot(dx, dx), dot(dy, dy)));
+    lod = clamp(lod, 0.0, log2(min(face_size.x, face_size.y)));
+
+    vec2 edge = clamp(min(uv, 1.0 - uv) * (face_size / exp2(lod)) + 0.5, 0.0, 1.0);
+    coverage = edge.x * edge.y;
 
-#define MAX_FACES 1024
-layout(std140) uniform FaceDataUniform {
-	FaceData face_data[MAX_FACES];
-};
+    return constant_color(color);
+}
 
 #define NUM_TEX 24
 
 uniform sampler2DArray aTexBorder[NUM_TEX];
 uniform sampler2DArray aTexClamp[NUM_TEX];
+// False for formats without alpha (GL_R8), their coverage is computed like for atlas tiles.
+uniform bool alphaCoverage;
 
 vec3 hsv2rgb(vec3 c)
 {
@@ -27,23 +82,45 @@ vec3 hsv2rgb(vec3 c)
     return c.z * mix(K.xxx, clamp(p - K.xxx, 0.0, 1.0), c.y);
 }
 
-vec4 ptexture_single(sampler2DArray tex[32], vec2 uv, uint texIDsliceID)
+vec4 ptexture_single(sampler2DArray tex[32], vec2 uv, uvec3 texLocation)
 {
-    uint texID = texIDsliceID & 0xFFFFu;
-    uint sliceID = texIDsliceID >> 16;
+    uint texID = texLocation.x;
+    uint sliceID = texLocation.y;
+    uint tile = texLocation.z;
+
+    float coverage;
+    if (texID == CONSTANT_FACE) return ptexture_constant(uv, sliceID, tile, coverage) * coverage;
+
+    if (tile == 0u && alphaCoverage) return texture(tex[texID], vec3(uv, sliceID));
 
-    return texture(tex[texID], vec3(uv, sliceID));
+    return ptexture_tile(tex[texID], uv, sliceID, tile, coverage) * coverage;
 }
 
 vec3 ptexture(sampler2DArray texBorder[NUM_TEX], sampler2DArray texClamp[NUM_TEX], vec2 uv, int faceID)
 {
-    uint texIDsliceID = face_data[faceID].texIDsliceID;
-
-    uint texID = texIDsliceID & 0xFFFFu;
-    uint sliceID = texIDsliceID >> 16;
-
-    vec4 border_color = texture(texBorder[texID], vec3(uv, sliceID));
-    vec4 clamp_color = texture(texClamp[texID], vec3(uv, sliceID));
+    uvec3 texLocation = face_location(uint(faceID));
+
+    uint texID = texLocation.x;
+    uint sliceID = texLocation.y;
+    uint tile = texLocation.z;
+
+    // Constant everywhere, so there's nothing to filter.
+    if (texID == CONSTANT_FACE) return constant_color(sliceID).rgb;
+
+    vec4 border_color;
+    vec4 clamp_color;
+    if (tile == 0u && alphaCoverage)
+    {
+        border_color = texture(texBorder[texID], vec3(uv, sliceID));
+        clamp_color = texture(texClamp[texID], vec3(uv, sliceID));
+    }
+    else
+    {
+        // The clamped sample stays inside the face, the border is emulated with its coverage.
+        float coverage;
+        clamp_color = ptexture_tile(texBorder[texID], uv, sliceID, tile, coverage);
+        border_color = clamp_color * coverage;
+    }
 
     vec3 color = border_color.a == 0 ? clamp_color.rgb : border_color.rgb / border_color.a;
 
@@ -52,6 +129,12 @@ vec3 ptexture(sampler2DArray texBorder[NUM_TEX], sampler2DArray texClamp[NUM_TEX
 
 void main()
 {
+    if (placeholder.a == 0.0)
+    {
+        FragColor = vec4(placeholder.rgb, 1);
+        return;
+    }
+
     vec3 color = ptexture(aTexBorder, aTexClamp, UV, faceID).rgb;
 
     FragColor = vec4(color, 1);
@@ -2,6 +2,7 @@
 
 in vec2 UV;
 flat in int faceID;
+flat in vec4 placeholder;
 
 out vec4 FragColor;
 
@@ -88,22 +89,94 @@ const mat3x2 neighborTransforms[16] = mat3x2[16](
     )
 );
 
+// The face table, two RGBA32UI texels per face (see TexIndex in ptex_utils.hh):
+// texture index, slice, the four neighbor transforms and the atlas tile,
+// then the four neighbor face indices.
+uniform usamplerBuffer faceData;
+
+#define NO_NEIGHBOR 0xFFFFFFFFu
+
 struct FaceData 
 {
-	uint texIDsliceID;
-	uint neighbor01Indices;
-	uint neighbor23Indices;
+	uvec3 texLocation;
+	uvec4 neighborIndices;
 	uint neighbor0123Transform;
 };
 
-#define MAX_FACES 1024
-layout(std140) uniform FaceDataUniform {
-	FaceData face_data[MAX_FACES];
-};
+// Texture index, slice and atlas tile.
+uvec3 face_location(uint faceID)
+{
+    return texelFetch(faceData, int(faceID) * 2).xyw;
+}
+
+FaceData face_data(int faceID)
+{
+    uvec4 header = texelFetch(faceData, faceID * 2);
+
+    FaceData data;
+    data.texLocation = header.xyw;
+    data.neighbor0123Transform = header.z;
+    data.neighborIndices = texelFetch(faceData, faceID * 2 + 1);
+    return data;
+}
+
+// A face packed into an atlas page, tile has its size and position in the page (see make_ptex_tile
+// in ptex_utils.hh). The page's coarser levels mix faces, so the lod is limited to the levels where
+// the face is at least a texel and the uv is clamped half a texel inside the face. coverage is the
+// weight CLAMP_TO_BORDER would have given the face's texels.
+vec4 ptexture_tile(sampler2DArray tex, vec2 uv, uint sliceID, uint tile, out float coverage)
+{
+    uvec2 shift = uvec2(tile & 0xFu, (tile >> 4) & 0xFu);
+    vec2 index = vec2(uvec2((tile >> 8) & 0xFFFu, tile >> 20));
+
+    vec2 scale = vec2(1.0) / vec2(uvec2(1u) << shift);
+    vec2 face_size = vec2(textureSize(tex, 0).xy) * scale;
+
+    vec2 dx = dFdx(uv * face_size);
+    vec2 dy = dFdy(uv * face_size);
+    float lod = 0.5 * log2(max(dot(dx, dx), dot(dy, dy)));
+    lod = clamp(lod, 0.0, log2(min(face_size.x, face_size.y)));
+
+    // Clamped for the coarser of the two levels trilinear filtering reads.
+    vec2 coarse_size = face_size / exp2(ceil(lod));
+    vec2 clamped = clamp(uv, 0.5 / coarse_size, 1.0 - 0.5 / coarse_size);
+
+    vec2 edge = clamp(min(uv, 1.0 - uv) * (face_size / exp2(lod)) + 0.5, 0.0, 1.0);
+    coverage = edge.x * edge.y;
+
+    return textureLod(tex, vec3((index + clamped) * scale, sliceID), lod);
+}
+
+#define CONSTANT_FACE 0xFFFFFFFFu
+
+// Color of a constant face, it's kept as RGBA8 in the slice field of the face table.
+vec4 constant_color(uint color)
+{
+    return vec4(uvec4(color, color >> 8, color >> 16, color >> 24) & 0xFFu) / 255.0;
+}
+
+// A constant face has no texture, tile has the log2 of its size instead. The coverage is
+// computed like ptexture_tile does so it still blends with its neighbors at the edges.
+vec4 ptexture_constant(vec2 uv, uint color, uint tile, out float coverage)
+{
+    vec2 face_size = vec2(uvec2(1u) << uvec2(tile & 0xFu, (tile >> 4) & 0xFu));
+
+    vec2 dx = dFdx(uv * face_size);
+    vec2 dy = dFdy(uv * face_size);
+    float lod = 0.5 * log2(max(dot(dx, dx), dot(dy, dy)));
+    lod = clamp(lod, 0.0, log2(min(face_size.x, face_size.y)));
+
+    vec2 edge = clamp(min(uv, 1.0 - uv) * (face_size / exp2(lod)) + 0.5, 0.0, 1.0);
+    coverage = edge.x * edge.y;
+
+    return constant_color(color);
+}
 
 #define NUM_TEX 32
 
 uniform sampler2DArray aTex[NUM_TEX];
+// False for formats without alpha (GL_R8), their coverage is computed like for atlas tiles.
+uniform bool alphaCoverage;
 
 vec3 hsv2rgb(vec3 c)
 {
@@ -112,26 +185,32 @@ vec3 hsv2rgb(vec3 c)
     return c.z * mix(K.xxx, clamp(p - K.xxx, 0.0, 1.0), c.y);
 }
 
-vec4 ptexture_single(sampler2DArray tex[NUM_TEX], vec2 uv, uint texIDsliceID)
+vec4 ptexture_single(sampler2DArray tex[NUM_TEX], vec2 uv, uvec3 texLocation)
 {
-    uint texID = texIDsliceID & 0xFFFFu;
-    uint sliceID = texIDsliceID >> 16;
+    uint texID = texLocation.x;
+    uint sliceID = texLocation.y;
+    uint tile = texLocation.z;
 
-    return texture(tex[texID], vec3(uv, sliceID));
+    float coverage;
+    if (texID == CONSTANT_FACE) return ptexture_constant(uv, sliceID, tile, coverage) * coverage;
+
+    if (tile == 0u && alphaCoverage) return texture(tex[texID], vec3(uv, sliceID));
+
+    return ptexture_tile(tex[texID], uv, sliceID, tile, coverage) * coverage;
 }
 
 vec3 ptexture(sampler2DArray tex[NUM_TEX], vec2 uv, int faceID)
 {
-    FaceData data = face_data[faceID];
+    FaceData data = face_data(faceID);
 
     vec4 color = vec4(0);
-    color += ptexture_single(tex, uv, data.texIDsliceID);
+    color += ptexture_single(tex, uv, data.texLocation);
 
-    uint neighbor0_id = data.neighbor01Indices & 0xFFFFu;
-    uint neighbor1_id = data.neighbor01Indices >> 16;
+    uint neighbor0_id = data.neighborIndices.x;
+    uint neighbor1_id = data.neighborIndices.y;
 
-    uint neighbor2_id = data.neighbor23Indices & 0xFFFFu;
-    uint neighbor3_id = data.neighbor23Indices >> 16;
+    uint neighbor2_id = data.neighborIndices.z;
+    uint neighbor3_id = data.neighborIndices.w;
 
     uint n0_transform = (data.neighbor0123Transform >> 0 ) & 0xFFu;
     uint n1_transform = (data.neighbor0123Transform >> 8 ) & 0xFFu;
@@ -143,16 +222,22 @@ vec3 ptexture(sampler2DArray tex[NUM_TEX], vec2 uv, int faceID)
     vec2 n2_uv = neighborTransforms[n2_transform] * vec3(uv, 1);
     vec2 n3_uv = neighborTransforms[n3_transform] * vec3(uv, 1);
 
-    if (neighbor0_id != 0xFFFFu) color += ptexture_single(tex, n0_uv, face_data[neighbor0_id].texIDsliceID);
-    if (neighbor1_id != 0xFFFFu) color += ptexture_single(tex, n1_uv, face_data[neighbor1_id].texIDsliceID);
-    if (neighbor2_id != 0xFFFFu) color += ptexture_single(tex, n2_uv, face_data[neighbor2_id].texIDsliceID);
-    if (neighbor3_id != 0xFFFFu) color += ptexture_single(tex, n3_uv, face_data[neighbor3_id].texIDsliceID);
+    if (neighbor0_id != NO_NEIGHBOR) color += ptexture_single(tex, n0_uv, face_location(neighbor0_id));
+    if (neighbor1_id != NO_NEIGHBOR) color += ptexture_single(tex, n1_uv, face_location(neighbor1_id));
+    if (neighbor2_id != NO_NEIGHBOR) color += ptexture_single(tex, n2_uv, face_location(neighbor2_id));
+    if (neighbor3_id != NO_NEIGHBOR) color += ptexture_single(tex, n3_uv, face_location(neighbor3_id));
 
     return color.rgb / color.a;
 }
 
 void main()
 {
+    if (placeholder.a == 0.0)
+    {
+        FragColor = vec4(placeholder.rgb, 1);
+        return;
+    }
+
     vec3 color = ptexture(aTex, UV, faceID).rgb;
 
     FragColor = vec4(color, 1);
@@ -0,0 +1,526 @@
+#include "block_compress.hh"
+
+#include <assert.h>
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define BLOCK_COMPRESS_SSE2 1
+#include <emmintrin.h>
+#else
+#define BLOCK_COMPRESS_SSE2 0
+#endif
+
+// A block as a structure of arrays so four texels can be processed at once.
+typedef struct {
+	float c[4][16];
+} block_texels_t;
+
+static void load_block(const rgba8_t texels[16], bool use_alpha, block_texels_t* block)
+{
+	for (int i = 0; i < 16; i++)
+	{
+		block->c[0][i] = texels[i].r;
+		block->c[1][i] = texels[i].g;
+		block->c[2][i] = texels[i].b;
+		block->c[3][i] = use_alpha ? texels[i].a : 0.0f;
+	}
+}
+
+// For every texel finds the closest palette entry and returns the summed squared error.
+// Ties go to the lower index.
+static float find_indices(const block_texels_t* block, const float palette[][4], int num_colors, uint8_t indices[16])
+{
+	float error = 0;
+
+#if BLOCK_COMPRESS_SSE2
+	for (int i = 0; i < 16; i += 4)
+	{
+		__m128 r = _mm_loadu_ps(&block->c[0][i]);
+		__m128 g = _mm_loadu_ps(&block->c[1][i]);
+		__m128 b = _mm_loadu_ps(&block->c[2][i]);
+		__m128 a = _mm_loadu_ps(&block->c[3][i]);
+
+		__m128 best = _mm_set1_ps(FLT_MAX);
+		__m128 best_index = _mm_setzero_ps();
+
+		for (int p = 0; p < num_colors; p++)
+		{
+			__m128 dr = _mm_sub_ps(r, _mm_set1_ps(palette[p][0]));
+			__m128 dg = _mm_sub_ps(g, _mm_set1_ps(palette[p][1]));
+			__m128 db = _mm_sub_ps(b, _mm_set1_ps(palette[p][2]));
+			__m128 da = _mm_sub_ps(a, _mm_set1_ps(palette[p][3]));
+
+			__m128 dist = _mm_add_ps(
+				_mm_add_ps(_mm_mul_ps(dr, dr), _mm_mul_ps(dg, dg)),
+				_mm_add_ps(_mm_mul_ps(db, db), _mm_mul_ps(da, da)));
+
+			__m128 closer = _mm_cmplt_ps(dist, best);
+			best = _mm_min_ps(dist, best);
+			best_index = _mm_or_ps(_mm_and_ps(closer, _mm_set1_ps((float)p)), _mm_andnot_ps(closer, best_index));
+		}
+
+		float best_dist[4];
+		float index[4];
+		_mm_storeu_ps(best_dist, best);
+		_mm_storeu_ps(index, best_index);
+
+		for (int k = 0; k < 4; k++)
+		{
+			indices[i + k] = (uint8_t)index[k];
+			error += best_dist[k];
+		}
+	}
+#else
+	for (int i = 0; i < 16; i++)
+	{
+		float best = FLT_MAX;
+		int best_index = 0;
+
+		for (int p = 0; p < num_colors; p++)
+		{
+			float dist = 0;
+			for (int ch = 0; ch < 4; ch++)
+			{
+				float d = block->c[ch][i] - palette[p][ch];
+				dist += d * d;
+			}
+
+			if (dist < best)
+			{
+				best = dist;
+				best_index = p;
+			}
+		}
+
+		indices[i] = (uint8_t)best_index;
+		error += best;
+	}
+#endif
+
+	return error;
+}
+
+static float clamp_channel(float value)
+{
+	return value < 0 ? 0 : (value > 255 ? 255 : value);
+}
+
+// Fits a line through the texels with power iteration on the covariance matrix,
+// and returns the ends of the texels' projection onto it.
+static void fit_principal_axis(const block_texels_t* block, float e0[4], float e1[4])
+{
+	float mean[4] = { 0, 0, 0, 0 };
+	float min[4] = { 255, 255, 255, 255 };
+	float max[4] = { 0, 0, 0, 0 };
+	for (int ch = 0; ch < 4; ch++)
+	{
+		for (int i = 0; i < 16; i++)
+		{
+			float value = block->c[ch][i];
+			mean[ch] += value;
+			if (value < min[ch]) min[ch] = value;
+			if (value > max[ch]) max[ch] = value;
+		}
+		mean[ch] /= 16.0f;
+	}
+
+	float cov[4][4];
+	for (int a = 0; a < 4; a++)
+	{
+		for (int b = a; b < 4; b++)
+		{
+			float sum = 0;
+			for (int i = 0; i < 16; i++)
+			{
+				sum += (block->c[a][i] - mean[a]) * (block->c[b][i] - mean[b]);
+			}
+			cov[a][b] = sum;
+			cov[b][a] = sum;
+		}
+	}
+
+	// Start from the bounding box diagonal, it's rarely far off.
+	float axis[4];
+	for (int ch = 0; ch < 4; ch++)
+	{
+		axis[ch] = max[ch] - min[ch];
+	}
+
+	for (int iteration = 0; iteration < 8; iteration++)
+	{
+		float next[4];
+		float largest = 0;
+		for (int a = 0; a < 4; a++)
+		{
+			next[a] = cov[a][0] * axis[0] + cov[a][1] * axis[1] + cov[a][2] * axis[2] + cov[a][3] * axis[3];
+			if (fabsf(next[a]) > largest) largest = fabsf(next[a]);
+		}
+
+		if (largest == 0)
+			break;
+
+		for (int a = 0; a < 4; a++)
+		{
+			axis[a] = next[a] / largest;
+		}
+	}
+
+	float length = sqrtf(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2] + axis[3] * axis[3]);
+	if (length == 0)
+	{
+		// A solid block.
+		memcpy(e0, mean, sizeof(mean));
+		memcpy(e1, mean, sizeof(mean));
+		return;
+	}
+
+	for (int ch = 0; ch < 4; ch++)
+	{
+		axis[ch] /= length;
+	}
+
+	float t_min = FLT_MAX;
+	float t_max = -FLT_MAX;
+	for (int i = 0; i < 16; i++)
+	{
+		float t = 0;
+		for (int ch = 0; ch < 4; ch++)
+		{
+			t += (block->c[ch][i] - mean[ch]) * axis[ch];
+		}
+
+		if (t < t_min) t_min = t;
+		if (t > t_max) t_max = t;
+	}
+
+	for (int ch = 0; ch < 4; ch++)
+	{
+		e0[ch] = clamp_channel(mean[ch] + axis[ch] * t_min);
+		e1[ch] = clamp_channel(mean[ch] + axis[ch] * t_max);
+	}
+}
+
+// Least squares fit of the end points given the palette position (0 at e0, 1 at e1) each texel was assigned.
+static bool refine_endpoints(const block_texels_t* block, const uint8_t indices[16], const float* positions, float e0[4], float e1[4])
+{
+	float alpha2 = 0, beta2 = 0, alphabeta = 0;
+	float alphax[4] = { 0, 0, 0, 0 };
+	float betax[4] = { 0, 0, 0, 0 };
+
+	for (int i = 0; i < 16; i++)
+	{
+		float beta = positions[indices[i]];
+		float alpha = 1.0f - beta;
+
+		alpha2 += alpha * alpha;
+		beta2 += beta * beta;
+		alphabeta += alpha * beta;
+
+		for (int ch = 0; ch < 4; ch++)
+		{
+			alphax[ch] += alpha * block->c[ch][i];
+			betax[ch] += beta * block->c[ch][i];
+		}
+	}
+
+	float det = alpha2 * beta2 - alphabeta * alphabeta;
+	if (fabsf(det) < 1e-6f)
+		return false;
+
+	for (int ch = 0; ch < 4; ch++)
+	{
+		e0[ch] = clamp_channel((alphax[ch] * beta2 - betax[ch] * alphabeta) / det);
+		e1[ch] = clamp_channel((betax[ch] * alpha2 - alphax[ch] * alphabeta) / det);
+	}
+
+	return true;
+}
+
+size_t block_size(block_format format)
+{
+	switch (format)
+	{
+	case BLOCK_FORMAT_BC1: return BC1_BLOCK_SIZE;
+	case BLOCK_FORMAT_BC7: return BC7_BLOCK_SIZE;
+	default: assert(false); return 0;
+	}
+}
+
+size_t block_compressed_size(block_format format, int width, int height)
+{
+	size_t blocks_x = (width + 3) / 4;
+	size_t blocks_y = (height + 3) / 4;
+	return blocks_x * blocks_y * block_size(format);
+}
+
+// BC1
+
+static uint16_t quantize_565(const float color[4])
+{
+	int r = (int)(color[0] * (31.0f / 255.0f) + 0.5f);
+	int g = (int)(color[1] * (63.0f / 255.0f) + 0.5f);
+	int b = (int)(color[2] * (31.0f / 255.0f) + 0.5f);
+	return (uint16_t)(r << 11 | g << 5 | b);
+}
+
+static void expand_565(uint16_t color, int out[3])
+{
+	int r = color >> 11;
+	int g = (color >> 5) & 63;
+	int b = color & 31;
+	out[0] = (r << 3) | (r >> 2);
+	out[1] = (g << 2) | (g >> 4);
+	out[2] = (b << 3) | (b >> 2);
+}
+
+// Evaluates the 4 color mode palette, which end point is bigger only matters when writing the block.
+static float evaluate_bc1(const block_texels_t* block, uint16_t c0, uint16_t c1, uint8_t indices[16])
+{
+	int p0[3], p1[3];
+	expand_565(c0, p0);
+	expand_565(c1, p1);
+
+	float palette[4][4];
+	for (int ch = 0; ch < 3; ch++)
+	{
+		palette[0][ch] = (float)p0[ch];
+		palette[1][ch] = (float)p1[ch];
+		palette[2][ch] = (float)((2 * p0[ch] + p1[ch]) / 3);
+		palette[3][ch] = (float)((p0[ch] + 2 * p1[ch]) / 3);
+	}
+	palette[0][3] = palette[1][3] = palette[2][3] = palette[3][3] = 0;
+
+	return find_indices(block, palette, 4, indices);
+}
+
+void encode_bc1_block(const rgba8_t texels[16], uint8_t out[BC1_BLOCK_SIZE])
+{
+	static const float positions[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+
+	block_texels_t block;
+	load_block(texels, false, &block);
+
+	float e0[4], e1[4];
+	fit_principal_axis(&block, e0, e1);
+
+	uint16_t c0 = quantize_565(e0);
+	uint16_t c1 = quantize_565(e1);
+	uint8_t indices[16];
+	float error = evaluate_bc1(&block, c0, c1, indices);
+
+	if (c0 != c1 && refine_endpoints(&block, indices, positions, e0, e1))
+	{
+		uint16_t refined_c0 = quantize_565(e0);
+		uint16_t refined_c1 = quantize_565(e1);
+		uint8_t refined_indices[16];
+		float refined_error = evaluate_bc1(&block, refined_c0, refined_c1, refined_indices);
+
+		if (refined_error < error)
+		{
+			c0 = refined_c0;
+			c1 = refined_c1;
+			memcpy(indices, refined_indices, sizeof(indices));
+		}
+	}
+
+	// c0 > c1 selects the 4 color mode. Equal end points would select the
+	// 3 color mode with transparent black at index 3, but then every index is 0 anyway.
+	if (c0 < c1)
+	{
+		uint16_t temp = c0;
+		c0 = c1;
+		c1 = temp;
+
+		for (int i = 0; i < 16; i++)
+		{
+			indices[i] ^= 1;
+		}
+	}
+	else if (c0 == c1)
+	{
+		memset(indices, 0, sizeof(indices));
+	}
+
+	uint32_t index_bits = 0;
+	for (int i = 0; i < 16; i++)
+	{
+		index_bits |= (uint32_t)indices[i] << (i * 2);
+	}
+
+	out[0] = (uint8_t)(c0 & 0xFF);
+	out[1] = (uint8_t)(c0 >> 8);
+	out[2] = (uint8_t)(c1 & 0xFF);
+	out[3] = (uint8_t)(c1 >> 8);
+	out[4] = (uint8_t)(index_bits & 0xFF);
+	out[5] = (uint8_t)((index_bits >> 8) & 0xFF);
+	out[6] = (uint8_t)((index_bits >> 16) & 0xFF);
+	out[7] = (uint8_t)(index_bits >> 24);
+}
+
+// BC7 mode 6: one subset, 7.7.7.7 end points with a p-bit each, 4 bit indices.
+
+static const int bc7_weights4[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+// bc7_weights4 / 64, the blocks are encoded on several threads at once so it can't be filled in lazily.
+static const float bc7_positions4[16] = {
+	0 / 64.0f, 4 / 64.0f, 9 / 64.0f, 13 / 64.0f, 17 / 64.0f, 21 / 64.0f, 26 / 64.0f, 30 / 64.0f,
+	34 / 64.0f, 38 / 64.0f, 43 / 64.0f, 47 / 64.0f, 51 / 64.0f, 55 / 64.0f, 60 / 64.0f, 64 / 64.0f
+};
+
+typedef struct {
+	int q0[4], q1[4];
+	int p0, p1;
+	uint8_t indices[16];
+	float error;
+} bc7_mode6_t;
+
+static void quantize_bc7_endpoint(const float endpoint[4], int pbit, int quantized[4], int expanded[4])
+{
+	for (int ch = 0; ch < 4; ch++)
+	{
+		int value = (int)((endpoint[ch] - pbit) * 0.5f + 0.5f);
+		if (value < 0) value = 0;
+		if (value > 127) value = 127;
+
+		quantized[ch] = value;
+		expanded[ch] = (value << 1) | pbit;
+	}
+}
+
+// Tries every p-bit combination for the end points and keeps the best in best.
+static void try_bc7_endpoints(const block_texels_t* block, const float e0[4], const float e1[4], bc7_mode6_t* best)
+{
+	for (int p0 = 0; p0 < 2; p0++)
+	{
+		for (int p1 = 0; p1 < 2; p1++)
+		{
+			bc7_mode6_t candidate;
+			candidate.p0 = p0;
+			candidate.p1 = p1;
+
+			int x0[4], x1[4];
+			quantize_bc7_endpoint(e0, p0, candidate.q0, x0);
+			quantize_bc7_endpoint(e1, p1, candidate.q1, x1);
+
+			float palette[16][4];
+			for (int i = 0; i < 16; i++)
+			{
+				int w = bc7_weights4[i];
+				for (int ch = 0; ch < 4; ch++)
+				{
+					palette[i][ch] = (float)(((64 - w) * x0[ch] + w * x1[ch] + 32) >> 6);
+				}
+			}
+
+			candidate.error = find_indices(block, palette, 16, candidate.indices);
+			if (candidate.error < best->error)
+				*best = candidate;
+		}
+	}
+}
+
+typedef struct {
+	uint8_t* data;
+	int bit;
+} bit_writer_t;
+
+static void write_bits(bit_writer_t* writer, uint32_t value, int count)
+{
+	for (int i = 0; i < count; i++)
+	{
+		if (value & (1u << i))
+			writer->data[writer->bit >> 3] |= (uint8_t)(1u << (writer->bit & 7));
+		writer->bit++;
+	}
+}
+
+void encode_bc7_block(const rgba8_t texels[16], uint8_t out[BC7_BLOCK_SIZE])
+{
+	block_texels_t block;
+	load_block(texels, true, &block);
+
+	float e0[4], e1[4];
+	fit_principal_axis(&block, e0, e1);
+
+	bc7_mode6_t best;
+	best.error = FLT_MAX;
+	try_bc7_endpoints(&block, e0, e1, &best);
+
+	if (best.error > 0 && refine_endpoints(&block, best.indices, bc7_positions4, e0, e1))
+		try_bc7_endpoints(&block, e0, e1, &best);
+
+	// The first index is stored with its top bit implied to be 0,
+	// flip the end points around if it's set.
+	if (best.indices[0] >= 8)
+	{
+		for (int ch = 0; ch < 4; ch++)
+		{
+			int temp = best.q0[ch];
+			best.q0[ch] = best.q1[ch];
+			best.q1[ch] = temp;
+		}
+
+		int temp = best.p0;
+		best.p0 = best.p1;
+		best.p1 = temp;
+
+		for (int i = 0; i < 16; i++)
+		{
+			best.indices[i] = 15 - best.indices[i];
+		}
+	}
+
+	memset(out, 0, BC7_BLOCK_SIZE);
+	bit_writer_t writer = { out, 0 };
+
+	// Mode 6 is 6 zero bits followed by a one.
+	write_bits(&writer, 1 << 6, 7);
+
+	for (int ch = 0; ch < 4; ch++)
+	{
+		write_bits(&writer, best.q0[ch], 7);
+		write_bits(&writer, best.q1[ch], 7);
+	}
+
+	write_bits(&writer, best.p0, 1);
+	write_bits(&writer, best.p1, 1);
+
+	write_bits(&writer, best.indices[0], 3);
+	for (int i = 1; i < 16; i++)
+	{
+		write_bits(&writer, best.indices[i], 4);
+	}
+
+	assert(writer.bit == 128);
+}
+
+void encode_image(block_format format, const rgba8_t* texels, int width, int height, uint8_t* out)
+{
+	size_t size = block_size(format);
+
+	for (int by = 0; by < height; by += 4)
+	{
+		for (int bx = 0; bx < width; bx += 4)
+		{
+			rgba8_t block[16];
+			for (int y = 0; y < 4; y++)
+			{
+				int sy = by + y < height ? by + y : height - 1;
+				for (int x = 0; x < 4; x++)
+				{
+					int sx = bx + x < width ? bx + x : width - 1;
+					block[y * 4 + x] = texels[sy * width + sx];
+				}
+			}
+
+			if (format == BLOCK_FORMAT_BC1)
+				encode_bc1_block(block, out);
+			else
+				encode_bc7_block(block, out);
+
+			out += size;
+		}
+	}
+}
@@ -0,0 +1,35 @@
+#ifndef BLOCK_COMPRESS_H
+#define BLOCK_COMPRESS_H
+
+#include "util.hh"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// CPU encoders for BC1 (opaque, 4 bpp) and BC7 (mode 6 only, 8 bpp).
+// Both fit endpoints along the principal axis of the block and refine them
+// once with least squares, the palette search uses SSE2 when it's available.
+
+enum block_format {
+	BLOCK_FORMAT_NONE = 0,
+	BLOCK_FORMAT_BC1 = 1,
+	BLOCK_FORMAT_BC7 = 2,
+};
+
+#define BC1_BLOCK_SIZE 8
+#define BC7_BLOCK_SIZE 16
+
+size_t block_size(block_format format);
+
+// Size of a width x height image, partial blocks at the edges count as whole blocks.
+size_t block_compressed_size(block_format format, int width, int height);
+
+// texels is a 4x4 block in row major order. Alpha is ignored by BC1.
+void encode_bc1_block(const rgba8_t texels[16], uint8_t out[BC1_BLOCK_SIZE]);
+void encode_bc7_block(const rgba8_t texels[16], uint8_t out[BC7_BLOCK_SIZE]);
+
+// Encodes a whole image, blocks that go past the edge (including images smaller
+// than a block) are padded by repeating the last row and column.
+void encode_image(block_format format, const rgba8_t* texels, int width, int height, uint8_t* out);
+
+#endif // !BLOCK_COMPRESS_H
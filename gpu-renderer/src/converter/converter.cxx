@@ -36,11 +36,6 @@ struct texture_t {
 	int width, height;
 };
 
-struct face_neighbor_t {
-	int neighbors[4];
-	int edges[4];
-};
-
 rgb8_t rgb8_avg2(rgb8_t a, rgb8_t b)
 {
 	return { (uint8_t)((a.r + b.r) / 2), (uint8_t)((a.g + b.g) / 2), (uint8_t)((a.b + b.b) / 2) };
@@ -146,7 +141,7 @@ float wedge(vec2_t v, vec2_t w)
 	return v.x * w.y - v.y * w.x;
 }
 
-void transfer_data(ptex_mesh_t* mesh, custom_arrays::array_t<face_neighbor_t> neighbors, texture_t* texture, Ptex::PtexWriter* writer)
+void transfer_data(ptex_mesh_t* mesh, texture_t* texture, Ptex::PtexWriter* writer)
 {
 	bool b = false;
 
@@ -228,13 +223,12 @@ void transfer_data(ptex_mesh_t* mesh, custom_arrays::array_t<face_neighbor_t> ne
 			}
 		}
 
-		// FIXME: Figure out what faces are what neighbors!
-
-		int* n = &neighbors[face_id].neighbors[0];
+		int32_t* n = &mesh->adj_faces[face_id * 4];
 		info.setadjfaces(n[0], n[1], n[2], n[3]);
 
-		int* e = &neighbors[face_id].edges[0];
-		info.setadjedges(e[0], e[1], e[2], e[3]);
+		// Boundary edges have -1, Ptex wants an edge either way.
+		int8_t* e = &mesh->adj_edges[face_id * 4];
+		info.setadjedges(e[0] < 0 ? 0 : e[0], e[1] < 0 ? 0 : e[1], e[2] < 0 ? 0 : e[2], e[3] < 0 ? 0 : e[3]);
 
 		// FIXME: Set adj mode
 
@@ -245,58 +239,6 @@ void transfer_data(ptex_mesh_t* mesh, custom_arrays::array_t<face_neighbor_t> ne
 	}
 }
 
-custom_arrays::array_t<face_neighbor_t> parse_adj_data(const char* path) {
-	FILE* file = fopen(path, "rb");
-
-	custom_arrays::array_t<face_neighbor_t> faces(16);
-
-	fseek(file, 0, SEEK_END);
-	size_t size = ftell(file);
-	fseek(file, 0, SEEK_SET);
-
-	int matched;
-	do {
-		int face, n0, n1, n2, n3;
-		matched = fscanf(file, "%d: %d, %d, %d, %d", &face, &n0, &n1, &n2, &n3);
-
-		face_neighbor_t data = { n0,n1,n2,n3 };
-
-		faces.add(data);
-
-	} while (matched == 5);
-
-	fclose(file);
-
-	return faces;
-}
-
-void calculate_edges(ptex_mesh_t* mesh, custom_arrays::array_t<face_neighbor_t> faces) {
-
-	for (size_t i = 0; i < mesh->num_vertices; i += 4)
-	{
-		int face_id = i / 4;
-
-		int* neighbors = &faces[face_id].neighbors[0];
-
-		int* edges = &faces[face_id].edges[0];
-
-		for (size_t my_n_id = 0; my_n_id < 4; my_n_id++)
-		{
-			// Go to the next face and find where this face id is located.
-			for (size_t other_n_id = 0; other_n_id < 4; other_n_id++)
-			{
-				if (faces[neighbors[my_n_id]].neighbors[other_n_id] == face_id)
-				{
-					// my_n_id = the edge of the current face
-					// other_n_id = the edge of the adjacent face connected to this face.
-					
-					edges[my_n_id] = other_n_id;
-				}
-			}
-		}
-	}
-}
-
 int main(int argv, char** argc)
 {
 	change_directory(ASSETS_PATH);
@@ -304,7 +246,6 @@ int main(int argv, char** argc)
 	const char* ptex_path = "models/robot/Quandtum_BA-2_v1_1.ptex";
 	const char* obj_path = "models/robot/robot_2.obj";
 	const char* tex_path = "models/robot/textures/Turret-Diffuse.jpg";
-	const char* adj_path = "models/robot/robot_2.adj";
 
 	ptex_mesh_t* mesh = load_mesh(obj_path);
 
@@ -322,12 +263,9 @@ int main(int argv, char** argc)
 		printf("Ptex Writer Open Error: %s\n", error_str.c_str());
 	}
 
-	custom_arrays::array_t<face_neighbor_t> face_data = parse_adj_data(adj_path);
-	calculate_edges(mesh, face_data);
-
 	texture_t tex = { tex_data, width, height };
 
-	transfer_data(mesh, face_data, &tex, writer);
+	transfer_data(mesh, &tex, writer);
 
 	
 	writer->close(error_str);
@@ -1,5 +1,6 @@
 
 #include "cpu_renderer.hh"
+#include "pixel_convert.hh"
 
 #include <stdlib.h>
 #include <assert.h>
@@ -27,15 +28,8 @@ rgb8_t* vec3_buffer_to_rgb8(vec3_t* buffer, int width, int height)
     rgb8_t* rgb_buffer = (rgb8_t*)malloc(width * height * sizeof(rgb8_t));
     assert(rgb_buffer != NULL);
 
-    for (int y = 0; y < height; y++)
-    {
-        for (int x = 0; x < width; x++)
-        {
-            int index = y * width + x;
-
-            rgb_buffer[index] = vec3_to_rgb8(buffer[index]);
-        }
-    }
+    // Rounds like convert_float_uint, with the values clamped to [0, 1] first.
+    convert_float_to_unorm8((const float*)buffer, (uint8_t*)rgb_buffer, (size_t)width * height * 3);
 
     return rgb_buffer;
 }
@@ -7,6 +7,8 @@
 #include <stb_image.h>
 
 bool has_KHR_debug = false;
+bool has_texture_compression_s3tc = false;
+bool has_texture_compression_bptc = false;
 
 void check_shader_error(int shader)
 {
@@ -275,7 +277,7 @@ void recreate_framebuffer(framebuffer_t* framebuffer, framebuffer_desc desc, int
 }
 
 
-GLuint create_vao(const vao_desc* desc, void* vertex_data, int vertex_size, int vertex_count)
+GLuint create_vao(const vao_desc* desc, void* vertex_data, int vertex_size, int vertex_count, const uint32_t* indices, int index_count)
 {
     GLuint vao;
     glGenVertexArrays(1, &vao);
@@ -305,11 +307,55 @@ GLuint create_vao(const vao_desc* desc, void* vertex_data, int vertex_size, int
         glEnableVertexAttribArray(i);
     }
 
+    // The element array binding is part of the VAO's state.
+    if (indices != NULL)
+    {
+        GLuint index_buffer;
+        glGenBuffers(1, &index_buffer);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, index_count * sizeof(uint32_t), indices, GL_STATIC_DRAW);
+    }
+
     glBindVertexArray(0);
 
     return vao;
 }
 
+index_ranges_t create_index_ranges(int max_ranges)
+{
+    index_ranges_t ranges;
+    ranges.num_ranges = 0;
+    ranges.max_ranges = max_ranges > 1 ? max_ranges : 1;
+    ranges.counts = (GLsizei*)malloc(sizeof(GLsizei) * ranges.max_ranges);
+    ranges.offsets = (const void**)malloc(sizeof(void*) * ranges.max_ranges);
+    return ranges;
+}
+
+void free_index_ranges(index_ranges_t* ranges)
+{
+    free(ranges->counts);
+    free(ranges->offsets);
+    ranges->counts = NULL;
+    ranges->offsets = NULL;
+    ranges->num_ranges = 0;
+    ranges->max_ranges = 0;
+}
+
+void set_whole_index_range(index_ranges_t* ranges, int index_count)
+{
+    ranges->num_ranges = 1;
+    ranges->counts[0] = index_count;
+    ranges->offsets[0] = 0;
+}
+
+void draw_index_ranges(const index_ranges_t* ranges)
+{
+    if (ranges->num_ranges == 1)
+        glDrawElements(GL_TRIANGLES, ranges->counts[0], GL_UNSIGNED_INT, ranges->offsets[0]);
+    else if (ranges->num_ranges > 1)
+        glMultiDrawElements(GL_TRIANGLES, ranges->counts, GL_UNSIGNED_INT, ranges->offsets, ranges->num_ranges);
+}
+
 
 texture_t create_texture(const char* filepath, texture_desc desc) {
     int channels;
@@ -2,11 +2,27 @@
 #define GL_UTILS_H
 
 #include <glad/glad.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #include "maths.hh"
 
 extern bool has_KHR_debug;
+extern bool has_texture_compression_s3tc;
+extern bool has_texture_compression_bptc;
+
+// glad is generated for core 3.3 without these extensions.
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGBA_S3TC_DXT1_EXT 0x83F1
+#endif
+
+#ifndef GL_COMPRESSED_RGBA_BPTC_UNORM
+#define GL_COMPRESSED_RGBA_BPTC_UNORM 0x8E8C
+#endif
 
 typedef struct {
     const char* name;
@@ -66,7 +82,26 @@ typedef struct {
     attribute_desc* attribs;
 } vao_desc;
 
-GLuint create_vao(const vao_desc* desc, void* vertex_data, int vertex_size, int vertex_count);
+// With indices the VAO also keeps an index buffer, and is drawn with glDrawElements and GL_UNSIGNED_INT.
+GLuint create_vao(const vao_desc* desc, void* vertex_data, int vertex_size, int vertex_count, const uint32_t* indices = NULL, int index_count = 0);
+
+// Parts of a VAO's index buffer to draw, with one glMultiDrawElements when there is more than one.
+typedef struct {
+    int num_ranges;
+    int max_ranges;
+    GLsizei* counts;
+    // Byte offsets into the index buffer.
+    const void** offsets;
+} index_ranges_t;
+
+index_ranges_t create_index_ranges(int max_ranges);
+
+void free_index_ranges(index_ranges_t* ranges);
+
+// A single range over the whole index buffer.
+void set_whole_index_range(index_ranges_t* ranges, int index_count);
+
+void draw_index_ranges(const index_ranges_t* ranges);
 
 typedef struct {
     GLenum wrap_s, wrap_t;
@@ -90,6 +125,8 @@ typedef struct {
     int height;
     int slices;
     GLuint texture;
+    // GL_RGBA8, one of the smaller ptex formats (see ptex_array_format) or one of the compressed formats.
+    GLenum internal_format;
     GLenum wrap_s, wrap_t;
     GLenum mag_filter, min_filter;
     bool is_sRGB;
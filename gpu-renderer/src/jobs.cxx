@@ -0,0 +1,130 @@
+#include "jobs.hh"
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#define CHUNKS_PER_WORKER 4
+
+namespace jobs {
+	typedef struct {
+		job_group* group;
+		std::shared_ptr<std::function<void(int)>> func;
+		int begin, end;
+	} chunk_t;
+
+	typedef struct {
+		std::mutex mutex;
+		std::condition_variable work_available;
+		std::condition_variable work_done;
+		std::deque<chunk_t> queue;
+		int num_workers;
+	} pool_t;
+
+	// The pool is never destroyed, the workers are detached
+	// and just die with the process.
+	static pool_t* pool = NULL;
+	static std::once_flag pool_init_flag;
+
+	static void worker_main(pool_t* p)
+	{
+		while (true)
+		{
+			chunk_t chunk;
+			{
+				std::unique_lock<std::mutex> lock(p->mutex);
+				p->work_available.wait(lock, [p] { return p->queue.empty() == false; });
+				chunk = p->queue.front();
+				p->queue.pop_front();
+			}
+
+			for (int i = chunk.begin; i < chunk.end; i++)
+			{
+				(*chunk.func)(i);
+			}
+
+			if (--chunk.group->remaining == 0)
+			{
+				// Take the lock so a waiter can't miss the notification.
+				std::lock_guard<std::mutex> lock(p->mutex);
+				p->work_done.notify_all();
+			}
+		}
+	}
+
+	static pool_t* get_pool()
+	{
+		std::call_once(pool_init_flag, [] {
+			pool_t* p = new pool_t();
+
+			int threads = (int)std::thread::hardware_concurrency();
+			p->num_workers = threads > 0 ? threads : 4;
+
+			for (int i = 0; i < p->num_workers; i++)
+			{
+				std::thread(worker_main, p).detach();
+			}
+
+			pool = p;
+		});
+
+		return pool;
+	}
+
+	int num_workers()
+	{
+		return get_pool()->num_workers;
+	}
+
+	void run(job_group* group, int count, std::function<void(int)> func)
+	{
+		if (count <= 0)
+			return;
+
+		pool_t* p = get_pool();
+
+		int num_chunks = p->num_workers * CHUNKS_PER_WORKER;
+		if (num_chunks > count) num_chunks = count;
+
+		std::shared_ptr<std::function<void(int)>> shared_func = std::make_shared<std::function<void(int)>>(std::move(func));
+
+		group->remaining += num_chunks;
+
+		{
+			std::lock_guard<std::mutex> lock(p->mutex);
+			for (int i = 0; i < num_chunks; i++)
+			{
+				chunk_t chunk;
+				chunk.group = group;
+				chunk.func = shared_func;
+				chunk.begin = (int)((int64_t)count * i / num_chunks);
+				chunk.end = (int)((int64_t)count * (i + 1) / num_chunks);
+				p->queue.push_back(chunk);
+			}
+		}
+
+		p->work_available.notify_all();
+	}
+
+	bool is_done(job_group* group)
+	{
+		return group->remaining == 0;
+	}
+
+	void wait(job_group* group)
+	{
+		pool_t* p = get_pool();
+
+		std::unique_lock<std::mutex> lock(p->mutex);
+		p->work_done.wait(lock, [group] { return group->remaining == 0; });
+	}
+
+	void parallel_for(int count, std::function<void(int)> func)
+	{
+		job_group group;
+		run(&group, count, std::move(func));
+		wait(&group);
+	}
+}
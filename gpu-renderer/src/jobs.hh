@@ -0,0 +1,31 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <atomic>
+#include <functional>
+
+// A fixed pool of worker threads that is started the first time it's used.
+// Work is queued as a range of indices that gets split into a few chunks per worker.
+// Jobs must not touch GL, the context only lives on the main thread.
+namespace jobs {
+	struct job_group {
+		std::atomic<int> remaining;
+
+		job_group() : remaining(0) {}
+	};
+
+	int num_workers();
+
+	// Queues func(i) for every i in [0, count) and returns immediately.
+	void run(job_group* group, int count, std::function<void(int)> func);
+
+	bool is_done(job_group* group);
+
+	// Blocks until all jobs queued on the group have finished.
+	void wait(job_group* group);
+
+	// run() followed by wait().
+	void parallel_for(int count, std::function<void(int)> func);
+}
+
+#endif // !JOBS_H
@@ -0,0 +1,229 @@
+#include "lz4.hh"
+
+#include <string.h>
+
+#define LZ4_MIN_MATCH 4
+// The last 5 bytes are always literals, and the last match has to start 12 bytes before the end.
+#define LZ4_LAST_LITERALS 5
+#define LZ4_MF_LIMIT 12
+#define LZ4_MAX_OFFSET 65535
+
+#define LZ4_HASH_LOG 12
+#define LZ4_HASH_SIZE (1 << LZ4_HASH_LOG)
+
+static inline uint32_t read32(const uint8_t* ptr)
+{
+	uint32_t value;
+	memcpy(&value, ptr, sizeof(value));
+	return value;
+}
+
+static inline uint32_t hash32(uint32_t sequence)
+{
+	return (sequence * 2654435761u) >> (32 - LZ4_HASH_LOG);
+}
+
+static inline uint8_t* write_length(uint8_t* op, size_t length)
+{
+	while (length >= 255)
+	{
+		*op++ = 255;
+		length -= 255;
+	}
+	*op++ = (uint8_t)length;
+	return op;
+}
+
+size_t lz4_compress_bound(size_t size)
+{
+	return size + size / 255 + 16;
+}
+
+size_t lz4_compress(const void* src, size_t src_size, void* dst, size_t dst_capacity)
+{
+	const uint8_t* source = (const uint8_t*)src;
+	const uint8_t* ip = source;
+	const uint8_t* anchor = source;
+	const uint8_t* src_end = source + src_size;
+
+	uint8_t* op = (uint8_t*)dst;
+	uint8_t* dst_end = op + dst_capacity;
+
+	if (src_size > LZ4_MF_LIMIT)
+	{
+		// Positions are stored relative to the source, 0 is a valid (if unlikely) candidate
+		// so every candidate is verified before it's used.
+		uint32_t table[LZ4_HASH_SIZE];
+		memset(table, 0, sizeof(table));
+
+		const uint8_t* match_limit = src_end - LZ4_MF_LIMIT;
+		const uint8_t* match_end_limit = src_end - LZ4_LAST_LITERALS;
+
+		while (ip < match_limit)
+		{
+			uint32_t sequence = read32(ip);
+			uint32_t hash = hash32(sequence);
+			const uint8_t* ref = source + table[hash];
+			table[hash] = (uint32_t)(ip - source);
+
+			if (ref >= ip || ip - ref > LZ4_MAX_OFFSET || read32(ref) != sequence)
+			{
+				// Skip faster through data that doesn't compress.
+				ip += 1 + ((ip - anchor) >> 6);
+				continue;
+			}
+
+			const uint8_t* match_end = ip + LZ4_MIN_MATCH;
+			const uint8_t* ref_end = ref + LZ4_MIN_MATCH;
+			while (match_end < match_end_limit && *match_end == *ref_end)
+			{
+				match_end++;
+				ref_end++;
+			}
+
+			size_t literal_length = ip - anchor;
+			size_t match_length = match_end - ip - LZ4_MIN_MATCH;
+
+			// token + literal length + literals + offset + match length
+			size_t needed = 1 + literal_length / 255 + 1 + literal_length + 2 + match_length / 255 + 1;
+			if ((size_t)(dst_end - op) < needed)
+				return 0;
+
+			uint8_t* token = op++;
+
+			if (literal_length >= 15)
+			{
+				*token = 15 << 4;
+				op = write_length(op, literal_length - 15);
+			}
+			else
+			{
+				*token = (uint8_t)(literal_length << 4);
+			}
+
+			memcpy(op, anchor, literal_length);
+			op += literal_length;
+
+			uint16_t offset = (uint16_t)(ip - ref);
+			*op++ = (uint8_t)(offset & 0xFF);
+			*op++ = (uint8_t)(offset >> 8);
+
+			if (match_length >= 15)
+			{
+				*token |= 15;
+				op = write_length(op, match_length - 15);
+			}
+			else
+			{
+				*token |= (uint8_t)match_length;
+			}
+
+			ip = match_end;
+			anchor = ip;
+
+			// Insert a position inside the match so runs chain into each other.
+			if (ip < match_limit)
+				table[hash32(read32(ip - 2))] = (uint32_t)(ip - 2 - source);
+		}
+	}
+
+	// The remaining bytes are written as one last literal run.
+	size_t literal_length = src_end - anchor;
+	size_t needed = 1 + literal_length / 255 + 1 + literal_length;
+	if ((size_t)(dst_end - op) < needed)
+		return 0;
+
+	uint8_t* token = op++;
+	if (literal_length >= 15)
+	{
+		*token = 15 << 4;
+		op = write_length(op, literal_length - 15);
+	}
+	else
+	{
+		*token = (uint8_t)(literal_length << 4);
+	}
+
+	memcpy(op, anchor, literal_length);
+	op += literal_length;
+
+	return op - (uint8_t*)dst;
+}
+
+static inline bool read_length(const uint8_t** ip, const uint8_t* src_end, size_t* length)
+{
+	uint8_t byte;
+	do
+	{
+		if (*ip >= src_end)
+			return false;
+
+		byte = *(*ip)++;
+		*length += byte;
+	} while (byte == 255);
+
+	return true;
+}
+
+bool lz4_decompress(const void* src, size_t src_size, void* dst, size_t dst_size)
+{
+	const uint8_t* ip = (const uint8_t*)src;
+	const uint8_t* src_end = ip + src_size;
+
+	uint8_t* op = (uint8_t*)dst;
+	uint8_t* dst_start = op;
+	uint8_t* dst_end = op + dst_size;
+
+	while (ip < src_end)
+	{
+		uint8_t token = *ip++;
+
+		size_t literal_length = token >> 4;
+		if (literal_length == 15 && read_length(&ip, src_end, &literal_length) == false)
+			return false;
+
+		if ((size_t)(src_end - ip) < literal_length || (size_t)(dst_end - op) < literal_length)
+			return false;
+
+		memcpy(op, ip, literal_length);
+		ip += literal_length;
+		op += literal_length;
+
+		// The last sequence only has literals.
+		if (ip == src_end)
+			break;
+
+		if (src_end - ip < 2)
+			return false;
+
+		size_t offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+
+		if (offset == 0 || offset > (size_t)(op - dst_start))
+			return false;
+
+		size_t match_length = token & 15;
+		if (match_length == 15 && read_length(&ip, src_end, &match_length) == false)
+			return false;
+		match_length += LZ4_MIN_MATCH;
+
+		if ((size_t)(dst_end - op) < match_length)
+			return false;
+
+		// Matches can overlap the output, copy in chunks that don't
+		// and let the repeated region double every iteration.
+		const uint8_t* match = op - offset;
+		while (match_length > 0)
+		{
+			size_t chunk = op - match;
+			if (chunk > match_length)
+				chunk = match_length;
+
+			memcpy(op, match, chunk);
+			op += chunk;
+			match_length -= chunk;
+		}
+	}
+
+	return op == dst_end;
+}
@@ -0,0 +1,21 @@
+#ifndef LZ4_H
+#define LZ4_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// A small implementation of the LZ4 block format (no frame format).
+// Output is compatible with the reference LZ4 decoder and vice versa.
+// The compressor is the simple greedy single-probe variant,
+// it's fast but doesn't try as hard as LZ4_compress_HC.
+
+// Worst case compressed size of size bytes of input.
+size_t lz4_compress_bound(size_t size);
+
+// Returns the compressed size, or 0 if the output didn't fit in dst_capacity.
+size_t lz4_compress(const void* src, size_t src_size, void* dst, size_t dst_capacity);
+
+// Returns false if the block is malformed or doesn't decompress to exactly dst_size bytes.
+bool lz4_decompress(const void* src, size_t src_size, void* dst, size_t dst_size);
+
+#endif // !LZ4_H
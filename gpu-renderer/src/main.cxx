@@ -4,6 +4,9 @@
 
 #include "mesh.hh"
 #include "mesh_loading.hh"
+#include "mesh_cache.hh"
+#include "mesh_adjacency.hh"
+#include "mesh_clusters.hh"
 
 #define GLFW_INCLUDE_NONE
 #include <GLFW/glfw3.h>
@@ -19,6 +22,15 @@
 #include "util.hh"
 #include "gl_utils.hh"
 #include "ptex_utils.hh"
+#include "ptex_atlas.hh"
+#include "ptex_pack.hh"
+#include "ptex_tile_pack.hh"
+#include "ptex_stream.hh"
+#include "ptex_compress.hh"
+#include "ptex_gutter.hh"
+#include "ptex_reload.hh"
+#include "ptex_residency.hh"
+#include "pixel_convert.hh"
 
 #include "platform.hh"
 
@@ -52,6 +64,16 @@ custom_arrays::array_t<ptex_mesh_t*> meshes(10);
 custom_arrays::array_t<GLuint> mesh_vaos(10);
 custom_arrays::array_t<Ptex::PtexTexture*> ptexTextures(10);
 custom_arrays::array_t<gl_ptex_data> texturesGLData(10);
+// NULL once a model's textures are fully loaded.
+custom_arrays::array_t<ptex_stream_t*> texture_streams(10);
+// NULL until a model's textures are loaded, or while g_watch_ptex_files is off.
+custom_arrays::array_t<ptex_watch_t*> ptex_watches(10);
+// NULL for models with every face resident, see g_ptex_residency.
+custom_arrays::array_t<ptex_residency_t*> residencies(10);
+// Time the model was last drawn, the inactive models drawn the longest ago are evicted first.
+custom_arrays::array_t<double> mesh_last_used(10);
+// The clusters of the model left after culling this frame.
+custom_arrays::array_t<index_ranges_t> mesh_draw_ranges(10);
 custom_arrays::array_t<mat4_t> mesh_model_matrix(10);
 custom_arrays::array_t<vec3_t> background_colors(10);
 
@@ -70,6 +92,18 @@ typedef struct {
 
 camera_t g_camera;
 
+// The textures of the models that aren't drawn are freed while all models' textures take more
+// than g_texture_memory_budget, and loaded again from their pack (or the ptex file if there is none)
+// when the model is selected. Streaming models and models with a residency pool are kept.
+bool g_evict_inactive_models = true;
+uint64_t g_texture_memory_budget = 256 * 1024 * 1024;
+
+cluster_cull_stats_t cluster_cull_stats;
+
+// Set from the UI, the samples the nvidia method draws are counted with and without culling next frame.
+bool measure_cluster_samples = false;
+uint64_t whole_mesh_samples = 0, culled_mesh_samples = 0;
+
 struct saved_viewpoint {
     char name[128];
     camera_t camera;
@@ -214,6 +248,7 @@ void GLFWFrambufferSizeCallback(GLFWwindow* window, int width, int height)
     Methods::intel.resize_buffers(width, height);
     Methods::hybrid.resize_buffers(width, height);
     Methods::reducedTraverse.resize_buffers(width, height);
+    Methods::gutter.resize_buffers(width, height);
 
     g_camera.aspect = width / (float)height;
 
@@ -520,6 +555,286 @@ void* download_rgb8_framebuffer(framebuffer_t* framebuffer, GLenum attachment) {
 
 #define VIEWPOINTS_FILE "viewpoints.vp"
 
+void write_ptex_caches(const char* ptex_path, gl_ptex_data ptex_data)
+{
+    if (g_use_ptex_pack_cache == false)
+        return;
+
+    char pack_path[PATH_SIZE];
+    ptex_pack_path(ptex_path, g_use_ptex_tile_pack ? PTEX_TILE_PACK_EXTENSION : PTEX_PACK_EXTENSION, pack_path, sizeof(pack_path));
+
+    if (g_use_ptex_tile_pack)
+        write_ptex_tile_pack(pack_path, ptex_path, ptex_data);
+    else
+        write_ptex_pack(pack_path, ptex_path, ptex_data);
+}
+
+// Block compresses the textures if g_ptex_block_compression is set, and writes the cache
+// unless the textures were loaded from an up to date one that didn't need compressing.
+void finish_ptex_textures(const char* name, const char* ptex_path, gl_ptex_data* ptex_data, bool from_cache)
+{
+    bool compressed = false;
+    if (g_ptex_block_compression != BLOCK_FORMAT_NONE)
+    {
+        ptex_compression_stats stats;
+        compressed = compress_ptex_arrays(name, ptex_data, g_ptex_block_compression, &stats);
+        if (compressed)
+            print_ptex_compression_stats(name, g_ptex_block_compression, &stats);
+    }
+
+    if (from_cache == false || compressed)
+        write_ptex_caches(ptex_path, *ptex_data);
+
+    uint64_t size, rgba8_size;
+    ptex_arrays_memory_size(ptex_data->array_textures, &size, &rgba8_size);
+    printf("%s textures use %.1fMB of GPU memory (%.1fMB as RGBA8), process peak memory %.1fMB\n",
+        name, size / (1024.0 * 1024.0), rgba8_size / (1024.0 * 1024.0), get_peak_memory_usage() / (1024.0 * 1024.0));
+}
+
+// Size and decode rate of the face data in the file's own data type.
+void print_ptex_data_throughput(const char* name, Ptex::PtexTexture* ptex, double seconds)
+{
+    double megabytes = ptex_data_size(ptex) / (1024.0 * 1024.0);
+    printf("%s has %d channel %s data, %.1fMB at %.1fMB/s\n",
+        name, ptex->numChannels(), Ptex::DataTypeName(ptex->dataType()), megabytes, seconds > 0 ? megabytes / seconds : 0.0);
+}
+
+void update_texture_streams()
+{
+    for (int i = 0; i < texture_streams.size; i++)
+    {
+        ptex_stream_t* stream = texture_streams[i];
+        if (stream == NULL)
+            continue;
+
+        if (update_ptex_stream(stream, &texturesGLData[i]))
+        {
+            printf("Streamed textures for %s in %.2fms\n", mesh_names[i], (stream->end_time - stream->start_time) * 1000.0);
+            print_ptex_mip_stats(mesh_names[i], &stream->mip_stats);
+            print_ptex_data_throughput(mesh_names[i], ptexTextures[i], stream->end_time - stream->start_time);
+
+            finish_ptex_textures(mesh_names[i], ptexTextures[i]->path(), &texturesGLData[i], false);
+
+            destroy_ptex_stream(stream);
+            texture_streams[i] = NULL;
+        }
+    }
+}
+
+// Loads every face before returning, see g_ptex_bounded_load.
+gl_ptex_data load_ptex_textures(const char* name, Ptex::PtexTexture* ptex)
+{
+    if (g_ptex_bounded_load)
+        return load_ptex_stream(name, ptex, GL_LINEAR, GL_LINEAR);
+
+    return create_gl_texture_arrays(name, extract_textures(ptex), GL_LINEAR, GL_LINEAR);
+}
+
+void refresh_current_filter(int mesh)
+{
+    if (mesh != current_mesh)
+        return;
+
+    if (current_filter) current_filter->release();
+    current_filter = PtexFilter::getFilter(ptexTextures[current_mesh], PtexFilter::Options{ g_current_filter_type, false, 0, false });
+}
+
+// Loads the textures of a model again after an edit that can't be uploaded in place.
+void reload_ptex_textures(int mesh)
+{
+    const char* name = mesh_names[mesh];
+    const char* ptex_path = ptexTextures[mesh]->path();
+
+    Ptex::String error_str;
+    Ptex::PtexTexture* ptex = PtexTexture::open(ptex_path, error_str);
+    if (ptex == NULL)
+    {
+        printf("Ptex Error at model %s! %s\n", name, error_str.c_str());
+        return;
+    }
+
+    destroy_gl_ptex_data(&texturesGLData[mesh]);
+
+    double start = glfwGetTime();
+    texturesGLData[mesh] = load_ptex_textures(name, ptex);
+    printf("Reloaded textures for %s from '%s' in %.2fms\n", name, ptex_path, (glfwGetTime() - start) * 1000.0);
+
+    finish_ptex_textures(name, ptex_path, &texturesGLData[mesh], false);
+
+    ptexTextures[mesh]->release();
+    ptexTextures[mesh] = ptex;
+    refresh_current_filter(mesh);
+}
+
+void update_ptex_watches()
+{
+    for (int i = 0; i < ptex_watches.size; i++)
+    {
+        // A streaming model is watched once all its faces are uploaded,
+        // the faces of a residency pool are only loaded when they're seen.
+        if (texture_streams[i] != NULL || residencies[i] != NULL)
+            continue;
+
+        // Evicted models are watched again once they're restored.
+        if (g_watch_ptex_files == false || texturesGLData[i].array_textures == NULL)
+        {
+            if (ptex_watches[i] != NULL)
+                destroy_ptex_watch(ptex_watches[i]);
+            ptex_watches[i] = NULL;
+            continue;
+        }
+
+        if (ptex_watches[i] == NULL)
+        {
+            ptex_watches[i] = begin_ptex_watch(ptexTextures[i]);
+            continue;
+        }
+
+        ptex_reload_result result = update_ptex_watch(mesh_names[i], ptex_watches[i], &ptexTextures[i], &texturesGLData[i]);
+        if (result == PTEX_RELOAD_UPDATED)
+        {
+            refresh_current_filter(i);
+        }
+        else if (result == PTEX_RELOAD_FULL)
+        {
+            // The hashes are taken again from the reloaded file.
+            destroy_ptex_watch(ptex_watches[i]);
+            ptex_watches[i] = NULL;
+
+            reload_ptex_textures(i);
+        }
+    }
+}
+
+// The gutter method has its own copy of the textures, they are packed the first time it's used.
+void ensure_gutter_textures(int mesh)
+{
+    gl_ptex_data* data = &texturesGLData[mesh];
+    if (data->gutter_array_textures != NULL && data->gutter_width == g_ptex_gutter_width)
+        return;
+
+    destroy_gutter_texture_arrays(data);
+    create_gutter_texture_arrays(mesh_names[mesh], ptexTextures[mesh], g_ptex_gutter_width, GL_LINEAR, GL_LINEAR, data);
+}
+
+// Loads the textures from the pack if there is an up to date one, or from the ptex file.
+// Returns the stream if the textures are streamed in, see g_stream_ptex_textures.
+ptex_stream_t* load_model_textures(const char* name, const char* ptex_path, Ptex::PtexTexture* ptex, gl_ptex_data* ptex_data)
+{
+    char pack_path[PATH_SIZE];
+    ptex_pack_path(ptex_path, g_use_ptex_tile_pack ? PTEX_TILE_PACK_EXTENSION : PTEX_PACK_EXTENSION, pack_path, sizeof(pack_path));
+
+    ptex_tile_pack_stats tile_stats;
+
+    double start = glfwGetTime();
+    if (g_use_ptex_pack_cache && g_use_ptex_tile_pack && load_ptex_tile_pack(pack_path, ptex_path, name, GL_LINEAR, GL_LINEAR, ptex_data, &tile_stats))
+    {
+        printf("Loaded textures for %s from '%s' in %.2fms\n", name, pack_path, (glfwGetTime() - start) * 1000.0);
+
+        ptex_read_stats ptex_stats;
+        bool compare = g_compare_ptex_read && read_ptex_for_comparison(ptex_path, &ptex_stats);
+        print_ptex_tile_pack_stats(name, &tile_stats, compare ? &ptex_stats : NULL);
+
+        finish_ptex_textures(name, ptex_path, ptex_data, true);
+    }
+    else if (g_use_ptex_pack_cache && g_use_ptex_tile_pack == false && load_ptex_pack(pack_path, ptex_path, name, GL_LINEAR, GL_LINEAR, ptex_data))
+    {
+        printf("Loaded textures for %s from '%s' in %.2fms\n", name, pack_path, (glfwGetTime() - start) * 1000.0);
+
+        finish_ptex_textures(name, ptex_path, ptex_data, true);
+    }
+    else if (g_stream_ptex_textures)
+    {
+        // The cache is written once the stream has finished, see update_texture_streams.
+        ptex_stream_t* stream = begin_ptex_stream(name, ptex, GL_LINEAR, GL_LINEAR, ptex_data);
+        printf("Started streaming textures for %s from '%s' in %.2fms\n", name, ptex_path, (glfwGetTime() - start) * 1000.0);
+        return stream;
+    }
+    else
+    {
+        *ptex_data = load_ptex_textures(name, ptex);
+        printf("Loaded textures for %s from '%s' in %.2fms\n", name, ptex_path, (glfwGetTime() - start) * 1000.0);
+        print_ptex_data_throughput(name, ptex, glfwGetTime() - start);
+
+        finish_ptex_textures(name, ptex_path, ptex_data, false);
+    }
+
+    return NULL;
+}
+
+void evict_model_textures(int mesh)
+{
+    uint64_t size = ptex_data_memory_size(&texturesGLData[mesh]);
+
+    // The hashes are taken again from the file when the model is restored.
+    if (ptex_watches[mesh] != NULL)
+        destroy_ptex_watch(ptex_watches[mesh]);
+    ptex_watches[mesh] = NULL;
+
+    destroy_gl_ptex_data(&texturesGLData[mesh]);
+    printf("Evicted the textures of %s, %.1fMB freed\n", mesh_names[mesh], size / (1024.0 * 1024.0));
+}
+
+// Loads the textures of an evicted model again, they have to be there before the model is drawn.
+void restore_model_textures(int mesh)
+{
+    if (texturesGLData[mesh].array_textures != NULL)
+        return;
+
+    texture_streams[mesh] = load_model_textures(mesh_names[mesh], ptexTextures[mesh]->path(), ptexTextures[mesh], &texturesGLData[mesh]);
+}
+
+// Evicts the inactive models drawn the longest ago until the textures fit g_texture_memory_budget.
+void update_texture_budget()
+{
+    mesh_last_used[current_mesh] = glfwGetTime();
+    restore_model_textures(current_mesh);
+
+    if (g_evict_inactive_models == false)
+        return;
+
+    uint64_t total = 0;
+    for (int i = 0; i < texturesGLData.size; i++)
+        total += ptex_data_memory_size(&texturesGLData[i]);
+
+    while (total > g_texture_memory_budget)
+    {
+        int oldest = -1;
+        for (int i = 0; i < texturesGLData.size; i++)
+        {
+            if (i == current_mesh || texturesGLData[i].array_textures == NULL || texture_streams[i] != NULL || residencies[i] != NULL)
+                continue;
+
+            if (oldest == -1 || mesh_last_used[i] < mesh_last_used[oldest])
+                oldest = i;
+        }
+
+        // What's left is in use.
+        if (oldest == -1)
+            break;
+
+        total -= ptex_data_memory_size(&texturesGLData[oldest]);
+        evict_model_textures(oldest);
+    }
+}
+
+// Samples that pass the depth test when the nvidia method draws the ranges of the model.
+uint64_t count_passed_samples(int model, const index_ranges_t* ranges, mat4_t mvp, vec3_t bg_color)
+{
+    GLuint query;
+    glGenQueries(1, &query);
+
+    glBeginQuery(GL_SAMPLES_PASSED, query);
+    Methods::nvidia.render(mesh_vaos[model], ranges, texturesGLData[model], mvp, bg_color);
+    glEndQuery(GL_SAMPLES_PASSED);
+
+    GLuint64 samples = 0;
+    glGetQueryObjectui64v(query, GL_QUERY_RESULT, &samples);
+    glDeleteQueries(1, &query);
+
+    return samples;
+}
+
 void add_model(const char* name, const char* model_path, const char* ptex_path, mat4_t model_mat, vec3_t bg)
 {
     Ptex::String error_str;
@@ -529,41 +844,67 @@ void add_model(const char* name, const char* model_path, const char* ptex_path,
         printf("Ptex Error at model %s! %s\n", name, error_str.c_str());
     }
 
-    ptex_mesh_t* mesh = load_ptex_mesh(model_path);
+    // The shaders can't find the faces past the end of the face table, or sample more than
+    // PTEX_MAX_SAMPLED_ARRAYS arrays. The residency pool is a single array.
+    bool resident = g_ptex_residency && ptex != NULL && ptex_data_is_rgba8(ptex->dataType());
+    if (ptex != NULL && (ptex_face_table_fits(name, ptex->numFaces()) == false || (resident == false && ptex_arrays_fit(name, ptex) == false)))
+    {
+        printf("Skipping %s.\n", name);
+        ptex->release();
+        return;
+    }
+
+    ptex_mesh_t* mesh = load_cached_ptex_mesh(model_path);
+
+    if (g_validate_ptex_adjacency)
+        validate_ptex_adjacency(name, ptex, mesh);
 
     GLuint mesh_vao;
     {
-        attribute_desc* attribs = new attribute_desc[4];
+        attribute_desc* attribs = new attribute_desc[3];
         attribs[0] = {
-            "Position", 3, GL_FLOAT, GL_FALSE, offsetof(ptex_vertex_t, position), false,
+            "Position", 3, GL_UNSIGNED_SHORT, GL_TRUE, offsetof(ptex_packed_vertex_t, position), false,
         };
         attribs[1] = {
-            "Normal", 3, GL_FLOAT, GL_FALSE, offsetof(ptex_vertex_t, normal), false,
+            "Normal", 2, GL_BYTE, GL_TRUE, offsetof(ptex_packed_vertex_t, normal), false,
         };
         attribs[2] = {
-            "UV", 2, GL_FLOAT, GL_TRUE, offsetof(ptex_vertex_t, uv), false,
-        };
-        attribs[3] = {
-            "FaceID", 1, GL_INT, GL_FALSE, offsetof(ptex_vertex_t, face_id), true,
+            "CornerFace", 1, GL_UNSIGNED_INT, GL_FALSE, offsetof(ptex_packed_vertex_t, corner_face), true,
         };
 
         vao_desc vao_desc = {
             "ptex model",
-            4,
+            3,
             attribs,
         };
 
-        mesh_vao = create_vao(&vao_desc, mesh->vertices, sizeof(ptex_vertex_t), mesh->num_vertices);
+        mesh_vao = create_vao(&vao_desc, mesh->packed_vertices, sizeof(ptex_packed_vertex_t), mesh->num_vertices, mesh->indices, mesh->num_indices);
+        print_ptex_mesh_stats(name, mesh);
 
         delete[] attribs;
     }
 
+    gl_ptex_data ptex_data;
+    ptex_stream_t* stream = NULL;
+    ptex_residency_t* residency = NULL;
+    if (g_ptex_residency)
+        residency = begin_ptex_residency(name, ptex, GL_LINEAR, GL_LINEAR, &ptex_data);
+
+    if (residency == NULL)
+        stream = load_model_textures(name, ptex_path, ptex, &ptex_data);
+
     mesh_names.add(name);
     meshes.add(mesh);
     mesh_vaos.add(mesh_vao);
+    mesh_draw_ranges.add(create_index_ranges(mesh->num_clusters));
     ptexTextures.add(ptex);
-    texturesGLData.add(create_gl_texture_arrays(name, extract_textures(ptex), GL_LINEAR, GL_LINEAR));
-    mesh_model_matrix.add(model_mat);
+    texturesGLData.add(ptex_data);
+    texture_streams.add(stream);
+    ptex_watches.add(NULL);
+    residencies.add(residency);
+    mesh_last_used.add(0.0);
+    // The packed positions are decoded to model space by the model matrix.
+    mesh_model_matrix.add(mat4_mul_mat4(ptex_mesh_position_decode(mesh), model_mat));
     background_colors.add(bg);
 }
 
@@ -641,7 +982,7 @@ int main(int argv, char** argc)
     const char* version = (char*)glGetString(GL_VERSION);
     glfwSetWindowTitle(window, version);
     
-    // Check for GL_KHR_debug
+    // Check for GL_KHR_debug and texture compression formats
     {
         int num_extensions;
         glGetIntegerv(GL_NUM_EXTENSIONS, &num_extensions);
@@ -654,6 +995,14 @@ int main(int argv, char** argc)
             {
                 has_KHR_debug = true;
             }
+            else if (strcmp(ext, "GL_EXT_texture_compression_s3tc") == 0)
+            {
+                has_texture_compression_s3tc = true;
+            }
+            else if (strcmp(ext, "GL_ARB_texture_compression_bptc") == 0)
+            {
+                has_texture_compression_bptc = true;
+            }
         }
     }
 
@@ -666,6 +1015,10 @@ int main(int argv, char** argc)
 #endif
     }
 
+    // Rows of the 1 and 2 byte ptex texel formats aren't 4 byte aligned (see ptex_array_format).
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+
     // Load models and textures
     {
         vec3_t blue_bg = rgb_to_vec3(100, 149, 237);
@@ -677,7 +1030,9 @@ int main(int argv, char** argc)
         add_model("sphere", "models/mud_sphere/mud_sphere.obj", "models/mud_sphere/mud_sphere.ptx", mat4_scale(0.01f, 0.01f, 0.01f), blue_bg);
         add_model("robot", "models/robot/robot_2.obj", "models/robot/Quandtum_BA-2_v1_1.ptex", mat4_mul_mat4(mat4_transpose(mat4_scale(0.2f, 0.2f, 0.2f)), mat4_transpose(mat4_translate(0, -0.8f, -0.5f))), white_bg);
         
-        current_mesh = 3;
+        // The last model, models the driver can't draw are skipped.
+        current_mesh = mesh_names.size - 1;
+        assert(current_mesh >= 0 && "None of the models could be loaded.");
 
         current_filter = PtexFilter::getFilter(ptexTextures[current_mesh], PtexFilter::Options{ g_current_filter_type, false, 0, false });
     }
@@ -741,6 +1096,13 @@ int main(int argv, char** argc)
 
         glfwPollEvents();
 
+        update_texture_budget();
+        update_texture_streams();
+        update_ptex_watches();
+
+        if (residencies[current_mesh] != NULL)
+            update_ptex_residency(residencies[current_mesh], &texturesGLData[current_mesh]);
+
         if (g_show_imgui)
         {
             ImGui_ImplGlfw_NewFrame();
@@ -768,6 +1130,7 @@ int main(int argv, char** argc)
                         if (ImGui::Selectable(mesh_names[i], is_selected))
                         {
                             current_mesh = i;
+                            restore_model_textures(current_mesh);
                             if (current_filter) current_filter->release();
                             current_filter = PtexFilter::getFilter(ptexTextures[current_mesh], PtexFilter::Options{ g_current_filter_type, false, 0, false });
                             g_camera.center = meshes[current_mesh]->center;
@@ -1006,6 +1369,54 @@ int main(int argv, char** argc)
                     ImGui::Checkbox("Visualize", &Methods::reducedTraverse.visualize);
                     break;
                 }
+                case Methods::Methods::gutter:
+                {
+                    int curr_aniso = Methods::gutter.clamp_sampler.desc.max_anisotropy;
+                    if (ImGui::SliderInt("Max Anisotropy", &curr_aniso, 1, 16))
+                    {
+                        glSamplerParameterf(Methods::gutter.clamp_sampler.sampler, GL_TEXTURE_MAX_ANISOTROPY_EXT, curr_aniso);
+                        Methods::gutter.clamp_sampler.desc.max_anisotropy = curr_aniso;
+                    }
+
+                    if (ImGui::SliderInt("MSAA", &Methods::gutter.framebuffer_desc.samples, 1, 16))
+                    {
+                        // Recreate the framebuffer with the new number of samples
+                        recreate_framebuffer(
+                            &Methods::gutter.framebuffer,
+                            Methods::gutter.framebuffer_desc,
+                            Methods::gutter.framebuffer.width,
+                            Methods::gutter.framebuffer.height);
+                    }
+
+                    bool isRGB8 = Methods::gutter.framebuffer_desc.color_attachments[0].internal_format == GL_RGB8;
+                    if (ImGui::Checkbox("RGB8 Output", &isRGB8)) {
+                        if (isRGB8)
+                        {
+                            Methods::gutter.framebuffer_desc.color_attachments[0].internal_format = GL_RGB8;
+                            Methods::gutter.resolve_framebuffer_desc.color_attachments[0].internal_format = GL_RGB8;
+                        }
+                        else {
+                            Methods::gutter.framebuffer_desc.color_attachments[0].internal_format = GL_RGB32F;
+                            Methods::gutter.resolve_framebuffer_desc.color_attachments[0].internal_format = GL_RGB32F;
+                        }
+
+                        recreate_framebuffer(
+                            &Methods::gutter.framebuffer,
+                            Methods::gutter.framebuffer_desc,
+                            Methods::gutter.framebuffer.width,
+                            Methods::gutter.framebuffer.height);
+
+                        recreate_framebuffer(
+                            &Methods::gutter.resolve_framebuffer,
+                            Methods::gutter.resolve_framebuffer_desc,
+                            Methods::gutter.resolve_framebuffer.width,
+                            Methods::gutter.resolve_framebuffer.height);
+                    }
+
+                    // The textures are repacked with the new width before the next frame is drawn.
+                    ImGui::SliderInt("Gutter width", &g_ptex_gutter_width, 1, PTEX_GUTTER_MAX_WIDTH);
+                    break;
+                }
                 default:
                     break;
                 }
@@ -1115,6 +1526,130 @@ int main(int argv, char** argc)
                         ImGui::EndPopup();
                     }
                 }
+
+                if (ImGui::CollapsingHeader("Texture streaming"))
+                {
+                    int budget_kb = g_ptex_stream_bytes_per_frame / 1024;
+                    if (ImGui::SliderInt("Upload per frame (KB)", &budget_kb, 256, PTEX_STREAM_PBO_SIZE / 1024))
+                        g_ptex_stream_bytes_per_frame = budget_kb * 1024;
+
+                    bool any_streaming = false;
+                    for (int i = 0; i < texture_streams.size; i++)
+                    {
+                        ptex_stream_t* stream = texture_streams[i];
+                        if (stream == NULL)
+                            continue;
+
+                        char overlay[128];
+                        sprintf(overlay, "%s: %d/%d faces", mesh_names[i], stream->uploaded_faces, stream->num_faces);
+                        ImGui::ProgressBar(ptex_stream_progress(stream), ImVec2(-1, 0), overlay);
+                        any_streaming = true;
+                    }
+
+                    if (any_streaming == false)
+                        ImGui::Text("All textures loaded.");
+
+                    ImGui::Checkbox("Reload edited ptex files", &g_watch_ptex_files);
+
+                    // Used by the models loaded after this, and by full reloads.
+                    ImGui::Checkbox("Bounded memory load", &g_ptex_bounded_load);
+                    int limit_mb = (int)(g_ptex_upload_memory_limit / (1024 * 1024));
+                    if (ImGui::SliderInt("Load memory limit (MB)", &limit_mb, 8, 1024))
+                        g_ptex_upload_memory_limit = (uint64_t)limit_mb * 1024 * 1024;
+                }
+
+                if (ImGui::CollapsingHeader("Texture memory"))
+                {
+                    ImGui::Checkbox("Evict inactive models", &g_evict_inactive_models);
+                    int budget_mb = (int)(g_texture_memory_budget / (1024 * 1024));
+                    if (ImGui::SliderInt("Memory budget (MB)", &budget_mb, 16, 4096))
+                        g_texture_memory_budget = (uint64_t)budget_mb * 1024 * 1024;
+
+                    uint64_t total = 0;
+                    for (int i = 0; i < texturesGLData.size; i++)
+                    {
+                        uint64_t size = ptex_data_memory_size(&texturesGLData[i]);
+                        total += size;
+
+                        const char* state = "resident";
+                        if (texturesGLData[i].array_textures == NULL)
+                            state = "evicted";
+                        else if (texture_streams[i] != NULL)
+                            state = "streaming";
+                        else if (residencies[i] != NULL)
+                            state = "pool";
+
+                        ImGui::Text("%s: %s, %.1fMB", mesh_names[i], state, size / (1024.0 * 1024.0));
+                    }
+                    ImGui::Text("Total: %.1fMB of %.1fMB", total / (1024.0 * 1024.0), g_texture_memory_budget / (1024.0 * 1024.0));
+                }
+
+                if (ImGui::CollapsingHeader("Texture residency"))
+                {
+                    // Used by the models loaded after this.
+                    ImGui::Checkbox("Load only the faces that are seen", &g_ptex_residency);
+                    int budget_mb = (int)(g_ptex_residency_budget / (1024 * 1024));
+                    if (ImGui::SliderInt("Pool size (MB)", &budget_mb, 1, 1024))
+                        g_ptex_residency_budget = (uint64_t)budget_mb * 1024 * 1024;
+
+                    ptex_residency_t* residency = residencies[current_mesh];
+                    if (residency != NULL)
+                    {
+                        ptex_residency_stats* stats = &residency->stats;
+                        ImGui::Text("%d/%d faces resident in %d/%d pages", stats->resident_faces, residency->num_faces, stats->used_pages, residency->num_pages);
+                        ImGui::Text("%llu loads (%.1fMB), %llu evictions", (unsigned long long)stats->loads,
+                            stats->uploaded_bytes / (1024.0 * 1024.0), (unsigned long long)stats->evictions);
+                    }
+                    else
+                    {
+                        ImGui::Text("%s has every face resident.", mesh_names[current_mesh]);
+                    }
+                }
+
+                if (ImGui::CollapsingHeader("Cluster culling"))
+                {
+                    ImGui::Checkbox("Cull clusters outside the frustum", &g_cull_clusters_frustum);
+                    ImGui::Checkbox("Cull clusters facing away (hides back faces)", &g_cull_clusters_backface);
+
+                    cluster_cull_stats_t* stats = &cluster_cull_stats;
+                    if (stats->num_clusters > 0)
+                    {
+                        ImGui::Text("%d/%d clusters drawn in %d draws", stats->drawn_clusters, stats->num_clusters, stats->num_ranges);
+                        ImGui::Text("%d/%d vertices and %d/%d triangles culled", stats->num_vertices - stats->drawn_vertices, stats->num_vertices,
+                            stats->num_triangles - stats->drawn_triangles, stats->num_triangles);
+                    }
+                    else
+                    {
+                        ImGui::Text("%s has no clusters.", mesh_names[current_mesh]);
+                    }
+
+                    if (ImGui::Button("Count samples"))
+                        measure_cluster_samples = true;
+
+                    if (whole_mesh_samples > 0)
+                    {
+                        ImGui::Text("%llu samples pass the depth test culled, %llu without (%.1f%% less)", (unsigned long long)culled_mesh_samples,
+                            (unsigned long long)whole_mesh_samples, 100.0 * (1.0 - (double)culled_mesh_samples / whole_mesh_samples));
+                    }
+                }
+
+                if (ImGui::CollapsingHeader("Pixel conversion"))
+                {
+                    // Lower isas are there to compare against, the results are the same.
+                    pixel_convert_isa isa = get_pixel_convert_isa();
+                    if (ImGui::BeginCombo("Instruction set", pixel_convert_isa_name(isa)))
+                    {
+                        for (int i = PIXEL_CONVERT_SCALAR; i <= detect_pixel_convert_isa(); i++)
+                        {
+                            if (ImGui::Selectable(pixel_convert_isa_name((pixel_convert_isa)i), i == isa))
+                                set_pixel_convert_isa((pixel_convert_isa)i);
+                        }
+                        ImGui::EndCombo();
+                    }
+
+                    if (ImGui::Button("Benchmark conversions"))
+                        benchmark_pixel_convert(4 * 1024 * 1024);
+                }
             }
 
             profiler::show_profiler();
@@ -1138,15 +1673,36 @@ int main(int argv, char** argc)
         mat4_t vp = mat4_mul_mat4(view, proj);
         mat4_t mvp = mat4_mul_mat4(model, vp);
 
+        index_ranges_t* draw_ranges = &mesh_draw_ranges[current_mesh];
+        if (meshes[current_mesh]->num_clusters > 0)
+        {
+            cull_mesh_clusters(meshes[current_mesh], mvp, mat4_mul_mat4(model, view), draw_ranges, &cluster_cull_stats);
+        }
+        else
+        {
+            set_whole_index_range(draw_ranges, meshes[current_mesh]->num_indices);
+            memset(&cluster_cull_stats, 0, sizeof(cluster_cull_stats));
+        }
+
+        if (measure_cluster_samples)
+        {
+            index_ranges_t whole_mesh = create_index_ranges(1);
+            set_whole_index_range(&whole_mesh, meshes[current_mesh]->num_indices);
+            whole_mesh_samples = count_passed_samples(current_mesh, &whole_mesh, mvp, bg_color);
+            culled_mesh_samples = count_passed_samples(current_mesh, draw_ranges, mvp, bg_color);
+            free_index_ranges(&whole_mesh);
+            measure_cluster_samples = false;
+        }
+
         if (takeScreenshot)
         {
             bool old_hybrid_viz = Methods::hybrid.visualize;
             bool old_reduced_traverse_viz = Methods::reducedTraverse.visualize;
 
             // Render using all methods.
-            Methods::nvidia.render(mesh_vaos[current_mesh], meshes[current_mesh]->num_vertices, texturesGLData[current_mesh], mvp, bg_color);
+            Methods::nvidia.render(mesh_vaos[current_mesh], draw_ranges, texturesGLData[current_mesh], mvp, bg_color);
 
-            Methods::intel.render(mesh_vaos[current_mesh], meshes[current_mesh]->num_vertices, texturesGLData[current_mesh], mvp, bg_color);
+            Methods::intel.render(mesh_vaos[current_mesh], draw_ranges, texturesGLData[current_mesh], mvp, bg_color);
             // resolve intel MS buffer
             glBindFramebuffer(GL_READ_FRAMEBUFFER, Methods::intel.ms_framebuffer.framebuffer);
             glBindFramebuffer(GL_DRAW_FRAMEBUFFER, Methods::intel.resolve_framebuffer.framebuffer);
@@ -1156,7 +1712,7 @@ int main(int argv, char** argc)
                 GL_COLOR_BUFFER_BIT, GL_NEAREST);
 
             Methods::hybrid.visualize = false;
-            Methods::hybrid.render(mesh_vaos[current_mesh], meshes[current_mesh]->num_vertices, texturesGLData[current_mesh], mvp, bg_color);
+            Methods::hybrid.render(mesh_vaos[current_mesh], draw_ranges, texturesGLData[current_mesh], mvp, bg_color);
             // resolve hybrid MS buffer
             glBindFramebuffer(GL_READ_FRAMEBUFFER, Methods::hybrid.ms_framebuffer.framebuffer);
             glBindFramebuffer(GL_DRAW_FRAMEBUFFER, Methods::hybrid.resolve_framebuffer.framebuffer);
@@ -1166,9 +1722,19 @@ int main(int argv, char** argc)
                 GL_COLOR_BUFFER_BIT, GL_NEAREST);
 
             Methods::reducedTraverse.visualize = false;
-            Methods::reducedTraverse.render(mesh_vaos[current_mesh], meshes[current_mesh]->num_vertices, texturesGLData[current_mesh], mvp, bg_color);
+            Methods::reducedTraverse.render(mesh_vaos[current_mesh], draw_ranges, texturesGLData[current_mesh], mvp, bg_color);
             
-            Methods::cpu.render(mesh_vaos[current_mesh], meshes[current_mesh]->num_vertices, ptexTextures[current_mesh], current_filter, mvp, bg_color);
+            Methods::cpu.render(mesh_vaos[current_mesh], draw_ranges, ptexTextures[current_mesh], current_filter, mvp, bg_color);
+
+            ensure_gutter_textures(current_mesh);
+            Methods::gutter.render(mesh_vaos[current_mesh], draw_ranges, texturesGLData[current_mesh], mvp, bg_color);
+            // resolve gutter buffer, it's multisampled when its MSAA slider is above 1
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, Methods::gutter.framebuffer.framebuffer);
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, Methods::gutter.resolve_framebuffer.framebuffer);
+            glBlitFramebuffer(
+                0, 0, Methods::gutter.framebuffer.width, Methods::gutter.framebuffer.height,
+                0, 0, Methods::gutter.resolve_framebuffer.width, Methods::gutter.resolve_framebuffer.height,
+                GL_COLOR_BUFFER_BIT, GL_NEAREST);
 
             // Then we will download all of the final pictures.
             rgb8_t* nvidia_data = (rgb8_t*)download_rgb8_framebuffer(&Methods::nvidia.framebuffer, GL_COLOR_ATTACHMENT0);
@@ -1176,6 +1742,7 @@ int main(int argv, char** argc)
             rgb8_t* hybrid_data = (rgb8_t*)download_rgb8_framebuffer(&Methods::hybrid.resolve_framebuffer, GL_COLOR_ATTACHMENT0);
             rgb8_t* reduced_traverse_data = (rgb8_t*)download_rgb8_framebuffer(&Methods::reducedTraverse.framebuffer, GL_COLOR_ATTACHMENT0);
             rgb8_t* cpu_data = (rgb8_t*)download_rgb8_framebuffer(&Methods::cpu.cpu_result_framebuffer, GL_COLOR_ATTACHMENT0);
+            rgb8_t* gutter_data = (rgb8_t*)download_rgb8_framebuffer(&Methods::gutter.resolve_framebuffer, GL_COLOR_ATTACHMENT0);
 
             // Render nvidia with MSAA x8 for visual comparisons
             int old_nvidia_samples = Methods::nvidia.framebuffer_desc.samples;
@@ -1186,7 +1753,7 @@ int main(int argv, char** argc)
                 Methods::nvidia.framebuffer_desc, 
                 Methods::nvidia.framebuffer.width,
                 Methods::nvidia.framebuffer.height);
-            Methods::nvidia.render(mesh_vaos[current_mesh], meshes[current_mesh]->num_vertices, texturesGLData[current_mesh], mvp, bg_color);
+            Methods::nvidia.render(mesh_vaos[current_mesh], draw_ranges, texturesGLData[current_mesh], mvp, bg_color);
             // resolve nvidia msaa buffer
             glBindFramebuffer(GL_READ_FRAMEBUFFER, Methods::nvidia.framebuffer.framebuffer);
             glBindFramebuffer(GL_DRAW_FRAMEBUFFER, Methods::nvidia.resolve_framebuffer.framebuffer);
@@ -1211,7 +1778,7 @@ int main(int argv, char** argc)
                 Methods::reducedTraverse.framebuffer_desc,
                 Methods::reducedTraverse.framebuffer.width,
                 Methods::reducedTraverse.framebuffer.height);
-            Methods::reducedTraverse.render(mesh_vaos[current_mesh], meshes[current_mesh]->num_vertices, texturesGLData[current_mesh], mvp, bg_color);
+            Methods::reducedTraverse.render(mesh_vaos[current_mesh], draw_ranges, texturesGLData[current_mesh], mvp, bg_color);
             // resolve reduced traverse msaa buffer
             glBindFramebuffer(GL_READ_FRAMEBUFFER, Methods::reducedTraverse.framebuffer.framebuffer);
             glBindFramebuffer(GL_DRAW_FRAMEBUFFER, Methods::reducedTraverse.resolve_framebuffer.framebuffer);
@@ -1232,7 +1799,7 @@ int main(int argv, char** argc)
 
             // Render hybrid visualization
             Methods::hybrid.visualize = true;
-            Methods::hybrid.render(mesh_vaos[current_mesh], meshes[current_mesh]->num_vertices, texturesGLData[current_mesh], mvp, bg_color);
+            Methods::hybrid.render(mesh_vaos[current_mesh], draw_ranges, texturesGLData[current_mesh], mvp, bg_color);
             // resolve hybrid MS buffer
             glBindFramebuffer(GL_READ_FRAMEBUFFER, Methods::hybrid.ms_framebuffer.framebuffer);
             glBindFramebuffer(GL_DRAW_FRAMEBUFFER, Methods::hybrid.resolve_framebuffer.framebuffer);
@@ -1243,7 +1810,7 @@ int main(int argv, char** argc)
 
             // Render reduced traverse visualization
             Methods::reducedTraverse.visualize = true;
-            Methods::reducedTraverse.render(mesh_vaos[current_mesh], meshes[current_mesh]->num_vertices, texturesGLData[current_mesh], mvp, bg_color);
+            Methods::reducedTraverse.render(mesh_vaos[current_mesh], draw_ranges, texturesGLData[current_mesh], mvp, bg_color);
             
             rgb8_t* hybrid_visualization_data = (rgb8_t*)download_rgb8_framebuffer(&Methods::hybrid.resolve_framebuffer, GL_COLOR_ATTACHMENT0);
             rgb8_t* reduced_traverse_visualization_data = (rgb8_t*)download_rgb8_framebuffer(&Methods::reducedTraverse.framebuffer, GL_COLOR_ATTACHMENT0);
@@ -1282,6 +1849,9 @@ int main(int argv, char** argc)
             sprintf(filename, "screenshots/%s/cpu.png", viewpoint_name);
             stbi_write_png(filename, Methods::cpu.cpu_result_framebuffer.width, Methods::cpu.cpu_result_framebuffer.height, 3, cpu_data, Methods::cpu.cpu_result_framebuffer.width * 3);
 
+            sprintf(filename, "screenshots/%s/gutter.png", viewpoint_name);
+            stbi_write_png(filename, Methods::gutter.framebuffer.width, Methods::gutter.framebuffer.height, 3, gutter_data, Methods::gutter.framebuffer.width * 3);
+
             sprintf(filename, "screenshots/%s/hybrid_viz.png", viewpoint_name);
             stbi_write_png(filename, Methods::hybrid.resolve_framebuffer.width, Methods::hybrid.resolve_framebuffer.height, 3, hybrid_visualization_data, Methods::hybrid.resolve_framebuffer.width * 3);
 
@@ -1297,6 +1867,7 @@ int main(int argv, char** argc)
             free(reduced_traverse_msaa_data);
             free(reduced_traverse_visualization_data);
             free(cpu_data);
+            free(gutter_data);
 
             takeScreenshot = false;
         }
@@ -1304,6 +1875,10 @@ int main(int argv, char** argc)
         int width, height;
         glfwGetFramebufferSize(window, &width, &height);
         glViewport(0, 0, width, height);
+
+        // The cpu method reads the file, it doesn't use the pool.
+        if (residencies[current_mesh] != NULL && current_rendering_method != Methods::Methods::cpu)
+            render_ptex_feedback(residencies[current_mesh], mesh_vaos[current_mesh], draw_ranges, mvp, width, height);
         
         const char* pass_name = Methods::method_names[(int)current_rendering_method];
 
@@ -1318,23 +1893,28 @@ int main(int argv, char** argc)
         switch (current_rendering_method)
         {
         case Methods::Methods::cpu:
-            Methods::cpu.render(mesh_vaos[current_mesh], meshes[current_mesh]->num_vertices, ptexTextures[current_mesh], current_filter, mvp, bg_color);
+            Methods::cpu.render(mesh_vaos[current_mesh], draw_ranges, ptexTextures[current_mesh], current_filter, mvp, bg_color);
             break;
 
         case Methods::Methods::nvidia:
-            Methods::nvidia.render(mesh_vaos[current_mesh], meshes[current_mesh]->num_vertices, texturesGLData[current_mesh], mvp, bg_color);
+            Methods::nvidia.render(mesh_vaos[current_mesh], draw_ranges, texturesGLData[current_mesh], mvp, bg_color);
             break;
 
         case Methods::Methods::intel:
-            Methods::intel.render(mesh_vaos[current_mesh], meshes[current_mesh]->num_vertices, texturesGLData[current_mesh], mvp, bg_color);
+            Methods::intel.render(mesh_vaos[current_mesh], draw_ranges, texturesGLData[current_mesh], mvp, bg_color);
             break;
 
         case Methods::Methods::hybrid:
-            Methods::hybrid.render(mesh_vaos[current_mesh], meshes[current_mesh]->num_vertices, texturesGLData[current_mesh], mvp, bg_color);
+            Methods::hybrid.render(mesh_vaos[current_mesh], draw_ranges, texturesGLData[current_mesh], mvp, bg_color);
             break;
 
         case Methods::Methods::reduced_traverse:
-            Methods::reducedTraverse.render(mesh_vaos[current_mesh], meshes[current_mesh]->num_vertices, texturesGLData[current_mesh], mvp, bg_color);
+            Methods::reducedTraverse.render(mesh_vaos[current_mesh], draw_ranges, texturesGLData[current_mesh], mvp, bg_color);
+            break;
+
+        case Methods::Methods::gutter:
+            ensure_gutter_textures(current_mesh);
+            Methods::gutter.render(mesh_vaos[current_mesh], draw_ranges, texturesGLData[current_mesh], mvp, bg_color);
             break;
 
         default:
@@ -1370,6 +1950,10 @@ int main(int argv, char** argc)
             color_output_framebuffer = Methods::reducedTraverse.framebuffer;
             break;
 
+        case Methods::Methods::gutter:
+            color_output_framebuffer = Methods::gutter.framebuffer;
+            break;
+
         default:
             assert(false);
             break;
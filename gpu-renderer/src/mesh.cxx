@@ -5,6 +5,7 @@
 #include <string.h>
 #include "maths.hh"
 #include "mesh.hh"
+#include "obj_parse.hh"
 
 #include <vector>
 
@@ -57,66 +58,32 @@ mesh_t * load_obj(const char* filename) {
     std::vector<int> position_indices;
     std::vector<int> texcoord_indices;
     std::vector<int> normal_indices;
-    char line[LINE_SIZE];
+    obj_data_t obj;
     mesh_t* mesh;
-    FILE* file;
-
-    std::vector<vec3_t> positions = {};
-    std::vector<vec2_t> texcoords = {};
-    std::vector<vec3_t> normals = {};
-
-    file = fopen(filename, "rb");
-    assert(file != NULL);
-    while (1) {
-        int items;
-        if (fgets(line, LINE_SIZE, file) == NULL) {
-            break;
-        }
-        else if (strncmp(line, "v ", 2) == 0) {               /* position */
-            vec3_t position;
-            items = sscanf(line, "v %f %f %f",
-                &position.x, &position.y, &position.z);
-            assert(items == 3);
-            positions.push_back(position);
-        }
-        else if (strncmp(line, "vt ", 3) == 0) {              /* texcoord */
-            vec2_t texcoord;
-            items = sscanf(line, "vt %f %f",
-                &texcoord.x, &texcoord.y);
-            assert(items == 2);
-            texcoords.push_back(texcoord);
-        }
-        else if (strncmp(line, "vn ", 3) == 0) {              /* normal */
-            vec3_t normal;
-            items = sscanf(line, "vn %f %f %f",
-                &normal.x, &normal.y, &normal.z);
-            assert(items == 3);
-            normals.push_back(normal);
-        }
-        else if (strncmp(line, "f ", 2) == 0) {               /* face */
-            int i;
+    int i;
 
-            int spaces = 0;
-            for (int i = 0; line[i] != 0; i++)
-            {
-                if (line[i] == ' ') spaces++;
-            }
+    if (parse_obj(filename, &obj) == false) {
+        assert(false);
+        return NULL;
+    }
 
-            int pos_indices[3], uv_indices[3], n_indices[3];
-            items = sscanf(line, "f %d/%d/%d %d/%d/%d %d/%d/%d",
-                &pos_indices[0], &uv_indices[0], &n_indices[0],
-                &pos_indices[1], &uv_indices[1], &n_indices[1],
-                &pos_indices[2], &uv_indices[2], &n_indices[2]);
-            assert(items == 9);
-            for (i = 0; i < 3; i++) {
-                position_indices.push_back(pos_indices[i] - 1);
-                texcoord_indices.push_back(uv_indices[i] - 1);
-                normal_indices.push_back(n_indices[i] - 1);
-            }
+    position_indices.reserve(obj.num_indices);
+    texcoord_indices.reserve(obj.num_indices);
+    normal_indices.reserve(obj.num_indices);
+    for (i = 0; i < obj.num_faces; i++) {
+        const obj_index_t* face = obj.indices + obj.face_offsets[i];
+        assert(obj.face_num_verts[i] == 3);
+        for (int j = 0; j < 3; j++) {
+            position_indices.push_back(face[j].v);
+            texcoord_indices.push_back(face[j].vt);
+            normal_indices.push_back(face[j].vn);
         }
-        UNUSED_VAR(items);
     }
-    fclose(file);
+
+    std::vector<vec3_t> positions(obj.positions, obj.positions + obj.num_positions);
+    std::vector<vec2_t> texcoords(obj.texcoords, obj.texcoords + obj.num_texcoords);
+    std::vector<vec3_t> normals(obj.normals, obj.normals + obj.num_normals);
+    free_obj(&obj);
 
     mesh = build_mesh(positions, texcoords, normals, position_indices, texcoord_indices, normal_indices);
 
@@ -0,0 +1,247 @@
+#include "mesh_adjacency.hh"
+
+#include "jobs.hh"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+bool g_validate_ptex_adjacency = true;
+
+// Buckets are matched this many vertices at a time on the job threads.
+#define ADJACENCY_VERTICES_PER_JOB (1 << 16)
+
+typedef struct {
+	int other_vertex;
+	// face * 4 + edge
+	int half_edge;
+} half_edge_t;
+
+static uint32_t float_bits(float value)
+{
+	// So -0 and 0 weld.
+	value += 0.0f;
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	return bits;
+}
+
+static uint32_t hash_position(vec3_t p)
+{
+	uint32_t hash = float_bits(p.x) * 0x9E3779B1u;
+	hash = (hash ^ float_bits(p.y)) * 0x85EBCA77u;
+	hash = (hash ^ float_bits(p.z)) * 0xC2B2AE3Du;
+	return hash ^ (hash >> 16);
+}
+
+// Maps every position to the first position with the same coordinates,
+// numbered in the order they are first seen. Returns the number of welded positions.
+static int weld_positions(const obj_data_t* obj, int* welded)
+{
+	uint32_t table_size = 16;
+	while (table_size < (uint32_t)obj->num_positions * 2)
+		table_size *= 2;
+
+	// Open addressing, holds the first position with those coordinates.
+	std::vector<int> table(table_size, -1);
+
+	int num_welded = 0;
+	for (int i = 0; i < obj->num_positions; i++)
+	{
+		vec3_t p = obj->positions[i];
+		uint32_t slot = hash_position(p) & (table_size - 1);
+		while (true)
+		{
+			int first = table[slot];
+			if (first == -1)
+			{
+				table[slot] = i;
+				welded[i] = num_welded++;
+				break;
+			}
+
+			vec3_t q = obj->positions[first];
+			if (p.x == q.x && p.y == q.y && p.z == q.z)
+			{
+				welded[i] = welded[first];
+				break;
+			}
+
+			slot = (slot + 1) & (table_size - 1);
+		}
+	}
+
+	return num_welded;
+}
+
+void build_face_adjacency(const obj_data_t* obj, int32_t* adj_faces, int8_t* adj_edges, face_adjacency_stats_t* stats)
+{
+	memset(stats, 0, sizeof(*stats));
+
+	for (int i = 0; i < obj->num_faces * 4; i++)
+	{
+		adj_faces[i] = -1;
+		adj_edges[i] = -1;
+	}
+
+	std::vector<int> welded(obj->num_positions);
+	int num_vertices = weld_positions(obj, welded.data());
+	stats->num_welded_positions = num_vertices;
+
+	// Counting sort of the half edges by their smallest vertex, so the two halves of an edge
+	// end up in the same bucket. Degenerate edges are left out, they stay boundaries.
+	std::vector<int> bucket_offsets(num_vertices + 1, 0);
+	for (int face = 0; face < obj->num_faces; face++)
+	{
+		int num_verts = obj->face_num_verts[face];
+		// There are only 4 entries per face, n-gons keep boundaries on every edge.
+		if (num_verts > 4)
+		{
+			stats->num_skipped_faces++;
+			continue;
+		}
+
+		const obj_index_t* corners = obj->indices + obj->face_offsets[face];
+		for (int edge = 0; edge < num_verts; edge++)
+		{
+			int a = welded[corners[edge].v];
+			int b = welded[corners[(edge + 1) % num_verts].v];
+			if (a != b)
+				bucket_offsets[(a < b ? a : b) + 1]++;
+		}
+	}
+
+	for (int i = 0; i < num_vertices; i++)
+		bucket_offsets[i + 1] += bucket_offsets[i];
+
+	std::vector<half_edge_t> half_edges(bucket_offsets[num_vertices]);
+	std::vector<int> bucket_fill(bucket_offsets.begin(), bucket_offsets.end() - 1);
+	for (int face = 0; face < obj->num_faces; face++)
+	{
+		int num_verts = obj->face_num_verts[face];
+		if (num_verts > 4)
+			continue;
+
+		const obj_index_t* corners = obj->indices + obj->face_offsets[face];
+		for (int edge = 0; edge < num_verts; edge++)
+		{
+			int a = welded[corners[edge].v];
+			int b = welded[corners[(edge + 1) % num_verts].v];
+			if (a == b)
+				continue;
+
+			half_edge_t* half_edge = &half_edges[bucket_fill[a < b ? a : b]++];
+			half_edge->other_vertex = a < b ? b : a;
+			half_edge->half_edge = face * 4 + edge;
+		}
+	}
+
+	// Buckets are as big as the number of edges around a vertex, so matching within them is cheap.
+	int num_jobs = (num_vertices + ADJACENCY_VERTICES_PER_JOB - 1) / ADJACENCY_VERTICES_PER_JOB;
+	std::vector<face_adjacency_stats_t> job_stats(num_jobs);
+	jobs::parallel_for(num_jobs, [&](int job) {
+		face_adjacency_stats_t* job_stat = &job_stats[job];
+		memset(job_stat, 0, sizeof(*job_stat));
+
+		int begin = job * ADJACENCY_VERTICES_PER_JOB;
+		int end = begin + ADJACENCY_VERTICES_PER_JOB < num_vertices ? begin + ADJACENCY_VERTICES_PER_JOB : num_vertices;
+		for (int vertex = begin; vertex < end; vertex++)
+		{
+			half_edge_t* bucket = half_edges.data() + bucket_offsets[vertex];
+			int bucket_size = bucket_offsets[vertex + 1] - bucket_offsets[vertex];
+
+			for (int i = 0; i < bucket_size; i++)
+			{
+				int first = bucket[i].half_edge;
+				if (first == -1)
+					continue;
+
+				int num_sharing = 1;
+				for (int j = i + 1; j < bucket_size; j++)
+				{
+					if (bucket[j].other_vertex != bucket[i].other_vertex || bucket[j].half_edge == -1)
+						continue;
+
+					num_sharing++;
+					int second = bucket[j].half_edge;
+					bucket[j].half_edge = -1;
+					if (num_sharing > 2)
+						continue;
+
+					adj_faces[first] = second / 4;
+					adj_edges[first] = (int8_t)(second % 4);
+					adj_faces[second] = first / 4;
+					adj_edges[second] = (int8_t)(first % 4);
+
+					// Both halves start at the smallest vertex when they go the same way.
+					int first_face = first / 4, second_face = second / 4;
+					int first_start = welded[obj->indices[obj->face_offsets[first_face] + first % 4].v];
+					int second_start = welded[obj->indices[obj->face_offsets[second_face] + second % 4].v];
+					if (first_start == second_start)
+						job_stat->num_flipped_edges++;
+				}
+
+				if (num_sharing == 1)
+					job_stat->num_boundary_edges++;
+				else if (num_sharing > 2)
+					job_stat->num_nonmanifold_edges++;
+			}
+		}
+	});
+
+	for (int i = 0; i < num_jobs; i++)
+	{
+		stats->num_boundary_edges += job_stats[i].num_boundary_edges;
+		stats->num_nonmanifold_edges += job_stats[i].num_nonmanifold_edges;
+		stats->num_flipped_edges += job_stats[i].num_flipped_edges;
+	}
+}
+
+int validate_ptex_adjacency(const char* name, Ptex::PtexTexture* ptex, const ptex_mesh_t* mesh)
+{
+	if (ptex == NULL || mesh->adj_faces == NULL)
+		return 0;
+
+	if (ptex->numFaces() != mesh->num_faces)
+	{
+		printf("%s: the ptex file has %d faces and the mesh %d, can't compare their adjacency.\n", name, ptex->numFaces(), mesh->num_faces);
+		return mesh->num_faces;
+	}
+
+	int num_edges = ptex->meshType() == Ptex::mt_triangle ? 3 : 4;
+
+	int num_different = 0;
+	int first_different = -1;
+	for (int face = 0; face < mesh->num_faces; face++)
+	{
+		const Ptex::FaceInfo& info = ptex->getFaceInfo(face);
+		const int32_t* adj_faces = mesh->adj_faces + face * 4;
+		const int8_t* adj_edges = mesh->adj_edges + face * 4;
+
+		bool same = true;
+		for (int edge = 0; edge < num_edges; edge++)
+		{
+			if (info.adjfaces[edge] != adj_faces[edge])
+				same = false;
+			// The edge of a missing neighbor is whatever the writer left there.
+			else if (adj_faces[edge] != -1 && info.adjedge(edge) != adj_edges[edge])
+				same = false;
+		}
+
+		if (same == false)
+		{
+			if (first_different == -1)
+				first_different = face;
+			num_different++;
+		}
+	}
+
+	if (num_different == 0)
+		printf("%s: the ptex adjacency matches the mesh.\n", name);
+	else printf("%s: the ptex adjacency differs from the mesh on %d of %d faces, the first is face %d.\n", name, num_different, mesh->num_faces, first_different);
+
+	return num_different;
+}
@@ -0,0 +1,36 @@
+#ifndef MESH_ADJACENCY_H
+#define MESH_ADJACENCY_H
+
+#include "obj_parse.hh"
+#include "mesh_loading.hh"
+
+#include <Ptexture.h>
+
+// Face adjacency in the layout of Ptex::FaceInfo's adjfaces and adjedges, built from the
+// OBJ connectivity in linear time. Positions with the same coordinates are welded first,
+// exporters split them along uv seams and the faces on either side are still neighbors.
+// Then every half edge is bucketed by its smallest welded vertex and matched with the
+// other half edge in its bucket going to the same vertex.
+
+typedef struct {
+	int num_welded_positions;
+	int num_boundary_edges;
+	// Edges with more than two faces, only the first two are connected.
+	int num_nonmanifold_edges;
+	// Neighbors going the same way along their shared edge, the winding is inconsistent.
+	int num_flipped_edges;
+	// Faces with more than 4 vertices, they have no neighbors.
+	int num_skipped_faces;
+} face_adjacency_stats_t;
+
+// Fills 4 entries per face, edge i goes from corner i to corner i + 1.
+// -1 for boundary edges and the 4th edge of triangles.
+void build_face_adjacency(const obj_data_t* obj, int32_t* adj_faces, int8_t* adj_edges, face_adjacency_stats_t* stats);
+
+extern bool g_validate_ptex_adjacency;
+
+// Compares the adjacency the ptex file was written with against the mesh's and prints
+// how many faces differ. Returns the number of faces that differ.
+int validate_ptex_adjacency(const char* name, Ptex::PtexTexture* ptex, const ptex_mesh_t* mesh);
+
+#endif // !MESH_ADJACENCY_H
@@ -0,0 +1,255 @@
+#include "mesh_cache.hh"
+
+#include "ptex_pack.hh"
+#include "platform.hh"
+#include "util.hh"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+bool g_use_mesh_cache = true;
+
+#define MESH_CACHE_ALIGNMENT 16
+
+static uint64_t align_offset(uint64_t offset)
+{
+	return (offset + MESH_CACHE_ALIGNMENT - 1) & ~(uint64_t)(MESH_CACHE_ALIGNMENT - 1);
+}
+
+static uint64_t hash_path(const char* path)
+{
+	return hash_fnv1a(path, strlen(path));
+}
+
+static bool validate_mesh_cache(const mapped_file_t* cache, const char* obj_path)
+{
+	if (cache->size < sizeof(mesh_cache_header))
+		return false;
+
+	const mesh_cache_header* header = (const mesh_cache_header*)cache->data;
+
+	if (header->magic != MESH_CACHE_MAGIC || header->version != MESH_CACHE_VERSION || header->vertex_size != sizeof(ptex_vertex_t) ||
+		header->packed_vertex_size != sizeof(ptex_packed_vertex_t) || header->cluster_size != sizeof(mesh_cluster_t))
+		return false;
+
+	uint64_t source_size;
+	int64_t source_mtime;
+	if (get_file_info(obj_path, &source_size, &source_mtime) == false)
+		return false;
+
+	if (header->source_size != source_size || header->source_mtime != source_mtime || header->source_path_hash != hash_path(obj_path))
+		return false;
+
+	if (header->num_vertices < 0 || header->num_indices < 0 || header->num_faces < 0 || header->num_clusters < 0)
+		return false;
+
+	// Make sure the cache wasn't truncated.
+	if (header->vertices_offset + header->num_vertices * sizeof(ptex_vertex_t) > cache->size ||
+		header->packed_vertices_offset + header->num_vertices * sizeof(ptex_packed_vertex_t) > cache->size ||
+		header->indices_offset + header->num_indices * sizeof(uint32_t) > cache->size ||
+		header->adj_faces_offset + header->num_faces * 4 * sizeof(int32_t) > cache->size ||
+		header->adj_edges_offset + header->num_faces * 4 * sizeof(int8_t) > cache->size ||
+		header->clusters_offset + header->num_clusters * sizeof(mesh_cluster_t) > cache->size)
+		return false;
+
+	// The arrays are used in place, so they have to be aligned in the mapping.
+	if (header->vertices_offset % MESH_CACHE_ALIGNMENT != 0 || header->packed_vertices_offset % MESH_CACHE_ALIGNMENT != 0 ||
+		header->indices_offset % MESH_CACHE_ALIGNMENT != 0 || header->adj_faces_offset % MESH_CACHE_ALIGNMENT != 0 ||
+		header->clusters_offset % MESH_CACHE_ALIGNMENT != 0)
+		return false;
+
+	// The clusters are drawn straight from the index buffer.
+	const mesh_cluster_t* clusters = (const mesh_cluster_t*)((const uint8_t*)cache->data + header->clusters_offset);
+	for (int i = 0; i < header->num_clusters; i++)
+	{
+		if (clusters[i].first_index < 0 || clusters[i].num_indices < 0 || clusters[i].first_index + clusters[i].num_indices > header->num_indices)
+			return false;
+	}
+
+	return true;
+}
+
+bool load_mesh_cache(const char* cache_path, const char* obj_path, ptex_mesh_t** mesh)
+{
+	mapped_file_t* cache = (mapped_file_t*)malloc(sizeof(mapped_file_t));
+	if (map_file(cache_path, cache) == false)
+	{
+		free(cache);
+		return false;
+	}
+
+	if (validate_mesh_cache(cache, obj_path) == false)
+	{
+		printf("Mesh cache '%s' is out of date.\n", cache_path);
+		unmap_file(cache);
+		free(cache);
+		return false;
+	}
+
+	uint8_t* data = (uint8_t*)cache->data;
+	const mesh_cache_header* header = (const mesh_cache_header*)data;
+
+	// The mapping is read-only, nothing writes to a loaded mesh.
+	ptex_mesh_t* result = (ptex_mesh_t*)malloc(sizeof(ptex_mesh_t));
+	result->num_vertices = header->num_vertices;
+	result->vertices = (ptex_vertex_t*)(data + header->vertices_offset);
+	result->packed_vertices = (ptex_packed_vertex_t*)(data + header->packed_vertices_offset);
+	result->num_indices = header->num_indices;
+	result->indices = (uint32_t*)(data + header->indices_offset);
+	result->num_faces = header->num_faces;
+	result->adj_faces = (int32_t*)(data + header->adj_faces_offset);
+	result->adj_edges = (int8_t*)(data + header->adj_edges_offset);
+	result->num_clusters = header->num_clusters;
+	result->clusters = (mesh_cluster_t*)(data + header->clusters_offset);
+	result->bbox_min = header->bbox_min;
+	result->bbox_max = header->bbox_max;
+	result->center = header->center;
+	result->mapping = cache;
+
+	*mesh = result;
+	return true;
+}
+
+static bool write_padding(FILE* file, uint64_t* written, uint64_t offset)
+{
+	static const uint8_t zeros[MESH_CACHE_ALIGNMENT] = { 0 };
+
+	assert(offset >= *written && offset - *written <= MESH_CACHE_ALIGNMENT);
+
+	size_t padding = offset - *written;
+	if (padding != 0 && fwrite(zeros, 1, padding, file) != padding)
+		return false;
+
+	*written = offset;
+	return true;
+}
+
+static bool write_array(FILE* file, uint64_t* written, uint64_t offset, const void* data, size_t element_size, int count)
+{
+	if (write_padding(file, written, offset) == false)
+		return false;
+
+	if (count != 0 && fwrite(data, element_size, count, file) != (size_t)count)
+		return false;
+
+	*written += (uint64_t)element_size * count;
+	return true;
+}
+
+bool write_mesh_cache(const char* cache_path, const char* obj_path, const ptex_mesh_t* mesh)
+{
+	// Meshes from load_mesh have no packed vertices or index buffer to cache.
+	if (mesh->packed_vertices == NULL || mesh->indices == NULL)
+		return false;
+
+	mesh_cache_header header;
+	memset(&header, 0, sizeof(header));
+
+	header.magic = MESH_CACHE_MAGIC;
+	header.version = MESH_CACHE_VERSION;
+	header.source_path_hash = hash_path(obj_path);
+	header.vertex_size = sizeof(ptex_vertex_t);
+	header.packed_vertex_size = sizeof(ptex_packed_vertex_t);
+	header.num_vertices = mesh->num_vertices;
+	header.num_indices = mesh->num_indices;
+	header.num_faces = mesh->num_faces;
+	header.num_clusters = mesh->num_clusters;
+	header.cluster_size = sizeof(mesh_cluster_t);
+	header.bbox_min = mesh->bbox_min;
+	header.bbox_max = mesh->bbox_max;
+	header.center = mesh->center;
+
+	if (get_file_info(obj_path, &header.source_size, &header.source_mtime) == false)
+	{
+		printf("Could not read '%s' to write mesh cache.\n", obj_path);
+		return false;
+	}
+
+	// Lay out the file before writing anything.
+	uint64_t offset = align_offset(sizeof(mesh_cache_header));
+	header.vertices_offset = offset;
+	offset = align_offset(offset + (uint64_t)header.num_vertices * sizeof(ptex_vertex_t));
+	header.packed_vertices_offset = offset;
+	offset = align_offset(offset + (uint64_t)header.num_vertices * sizeof(ptex_packed_vertex_t));
+	header.indices_offset = offset;
+	offset = align_offset(offset + (uint64_t)header.num_indices * sizeof(uint32_t));
+	header.adj_faces_offset = offset;
+	offset = align_offset(offset + (uint64_t)header.num_faces * 4 * sizeof(int32_t));
+	header.adj_edges_offset = offset;
+	offset = align_offset(offset + (uint64_t)header.num_faces * 4 * sizeof(int8_t));
+	header.clusters_offset = offset;
+
+	FILE* file = fopen(cache_path, "wb");
+	if (file == NULL)
+	{
+		printf("Could not open '%s' for writing.\n", cache_path);
+		return false;
+	}
+
+	bool success = true;
+	uint64_t written = 0;
+
+	success &= fwrite(&header, sizeof(header), 1, file) == 1;
+	written = sizeof(header);
+
+	success = success && write_array(file, &written, header.vertices_offset, mesh->vertices, sizeof(ptex_vertex_t), header.num_vertices);
+	success = success && write_array(file, &written, header.packed_vertices_offset, mesh->packed_vertices, sizeof(ptex_packed_vertex_t), header.num_vertices);
+	success = success && write_array(file, &written, header.indices_offset, mesh->indices, sizeof(uint32_t), header.num_indices);
+	success = success && write_array(file, &written, header.adj_faces_offset, mesh->adj_faces, sizeof(int32_t), header.num_faces * 4);
+	success = success && write_array(file, &written, header.adj_edges_offset, mesh->adj_edges, sizeof(int8_t), header.num_faces * 4);
+	success = success && write_array(file, &written, header.clusters_offset, mesh->clusters, sizeof(mesh_cluster_t), header.num_clusters);
+
+	fclose(file);
+
+	if (success == false)
+	{
+		printf("Failed to write mesh cache '%s'.\n", cache_path);
+		remove(cache_path);
+	}
+
+	return success;
+}
+
+ptex_mesh_t* load_cached_ptex_mesh(const char* obj_path)
+{
+	if (g_use_mesh_cache == false)
+		return load_ptex_mesh(obj_path);
+
+	char cache_path[PATH_SIZE];
+	ptex_pack_path(obj_path, MESH_CACHE_EXTENSION, cache_path, sizeof(cache_path));
+
+	ptex_mesh_t* mesh;
+	if (load_mesh_cache(cache_path, obj_path, &mesh))
+	{
+		printf("Loaded mesh cache '%s'.\n", cache_path);
+		return mesh;
+	}
+
+	mesh = load_ptex_mesh(obj_path);
+	if (mesh->num_faces > 0 && write_mesh_cache(cache_path, obj_path, mesh))
+		printf("Wrote mesh cache '%s'.\n", cache_path);
+
+	return mesh;
+}
+
+void free_ptex_mesh(ptex_mesh_t* mesh)
+{
+	if (mesh->mapping != NULL)
+	{
+		unmap_file(mesh->mapping);
+		free(mesh->mapping);
+	}
+	else
+	{
+		free(mesh->vertices);
+		free(mesh->packed_vertices);
+		free(mesh->indices);
+		free(mesh->adj_faces);
+		free(mesh->adj_edges);
+		free(mesh->clusters);
+	}
+
+	free(mesh);
+}
@@ -0,0 +1,56 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include "mesh_loading.hh"
+
+// A .ptexmesh file is a cache of what load_ptex_mesh builds from an OBJ: the reordered vertex and
+// index buffers, the face adjacency, the clusters and the bounds. It is keyed to the path, size and mtime
+// of the OBJ, and on later runs it's mapped and the mesh arrays point straight into the
+// mapping, so the buffers are uploaded without being parsed or copied.
+
+#define MESH_CACHE_MAGIC 0x48534D50 // "PMSH"
+#define MESH_CACHE_VERSION 5
+
+#define MESH_CACHE_EXTENSION ".ptexmesh"
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+
+	uint64_t source_size;
+	int64_t source_mtime;
+	uint64_t source_path_hash;
+
+	int32_t vertex_size;
+	int32_t packed_vertex_size;
+	int32_t num_vertices;
+	int32_t num_indices;
+	int32_t num_faces;
+	int32_t num_clusters;
+	int32_t cluster_size;
+
+	vec3_t bbox_min, bbox_max;
+	vec3_t center;
+
+	uint64_t vertices_offset;
+	uint64_t packed_vertices_offset;
+	uint64_t indices_offset;
+	uint64_t adj_faces_offset;
+	uint64_t adj_edges_offset;
+	uint64_t clusters_offset;
+} mesh_cache_header;
+
+extern bool g_use_mesh_cache;
+
+// Returns false if there is no cache or it is out of date with the OBJ file.
+bool load_mesh_cache(const char* cache_path, const char* obj_path, ptex_mesh_t** mesh);
+
+bool write_mesh_cache(const char* cache_path, const char* obj_path, const ptex_mesh_t* mesh);
+
+// load_ptex_mesh through the cache next to the OBJ, writing it if it's missing or out of date.
+ptex_mesh_t* load_cached_ptex_mesh(const char* obj_path);
+
+// Frees the arrays or unmaps the cache they point into.
+void free_ptex_mesh(ptex_mesh_t* mesh);
+
+#endif // !MESH_CACHE_H
@@ -0,0 +1,296 @@
+#include "mesh_clusters.hh"
+
+#include <assert.h>
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+bool g_cull_clusters_frustum = true;
+// Off by default, GL_CULL_FACE isn't enabled so back faces are drawn and single sided
+// geometry like the ground plane or the inside of open meshes would disappear.
+bool g_cull_clusters_backface = false;
+
+typedef struct {
+	float a, b, c, d;
+} plane_t;
+
+static int face_index_count(const ptex_mesh_t* mesh, const int* face_first_index, int face)
+{
+	int end = face + 1 < mesh->num_faces ? face_first_index[face + 1] : mesh->num_indices;
+	return end - face_first_index[face];
+}
+
+// Sum of the normals of the triangles, the length is twice their area.
+static vec3_t face_normal(const ptex_mesh_t* mesh, const uint32_t* indices, int index_count)
+{
+	vec3_t normal = { 0, 0, 0 };
+	for (int i = 0; i + 2 < index_count; i += 3)
+	{
+		vec3_t p0 = mesh->vertices[indices[i + 0]].position;
+		vec3_t p1 = mesh->vertices[indices[i + 1]].position;
+		vec3_t p2 = mesh->vertices[indices[i + 2]].position;
+		normal = vec3_add(normal, vec3_cross(vec3_sub(p1, p0), vec3_sub(p2, p0)));
+	}
+	return normal;
+}
+
+static vec3_t normalize_or_zero(vec3_t v)
+{
+	float length = vec3_length(v);
+	return length > 0 ? vec3_div(v, length) : v;
+}
+
+static void compute_cluster_bounds(const ptex_mesh_t* mesh, mesh_cluster_t* cluster)
+{
+	const uint32_t* indices = mesh->indices + cluster->first_index;
+
+	vec3_t min = vec3_new(FLT_MAX, FLT_MAX, FLT_MAX);
+	vec3_t max = vec3_new(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for (int i = 0; i < cluster->num_indices; i++)
+	{
+		vec3_t p = mesh->vertices[indices[i]].position;
+		min = vec3_min(min, p);
+		max = vec3_max(max, p);
+	}
+
+	cluster->center = vec3_div(vec3_add(min, max), 2);
+	cluster->radius = 0;
+	for (int i = 0; i < cluster->num_indices; i++)
+	{
+		float distance = vec3_length(vec3_sub(mesh->vertices[indices[i]].position, cluster->center));
+		if (distance > cluster->radius)
+			cluster->radius = distance;
+	}
+
+	// The cone is over the triangles and not the faces, the two triangles of a quad that isn't flat
+	// point different ways.
+	vec3_t axis = face_normal(mesh, indices, cluster->num_indices);
+	axis = normalize_or_zero(axis);
+
+	// Degenerate triangles have no normal and can't be seen either way.
+	float min_dot = 1;
+	for (int i = 0; i + 2 < cluster->num_indices; i += 3)
+	{
+		vec3_t normal = normalize_or_zero(face_normal(mesh, indices + i, 3));
+		if (vec3_length(normal) > 0)
+			min_dot = fminf(min_dot, vec3_dot(axis, normal));
+	}
+
+	cluster->cone_axis = axis;
+	// The cluster faces away when the view direction is within 90 degrees minus the cone's half angle of the axis.
+	if (vec3_length(axis) == 0 || min_dot <= 0)
+		cluster->cone_cutoff = 2;
+	else cluster->cone_cutoff = sqrtf(1 - min_dot * min_dot);
+}
+
+void build_mesh_clusters(ptex_mesh_t* mesh, const int* face_first_index)
+{
+	int num_faces = mesh->num_faces;
+
+	std::vector<vec3_t> face_normals(num_faces);
+	for (int face = 0; face < num_faces; face++)
+		face_normals[face] = face_normal(mesh, mesh->indices + face_first_index[face], face_index_count(mesh, face_first_index, face));
+
+	// The faces of each cluster one after the other, in the order they were added.
+	std::vector<int> cluster_faces;
+	cluster_faces.reserve(num_faces);
+	std::vector<int> cluster_starts;
+
+	std::vector<int> face_cluster(num_faces, -1);
+	// The last cluster that queued the face, so it's only queued once per cluster.
+	std::vector<int> queued_by(num_faces, -1);
+	std::vector<int> queue;
+	queue.reserve(MESH_CLUSTER_MAX_FACES * 4);
+
+	for (int seed = 0; seed < num_faces; seed++)
+	{
+		if (face_cluster[seed] != -1)
+			continue;
+
+		int cluster = (int)cluster_starts.size();
+		cluster_starts.push_back((int)cluster_faces.size());
+
+		vec3_t normal_sum = { 0, 0, 0 };
+		int size = 0;
+
+		queue.clear();
+		queue.push_back(seed);
+		queued_by[seed] = cluster;
+		for (size_t head = 0; head < queue.size() && size < MESH_CLUSTER_MAX_FACES; head++)
+		{
+			int face = queue[head];
+
+			vec3_t normal = normalize_or_zero(face_normals[face]);
+			vec3_t average = normalize_or_zero(normal_sum);
+			if (size > 0 && vec3_length(average) > 0 && vec3_length(normal) > 0 && vec3_dot(average, normal) < MESH_CLUSTER_MIN_NORMAL_DOT)
+				continue;
+
+			face_cluster[face] = cluster;
+			cluster_faces.push_back(face);
+			normal_sum = vec3_add(normal_sum, normal);
+			size++;
+
+			for (int edge = 0; edge < 4; edge++)
+			{
+				int neighbor = mesh->adj_faces[face * 4 + edge];
+				if (neighbor == -1 || face_cluster[neighbor] != -1 || queued_by[neighbor] == cluster)
+					continue;
+
+				queued_by[neighbor] = cluster;
+				queue.push_back(neighbor);
+			}
+		}
+	}
+
+	int num_clusters = (int)cluster_starts.size();
+	cluster_starts.push_back(num_faces);
+
+	// Sort the index buffer by cluster, the face ids are in the vertices so they don't change.
+	uint32_t* sorted_indices = (uint32_t*)malloc(sizeof(uint32_t) * (mesh->num_indices > 0 ? mesh->num_indices : 1));
+	mesh_cluster_t* clusters = (mesh_cluster_t*)malloc(sizeof(mesh_cluster_t) * (num_clusters > 0 ? num_clusters : 1));
+
+	int num_sorted = 0;
+	for (int c = 0; c < num_clusters; c++)
+	{
+		mesh_cluster_t* cluster = &clusters[c];
+		cluster->first_index = num_sorted;
+		cluster->num_vertices = 0;
+
+		for (int i = cluster_starts[c]; i < cluster_starts[c + 1]; i++)
+		{
+			int face = cluster_faces[i];
+			int count = face_index_count(mesh, face_first_index, face);
+			memcpy(sorted_indices + num_sorted, mesh->indices + face_first_index[face], count * sizeof(uint32_t));
+			num_sorted += count;
+
+			// Faces don't share vertices, quads are drawn as two triangles over 4.
+			cluster->num_vertices += count == 6 ? 4 : count;
+		}
+
+		cluster->num_indices = num_sorted - cluster->first_index;
+	}
+	assert(num_sorted == mesh->num_indices);
+
+	free(mesh->indices);
+	mesh->indices = sorted_indices;
+
+	for (int c = 0; c < num_clusters; c++)
+		compute_cluster_bounds(mesh, &clusters[c]);
+
+	mesh->num_clusters = num_clusters;
+	mesh->clusters = clusters;
+
+	printf("Grouped %d faces into %d clusters, %.1f faces per cluster on average.\n", num_faces, num_clusters, num_clusters > 0 ? num_faces / (double)num_clusters : 0.0);
+}
+
+static plane_t normalize_plane(plane_t plane)
+{
+	float length = sqrtf(plane.a * plane.a + plane.b * plane.b + plane.c * plane.c);
+	if (length > 0)
+	{
+		plane.a /= length;
+		plane.b /= length;
+		plane.c /= length;
+		plane.d /= length;
+	}
+	return plane;
+}
+
+// The planes in the space mvp takes positions from, pointing inwards. mvp takes row vectors,
+// so clip space x, y, z and w are its columns.
+static void extract_frustum_planes(mat4_t mvp, plane_t planes[6])
+{
+	for (int axis = 0; axis < 3; axis++)
+	{
+		plane_t near_side, far_side;
+		near_side.a = mvp.m[0][3] + mvp.m[0][axis];
+		near_side.b = mvp.m[1][3] + mvp.m[1][axis];
+		near_side.c = mvp.m[2][3] + mvp.m[2][axis];
+		near_side.d = mvp.m[3][3] + mvp.m[3][axis];
+
+		far_side.a = mvp.m[0][3] - mvp.m[0][axis];
+		far_side.b = mvp.m[1][3] - mvp.m[1][axis];
+		far_side.c = mvp.m[2][3] - mvp.m[2][axis];
+		far_side.d = mvp.m[3][3] - mvp.m[3][axis];
+
+		planes[axis * 2 + 0] = normalize_plane(near_side);
+		planes[axis * 2 + 1] = normalize_plane(far_side);
+	}
+}
+
+static bool sphere_outside_frustum(const plane_t planes[6], vec3_t center, float radius)
+{
+	for (int i = 0; i < 6; i++)
+	{
+		const plane_t* plane = &planes[i];
+		if (plane->a * center.x + plane->b * center.y + plane->c * center.z + plane->d < -radius)
+			return true;
+	}
+	return false;
+}
+
+static bool cluster_faces_away(const mesh_cluster_t* cluster, vec3_t eye)
+{
+	if (cluster->cone_cutoff > 1)
+		return false;
+
+	vec3_t to_center = vec3_sub(cluster->center, eye);
+	return vec3_dot(to_center, cluster->cone_axis) >= cluster->cone_cutoff * vec3_length(to_center) + cluster->radius;
+}
+
+void cull_mesh_clusters(const ptex_mesh_t* mesh, mat4_t mvp, mat4_t model_view, index_ranges_t* ranges, cluster_cull_stats_t* stats)
+{
+	assert(ranges->max_ranges >= mesh->num_clusters);
+
+	// The clusters are in the space of the float positions.
+	mat4_t encode = mat4_inverse(ptex_mesh_position_decode(mesh));
+	mat4_t cluster_mvp = mat4_mul_mat4(encode, mvp);
+	mat4_t cluster_model_view = mat4_mul_mat4(encode, model_view);
+
+	plane_t planes[6];
+	extract_frustum_planes(cluster_mvp, planes);
+
+	// The origin of view space, the translation is the last row.
+	mat4_t view_to_model = mat4_inverse(cluster_model_view);
+	vec3_t eye = vec3_new(view_to_model.m[3][0], view_to_model.m[3][1], view_to_model.m[3][2]);
+
+	memset(stats, 0, sizeof(*stats));
+	stats->num_clusters = mesh->num_clusters;
+
+	ranges->num_ranges = 0;
+	int range_end = -1;
+	for (int i = 0; i < mesh->num_clusters; i++)
+	{
+		const mesh_cluster_t* cluster = &mesh->clusters[i];
+		stats->num_vertices += cluster->num_vertices;
+		stats->num_triangles += cluster->num_indices / 3;
+
+		if (g_cull_clusters_frustum && sphere_outside_frustum(planes, cluster->center, cluster->radius))
+			continue;
+
+		if (g_cull_clusters_backface && cluster_faces_away(cluster, eye))
+			continue;
+
+		stats->drawn_clusters++;
+		stats->drawn_vertices += cluster->num_vertices;
+		stats->drawn_triangles += cluster->num_indices / 3;
+
+		if (cluster->first_index == range_end)
+		{
+			ranges->counts[ranges->num_ranges - 1] += cluster->num_indices;
+		}
+		else
+		{
+			ranges->counts[ranges->num_ranges] = cluster->num_indices;
+			ranges->offsets[ranges->num_ranges] = (const void*)(cluster->first_index * sizeof(uint32_t));
+			ranges->num_ranges++;
+		}
+		range_end = cluster->first_index + cluster->num_indices;
+	}
+
+	stats->num_ranges = ranges->num_ranges;
+}
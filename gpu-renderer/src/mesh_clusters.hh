@@ -0,0 +1,37 @@
+#ifndef MESH_CLUSTERS_H
+#define MESH_CLUSTERS_H
+
+#include "mesh_loading.hh"
+#include "gl_utils.hh"
+
+// Faces are grouped into clusters of up to MESH_CLUSTER_MAX_FACES. A cluster is grown breadth
+// first over the face adjacency from the first face that isn't in one yet, only taking faces
+// within 60 degrees of the cluster's average normal, so clusters are compact patches with
+// narrow normal cones. The index buffer is sorted by cluster and each
+// frame the clusters outside the frustum are skipped, the rest are drawn with one
+// glMultiDrawElements. Skipping the clusters facing away is opt in since back faces are drawn.
+
+#define MESH_CLUSTER_MAX_FACES 128
+// Cosine of the largest angle between a face and the cluster's average normal.
+#define MESH_CLUSTER_MIN_NORMAL_DOT 0.5f
+
+extern bool g_cull_clusters_frustum;
+extern bool g_cull_clusters_backface;
+
+// face_first_index is where the triangles of each face start in mesh->indices.
+// Sorts the index buffer by cluster and fills in mesh->clusters.
+void build_mesh_clusters(ptex_mesh_t* mesh, const int* face_first_index);
+
+typedef struct {
+	int num_clusters, drawn_clusters;
+	int num_vertices, drawn_vertices;
+	int num_triangles, drawn_triangles;
+	int num_ranges;
+} cluster_cull_stats_t;
+
+// mvp and model_view take the packed positions, like the matrices the methods draw with.
+// Writes the index ranges of the clusters that are left to ranges, clusters next to each
+// other in the index buffer are merged into one range.
+void cull_mesh_clusters(const ptex_mesh_t* mesh, mat4_t mvp, mat4_t model_view, index_ranges_t* ranges, cluster_cull_stats_t* stats);
+
+#endif // !MESH_CLUSTERS_H
@@ -1,234 +1,328 @@
 
 #include "mesh_loading.hh"
 
-#define TINYOBJ_LOADER_C_IMPLEMENTATION
+#include "obj_parse.hh"
+#include "mesh_adjacency.hh"
+#include "mesh_clusters.hh"
+#include "mesh_vertex_cache.hh"
+#include "jobs.hh"
+#include "array.hh"
+
+#include <assert.h>
 #include <float.h>
-#include <tinyobj_loader_c.h>
-
+#include <math.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include <vector>
 
+// Faces are turned into vertices this many at a time on the job threads.
+#define MESH_FACES_PER_JOB (1 << 16)
+#define MESH_VERTICES_PER_JOB (1 << 18)
+
 typedef struct {
-	//FILE* file;
-} file_reader_context_t;
+	vec3_t min, max;
+} bbox_t;
 
-void file_reader(void* ctx, const char* filename, int is_mtl, const char* obj_filename, char** buf, size_t* len) {
-	FILE* file = fopen(filename, "rb");
-	assert(file != NULL);
+static ptex_mesh_t* alloc_ptex_mesh(int num_vertices)
+{
+	ptex_mesh_t* mesh = (ptex_mesh_t*)malloc(sizeof(ptex_mesh_t));
+	mesh->num_vertices = num_vertices;
+	mesh->vertices = (ptex_vertex_t*)malloc(sizeof(ptex_vertex_t) * (num_vertices > 0 ? num_vertices : 1));
+	mesh->packed_vertices = NULL;
+	mesh->num_indices = 0;
+	mesh->indices = NULL;
+	mesh->num_faces = 0;
+	mesh->adj_faces = NULL;
+	mesh->adj_edges = NULL;
+	mesh->num_clusters = 0;
+	mesh->clusters = NULL;
+	mesh->bbox_min = { 0, 0, 0 };
+	mesh->bbox_max = { 0, 0, 0 };
+	mesh->center = { 0, 0, 0 };
+	mesh->mapping = NULL;
+	return mesh;
+}
 
-	fseek(file, 0, SEEK_END);
-	size_t size = ftell(file);
-	fseek(file, 0, SEEK_SET);
+static void build_mesh_adjacency(const char* filename, const obj_data_t* obj, ptex_mesh_t* mesh)
+{
+	mesh->adj_faces = alloc_array(int32_t, obj->num_faces * 4);
+	mesh->adj_edges = alloc_array(int8_t, obj->num_faces * 4);
 
-	*buf = (char*)malloc((size + 1) * sizeof(char));
-	assert(*buf != NULL);
+	face_adjacency_stats_t stats;
+	build_face_adjacency(obj, mesh->adj_faces, mesh->adj_edges, &stats);
 
-	size_t read_size = fread(*buf, sizeof(char), size, file);
-	(*buf)[size] = '\0';
-	
-	assert(size == read_size);
-	
-	*len = read_size;
+	printf("'%s' has %d welded positions, %d boundary edges, %d non-manifold edges and %d flipped edges.\n",
+		filename, stats.num_welded_positions, stats.num_boundary_edges, stats.num_nonmanifold_edges, stats.num_flipped_edges);
 
-	fclose(file);
+	if (stats.num_skipped_faces > 0)
+		printf("'%s' has %d faces with more than 4 vertices, they were left without neighbors.\n", filename, stats.num_skipped_faces);
 }
 
-ptex_mesh_t* load_ptex_mesh(const char* filename) {
+static ptex_vertex_t make_ptex_vertex(const obj_data_t* obj, obj_index_t index, int face_id)
+{
+	ptex_vertex_t vertex;
+	vertex.position = obj->positions[index.v];
+	if (index.vn != OBJ_NO_INDEX)
+		vertex.normal = obj->normals[index.vn];
+	else vertex.normal = { 0, 0, 0 };
+	vertex.face_id = face_id;
+	return vertex;
+}
+
+// Runs build(face, bbox) for every face on the job threads and returns the bounds of all of them.
+template<typename F>
+static bbox_t build_faces_parallel(int num_faces, F build)
+{
+	int num_jobs = (num_faces + MESH_FACES_PER_JOB - 1) / MESH_FACES_PER_JOB;
+
+	// The initial max is FLT_MIN like it has always been, so the center doesn't move.
+	bbox_t empty = { vec3_new(FLT_MAX, FLT_MAX, FLT_MAX), vec3_new(FLT_MIN, FLT_MIN, FLT_MIN) };
+	std::vector<bbox_t> bboxes(num_jobs, empty);
+
+	jobs::parallel_for(num_jobs, [&](int job) {
+		int begin = job * MESH_FACES_PER_JOB;
+		int end = begin + MESH_FACES_PER_JOB < num_faces ? begin + MESH_FACES_PER_JOB : num_faces;
+		for (int face = begin; face < end; face++)
+			build(face, &bboxes[job]);
+	});
+
+	bbox_t bbox = empty;
+	for (int i = 0; i < num_jobs; i++)
+	{
+		bbox.min = vec3_min(bbox.min, bboxes[i].min);
+		bbox.max = vec3_max(bbox.max, bboxes[i].max);
+	}
+	return bbox;
+}
+
+// Size of the box positions are quantized in, flat axes get 1 so the scale stays invertible.
+static vec3_t quantization_extent(vec3_t bbox_min, vec3_t bbox_max)
+{
+	vec3_t extent = vec3_sub(bbox_max, bbox_min);
+	if (extent.x <= 0) extent.x = 1;
+	if (extent.y <= 0) extent.y = 1;
+	if (extent.z <= 0) extent.z = 1;
+	return extent;
+}
+
+static uint16_t quantize_unorm16(float value, float min, float extent)
+{
+	return (uint16_t)roundf(float_clamp((value - min) / extent, 0, 1) * 65535.0f);
+}
+
+static int8_t quantize_snorm8(float value)
+{
+	return (int8_t)roundf(float_clamp(value, -1, 1) * 127.0f);
+}
 
-	tinyobj_attrib_t attrib;
-	tinyobj_attrib_init(&attrib);
-	tinyobj_shape_t* shapes;
-	size_t num_shapes;
-	tinyobj_material_t* materials;
-	size_t num_materials;
+static float sign_not_zero(float value)
+{
+	return value >= 0 ? 1.0f : -1.0f;
+}
 
+// Projects the normal onto an octahedron and unfolds the lower half over the corners of the square.
+static void encode_octahedral(vec3_t normal, int8_t* out)
+{
+	float length = fabsf(normal.x) + fabsf(normal.y) + fabsf(normal.z);
+	if (length == 0)
 	{
-		file_reader_context_t file_reader_context;
-		//file_reader_context.file = fopen(filename, "rb");
-		//assert(file_reader_context.file != NULL);
+		out[0] = 0;
+		out[1] = 0;
+		return;
+	}
 
-		int result = tinyobj_parse_obj(&attrib, &shapes, &num_shapes, &materials, &num_materials, filename, file_reader, &file_reader_context, 0);
+	float x = normal.x / length;
+	float y = normal.y / length;
+	if (normal.z < 0)
+	{
+		float folded_x = (1 - fabsf(y)) * sign_not_zero(x);
+		float folded_y = (1 - fabsf(x)) * sign_not_zero(y);
+		x = folded_x;
+		y = folded_y;
+	}
 
-		if (result != TINYOBJ_SUCCESS)
+	out[0] = quantize_snorm8(x);
+	out[1] = quantize_snorm8(y);
+}
+
+static void pack_ptex_vertices(ptex_mesh_t* mesh)
+{
+	vec3_t min = mesh->bbox_min;
+	vec3_t extent = quantization_extent(mesh->bbox_min, mesh->bbox_max);
+
+	mesh->packed_vertices = (ptex_packed_vertex_t*)malloc(sizeof(ptex_packed_vertex_t) * (mesh->num_vertices > 0 ? mesh->num_vertices : 1));
+
+	int num_jobs = (mesh->num_vertices + MESH_VERTICES_PER_JOB - 1) / MESH_VERTICES_PER_JOB;
+	jobs::parallel_for(num_jobs, [&](int job) {
+		int begin = job * MESH_VERTICES_PER_JOB;
+		int end = begin + MESH_VERTICES_PER_JOB < mesh->num_vertices ? begin + MESH_VERTICES_PER_JOB : mesh->num_vertices;
+		for (int i = begin; i < end; i++)
 		{
-			printf("Could not load file '%s'.\n", filename);
+			const ptex_vertex_t* vertex = &mesh->vertices[i];
+			ptex_packed_vertex_t* packed = &mesh->packed_vertices[i];
+
+			packed->position[0] = quantize_unorm16(vertex->position.x, min.x, extent.x);
+			packed->position[1] = quantize_unorm16(vertex->position.y, min.y, extent.y);
+			packed->position[2] = quantize_unorm16(vertex->position.z, min.z, extent.z);
+			encode_octahedral(vertex->normal, packed->normal);
+
+			// The corner uvs are all 0 or 1, so they map straight back to the corner.
+			uint32_t corner = vertex->uv.y == 0 ? (vertex->uv.x == 0 ? 0 : 1) : (vertex->uv.x == 0 ? 3 : 2);
+			assert(vertex->face_id >= 0 && vertex->face_id < (1 << 30));
+			packed->corner_face = (uint32_t)vertex->face_id << 2 | corner;
 		}
-	}
+	});
+}
 
-	vec3_t* positions = (vec3_t*)attrib.vertices;
-	vec3_t* normals = (vec3_t*)attrib.normals;
+mat4_t ptex_mesh_position_decode(const ptex_mesh_t* mesh)
+{
+	vec3_t extent = quantization_extent(mesh->bbox_min, mesh->bbox_max);
 
-	std::vector<ptex_vertex_t> vertices;
+	// Transposed like the model matrices.
+	mat4_t scale = mat4_transpose(mat4_scale(extent.x, extent.y, extent.z));
+	mat4_t translate = mat4_transpose(mat4_translate(mesh->bbox_min.x, mesh->bbox_min.y, mesh->bbox_min.z));
+	return mat4_mul_mat4(scale, translate);
+}
 
-	vec3_t bbox_min = vec3_new(FLT_MAX, FLT_MAX, FLT_MAX);
-	vec3_t bbox_max = vec3_new(FLT_MIN, FLT_MIN, FLT_MIN);
+ptex_mesh_t* load_ptex_mesh(const char* filename) {
 
-	size_t vertex_id = 0;
-	for (size_t face_id = 0; face_id < attrib.num_face_num_verts; face_id++)
+	obj_data_t obj;
+	if (parse_obj(filename, &obj) == false)
 	{
-		int num_verts = attrib.face_num_verts[face_id];
-		//printf("verts for face %zu: %d\n", face_id, num_verts);
+		printf("Could not load file '%s'.\n", filename);
+		return alloc_ptex_mesh(0);
+	}
 
+	// Every corner of a face is its own vertex, they can't be shared with the neighbors
+	// since the face id and the uv are per face. Quads are drawn as two triangles over their 4 vertices.
+	int* first_vertex = alloc_array(int, obj.num_faces);
+	int* first_index = alloc_array(int, obj.num_faces);
+	int num_vertices = 0;
+	int num_indices = 0;
+	for (int face_id = 0; face_id < obj.num_faces; face_id++)
+	{
+		int num_verts = obj.face_num_verts[face_id];
 		assert((num_verts == 4 || num_verts == 3) && "We only handle quad meshes for now.");
-		
-		for (size_t i = 0; i < num_verts; i++)
-		{
-			auto face = attrib.faces[vertex_id + i];
 
-			vec3_t pos = positions[face.v_idx];
+		first_vertex[face_id] = num_vertices;
+		first_index[face_id] = num_indices;
+		num_vertices += num_verts;
+		num_indices += num_verts == 3 ? 3 : 6;
+	}
+
+	ptex_mesh_t* mesh = alloc_ptex_mesh(num_vertices);
+	mesh->num_indices = num_indices;
+	mesh->indices = (uint32_t*)malloc(sizeof(uint32_t) * (num_indices > 0 ? num_indices : 1));
+
+	bbox_t bbox = build_faces_parallel(obj.num_faces, [&](int face_id, bbox_t* bbox) {
+		int num_verts = obj.face_num_verts[face_id];
+		const obj_index_t* face = obj.indices + obj.face_offsets[face_id];
+		ptex_vertex_t* out = mesh->vertices + first_vertex[face_id];
+		uint32_t* out_indices = mesh->indices + first_index[face_id];
 
-			bbox_max = vec3_max(bbox_max, pos);
-			bbox_min = vec3_min(bbox_min, pos);
+		for (int i = 0; i < num_verts; i++)
+		{
+			vec3_t pos = obj.positions[face[i].v];
+
+			bbox->max = vec3_max(bbox->max, pos);
+			bbox->min = vec3_min(bbox->min, pos);
 		}
 
 		// FIXME: More proper handling!
 		if (num_verts == 3)
 		{
-			for (size_t i = 0; i < 3; i++)
+			const vec2_t uvs[3] = { { 0, 0 }, { 1, 0 }, { 0, 1 } };
+			for (int i = 0; i < 3; i++)
 			{
-				auto face = attrib.faces[vertex_id + i];
-
-				ptex_vertex_t vertex;
-
-				vertex.position = positions[face.v_idx];
-				if (face.vn_idx != 0x80000000)
-					vertex.normal = normals[face.vn_idx];
-				else vertex.normal = { 0, 0, 0 };
-				vertex.face_id = face_id;
-				switch (i)
-				{
-				case 0: vertex.uv = { 0, 0 }; break;
-				case 1: vertex.uv = { 1, 0 }; break;
-				case 2: vertex.uv = { 0, 1 }; break;
-				case 3: vertex.uv = { 0, 1 }; assert(false); break;
-				}
-
-				vertices.push_back(vertex);
+				out[i] = make_ptex_vertex(&obj, face[i], face_id);
+				out[i].uv = uvs[i];
+				out_indices[i] = first_vertex[face_id] + i;
 			}
-
-			vertex_id += num_verts;
-
-			continue;
+			return;
 		}
 
-		const int index[6] = { 0, 1, 2, 2, 3, 0 };
-
-		for (size_t i = 0; i < 6; i++)
+		const vec2_t uvs[4] = { { 0, 0 }, { 1, 0 }, { 1, 1 }, { 0, 1 } };
+		for (int i = 0; i < 4; i++)
 		{
-			auto face = attrib.faces[vertex_id + index[i]];
-
-			ptex_vertex_t vertex;
-
-			vertex.position = positions[face.v_idx];
-			if (face.vn_idx != 0x80000000)
-				vertex.normal = normals[face.vn_idx];
-			else vertex.normal = { 0, 0, 0 };
-			vertex.face_id = face_id;
-			switch (index[i])
-			{
-			case 0: vertex.uv = { 0, 0 }; break;
-			case 1: vertex.uv = { 1, 0 }; break;
-			case 2: vertex.uv = { 1, 1 }; break;
-			case 3: vertex.uv = { 0, 1 }; break;
-			}
-
-			vertices.push_back(vertex);
+			out[i] = make_ptex_vertex(&obj, face[i], face_id);
+			out[i].uv = uvs[i];
 		}
 
-		vertex_id += num_verts;
-	}
+		const int index[6] = { 0, 1, 2, 2, 3, 0 };
+		for (int i = 0; i < 6; i++)
+			out_indices[i] = first_vertex[face_id] + index[i];
+	});
 
-	ptex_mesh_t* mesh = (ptex_mesh_t*)malloc(sizeof(ptex_mesh_t));
-	mesh->num_vertices = vertices.size();
-	mesh->vertices = (ptex_vertex_t*)malloc(sizeof(ptex_vertex_t) * mesh->num_vertices);
-	memcpy(mesh->vertices, vertices.data(), sizeof(ptex_vertex_t) * mesh->num_vertices);
+	mesh->num_faces = obj.num_faces;
+	build_mesh_adjacency(filename, &obj, mesh);
+	build_mesh_clusters(mesh, first_index);
+	optimize_vertex_cache(mesh);
 
-	mesh->center = vec3_div(vec3_add(bbox_min, bbox_max), 2);
+	mesh->bbox_min = bbox.min;
+	mesh->bbox_max = bbox.max;
+	mesh->center = vec3_div(vec3_add(bbox.min, bbox.max), 2);
 
-	tinyobj_attrib_free(&attrib);
-	tinyobj_materials_free(materials, num_materials);
-	tinyobj_shapes_free(shapes, num_shapes);
+	pack_ptex_vertices(mesh);
+
+	free(first_vertex);
+	free(first_index);
+	free_obj(&obj);
 
 	return mesh;
 }
 
 ptex_mesh_t* load_mesh(const char* filename) {
-	tinyobj_attrib_t attrib;
-	tinyobj_attrib_init(&attrib);
-	tinyobj_shape_t* shapes;
-	size_t num_shapes;
-	tinyobj_material_t* materials;
-	size_t num_materials;
-
+	obj_data_t obj;
+	if (parse_obj(filename, &obj) == false)
 	{
-		file_reader_context_t file_reader_context;
-		//file_reader_context.file = fopen(filename, "rb");
-		//assert(file_reader_context.file != NULL);
-
-		int result = tinyobj_parse_obj(&attrib, &shapes, &num_shapes, &materials, &num_materials, filename, file_reader, &file_reader_context, 0);
-
-		if (result != TINYOBJ_SUCCESS)
-		{
-			printf("Could not load file '%s'.\n", filename);
-		}
+		printf("Could not load file '%s'.\n", filename);
+		return alloc_ptex_mesh(0);
 	}
 
-	vec3_t* positions = (vec3_t*)attrib.vertices;
-	vec3_t* normals = (vec3_t*)attrib.normals;
-	vec2_t* texcoords = (vec2_t*)attrib.texcoords;
-
-	std::vector<ptex_vertex_t> vertices;
-
-	vec3_t bbox_min = vec3_new(FLT_MAX, FLT_MAX, FLT_MAX);
-	vec3_t bbox_max = vec3_new(FLT_MIN, FLT_MIN, FLT_MIN);
-
-	size_t vertex_id = 0;
-	for (size_t face_id = 0; face_id < attrib.num_face_num_verts; face_id++)
-	{
-		int num_verts = attrib.face_num_verts[face_id];
-		//printf("verts for face %zu: %d\n", face_id, num_verts);
+	ptex_mesh_t* mesh = alloc_ptex_mesh(obj.num_faces * 4);
 
+	bbox_t bbox = build_faces_parallel(obj.num_faces, [&](int face_id, bbox_t* bbox) {
+		int num_verts = obj.face_num_verts[face_id];
 		assert(num_verts == 4 && "We only handle quad meshes for now.");
 
-		if (face_id == 703)
-		{
-			printf("test\n");
-		}
-
-		for (size_t i = 0; i < num_verts; i++)
+		const obj_index_t* face = obj.indices + obj.face_offsets[face_id];
+		for (int i = 0; i < 4; i++)
 		{
-			auto face = attrib.faces[vertex_id + i];
+			ptex_vertex_t vertex = make_ptex_vertex(&obj, face[i], face_id);
+			vertex.uv = obj.texcoords[face[i].vt];
 
-			vec3_t pos = positions[face.v_idx];
+			bbox->max = vec3_max(bbox->max, vertex.position);
+			bbox->min = vec3_min(bbox->min, vertex.position);
 
-			bbox_max = vec3_max(bbox_max, pos);
-			bbox_min = vec3_min(bbox_min, pos);
-
-			ptex_vertex_t vertex;
+			mesh->vertices[face_id * 4 + i] = vertex;
+		}
+	});
 
-			vertex.position = positions[face.v_idx];
-			if (face.vn_idx != 0x80000000)
-				vertex.normal = normals[face.vn_idx];
-			else vertex.normal = { 0, 0, 0 };
-			vertex.face_id = face_id;
-			vertex.uv = texcoords[face.vt_idx];
+	mesh->num_faces = obj.num_faces;
+	build_mesh_adjacency(filename, &obj, mesh);
 
-			vertices.push_back(vertex);
-		}
+	mesh->bbox_min = bbox.min;
+	mesh->bbox_max = bbox.max;
+	mesh->center = vec3_div(vec3_add(bbox.min, bbox.max), 2);
 
-		vertex_id += num_verts;
-	}
+	free_obj(&obj);
 
-	ptex_mesh_t* mesh = (ptex_mesh_t*)malloc(sizeof(ptex_mesh_t));
-	mesh->num_vertices = vertices.size();
-	mesh->vertices = (ptex_vertex_t*)malloc(sizeof(ptex_vertex_t) * mesh->num_vertices);
-	memcpy(mesh->vertices, vertices.data(), sizeof(ptex_vertex_t) * mesh->num_vertices);
+	return mesh;
+}
 
-	mesh->center = vec3_div(vec3_add(bbox_min, bbox_max), 2);
+void print_ptex_mesh_stats(const char* name, const ptex_mesh_t* mesh)
+{
+	if (mesh->indices == NULL)
+		return;
 
-	tinyobj_attrib_free(&attrib);
-	tinyobj_materials_free(materials, num_materials);
-	tinyobj_shapes_free(shapes, num_shapes);
+	uint64_t unindexed_size = (uint64_t)mesh->num_indices * sizeof(ptex_vertex_t);
+	uint64_t indexed_size = (uint64_t)mesh->num_vertices * sizeof(ptex_packed_vertex_t) + (uint64_t)mesh->num_indices * sizeof(uint32_t);
 
-	return mesh;
+	// The corners two triangles of a quad share are next to each other in the index buffer,
+	// so they are in the post transform cache and every vertex is shaded once.
+	printf("%s has %d vertices and %d indices, %.2fMB instead of %.2fMB unindexed with float vertices (%.0f%% less), %d vertex shader invocations instead of %d\n",
+		name, mesh->num_vertices, mesh->num_indices, indexed_size / (1024.0 * 1024.0), unindexed_size / (1024.0 * 1024.0),
+		unindexed_size > 0 ? 100.0 * (1.0 - (double)indexed_size / unindexed_size) : 0.0, mesh->num_vertices, mesh->num_indices);
 }
@@ -1,6 +1,9 @@
+#ifndef MESH_LOADING_H
+#define MESH_LOADING_H
 
 #include <stdint.h>
 #include "maths.hh"
+#include "platform.hh"
 
 typedef struct {
 	vec3_t position;
@@ -9,12 +12,68 @@ typedef struct {
 	int32_t face_id;
 } ptex_vertex_t;
 
+// What ptex.vert reads, 12 bytes instead of the 36 of ptex_vertex_t.
+// The position is unorm16 within the mesh bounds, see ptex_mesh_position_decode.
+// The normal is octahedral snorm8 and fills the space that aligns corner_face.
+// The corner is in the low 2 bits of corner_face, 0 to 3 going (0, 0), (1, 0), (1, 1), (0, 1)
+// in uv, and the face id is in the 30 bits above.
+typedef struct {
+	uint16_t position[3];
+	int8_t normal[2];
+	uint32_t corner_face;
+} ptex_packed_vertex_t;
+
+// A patch of up to MESH_CLUSTER_MAX_FACES neighboring faces, drawn as one range of the index buffer.
+// See mesh_clusters.hh.
+typedef struct {
+	int first_index, num_indices;
+	int num_vertices;
+
+	vec3_t center;
+	float radius;
+
+	// Every face normal is within the cone around axis, the cluster faces away from eyes
+	// where dot(center - eye, axis) >= cone_cutoff * length(center - eye) + radius.
+	// cone_cutoff is above 1 when the faces spread too wide for that.
+	vec3_t cone_axis;
+	float cone_cutoff;
+} mesh_cluster_t;
+
 typedef struct {
 	int num_vertices;
 	ptex_vertex_t* vertices;
+	// The same vertices packed for the GPU, NULL from load_mesh.
+	ptex_packed_vertex_t* packed_vertices;
+	// Triangle list over vertices, NULL from load_mesh where every 4 vertices are a quad.
+	int num_indices;
+	uint32_t* indices;
+
+	// Neighbor face and the edge of it across each edge of a face, like Ptex::FaceInfo's
+	// adjfaces and adjedges, see mesh_adjacency.hh.
+	int num_faces;
+	int32_t* adj_faces;
+	int8_t* adj_edges;
+
+	// The index buffer is sorted by cluster. NULL from load_mesh.
+	int num_clusters;
+	mesh_cluster_t* clusters;
+
+	vec3_t bbox_min, bbox_max;
 	vec3_t center;
+
+	// Set when the arrays point into a mapped mesh cache (see mesh_cache.hh) instead of being allocated.
+	mapped_file_t* mapping;
 } ptex_mesh_t;
 
 ptex_mesh_t* load_ptex_mesh(const char* filename);
 
+// Matrix taking the unorm positions of packed_vertices to model space, to go before the model matrix.
+mat4_t ptex_mesh_position_decode(const ptex_mesh_t* mesh);
+
 ptex_mesh_t* load_mesh(const char* filename);
+
+// Prints the vertex memory and vertex shader invocations of the indexed, packed mesh against drawing
+// every triangle corner as its own float vertex.
+void print_ptex_mesh_stats(const char* name, const ptex_mesh_t* mesh);
+
+#endif // !MESH_LOADING_H
@@ -0,0 +1,267 @@
+#include "mesh_vertex_cache.hh"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+// Reused between the ranges so every range only touches its own vertices.
+typedef struct {
+	// Global vertex to its number within the range, -1 outside it.
+	std::vector<int> local_id;
+	std::vector<uint32_t> vertices;
+
+	// The triangles using each vertex, offsets into triangles.
+	std::vector<int> offsets;
+	std::vector<int> triangles;
+	// Triangles using the vertex that haven't been emitted yet.
+	std::vector<int> live;
+	std::vector<int> stamps;
+	std::vector<bool> emitted;
+
+	std::vector<int> dead_ends;
+	std::vector<int> candidates;
+	std::vector<uint32_t> output;
+} tipsify_scratch_t;
+
+void analyze_vertex_cache(const ptex_mesh_t* mesh, vertex_cache_stats_t* stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	if (mesh->num_indices == 0)
+		return;
+
+	const int stride = (int)sizeof(ptex_packed_vertex_t);
+	int num_lines = (int)(((uint64_t)mesh->num_vertices * stride + VERTEX_FETCH_LINE_SIZE - 1) / VERTEX_FETCH_LINE_SIZE);
+
+	// FIFO caches as timestamps, an entry is still in the cache when less than the cache size
+	// entries were added after it.
+	std::vector<int> vertex_stamps(mesh->num_vertices, 0);
+	std::vector<int> line_stamps(num_lines, 0);
+	std::vector<bool> used(mesh->num_vertices, false);
+	int vertex_time = VERTEX_CACHE_SIZE + 1;
+	int line_time = VERTEX_FETCH_CACHE_LINES + 1;
+
+	int num_transformed = 0;
+	int num_used = 0;
+	uint64_t fetched_bytes = 0;
+	for (int i = 0; i < mesh->num_indices; i++)
+	{
+		uint32_t vertex = mesh->indices[i];
+		if (used[vertex] == false)
+		{
+			used[vertex] = true;
+			num_used++;
+		}
+
+		if (vertex_time - vertex_stamps[vertex] <= VERTEX_CACHE_SIZE)
+			continue;
+
+		vertex_stamps[vertex] = vertex_time++;
+		num_transformed++;
+
+		// Only vertices that miss the post transform cache are fetched.
+		int first_line = (int)((uint64_t)vertex * stride / VERTEX_FETCH_LINE_SIZE);
+		int last_line = (int)(((uint64_t)vertex * stride + stride - 1) / VERTEX_FETCH_LINE_SIZE);
+		for (int line = first_line; line <= last_line; line++)
+		{
+			if (line_time - line_stamps[line] <= VERTEX_FETCH_CACHE_LINES)
+				continue;
+
+			line_stamps[line] = line_time++;
+			fetched_bytes += VERTEX_FETCH_LINE_SIZE;
+		}
+	}
+
+	stats->acmr = num_transformed / (float)(mesh->num_indices / 3);
+	stats->atvr = num_transformed / (float)num_used;
+	stats->overfetch = fetched_bytes / (float)((uint64_t)num_used * stride);
+}
+
+static int tipsify_next_vertex(tipsify_scratch_t* s, int time, int* cursor)
+{
+	// The candidate that will still be in the cache after its remaining triangles are emitted
+	// and that has been in it the longest.
+	int best = -1, best_priority = -1;
+	for (size_t i = 0; i < s->candidates.size(); i++)
+	{
+		int vertex = s->candidates[i];
+		if (s->live[vertex] == 0)
+			continue;
+
+		int priority = 0;
+		if (time - s->stamps[vertex] + 2 * s->live[vertex] <= VERTEX_CACHE_SIZE)
+			priority = time - s->stamps[vertex];
+
+		if (priority > best_priority)
+		{
+			best_priority = priority;
+			best = vertex;
+		}
+	}
+
+	if (best != -1)
+		return best;
+
+	// Dead end, go back through the recently used vertices and then to the next one in input order.
+	while (s->dead_ends.empty() == false)
+	{
+		int vertex = s->dead_ends.back();
+		s->dead_ends.pop_back();
+		if (s->live[vertex] > 0)
+			return vertex;
+	}
+
+	for (; *cursor < (int)s->vertices.size(); (*cursor)++)
+	{
+		if (s->live[*cursor] > 0)
+			return *cursor;
+	}
+
+	return -1;
+}
+
+static void tipsify_range(uint32_t* indices, int num_indices, tipsify_scratch_t* s)
+{
+	int num_triangles = num_indices / 3;
+	if (num_triangles == 0)
+		return;
+
+	s->vertices.clear();
+	for (int i = 0; i < num_triangles * 3; i++)
+	{
+		uint32_t vertex = indices[i];
+		if (s->local_id[vertex] == -1)
+		{
+			s->local_id[vertex] = (int)s->vertices.size();
+			s->vertices.push_back(vertex);
+		}
+	}
+
+	int num_vertices = (int)s->vertices.size();
+
+	s->offsets.assign(num_vertices + 1, 0);
+	for (int i = 0; i < num_triangles * 3; i++)
+		s->offsets[s->local_id[indices[i]] + 1]++;
+
+	s->live.resize(num_vertices);
+	for (int v = 0; v < num_vertices; v++)
+	{
+		s->live[v] = s->offsets[v + 1];
+		s->offsets[v + 1] += s->offsets[v];
+	}
+
+	s->triangles.resize(num_triangles * 3);
+	for (int i = 0; i < num_triangles * 3; i++)
+	{
+		int vertex = s->local_id[indices[i]];
+		s->triangles[s->offsets[vertex + 1] - s->live[vertex]] = i / 3;
+		s->live[vertex]--;
+	}
+	for (int v = 0; v < num_vertices; v++)
+		s->live[v] = s->offsets[v + 1] - s->offsets[v];
+
+	s->stamps.assign(num_vertices, 0);
+	s->emitted.assign(num_triangles, false);
+	s->dead_ends.clear();
+	s->output.clear();
+
+	int time = VERTEX_CACHE_SIZE + 1;
+	int cursor = 0;
+	int fan = 0;
+	while (fan != -1)
+	{
+		// Emit every triangle around the fanning vertex, their vertices are the next candidates.
+		s->candidates.clear();
+		for (int i = s->offsets[fan]; i < s->offsets[fan + 1]; i++)
+		{
+			int triangle = s->triangles[i];
+			if (s->emitted[triangle])
+				continue;
+
+			s->emitted[triangle] = true;
+			for (int corner = 0; corner < 3; corner++)
+			{
+				uint32_t vertex = indices[triangle * 3 + corner];
+				int local = s->local_id[vertex];
+
+				s->output.push_back(vertex);
+				s->dead_ends.push_back(local);
+				s->candidates.push_back(local);
+				s->live[local]--;
+
+				if (time - s->stamps[local] > VERTEX_CACHE_SIZE)
+					s->stamps[local] = time++;
+			}
+		}
+
+		fan = tipsify_next_vertex(s, time, &cursor);
+	}
+
+	assert(s->output.size() == (size_t)num_triangles * 3);
+	memcpy(indices, s->output.data(), s->output.size() * sizeof(uint32_t));
+
+	for (int v = 0; v < num_vertices; v++)
+		s->local_id[s->vertices[v]] = -1;
+}
+
+// Numbers the vertices in the order the index buffer first uses them, the unused ones go last.
+static void optimize_vertex_fetch(ptex_mesh_t* mesh)
+{
+	std::vector<int> remap(mesh->num_vertices, -1);
+	int next = 0;
+	for (int i = 0; i < mesh->num_indices; i++)
+	{
+		uint32_t vertex = mesh->indices[i];
+		if (remap[vertex] == -1)
+			remap[vertex] = next++;
+		mesh->indices[i] = remap[vertex];
+	}
+
+	for (int v = 0; v < mesh->num_vertices; v++)
+	{
+		if (remap[v] == -1)
+			remap[v] = next++;
+	}
+
+	ptex_vertex_t* vertices = (ptex_vertex_t*)malloc(sizeof(ptex_vertex_t) * (mesh->num_vertices > 0 ? mesh->num_vertices : 1));
+	for (int v = 0; v < mesh->num_vertices; v++)
+		vertices[remap[v]] = mesh->vertices[v];
+
+	free(mesh->vertices);
+	mesh->vertices = vertices;
+}
+
+void optimize_vertex_cache(ptex_mesh_t* mesh)
+{
+	if (mesh->indices == NULL || mesh->num_indices == 0)
+		return;
+
+	assert(mesh->packed_vertices == NULL && "The packed vertices would not be reordered.");
+
+	vertex_cache_stats_t before;
+	analyze_vertex_cache(mesh, &before);
+
+	tipsify_scratch_t scratch;
+	scratch.local_id.assign(mesh->num_vertices, -1);
+
+	// The clusters are drawn as ranges of the index buffer, triangles can't move between them.
+	if (mesh->num_clusters > 0)
+	{
+		for (int i = 0; i < mesh->num_clusters; i++)
+		{
+			const mesh_cluster_t* cluster = &mesh->clusters[i];
+			tipsify_range(mesh->indices + cluster->first_index, cluster->num_indices, &scratch);
+		}
+	}
+	else tipsify_range(mesh->indices, mesh->num_indices, &scratch);
+
+	optimize_vertex_fetch(mesh);
+
+	vertex_cache_stats_t after;
+	analyze_vertex_cache(mesh, &after);
+
+	printf("Reordered for a %d entry vertex cache, ACMR %.3f -> %.3f, ATVR %.3f -> %.3f, vertex fetch overfetch %.2f -> %.2f.\n",
+		VERTEX_CACHE_SIZE, before.acmr, after.acmr, before.atvr, after.atvr, before.overfetch, after.overfetch);
+}
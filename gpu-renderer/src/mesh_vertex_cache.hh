@@ -0,0 +1,29 @@
+#ifndef MESH_VERTEX_CACHE_H
+#define MESH_VERTEX_CACHE_H
+
+#include "mesh_loading.hh"
+
+// Reorders the index buffer for the post transform vertex cache and the vertex buffer for fetching.
+// The triangles of each cluster are reordered with Tipsify (Sander et al. 2007) within the cluster's
+// range, so the cluster ranges stay the same. The vertices are then renumbered in the order the
+// index buffer first uses them. The face id and corner are in the vertex so they move with it.
+
+// FIFO entries the post transform cache is simulated and optimized with.
+#define VERTEX_CACHE_SIZE 16
+// Vertex fetch is simulated as a FIFO of this many lines of VERTEX_FETCH_LINE_SIZE bytes.
+#define VERTEX_FETCH_CACHE_LINES 64
+#define VERTEX_FETCH_LINE_SIZE 64
+
+typedef struct {
+	// Vertex shader invocations per triangle and per vertex.
+	float acmr, atvr;
+	// Bytes of packed vertices fetched over the bytes of the vertices that are used.
+	float overfetch;
+} vertex_cache_stats_t;
+
+void analyze_vertex_cache(const ptex_mesh_t* mesh, vertex_cache_stats_t* stats);
+
+// Has to go before the vertices are packed, only mesh->vertices is reordered.
+void optimize_vertex_cache(ptex_mesh_t* mesh);
+
+#endif // !MESH_VERTEX_CACHE_H
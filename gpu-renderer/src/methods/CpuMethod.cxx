@@ -108,7 +108,7 @@ namespace Methods {
 		}
 	}
 
-	void CpuMethod::render(GLuint vao, int vertex_count, Ptex::PtexTexture* texture, Ptex::PtexFilter* filter, mat4_t mvp, vec3_t bg_color) {
+	void CpuMethod::render(GLuint vao, const index_ranges_t* ranges, Ptex::PtexTexture* texture, Ptex::PtexFilter* filter, mat4_t mvp, vec3_t bg_color) {
 
 		glBindFramebuffer(GL_FRAMEBUFFER, to_cpu_framebuffer.framebuffer);
 
@@ -133,7 +133,7 @@ namespace Methods {
 
 		glUseProgram(to_cpu_program);
 
-		glDrawArrays(GL_TRIANGLES, 0, vertex_count);
+		draw_index_ranges(ranges);
 
 		// Download data to cpu
 		// FIXME: Do not re-allocate buffers every frame!
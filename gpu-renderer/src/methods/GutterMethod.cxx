@@ -0,0 +1,156 @@
+
+#include "Methods.hh"
+
+namespace Methods {
+	GutterMethod gutter;
+
+	void GutterMethod::init(int width, int height, GLenum mag_filter, GLenum min_filter, int max_anisotropy) {
+		// setup color output buffer
+		{
+			color_attachment_desc color_desc = {
+				"Attachment: gutter.color (RGB8)",
+				GL_RGB8,
+				GL_RGB,
+				GL_FLOAT,
+				GL_REPEAT, GL_REPEAT,
+				GL_LINEAR, GL_LINEAR
+			};
+
+			color_attachment_desc* color_descriptions = new color_attachment_desc[1];
+			color_descriptions[0] = color_desc;
+
+			depth_attachment_desc depth_desc = {
+				"Attachment: gutter.depth (DEPTH32F)",
+				GL_DEPTH_COMPONENT32F,
+				GL_REPEAT, GL_REPEAT,
+				GL_LINEAR, GL_LINEAR
+			};
+
+			depth_attachment_desc* depth_descriptions = new depth_attachment_desc[1];
+			depth_descriptions[0] = depth_desc;
+
+			framebuffer_desc = {
+				"FBO: gutter",
+				1,
+				color_descriptions,
+				depth_descriptions,
+				1 // number of samples
+			};
+
+			framebuffer = create_framebuffer(framebuffer_desc, width, height);
+		}
+
+		// setup resolve output buffer only used for screenshots
+		{
+			color_attachment_desc color_desc = {
+				"Attachment: gutter_resolve.color (RGB8)",
+				GL_RGB8,
+				GL_RGB,
+				GL_FLOAT,
+				GL_REPEAT, GL_REPEAT,
+				GL_LINEAR, GL_LINEAR
+			};
+
+			color_attachment_desc* color_descriptions = new color_attachment_desc[1];
+			color_descriptions[0] = color_desc;
+
+			depth_attachment_desc depth_desc = {
+				"Attachment: gutter_resolve.depth (DEPTH32F)",
+				GL_DEPTH_COMPONENT32F,
+				GL_REPEAT, GL_REPEAT,
+				GL_LINEAR, GL_LINEAR
+			};
+
+			depth_attachment_desc* depth_descriptions = new depth_attachment_desc[1];
+			depth_descriptions[0] = depth_desc;
+
+			resolve_framebuffer_desc = {
+				"FBO: gutter_resolve",
+				1,
+				color_descriptions,
+				depth_descriptions,
+				1 // number of samples
+			};
+
+			resolve_framebuffer = create_framebuffer(resolve_framebuffer_desc, width, height);
+		}
+
+		ptex_program = compile_shader("program: gutter_ptex", "shaders/ptex.vert", "shaders/ptex_gutter.frag");
+
+		// The border is in the texture, so clamping to the edge of the slice never samples another face.
+		sampler_desc clamp_desc = {
+			GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE,
+			mag_filter, min_filter,
+			max_anisotropy,
+			{ 0, 0, 0, 0 }
+		};
+
+		clamp_sampler = create_sampler("sampler: gutter.clamp", clamp_desc);
+
+		uniform_1i(ptex_program, "facePlaceholders", placeholder_texture_unit);
+		uniform_1i(ptex_program, "faceData", face_data_texture_unit);
+
+		{
+			char name[32];
+			for (int i = 0; i < 32; i++)
+			{
+				sprintf(name, "aTex[%d]", i);
+				uniform_1i(ptex_program, name, i);
+			}
+		}
+	}
+
+	void GutterMethod::render(GLuint vao, const index_ranges_t* ranges, gl_ptex_data ptex_data, mat4_t mvp, vec3_t bg_color)
+	{
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer.framebuffer);
+
+		glClearColor(bg_color.x, bg_color.y, bg_color.z, 1.0f);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+
+		// Nothing to draw until the gutter textures have been packed.
+		if (ptex_data.gutter_array_textures == NULL)
+		{
+			glBindFramebuffer(GL_FRAMEBUFFER, 0);
+			return;
+		}
+
+		glBindVertexArray(vao);
+
+		uniform_mat4(ptex_program, "mvp", &mvp);
+		uniform_1i(ptex_program, "gutterWidth", ptex_data.gutter_width);
+
+		glUseProgram(ptex_program);
+
+		// The gutter arrays have their own face table, only the texture and slice of each face are used.
+		bind_face_data(ptex_data.gutter_face_data_texture);
+
+		assert(ptex_data.gutter_array_textures->size <= 32);
+		for (int i = 0; i < ptex_data.gutter_array_textures->size; i++)
+		{
+			glActiveTexture(GL_TEXTURE0 + i);
+			glBindTexture(GL_TEXTURE_2D_ARRAY, (*ptex_data.gutter_array_textures).arr[i].texture);
+			glBindSampler(i, clamp_sampler.sampler);
+		}
+
+		draw_index_ranges(ranges);
+
+		glUseProgram(0);
+
+		for (int i = 0; i < ptex_data.gutter_array_textures->size; i++)
+		{
+			glActiveTexture(GL_TEXTURE0 + i);
+			glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+			glBindSampler(i, 0);
+		}
+
+		unbind_face_data();
+
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+
+	void GutterMethod::resize_buffers(int width, int height)
+	{
+		recreate_framebuffer(&framebuffer, framebuffer_desc, width, height);
+		recreate_framebuffer(&resolve_framebuffer, resolve_framebuffer_desc, width, height);
+	}
+}
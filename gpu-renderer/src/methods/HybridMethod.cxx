@@ -76,6 +76,8 @@ namespace Methods {
 
 		ptex_program = compile_shader("program: hybrid", "shaders/ptex.vert", "shaders/ptex_hybrid.frag");
 
+		uniform_1i(ptex_program, "facePlaceholders", placeholder_texture_unit);
+
 		sampler_desc border_desc = {
 			GL_CLAMP_TO_BORDER, GL_CLAMP_TO_BORDER,
 			mag_filter, min_filter,
@@ -93,8 +95,7 @@ namespace Methods {
 		border_sampler = create_sampler("sampler: hybrid.border", border_desc);
 		clamp_sampler = create_sampler("sampler: hybrid.border", clamp_desc);
 
-		int blockIndex = glGetUniformBlockIndex(ptex_program, "FaceDataUniform");
-		glUniformBlockBinding(ptex_program, blockIndex, 0);
+		uniform_1i(ptex_program, "faceData", face_data_texture_unit);
 
 		{
 			char name[32];
@@ -109,7 +110,7 @@ namespace Methods {
 		}
 	}
 
-	void HybridMethod::render(GLuint vao, int vertex_count, gl_ptex_data ptex_data, mat4_t mvp, vec3_t bg_color)
+	void HybridMethod::render(GLuint vao, const index_ranges_t* ranges, gl_ptex_data ptex_data, mat4_t mvp, vec3_t bg_color)
 	{
 		glBindFramebuffer(GL_FRAMEBUFFER, ms_framebuffer.framebuffer);
 
@@ -120,8 +121,11 @@ namespace Methods {
 
 		glUseProgram(ptex_program);
 
+		bind_face_placeholders(ptex_program, ptex_data);
+		set_alpha_coverage(ptex_program, ptex_data);
+
 		// Bind adjacency data
-		glBindBufferBase(GL_UNIFORM_BUFFER, 0, ptex_data.face_data_buffer);
+		bind_face_data(ptex_data.face_data_texture);
 
 		glClearColor(bg_color.x, bg_color.y, bg_color.z, 1.0f);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
@@ -138,7 +142,7 @@ namespace Methods {
 			glBindSampler(i + 24, clamp_sampler.sampler);
 		}
 
-		glDrawArrays(GL_TRIANGLES, 0, vertex_count);
+		draw_index_ranges(ranges);
 
 		for (int i = 0; i < ptex_data.array_textures->size; i++)
 		{
@@ -151,6 +155,9 @@ namespace Methods {
 			glBindSampler(i + 24, 0);
 		}
 
+		unbind_face_placeholders();
+		unbind_face_data();
+
 		glBindFramebuffer(GL_FRAMEBUFFER, 0);
 	}
 
@@ -79,6 +79,9 @@ namespace Methods {
 
         ptex_program = compile_shader("program: intel_ptex", "shaders/ptex.vert", "shaders/ptex_intel.frag");
 
+        uniform_1i(ptex_program, "facePlaceholders", placeholder_texture_unit);
+        uniform_1i(ptex_program, "faceData", face_data_texture_unit);
+
         {
             char name[32];
             for (int i = 0; i < 24; i++)
@@ -112,7 +115,7 @@ namespace Methods {
         clamp_sampler = create_sampler("sampler: intel.clamp", clamp_desc);
 	}
 
-    void IntelMethod::render(GLuint vao, int vertex_count, gl_ptex_data ptex_data, mat4_t mvp, vec3_t bg_color) {
+    void IntelMethod::render(GLuint vao, const index_ranges_t* ranges, gl_ptex_data ptex_data, mat4_t mvp, vec3_t bg_color) {
         glBindFramebuffer(GL_FRAMEBUFFER, ms_framebuffer.framebuffer);
 
         glBindVertexArray(vao);
@@ -121,7 +124,10 @@ namespace Methods {
 
         glUseProgram(ptex_program);
 
-        glBindBufferBase(GL_UNIFORM_BUFFER, 0, ptex_data.face_data_buffer);
+        bind_face_placeholders(ptex_program, ptex_data);
+        set_alpha_coverage(ptex_program, ptex_data);
+
+        bind_face_data(ptex_data.face_data_texture);
 
         glClearColor(bg_color.x, bg_color.y, bg_color.z, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
@@ -138,7 +144,7 @@ namespace Methods {
             glBindSampler(i + 24, clamp_sampler.sampler);
         }
 
-        glDrawArrays(GL_TRIANGLES, 0, vertex_count);
+        draw_index_ranges(ranges);
 
         for (size_t i = 0; i < 48; i++)
         {
@@ -147,6 +153,9 @@ namespace Methods {
             glBindSampler(i, 0);
         }
 
+        unbind_face_placeholders();
+        unbind_face_data();
+
         glBindFramebuffer(GL_FRAMEBUFFER, 0);
     }
 
@@ -1,21 +1,76 @@
 
 #include "Methods.hh"
 
+#include <assert.h>
+#include <stdio.h>
+
 namespace Methods {
-	const char* method_names[5] = {
+	const char* method_names[6] = {
 		"cpu",
 		"nvidia",
 		"intel",
 		"hybrid",
-		"reduced traverse"
+		"reduced traverse",
+		"gutter"
 	};
 
+	int placeholder_texture_unit = -1;
+	int face_data_texture_unit = -1;
+
+	static void init_texture_units()
+	{
+		GLint max_units = 0;
+		glGetIntegerv(GL_MAX_COMBINED_TEXTURE_IMAGE_UNITS, &max_units);
+		if (max_units < PTEX_ARRAY_TEXTURE_UNITS + 2)
+			printf("The driver has %d combined texture units, the ptex methods need %d.\n", max_units, PTEX_ARRAY_TEXTURE_UNITS + 2);
+		assert(max_units >= PTEX_ARRAY_TEXTURE_UNITS + 2);
+
+		placeholder_texture_unit = max_units - 1;
+		face_data_texture_unit = max_units - 2;
+	}
+
 	void init_methods(int width, int height, GLenum mag_filter, GLenum min_filter, int max_anisotropy)
 	{
+		init_texture_units();
+
 		cpu.init(width, height);
 		intel.init(width, height, mag_filter, min_filter, max_anisotropy);
 		nvidia.init(width, height, mag_filter, min_filter, max_anisotropy);
 		hybrid.init(width, height, mag_filter, min_filter, max_anisotropy);
 		reducedTraverse.init(width, height, mag_filter, min_filter, max_anisotropy);
+		gutter.init(width, height, mag_filter, min_filter, max_anisotropy);
+	}
+
+	void bind_face_placeholders(GLuint program, gl_ptex_data ptex_data)
+	{
+		uniform_1i(program, "usePlaceholders", ptex_data.face_placeholder_texture != 0);
+
+		glActiveTexture(GL_TEXTURE0 + placeholder_texture_unit);
+		glBindTexture(GL_TEXTURE_BUFFER, ptex_data.face_placeholder_texture);
+	}
+
+	void unbind_face_placeholders()
+	{
+		glActiveTexture(GL_TEXTURE0 + placeholder_texture_unit);
+		glBindTexture(GL_TEXTURE_BUFFER, 0);
+	}
+
+	void bind_face_data(GLuint face_data_texture)
+	{
+		glActiveTexture(GL_TEXTURE0 + face_data_texture_unit);
+		glBindTexture(GL_TEXTURE_BUFFER, face_data_texture);
+	}
+
+	void unbind_face_data()
+	{
+		glActiveTexture(GL_TEXTURE0 + face_data_texture_unit);
+		glBindTexture(GL_TEXTURE_BUFFER, 0);
+	}
+
+	void set_alpha_coverage(GLuint program, gl_ptex_data ptex_data)
+	{
+		// All arrays of a model share the format.
+		bool coverage = ptex_data.array_textures->size == 0 || ptex_format_has_coverage(ptex_data.array_textures->arr[0].internal_format);
+		uniform_1i(program, "alphaCoverage", coverage);
 	}
 }
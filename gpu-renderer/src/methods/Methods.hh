@@ -12,10 +12,32 @@ namespace Methods {
 		intel = 2,
 		hybrid = 3,
 		reduced_traverse = 4,
+		gutter = 5,
 
 		last,
 	};
-	extern const char* method_names[5];
+	extern const char* method_names[6];
+
+	// The intel and hybrid methods bind their border and clamp arrays to the first 48 units.
+#define PTEX_ARRAY_TEXTURE_UNITS 48
+
+	// The streaming placeholder colors are read in ptex.vert. The unit is the last one
+	// GL_MAX_COMBINED_TEXTURE_IMAGE_UNITS allows, past the ones the ptex arrays use, set by init_methods.
+	extern int placeholder_texture_unit;
+
+	// Binds the placeholder buffer texture of ptex_data, or disables placeholders if it isn't streaming.
+	void bind_face_placeholders(GLuint program, gl_ptex_data ptex_data);
+	void unbind_face_placeholders();
+
+	// The face table buffer texture read by the ptex fragment shaders (see TexIndex).
+	// The unit before placeholder_texture_unit, set by init_methods.
+	extern int face_data_texture_unit;
+
+	void bind_face_data(GLuint face_data_texture);
+	void unbind_face_data();
+
+	// Tells the ptex shaders if the arrays have coverage in alpha, see ptex_format_has_coverage.
+	void set_alpha_coverage(GLuint program, gl_ptex_data ptex_data);
 	
 	struct CpuMethod {
 		framebuffer_desc to_cpu_framebuffer_desc;
@@ -30,7 +52,7 @@ namespace Methods {
 		texture_t cpu_stream_texture;
 
 		void init(int width, int height);
-		void render(GLuint vao, int vertex_count, Ptex::PtexTexture* texture, Ptex::PtexFilter* filter, mat4_t mvp, vec3_t bg_color);
+		void render(GLuint vao, const index_ranges_t* ranges, Ptex::PtexTexture* texture, Ptex::PtexFilter* filter, mat4_t mvp, vec3_t bg_color);
 		void resize_buffers(int width, int height);
 	};
 
@@ -46,7 +68,7 @@ namespace Methods {
 		sampler_t border_sampler;
 
 		void init(int width, int height, GLenum mag_filter, GLenum min_filter, int max_anisotropy);
-		void render(GLuint vao, int vertex_count, gl_ptex_data ptex_data, mat4_t mvp, vec3_t bg_color);
+		void render(GLuint vao, const index_ranges_t* ranges, gl_ptex_data ptex_data, mat4_t mvp, vec3_t bg_color);
 		void resize_buffers(int width, int height);
 	};
 
@@ -64,7 +86,7 @@ namespace Methods {
 		sampler_t clamp_sampler;
 
 		void init(int width, int height, GLenum mag_filter, GLenum min_filter, int max_anisotropy);
-		void render(GLuint vao, int vertex_count, gl_ptex_data ptex_data, mat4_t mvp, vec3_t bg_color);
+		void render(GLuint vao, const index_ranges_t* ranges, gl_ptex_data ptex_data, mat4_t mvp, vec3_t bg_color);
 		void resize_buffers(int width, int height);
 	};
 	
@@ -84,7 +106,7 @@ namespace Methods {
 		bool visualize;
 
 		void init(int width, int height, GLenum mag_filter, GLenum min_filter, int max_anisotropy);
-		void render(GLuint vao, int vertex_count, gl_ptex_data ptex_data, mat4_t mvp, vec3_t bg_color);
+		void render(GLuint vao, const index_ranges_t* ranges, gl_ptex_data ptex_data, mat4_t mvp, vec3_t bg_color);
 		void resize_buffers(int width, int height);
 	};
 
@@ -102,7 +124,25 @@ namespace Methods {
 		bool visualize;
 
 		void init(int width, int height, GLenum mag_filter, GLenum min_filter, int max_anisotropy);
-		void render(GLuint vao, int vertex_count, gl_ptex_data ptex_data, mat4_t mvp, vec3_t bg_color);
+		void render(GLuint vao, const index_ranges_t* ranges, gl_ptex_data ptex_data, mat4_t mvp, vec3_t bg_color);
+		void resize_buffers(int width, int height);
+	};
+
+	// Samples the gutter padded copies of the arrays (see ptex_gutter.hh)
+	// with a single hardware filtered fetch and no neighbor traversal.
+	struct GutterMethod {
+		framebuffer_desc resolve_framebuffer_desc;
+		framebuffer_t resolve_framebuffer;
+
+		framebuffer_desc framebuffer_desc;
+		framebuffer_t framebuffer;
+
+		GLuint ptex_program;
+
+		sampler_t clamp_sampler;
+
+		void init(int width, int height, GLenum mag_filter, GLenum min_filter, int max_anisotropy);
+		void render(GLuint vao, const index_ranges_t* ranges, gl_ptex_data ptex_data, mat4_t mvp, vec3_t bg_color);
 		void resize_buffers(int width, int height);
 	};
 
@@ -111,6 +151,7 @@ namespace Methods {
 	extern IntelMethod intel;
 	extern HybridMethod hybrid;
 	extern ReducedTraverseMethod reducedTraverse;
+	extern GutterMethod gutter;
 
 	void init_methods(int width, int height, GLenum mag_filter, GLenum min_filter, int max_anisotropy);
 }
@@ -77,6 +77,8 @@ namespace Methods {
 
 		ptex_program = compile_shader("program: nvidia_ptex", "shaders/ptex.vert", "shaders/ptex_nvidia.frag");
 
+		uniform_1i(ptex_program, "facePlaceholders", placeholder_texture_unit);
+
 		sampler_desc border_desc = {
 			GL_CLAMP_TO_BORDER, GL_CLAMP_TO_BORDER,
 			mag_filter, min_filter,
@@ -86,9 +88,7 @@ namespace Methods {
 
 		border_sampler = create_sampler("sampler: nvidia.border", border_desc);
 
-		int blockIndex = glGetUniformBlockIndex(ptex_program, "FaceDataUniform");
-		if (blockIndex != -1)
-			glUniformBlockBinding(ptex_program, blockIndex, 0);
+		uniform_1i(ptex_program, "faceData", face_data_texture_unit);
 
 		{
 			char name[32];
@@ -100,7 +100,7 @@ namespace Methods {
 		}
 	}
 
-	void NvidiaMethod::render(GLuint vao, int vertex_count, gl_ptex_data ptex_data, mat4_t mvp, vec3_t bg_color)
+	void NvidiaMethod::render(GLuint vao, const index_ranges_t* ranges, gl_ptex_data ptex_data, mat4_t mvp, vec3_t bg_color)
 	{
 		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer.framebuffer);
 
@@ -110,8 +110,11 @@ namespace Methods {
 		
 		glUseProgram(ptex_program);
 
+		bind_face_placeholders(ptex_program, ptex_data);
+		set_alpha_coverage(ptex_program, ptex_data);
+
 		// Bind adjacency data
-		glBindBufferBase(GL_UNIFORM_BUFFER, 0, ptex_data.face_data_buffer);
+		bind_face_data(ptex_data.face_data_texture);
 
 		glClearColor(bg_color.x, bg_color.y, bg_color.z, 1.0f);
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
@@ -124,7 +127,7 @@ namespace Methods {
 			glBindSampler(i, border_sampler.sampler);
 		}
 
-		glDrawArrays(GL_TRIANGLES, 0, vertex_count);
+		draw_index_ranges(ranges);
 
 		glUseProgram(0);
 
@@ -135,6 +138,9 @@ namespace Methods {
 			glBindSampler(i, 0);
 		}
 
+		unbind_face_placeholders();
+		unbind_face_data();
+
 		glBindFramebuffer(GL_FRAMEBUFFER, 0);
 	}
 
@@ -0,0 +1,498 @@
+#include "obj_parse.hh"
+
+#include "jobs.hh"
+#include "platform.hh"
+#include "array.hh"
+
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <vector>
+
+// Chunks are at least this big so small files aren't split into more jobs than lines.
+#define OBJ_MIN_CHUNK_SIZE (1 << 20)
+#define OBJ_CHUNKS_PER_WORKER 4
+
+using obj_clock = std::chrono::high_resolution_clock;
+using obj_seconds = std::chrono::duration<double>;
+
+typedef struct {
+	const char* begin;
+	const char* end;
+
+	std::vector<vec3_t> positions;
+	std::vector<vec2_t> texcoords;
+	std::vector<vec3_t> normals;
+	std::vector<int> face_num_verts;
+	std::vector<obj_index_t> indices;
+
+	// Negative indices count back from the chunk's own data until the chunks are merged,
+	// these are the 3 * index + component of the ones that still need the earlier chunks' counts added.
+	std::vector<int> relative;
+
+	bool error;
+} obj_chunk_t;
+
+static inline bool is_digit(char c)
+{
+	return c >= '0' && c <= '9';
+}
+
+static inline bool is_blank(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+// Powers of ten that are exact in a double, a mantissa below 2^53 scaled by one of them is rounded once.
+static const double exact_powers_of_ten[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+	1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+const char* parse_obj_float(const char* begin, const char* end, float* value)
+{
+	const char* p = begin;
+
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+	{
+		negative = *p == '-';
+		p++;
+	}
+
+	// The first 19 significant digits fit a uint64_t, the ones after them only move the exponent.
+	uint64_t mantissa = 0;
+	int significant = 0;
+	int exponent = 0;
+	bool any_digits = false;
+
+	for (; p < end && is_digit(*p); p++)
+	{
+		any_digits = true;
+		if (significant < 19)
+		{
+			mantissa = mantissa * 10 + (*p - '0');
+			significant += mantissa != 0;
+		}
+		else exponent++;
+	}
+
+	if (p < end && *p == '.')
+	{
+		p++;
+		for (; p < end && is_digit(*p); p++)
+		{
+			any_digits = true;
+			if (significant < 19)
+			{
+				mantissa = mantissa * 10 + (*p - '0');
+				significant += mantissa != 0;
+				exponent--;
+			}
+		}
+	}
+
+	if (any_digits == false)
+	{
+		// nan, inf and the like are rare enough for strtod.
+		char buffer[64];
+		size_t length = 0;
+		while (begin + length < end && length < sizeof(buffer) - 1 && is_blank(begin[length]) == false && begin[length] != '\n')
+		{
+			buffer[length] = begin[length];
+			length++;
+		}
+		buffer[length] = '\0';
+
+		char* number_end;
+		double result = strtod(buffer, &number_end);
+		if (number_end == buffer)
+			return begin;
+
+		*value = (float)result;
+		return begin + (number_end - buffer);
+	}
+
+	if (p < end && (*p == 'e' || *p == 'E'))
+	{
+		const char* e = p + 1;
+		bool negative_exponent = false;
+		if (e < end && (*e == '-' || *e == '+'))
+		{
+			negative_exponent = *e == '-';
+			e++;
+		}
+
+		if (e < end && is_digit(*e))
+		{
+			int e_value = 0;
+			for (; e < end && is_digit(*e); e++)
+			{
+				if (e_value < 10000)
+					e_value = e_value * 10 + (*e - '0');
+			}
+			exponent += negative_exponent ? -e_value : e_value;
+			p = e;
+		}
+	}
+
+	double result = (double)mantissa;
+	if (mantissa != 0)
+	{
+		if (exponent >= 0 && exponent <= 22)
+			result *= exact_powers_of_ten[exponent];
+		else if (exponent < 0 && exponent >= -22)
+			result /= exact_powers_of_ten[-exponent];
+		else
+			result *= pow(10.0, exponent);
+	}
+
+	*value = (float)(negative ? -result : result);
+	return p;
+}
+
+static inline const char* skip_blanks(const char* p, const char* end)
+{
+	while (p < end && is_blank(*p))
+		p++;
+	return p;
+}
+
+static inline const char* skip_line(const char* p, const char* end)
+{
+	while (p < end && *p != '\n')
+		p++;
+	return p < end ? p + 1 : end;
+}
+
+static const char* parse_floats(const char* p, const char* end, float* values, int count, bool* ok)
+{
+	for (int i = 0; i < count; i++)
+	{
+		p = skip_blanks(p, end);
+		const char* number_end = parse_obj_float(p, end, &values[i]);
+		if (number_end == p)
+		{
+			*ok = false;
+			return p;
+		}
+		p = number_end;
+	}
+	return p;
+}
+
+static const char* parse_int(const char* p, const char* end, int* value)
+{
+	const char* begin = p;
+
+	bool negative = false;
+	if (p < end && (*p == '-' || *p == '+'))
+	{
+		negative = *p == '-';
+		p++;
+	}
+
+	if (p == end || is_digit(*p) == false)
+		return begin;
+
+	int result = 0;
+	for (; p < end && is_digit(*p); p++)
+		result = result * 10 + (*p - '0');
+
+	*value = negative ? -result : result;
+	return p;
+}
+
+// Makes an OBJ index zero based. component is 0, 1 or 2 for v, vt and vn.
+static bool resolve_index(obj_chunk_t* chunk, int index, int count, int component, int* resolved)
+{
+	if (index > 0)
+	{
+		*resolved = index - 1;
+		return true;
+	}
+
+	if (index < 0)
+	{
+		*resolved = count + index;
+		chunk->relative.push_back((int)chunk->indices.size() * 3 + component);
+		return true;
+	}
+
+	return false;
+}
+
+static const char* parse_face(obj_chunk_t* chunk, const char* p, const char* end)
+{
+	int num_verts = 0;
+	while (true)
+	{
+		p = skip_blanks(p, end);
+		if (p == end || *p == '\n' || *p == '#')
+			break;
+
+		obj_index_t index = { OBJ_NO_INDEX, OBJ_NO_INDEX, OBJ_NO_INDEX };
+		int value;
+
+		const char* number_end = parse_int(p, end, &value);
+		if (number_end == p || resolve_index(chunk, value, (int)chunk->positions.size(), 0, &index.v) == false)
+		{
+			chunk->error = true;
+			return p;
+		}
+		p = number_end;
+
+		if (p < end && *p == '/')
+		{
+			p++;
+			number_end = parse_int(p, end, &value);
+			if (number_end != p)
+			{
+				if (resolve_index(chunk, value, (int)chunk->texcoords.size(), 1, &index.vt) == false)
+				{
+					chunk->error = true;
+					return p;
+				}
+				p = number_end;
+			}
+
+			if (p < end && *p == '/')
+			{
+				p++;
+				number_end = parse_int(p, end, &value);
+				if (number_end != p)
+				{
+					if (resolve_index(chunk, value, (int)chunk->normals.size(), 2, &index.vn) == false)
+					{
+						chunk->error = true;
+						return p;
+					}
+					p = number_end;
+				}
+			}
+		}
+
+		chunk->indices.push_back(index);
+		num_verts++;
+	}
+
+	if (num_verts < 3)
+		chunk->error = true;
+
+	chunk->face_num_verts.push_back(num_verts);
+	return p;
+}
+
+static void parse_chunk(obj_chunk_t* chunk)
+{
+	const char* p = chunk->begin;
+	const char* end = chunk->end;
+
+	// About 30 bytes a line, most of them vertices.
+	size_t lines = (end - p) / 30;
+	chunk->positions.reserve(lines / 2);
+	chunk->indices.reserve(lines);
+
+	bool ok = true;
+	while (p < end && ok && chunk->error == false)
+	{
+		p = skip_blanks(p, end);
+		if (p == end)
+			break;
+
+		if (p[0] == 'v' && p + 1 < end)
+		{
+			if (is_blank(p[1]))
+			{
+				// A w or vertex colors after the position are skipped.
+				vec3_t position;
+				p = parse_floats(p + 1, end, &position.x, 3, &ok);
+				chunk->positions.push_back(position);
+			}
+			else if (p[1] == 't')
+			{
+				// v is optional, and a w coordinate is skipped.
+				vec2_t texcoord = { 0, 0 };
+				p = parse_floats(p + 2, end, &texcoord.x, 1, &ok);
+				p = parse_obj_float(skip_blanks(p, end), end, &texcoord.y);
+				chunk->texcoords.push_back(texcoord);
+			}
+			else if (p[1] == 'n')
+			{
+				vec3_t normal;
+				p = parse_floats(p + 2, end, &normal.x, 3, &ok);
+				chunk->normals.push_back(normal);
+			}
+		}
+		else if (p[0] == 'f' && p + 1 < end && is_blank(p[1]))
+		{
+			p = parse_face(chunk, p + 1, end);
+		}
+
+		p = skip_line(p, end);
+	}
+
+	if (ok == false)
+		chunk->error = true;
+}
+
+// The first byte of the line that offset is in, unless offset is at the start of a line.
+static size_t line_boundary(const char* data, size_t size, size_t offset)
+{
+	if (offset == 0 || offset >= size)
+		return offset < size ? offset : size;
+
+	if (data[offset - 1] == '\n')
+		return offset;
+
+	const char* newline = (const char*)memchr(data + offset, '\n', size - offset);
+	return newline != NULL ? (size_t)(newline - data) + 1 : size;
+}
+
+bool parse_obj(const char* filename, obj_data_t* obj)
+{
+	*obj = {};
+
+	obj_clock::time_point start = obj_clock::now();
+
+	mapped_file_t file;
+	if (map_file(filename, &file) == false)
+	{
+		printf("Could not map '%s'.\n", filename);
+		return false;
+	}
+
+	const char* data = (const char*)file.data;
+	size_t size = file.size;
+
+	size_t chunk_size = size / (jobs::num_workers() * OBJ_CHUNKS_PER_WORKER) + 1;
+	if (chunk_size < OBJ_MIN_CHUNK_SIZE)
+		chunk_size = OBJ_MIN_CHUNK_SIZE;
+	int num_chunks = (int)((size + chunk_size - 1) / chunk_size);
+
+	std::vector<obj_chunk_t> chunks(num_chunks);
+	jobs::parallel_for(num_chunks, [&](int i) {
+		obj_chunk_t* chunk = &chunks[i];
+		// Neighboring chunks find the same boundary between them.
+		chunk->begin = data + line_boundary(data, size, (size_t)i * chunk_size);
+		chunk->end = data + line_boundary(data, size, (size_t)(i + 1) * chunk_size);
+		chunk->error = false;
+		parse_chunk(chunk);
+	});
+
+	// Where each chunk's data starts in the merged arrays.
+	std::vector<obj_index_t> bases(num_chunks);
+	std::vector<int> face_bases(num_chunks);
+	bool error = false;
+	for (int i = 0; i < num_chunks; i++)
+	{
+		obj_chunk_t* chunk = &chunks[i];
+		error |= chunk->error;
+
+		bases[i] = { obj->num_positions, obj->num_texcoords, obj->num_normals };
+		face_bases[i] = obj->num_faces;
+
+		obj->num_positions += (int)chunk->positions.size();
+		obj->num_texcoords += (int)chunk->texcoords.size();
+		obj->num_normals += (int)chunk->normals.size();
+		obj->num_faces += (int)chunk->face_num_verts.size();
+		obj->num_indices += (int)chunk->indices.size();
+	}
+
+	if (error)
+	{
+		printf("Malformed face or vertex in '%s'.\n", filename);
+		unmap_file(&file);
+		*obj = {};
+		return false;
+	}
+
+	obj->positions = alloc_array(vec3_t, obj->num_positions);
+	obj->texcoords = alloc_array(vec2_t, obj->num_texcoords);
+	obj->normals = alloc_array(vec3_t, obj->num_normals);
+	obj->face_num_verts = alloc_array(int, obj->num_faces);
+	obj->face_offsets = alloc_array(int, obj->num_faces);
+	obj->indices = alloc_array(obj_index_t, obj->num_indices);
+
+	std::vector<char> out_of_range(num_chunks);
+	jobs::parallel_for(num_chunks, [&](int i) {
+		obj_chunk_t* chunk = &chunks[i];
+		obj_index_t base = bases[i];
+
+		if (chunk->positions.size() > 0)
+			memcpy(obj->positions + base.v, chunk->positions.data(), chunk->positions.size() * sizeof(vec3_t));
+		if (chunk->texcoords.size() > 0)
+			memcpy(obj->texcoords + base.vt, chunk->texcoords.data(), chunk->texcoords.size() * sizeof(vec2_t));
+		if (chunk->normals.size() > 0)
+			memcpy(obj->normals + base.vn, chunk->normals.data(), chunk->normals.size() * sizeof(vec3_t));
+
+		for (size_t j = 0; j < chunk->relative.size(); j++)
+		{
+			int* component = &chunk->indices[chunk->relative[j] / 3].v + chunk->relative[j] % 3;
+			*component += (&base.v)[chunk->relative[j] % 3];
+		}
+
+		// The index offset of the chunk's first face is the sum of the earlier chunks' indices.
+		int index_offset = 0;
+		for (int j = 0; j < i; j++)
+			index_offset += (int)chunks[j].indices.size();
+
+		int face = face_bases[i];
+		for (size_t j = 0; j < chunk->face_num_verts.size(); j++, face++)
+		{
+			obj->face_num_verts[face] = chunk->face_num_verts[j];
+			obj->face_offsets[face] = index_offset;
+			index_offset += chunk->face_num_verts[j];
+		}
+
+		obj_index_t* indices = obj->indices + obj->face_offsets[face_bases[i]];
+		bool bad = false;
+		for (size_t j = 0; j < chunk->indices.size(); j++)
+		{
+			obj_index_t index = chunk->indices[j];
+			bad |= index.v < 0 || index.v >= obj->num_positions;
+			bad |= index.vt != OBJ_NO_INDEX && (index.vt < 0 || index.vt >= obj->num_texcoords);
+			bad |= index.vn != OBJ_NO_INDEX && (index.vn < 0 || index.vn >= obj->num_normals);
+			indices[j] = index;
+		}
+		out_of_range[i] = bad;
+
+		// The merged copy is all that's needed from here on.
+		std::vector<vec3_t>().swap(chunk->positions);
+		std::vector<vec2_t>().swap(chunk->texcoords);
+		std::vector<vec3_t>().swap(chunk->normals);
+	});
+
+	unmap_file(&file);
+
+	for (int i = 0; i < num_chunks; i++)
+	{
+		if (out_of_range[i])
+		{
+			printf("'%s' has a face with an index outside its vertices.\n", filename);
+			free_obj(obj);
+			return false;
+		}
+	}
+
+	double seconds = obj_seconds(obj_clock::now() - start).count();
+	printf("Parsed '%s' in %.2fms (%.1fMB/s, %d chunks): %d positions, %d faces\n", filename, seconds * 1000.0,
+		size / (1024.0 * 1024.0) / (seconds > 0 ? seconds : 1.0), num_chunks, obj->num_positions, obj->num_faces);
+
+	return true;
+}
+
+void free_obj(obj_data_t* obj)
+{
+	free(obj->positions);
+	free(obj->texcoords);
+	free(obj->normals);
+	free(obj->face_num_verts);
+	free(obj->face_offsets);
+	free(obj->indices);
+	*obj = {};
+}
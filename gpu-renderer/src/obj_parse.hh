@@ -0,0 +1,44 @@
+#ifndef OBJ_PARSE_H
+#define OBJ_PARSE_H
+
+#include "maths.hh"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// OBJ parser for the large meshes. The file is mapped, split into chunks at line boundaries
+// and the chunks are parsed on the job threads, then merged in file order so the faces keep
+// their ids. Only v, vt, vn and f lines are read, groups, materials etc. are skipped.
+
+#define OBJ_NO_INDEX -1
+
+typedef struct {
+	// Zero based, OBJ_NO_INDEX where the face vertex has no texcoord or normal.
+	int v, vt, vn;
+} obj_index_t;
+
+typedef struct {
+	int num_positions, num_texcoords, num_normals;
+	vec3_t* positions;
+	vec2_t* texcoords;
+	vec3_t* normals;
+
+	int num_faces;
+	// Number of vertices of each face and where its first one is in indices.
+	int* face_num_verts;
+	int* face_offsets;
+
+	int num_indices;
+	obj_index_t* indices;
+} obj_data_t;
+
+// Returns false if the file can't be mapped, has a malformed face or an index outside the data.
+bool parse_obj(const char* filename, obj_data_t* obj);
+
+void free_obj(obj_data_t* obj);
+
+// Parses a decimal float like strtof, without the locale and with no need for a terminator.
+// Returns the end of the number, or begin if there isn't one.
+const char* parse_obj_float(const char* begin, const char* end, float* value);
+
+#endif // !OBJ_PARSE_H
@@ -0,0 +1,481 @@
+#include "pixel_convert.hh"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <atomic>
+#include <chrono>
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define PIXEL_CONVERT_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#else
+#define PIXEL_CONVERT_X86 0
+#endif
+
+// The SIMD versions are compiled for their isa whatever the rest of the build targets,
+// MSVC allows the intrinsics without it.
+#if defined(__GNUC__) || defined(__clang__)
+#define PIXEL_CONVERT_TARGET(isa) __attribute__((target(isa)))
+#else
+#define PIXEL_CONVERT_TARGET(isa)
+#endif
+
+using convert_clock = std::chrono::high_resolution_clock;
+using convert_seconds = std::chrono::duration<double>;
+
+typedef struct {
+	void (*gray8_to_rgba8)(const uint8_t* src, rgba8_t* dst, size_t count);
+	void (*rgb8_to_rgba8)(const rgb8_t* src, rgba8_t* dst, size_t count);
+	void (*float_to_unorm8)(const float* src, uint8_t* dst, size_t count);
+	void (*half_to_float)(const uint16_t* src, float* dst, size_t count);
+} convert_kernels_t;
+
+static void gray8_to_rgba8_scalar(const uint8_t* src, rgba8_t* dst, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		uint8_t gray = src[i];
+		dst[i] = { gray, gray, gray, 255 };
+	}
+}
+
+static void rgb8_to_rgba8_scalar(const rgb8_t* src, rgba8_t* dst, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		rgb8_t color = src[i];
+		dst[i] = { color.r, color.g, color.b, 255 };
+	}
+}
+
+static void float_to_unorm8_scalar(const float* src, uint8_t* dst, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+	{
+		float f = src[i];
+		f = f > 0.0f ? (f < 1.0f ? f : 1.0f) : 0.0f;
+		dst[i] = (uint8_t)roundf(f * 255.0f);
+	}
+}
+
+static float half_to_float(uint16_t half)
+{
+	uint32_t sign = (uint32_t)(half & 0x8000) << 16;
+	uint32_t exponent = (half >> 10) & 0x1f;
+	uint32_t mantissa = half & 0x3ff;
+
+	uint32_t bits;
+	if (exponent == 0x1f)
+	{
+		// Infinity and NaN, NaNs are made quiet like F16C does.
+		bits = sign | 0x7f800000 | mantissa << 13;
+		if (mantissa != 0)
+			bits |= 0x400000;
+	}
+	else if (exponent != 0)
+	{
+		bits = sign | (exponent + 127 - 15) << 23 | mantissa << 13;
+	}
+	else if (mantissa == 0)
+	{
+		bits = sign;
+	}
+	else
+	{
+		// Denormal halfs are normal floats.
+		exponent = 127 - 15 + 1;
+		while ((mantissa & 0x400) == 0)
+		{
+			mantissa <<= 1;
+			exponent--;
+		}
+		bits = sign | exponent << 23 | (mantissa & 0x3ff) << 13;
+	}
+
+	float f;
+	memcpy(&f, &bits, sizeof(f));
+	return f;
+}
+
+static void half_to_float_scalar(const uint16_t* src, float* dst, size_t count)
+{
+	for (size_t i = 0; i < count; i++)
+		dst[i] = half_to_float(src[i]);
+}
+
+static const convert_kernels_t scalar_kernels = {
+	gray8_to_rgba8_scalar,
+	rgb8_to_rgba8_scalar,
+	float_to_unorm8_scalar,
+	half_to_float_scalar,
+};
+
+#if PIXEL_CONVERT_X86
+
+PIXEL_CONVERT_TARGET("ssse3")
+static void gray8_to_rgba8_ssse3(const uint8_t* src, rgba8_t* dst, size_t count)
+{
+	const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+	const __m128i spread0 = _mm_setr_epi8(0, 0, 0, -1, 1, 1, 1, -1, 2, 2, 2, -1, 3, 3, 3, -1);
+	const __m128i spread1 = _mm_setr_epi8(4, 4, 4, -1, 5, 5, 5, -1, 6, 6, 6, -1, 7, 7, 7, -1);
+	const __m128i spread2 = _mm_setr_epi8(8, 8, 8, -1, 9, 9, 9, -1, 10, 10, 10, -1, 11, 11, 11, -1);
+	const __m128i spread3 = _mm_setr_epi8(12, 12, 12, -1, 13, 13, 13, -1, 14, 14, 14, -1, 15, 15, 15, -1);
+
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16)
+	{
+		__m128i gray = _mm_loadu_si128((const __m128i*)(src + i));
+		__m128i* out = (__m128i*)(dst + i);
+		_mm_storeu_si128(out + 0, _mm_or_si128(_mm_shuffle_epi8(gray, spread0), alpha));
+		_mm_storeu_si128(out + 1, _mm_or_si128(_mm_shuffle_epi8(gray, spread1), alpha));
+		_mm_storeu_si128(out + 2, _mm_or_si128(_mm_shuffle_epi8(gray, spread2), alpha));
+		_mm_storeu_si128(out + 3, _mm_or_si128(_mm_shuffle_epi8(gray, spread3), alpha));
+	}
+
+	gray8_to_rgba8_scalar(src + i, dst + i, count - i);
+}
+
+PIXEL_CONVERT_TARGET("ssse3")
+static void rgb8_to_rgba8_ssse3(const rgb8_t* src, rgba8_t* dst, size_t count)
+{
+	const __m128i alpha = _mm_set1_epi32((int)0xFF000000);
+	const __m128i spread = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+
+	// 16 pixels are 3 registers, the pixels that straddle two of them are shifted together first.
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16)
+	{
+		const __m128i* in = (const __m128i*)(src + i);
+		__m128i a = _mm_loadu_si128(in + 0);
+		__m128i b = _mm_loadu_si128(in + 1);
+		__m128i c = _mm_loadu_si128(in + 2);
+
+		__m128i* out = (__m128i*)(dst + i);
+		_mm_storeu_si128(out + 0, _mm_or_si128(_mm_shuffle_epi8(a, spread), alpha));
+		_mm_storeu_si128(out + 1, _mm_or_si128(_mm_shuffle_epi8(_mm_alignr_epi8(b, a, 12), spread), alpha));
+		_mm_storeu_si128(out + 2, _mm_or_si128(_mm_shuffle_epi8(_mm_alignr_epi8(c, b, 8), spread), alpha));
+		_mm_storeu_si128(out + 3, _mm_or_si128(_mm_shuffle_epi8(_mm_srli_si128(c, 4), spread), alpha));
+	}
+
+	rgb8_to_rgba8_scalar(src + i, dst + i, count - i);
+}
+
+// Same rounding as roundf for the clamped values: truncate, then round up from a half.
+PIXEL_CONVERT_TARGET("ssse3")
+static inline __m128i unorm8_sse(__m128 x)
+{
+	// max returns the second operand for NaN.
+	x = _mm_min_ps(_mm_max_ps(x, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+	__m128 scaled = _mm_mul_ps(x, _mm_set1_ps(255.0f));
+	__m128i truncated = _mm_cvttps_epi32(scaled);
+	__m128 fraction = _mm_sub_ps(scaled, _mm_cvtepi32_ps(truncated));
+	return _mm_sub_epi32(truncated, _mm_castps_si128(_mm_cmpge_ps(fraction, _mm_set1_ps(0.5f))));
+}
+
+PIXEL_CONVERT_TARGET("ssse3")
+static void float_to_unorm8_ssse3(const float* src, uint8_t* dst, size_t count)
+{
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16)
+	{
+		__m128i a = unorm8_sse(_mm_loadu_ps(src + i + 0));
+		__m128i b = unorm8_sse(_mm_loadu_ps(src + i + 4));
+		__m128i c = unorm8_sse(_mm_loadu_ps(src + i + 8));
+		__m128i d = unorm8_sse(_mm_loadu_ps(src + i + 12));
+		__m128i packed = _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+		_mm_storeu_si128((__m128i*)(dst + i), packed);
+	}
+
+	float_to_unorm8_scalar(src + i, dst + i, count - i);
+}
+
+PIXEL_CONVERT_TARGET("avx2")
+static void gray8_to_rgba8_avx2(const uint8_t* src, rgba8_t* dst, size_t count)
+{
+	// The shuffles work within each 128 bit lane, so both lanes get all 16 gray values.
+	const __m256i alpha = _mm256_set1_epi32((int)0xFF000000);
+	const __m256i spread0 = _mm256_setr_epi8(
+		0, 0, 0, -1, 1, 1, 1, -1, 2, 2, 2, -1, 3, 3, 3, -1,
+		4, 4, 4, -1, 5, 5, 5, -1, 6, 6, 6, -1, 7, 7, 7, -1);
+	const __m256i spread1 = _mm256_setr_epi8(
+		8, 8, 8, -1, 9, 9, 9, -1, 10, 10, 10, -1, 11, 11, 11, -1,
+		12, 12, 12, -1, 13, 13, 13, -1, 14, 14, 14, -1, 15, 15, 15, -1);
+
+	size_t i = 0;
+	for (; i + 16 <= count; i += 16)
+	{
+		__m256i gray = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)(src + i)));
+		__m256i* out = (__m256i*)(dst + i);
+		_mm256_storeu_si256(out + 0, _mm256_or_si256(_mm256_shuffle_epi8(gray, spread0), alpha));
+		_mm256_storeu_si256(out + 1, _mm256_or_si256(_mm256_shuffle_epi8(gray, spread1), alpha));
+	}
+
+	gray8_to_rgba8_scalar(src + i, dst + i, count - i);
+}
+
+PIXEL_CONVERT_TARGET("avx2")
+static void rgb8_to_rgba8_avx2(const rgb8_t* src, rgba8_t* dst, size_t count)
+{
+	const __m256i alpha = _mm256_set1_epi32((int)0xFF000000);
+	const __m256i spread = _mm256_setr_epi8(
+		0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+		0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+
+	// Each lane loads 4 pixels, the second load reads 4 bytes past them, which the
+	// loop bound keeps inside src.
+	size_t i = 0;
+	for (; i + 10 <= count; i += 8)
+	{
+		const uint8_t* in = (const uint8_t*)(src + i);
+		__m128i lo = _mm_loadu_si128((const __m128i*)in);
+		__m128i hi = _mm_loadu_si128((const __m128i*)(in + 12));
+		__m256i rgb = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+		_mm256_storeu_si256((__m256i*)(dst + i), _mm256_or_si256(_mm256_shuffle_epi8(rgb, spread), alpha));
+	}
+
+	rgb8_to_rgba8_scalar(src + i, dst + i, count - i);
+}
+
+PIXEL_CONVERT_TARGET("avx2")
+static inline __m256i unorm8_avx2(__m256 x)
+{
+	x = _mm256_min_ps(_mm256_max_ps(x, _mm256_setzero_ps()), _mm256_set1_ps(1.0f));
+	__m256 scaled = _mm256_mul_ps(x, _mm256_set1_ps(255.0f));
+	__m256i truncated = _mm256_cvttps_epi32(scaled);
+	__m256 fraction = _mm256_sub_ps(scaled, _mm256_cvtepi32_ps(truncated));
+	return _mm256_sub_epi32(truncated, _mm256_castps_si256(_mm256_cmp_ps(fraction, _mm256_set1_ps(0.5f), _CMP_GE_OQ)));
+}
+
+PIXEL_CONVERT_TARGET("avx2")
+static void float_to_unorm8_avx2(const float* src, uint8_t* dst, size_t count)
+{
+	// The packs interleave the lanes, the permute puts the groups of 4 back in order.
+	const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+
+	size_t i = 0;
+	for (; i + 32 <= count; i += 32)
+	{
+		__m256i a = unorm8_avx2(_mm256_loadu_ps(src + i + 0));
+		__m256i b = unorm8_avx2(_mm256_loadu_ps(src + i + 8));
+		__m256i c = unorm8_avx2(_mm256_loadu_ps(src + i + 16));
+		__m256i d = unorm8_avx2(_mm256_loadu_ps(src + i + 24));
+		__m256i packed = _mm256_packus_epi16(_mm256_packs_epi32(a, b), _mm256_packs_epi32(c, d));
+		_mm256_storeu_si256((__m256i*)(dst + i), _mm256_permutevar8x32_epi32(packed, order));
+	}
+
+	float_to_unorm8_scalar(src + i, dst + i, count - i);
+}
+
+PIXEL_CONVERT_TARGET("avx2,f16c")
+static void half_to_float_f16c(const uint16_t* src, float* dst, size_t count)
+{
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8)
+		_mm256_storeu_ps(dst + i, _mm256_cvtph_ps(_mm_loadu_si128((const __m128i*)(src + i))));
+
+	half_to_float_scalar(src + i, dst + i, count - i);
+}
+
+static const convert_kernels_t ssse3_kernels = {
+	gray8_to_rgba8_ssse3,
+	rgb8_to_rgba8_ssse3,
+	float_to_unorm8_ssse3,
+	half_to_float_scalar,
+};
+
+static const convert_kernels_t avx2_kernels = {
+	gray8_to_rgba8_avx2,
+	rgb8_to_rgba8_avx2,
+	float_to_unorm8_avx2,
+	half_to_float_f16c,
+};
+
+#endif // PIXEL_CONVERT_X86
+
+static const convert_kernels_t* isa_kernels(pixel_convert_isa isa)
+{
+#if PIXEL_CONVERT_X86
+	if (isa == PIXEL_CONVERT_AVX2)
+		return &avx2_kernels;
+	if (isa == PIXEL_CONVERT_SSSE3)
+		return &ssse3_kernels;
+#endif
+	return &scalar_kernels;
+}
+
+pixel_convert_isa detect_pixel_convert_isa()
+{
+#if PIXEL_CONVERT_X86 && defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	int max_leaf = info[0];
+
+	__cpuid(info, 1);
+	bool ssse3 = (info[2] & (1 << 9)) != 0;
+	bool f16c = (info[2] & (1 << 29)) != 0;
+	// The OS has to save the ymm registers too.
+	bool avx = (info[2] & (1 << 28)) != 0 && (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 6) == 6;
+
+	bool avx2 = false;
+	if (max_leaf >= 7)
+	{
+		__cpuidex(info, 7, 0);
+		avx2 = (info[1] & (1 << 5)) != 0;
+	}
+
+	if (avx && avx2 && f16c)
+		return PIXEL_CONVERT_AVX2;
+	if (ssse3)
+		return PIXEL_CONVERT_SSSE3;
+#elif PIXEL_CONVERT_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("f16c"))
+		return PIXEL_CONVERT_AVX2;
+	if (__builtin_cpu_supports("ssse3"))
+		return PIXEL_CONVERT_SSSE3;
+#endif
+	return PIXEL_CONVERT_SCALAR;
+}
+
+// -1 until a kernel is used or the isa is set. Kernels are called from the job threads.
+static std::atomic<int> g_pixel_convert_isa(-1);
+
+pixel_convert_isa get_pixel_convert_isa()
+{
+	int isa = g_pixel_convert_isa.load(std::memory_order_relaxed);
+	if (isa < 0)
+	{
+		isa = detect_pixel_convert_isa();
+		g_pixel_convert_isa.store(isa, std::memory_order_relaxed);
+	}
+	return (pixel_convert_isa)isa;
+}
+
+pixel_convert_isa set_pixel_convert_isa(pixel_convert_isa isa)
+{
+	pixel_convert_isa supported = detect_pixel_convert_isa();
+	if (isa > supported)
+		isa = supported;
+
+	g_pixel_convert_isa.store(isa, std::memory_order_relaxed);
+	return isa;
+}
+
+const char* pixel_convert_isa_name(pixel_convert_isa isa)
+{
+	switch (isa)
+	{
+	case PIXEL_CONVERT_SCALAR: return "scalar";
+	case PIXEL_CONVERT_SSSE3: return "SSSE3";
+	case PIXEL_CONVERT_AVX2: return "AVX2";
+	default: return "unknown";
+	}
+}
+
+void convert_gray8_to_rgba8(const uint8_t* src, rgba8_t* dst, size_t count)
+{
+	isa_kernels(get_pixel_convert_isa())->gray8_to_rgba8(src, dst, count);
+}
+
+void convert_rgb8_to_rgba8(const rgb8_t* src, rgba8_t* dst, size_t count)
+{
+	isa_kernels(get_pixel_convert_isa())->rgb8_to_rgba8(src, dst, count);
+}
+
+void convert_float_to_unorm8(const float* src, uint8_t* dst, size_t count)
+{
+	isa_kernels(get_pixel_convert_isa())->float_to_unorm8(src, dst, count);
+}
+
+void convert_half_to_float(const uint16_t* src, float* dst, size_t count)
+{
+	isa_kernels(get_pixel_convert_isa())->half_to_float(src, dst, count);
+}
+
+#define PIXEL_CONVERT_BENCHMARK_RUNS 8
+
+// Best time of a few runs, the first run also warms up the caches and page tables.
+template<typename F>
+static double time_kernel(F kernel)
+{
+	double best = 0;
+	for (int run = 0; run < PIXEL_CONVERT_BENCHMARK_RUNS; run++)
+	{
+		convert_clock::time_point start = convert_clock::now();
+		kernel();
+		double seconds = convert_seconds(convert_clock::now() - start).count();
+		if (run == 0 || seconds < best)
+			best = seconds;
+	}
+	return best;
+}
+
+void benchmark_pixel_convert(size_t count)
+{
+	uint8_t* gray = (uint8_t*)malloc(count);
+	rgb8_t* rgb = (rgb8_t*)malloc(count * sizeof(rgb8_t));
+	float* floats = (float*)malloc(count * sizeof(float));
+	uint16_t* halfs = (uint16_t*)malloc(count * sizeof(uint16_t));
+
+	// One output buffer per isa, compared against the scalar one.
+	uint8_t* out[PIXEL_CONVERT_AVX2 + 1];
+	for (int isa = 0; isa <= PIXEL_CONVERT_AVX2; isa++)
+		out[isa] = (uint8_t*)malloc(count * sizeof(float));
+
+	// Floats a bit outside [0, 1] so the clamping is covered, halfs over every bit pattern.
+	uint32_t state = 0x12345678;
+	for (size_t i = 0; i < count; i++)
+	{
+		state = state * 1664525 + 1013904223;
+		gray[i] = (uint8_t)(state >> 24);
+		rgb[i] = { (uint8_t)(state >> 8), (uint8_t)(state >> 16), (uint8_t)(state >> 24) };
+		floats[i] = (state >> 8) / (float)(1 << 24) * 1.2f - 0.1f;
+		halfs[i] = (uint16_t)i;
+	}
+
+	const char* names[] = { "gray8 -> rgba8", "rgb8 -> rgba8", "float -> unorm8", "half -> float" };
+	size_t bytes[] = { count * 5, count * 7, count * 5, count * 6 };
+	size_t out_size[] = { count * 4, count * 4, count, count * 4 };
+
+	pixel_convert_isa supported = detect_pixel_convert_isa();
+	printf("Pixel conversion kernels over %.1fM pixels, %s supported:\n", count / 1000000.0, pixel_convert_isa_name(supported));
+
+	for (int kernel = 0; kernel < 4; kernel++)
+	{
+		printf("  %-16s", names[kernel]);
+		for (int isa = 0; isa <= supported; isa++)
+		{
+			const convert_kernels_t* kernels = isa_kernels((pixel_convert_isa)isa);
+			uint8_t* dst = out[isa];
+
+			double seconds = time_kernel([&]() {
+				switch (kernel)
+				{
+				case 0: kernels->gray8_to_rgba8(gray, (rgba8_t*)dst, count); break;
+				case 1: kernels->rgb8_to_rgba8(rgb, (rgba8_t*)dst, count); break;
+				case 2: kernels->float_to_unorm8(floats, dst, count); break;
+				case 3: kernels->half_to_float(halfs, (float*)dst, count); break;
+				}
+			});
+
+			// NaN halfs convert to NaN floats with the same bits, so memcmp works for them too.
+			bool same = memcmp(dst, out[PIXEL_CONVERT_SCALAR], out_size[kernel]) == 0;
+			printf(" %s: %6.2fGB/s%s", pixel_convert_isa_name((pixel_convert_isa)isa),
+				seconds > 0 ? bytes[kernel] / seconds / 1e9 : 0.0, same ? "" : " (MISMATCH)");
+		}
+		printf("\n");
+	}
+
+	for (int isa = 0; isa <= PIXEL_CONVERT_AVX2; isa++)
+		free(out[isa]);
+	free(gray);
+	free(rgb);
+	free(floats);
+	free(halfs);
+}
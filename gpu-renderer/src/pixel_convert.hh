@@ -0,0 +1,42 @@
+#ifndef PIXEL_CONVERT_H
+#define PIXEL_CONVERT_H
+
+#include "util.hh"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Conversions between the pixel formats of ptex data and of the cpu method's output.
+// Every kernel has a scalar version and SSSE3 and AVX2 versions on x86, half to float uses F16C
+// with AVX2. The fastest set the cpu supports is picked the first time a kernel is used.
+// All versions of a kernel give the same result.
+
+enum pixel_convert_isa {
+	PIXEL_CONVERT_SCALAR = 0,
+	PIXEL_CONVERT_SSSE3 = 1,
+	PIXEL_CONVERT_AVX2 = 2,
+};
+
+void convert_gray8_to_rgba8(const uint8_t* src, rgba8_t* dst, size_t count);
+void convert_rgb8_to_rgba8(const rgb8_t* src, rgba8_t* dst, size_t count);
+
+// count floats, clamped to [0, 1] and rounded to the nearest like roundf. NaN becomes 0.
+void convert_float_to_unorm8(const float* src, uint8_t* dst, size_t count);
+
+void convert_half_to_float(const uint16_t* src, float* dst, size_t count);
+
+// The best isa the cpu supports.
+pixel_convert_isa detect_pixel_convert_isa();
+
+pixel_convert_isa get_pixel_convert_isa();
+
+// Limits the kernels to isa, or what the cpu supports if that's less. Returns the isa used.
+pixel_convert_isa set_pixel_convert_isa(pixel_convert_isa isa);
+
+const char* pixel_convert_isa_name(pixel_convert_isa isa);
+
+// Runs every kernel with every isa the cpu supports over count pixels and prints the GB/s,
+// counting the bytes read and written, and whether the results match the scalar version.
+void benchmark_pixel_convert(size_t count);
+
+#endif // !PIXEL_CONVERT_H
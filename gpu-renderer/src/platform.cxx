@@ -7,8 +7,13 @@
 #if WIN32
 #define WIN32_LEAN_AND_MEAN
 #include <Windows.h>
+#include <Psapi.h>
 #else
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
 #endif
 #include <stdio.h>
 
@@ -45,3 +50,151 @@ bool create_directory(const char* dirname)
 	mkdir(dirname, 0x777);
 #endif
 }
+
+bool get_file_info(const char* path, uint64_t* size, int64_t* mtime)
+{
+#if WIN32
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
+	if (GetFileAttributesEx(path, GetFileExInfoStandard, &attributes) == 0)
+		return false;
+
+	*size = ((uint64_t)attributes.nFileSizeHigh << 32) | attributes.nFileSizeLow;
+	*mtime = ((int64_t)attributes.ftLastWriteTime.dwHighDateTime << 32) | attributes.ftLastWriteTime.dwLowDateTime;
+	return true;
+#else
+	struct stat st;
+	if (stat(path, &st) != 0)
+		return false;
+
+	*size = st.st_size;
+	*mtime = st.st_mtime;
+	return true;
+#endif
+}
+
+bool map_file(const char* path, mapped_file_t* file)
+{
+	file->data = NULL;
+	file->size = 0;
+	file->file_handle = NULL;
+	file->mapping_handle = NULL;
+
+#if WIN32
+	HANDLE handle = CreateFile(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (handle == INVALID_HANDLE_VALUE)
+		return false;
+
+	LARGE_INTEGER size;
+	if (GetFileSizeEx(handle, &size) == 0 || size.QuadPart == 0)
+	{
+		CloseHandle(handle);
+		return false;
+	}
+
+	HANDLE mapping = CreateFileMapping(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (mapping == NULL)
+	{
+		CloseHandle(handle);
+		return false;
+	}
+
+	void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (data == NULL)
+	{
+		CloseHandle(mapping);
+		CloseHandle(handle);
+		return false;
+	}
+
+	file->data = data;
+	file->size = (size_t)size.QuadPart;
+	file->file_handle = handle;
+	file->mapping_handle = mapping;
+	return true;
+#else
+	int fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0)
+	{
+		close(fd);
+		return false;
+	}
+
+	void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	// The mapping keeps its own reference to the file.
+	close(fd);
+	if (data == MAP_FAILED)
+		return false;
+
+	file->data = data;
+	file->size = st.st_size;
+	return true;
+#endif
+}
+
+void unmap_file(mapped_file_t* file)
+{
+	if (file->data == NULL)
+		return;
+
+#if WIN32
+	UnmapViewOfFile(file->data);
+	CloseHandle((HANDLE)file->mapping_handle);
+	CloseHandle((HANDLE)file->file_handle);
+#else
+	munmap(file->data, file->size);
+#endif
+
+	file->data = NULL;
+	file->size = 0;
+	file->file_handle = NULL;
+	file->mapping_handle = NULL;
+}
+
+uint64_t get_peak_memory_usage()
+{
+#if WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)) == 0)
+		return 0;
+
+	return counters.PeakWorkingSetSize;
+#else
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) != 0)
+		return 0;
+
+	// Linux reports it in kilobytes.
+	return (uint64_t)usage.ru_maxrss * 1024;
+#endif
+}
+
+uint64_t get_memory_usage()
+{
+#if WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)) == 0)
+		return 0;
+
+	return counters.WorkingSetSize;
+#elif __linux__
+	// The second number is the resident set in pages.
+	FILE* file = fopen("/proc/self/statm", "r");
+	if (file == NULL)
+		return 0;
+
+	unsigned long long pages, resident;
+	int read = fscanf(file, "%llu %llu", &pages, &resident);
+	fclose(file);
+
+	if (read != 2)
+		return 0;
+
+	return (uint64_t)resident * sysconf(_SC_PAGESIZE);
+#else
+	return 0;
+#endif
+}
@@ -1,10 +1,36 @@
 #ifndef PLATFORM_H
 #define PLATFORM_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 bool change_directory(const char* path);
 
 const char* get_current_directory();
 
 bool create_directory(const char* dirname);
 
+// Returns false if the file doesn't exist.
+bool get_file_info(const char* path, uint64_t* size, int64_t* mtime);
+
+typedef struct {
+	void* data;
+	size_t size;
+
+	// Platform handles needed to unmap the file.
+	void* file_handle;
+	void* mapping_handle;
+} mapped_file_t;
+
+// Maps a whole file read-only into memory.
+bool map_file(const char* path, mapped_file_t* file);
+
+void unmap_file(mapped_file_t* file);
+
+// The memory the process has resident right now, in bytes. 0 where it can't be queried.
+uint64_t get_memory_usage();
+
+// The most memory the process has had resident so far, in bytes.
+uint64_t get_peak_memory_usage();
+
 #endif // !PLATFORM_H
@@ -1,5 +1,6 @@
 
 #include "profiler.hh"
+#include "platform.hh"
 
 #include <imgui.h>
 
@@ -158,6 +159,9 @@ namespace profiler {
 
 		if (ImGui::Begin("Profiler"))
 		{
+			// The peak includes loading, which is when the most memory is used.
+			ImGui::Text("Memory: %.1fMB | peak: %.1fMB", get_memory_usage() / (1024.0 * 1024.0), get_peak_memory_usage() / (1024.0 * 1024.0));
+
 			ids.clear();
 			ids.push(-1);
 			for (int i = 0; i < previous_render_passes.size; i++)
@@ -0,0 +1,371 @@
+#include "ptex_atlas.hh"
+
+#include "ptex_mips.hh"
+#include "jobs.hh"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+bool g_ptex_atlas_faces = false;
+
+using atlas_clock = std::chrono::high_resolution_clock;
+using atlas_seconds = std::chrono::duration<double>;
+
+#define TILE_SIZES (PTEX_TILE_MAX_LOG2 + 1)
+
+typedef struct {
+	int page;
+	int x, y;
+} free_rect_t;
+
+bool build_ptex_atlas_layout(Ptex::PtexTexture* ptex, int max_layers, TexIndex* face_indices, int* page_log2, ptex_atlas_stats* stats)
+{
+	atlas_clock::time_point start = atlas_clock::now();
+
+	int num_faces = ptex->numFaces();
+
+	std::vector<Ptex::Res> resolutions;
+	std::vector<int> resolution_faces;
+
+	int max_log2 = 0;
+	stats->face_texels = 0;
+	for (int i = 0; i < num_faces; i++)
+	{
+		Ptex::Res res = ptex->getFaceInfo(i).res;
+		max_log2 = std::max(max_log2, (int)std::max(res.ulog2, res.vlog2));
+		stats->face_texels += res.size();
+
+		size_t r = std::find(resolutions.begin(), resolutions.end(), res) - resolutions.begin();
+		if (r == resolutions.size())
+		{
+			resolutions.push_back(res);
+			resolution_faces.push_back(0);
+		}
+		resolution_faces[r]++;
+	}
+
+	if (max_log2 > PTEX_TILE_MAX_LOG2)
+		return false;
+
+	// Biggest faces first, so the free rectangles they leave behind are filled by the smaller ones.
+	std::vector<int> order(num_faces);
+	for (int i = 0; i < num_faces; i++)
+		order[i] = i;
+
+	std::sort(order.begin(), order.end(), [ptex](int a, int b) {
+		Ptex::Res ra = ptex->getFaceInfo(a).res;
+		Ptex::Res rb = ptex->getFaceInfo(b).res;
+		if (ra.ulog2 + ra.vlog2 != rb.ulog2 + rb.vlog2) return ra.ulog2 + ra.vlog2 > rb.ulog2 + rb.vlog2;
+		if (ra.ulog2 != rb.ulog2) return ra.ulog2 > rb.ulog2;
+		return a < b;
+	});
+
+	// Free rectangles by their log2 width and height, they are always aligned to their own size.
+	std::vector<free_rect_t> free_rects[TILE_SIZES][TILE_SIZES];
+
+	int num_pages = 0;
+	for (int i = 0; i < num_faces; i++)
+	{
+		int face = order[i];
+		const Ptex::FaceInfo& info = ptex->getFaceInfo(face);
+		int face_u = info.res.ulog2;
+		int face_v = info.res.vlog2;
+
+		int best_u = -1, best_v = -1;
+		for (int u = face_u; u <= max_log2; u++)
+		{
+			for (int v = face_v; v <= max_log2; v++)
+			{
+				if (free_rects[u][v].empty() == false && (best_u == -1 || u + v < best_u + best_v))
+				{
+					best_u = u;
+					best_v = v;
+				}
+			}
+		}
+
+		if (best_u == -1)
+		{
+			free_rect_t page = { num_pages++, 0, 0 };
+			free_rects[max_log2][max_log2].push_back(page);
+			best_u = max_log2;
+			best_v = max_log2;
+		}
+
+		free_rect_t rect = free_rects[best_u][best_v].back();
+		free_rects[best_u][best_v].pop_back();
+
+		// Split off halves until the rectangle is the size of the face.
+		int u = best_u, v = best_v;
+		while (u > face_u || v > face_v)
+		{
+			if (u - face_u >= v - face_v)
+			{
+				u--;
+				free_rect_t right = { rect.page, rect.x + (1 << u), rect.y };
+				free_rects[u][v].push_back(right);
+			}
+			else
+			{
+				v--;
+				free_rect_t top = { rect.page, rect.x, rect.y + (1 << v) };
+				free_rects[u][v].push_back(top);
+			}
+		}
+
+		int neighbors[4];
+		int edges[4];
+		for (int e = 0; e < 4; e++)
+		{
+			neighbors[e] = info.adjface(e);
+			edges[e] = info.adjedge(e);
+		}
+
+		TexIndex index = make_tex_index(rect.page / max_layers, rect.page % max_layers, neighbors, edges);
+		index.tile = make_ptex_tile(max_log2 - face_u, max_log2 - face_v, rect.x >> face_u, rect.y >> face_v);
+		face_indices[face] = index;
+	}
+
+	*page_log2 = max_log2;
+
+	stats->page_size = 1 << max_log2;
+	stats->num_pages = num_pages;
+	stats->num_arrays = ptex_num_array_parts(num_pages, max_layers);
+	stats->resolution_arrays = 0;
+	for (size_t r = 0; r < resolutions.size(); r++)
+		stats->resolution_arrays += ptex_num_array_parts(resolution_faces[r], max_layers);
+	stats->page_texels = (uint64_t)num_pages << (2 * max_log2);
+
+	stats->packed_faces = 0;
+	for (int i = 0; i < num_faces; i++)
+	{
+		if (face_indices[i].tile != 0)
+			stats->packed_faces++;
+	}
+
+	stats->layout_seconds = atlas_seconds(atlas_clock::now() - start).count();
+
+	return true;
+}
+
+bool ptex_arrays_fit(const char* name, Ptex::PtexTexture* ptex)
+{
+	int max_layers = ptex_max_array_layers();
+
+	int resolution_arrays = ptex_resolution_array_count(ptex, max_layers);
+	if (resolution_arrays <= PTEX_MAX_SAMPLED_ARRAYS)
+		return true;
+
+	if (ptex_data_is_rgba8(ptex->dataType()) == false)
+	{
+		printf("%s needs %d arrays, the shaders sample at most %d and the atlas needs RGBA8 faces.\n", name, resolution_arrays, PTEX_MAX_SAMPLED_ARRAYS);
+		return false;
+	}
+
+	ptex_atlas_stats stats;
+	TexIndex* face_indices = new TexIndex[ptex->numFaces()];
+	int page_log2;
+	bool fits = build_ptex_atlas_layout(ptex, max_layers, face_indices, &page_log2, &stats);
+	delete[] face_indices;
+
+	if (fits == false)
+	{
+		printf("%s needs %d arrays, the shaders sample at most %d and its faces are too big for an atlas.\n", name, resolution_arrays, PTEX_MAX_SAMPLED_ARRAYS);
+		return false;
+	}
+
+	if (stats.num_arrays > PTEX_MAX_SAMPLED_ARRAYS)
+	{
+		printf("%s needs %d arrays, or %d in the atlas, the shaders sample at most %d.\n", name, resolution_arrays, stats.num_arrays, PTEX_MAX_SAMPLED_ARRAYS);
+		return false;
+	}
+
+	return true;
+}
+
+bool create_gl_atlas_arrays(const char* name, gl_ptex_textures textures, GLenum mag_filter, GLenum min_filter, gl_ptex_data* data)
+{
+	Ptex::PtexTexture* ptex = textures.ptex;
+
+	if (ptex_data_is_rgba8(ptex->dataType()) == false)
+	{
+		printf("The atlas is built from RGBA8 faces, %s has %s data so it uses one array per resolution.\n", name, Ptex::DataTypeName(ptex->dataType()));
+		return false;
+	}
+
+	ptex_atlas_stats stats;
+	TexIndex* face_indices = new TexIndex[textures.num_faces];
+
+	int max_layers = ptex_max_array_layers();
+
+	int page_log2;
+	if (build_ptex_atlas_layout(ptex, max_layers, face_indices, &page_log2, &stats) == false)
+	{
+		printf("The faces of %s are too big for an atlas, using one array per resolution.\n", name);
+		delete[] face_indices;
+		return false;
+	}
+
+	atlas_clock::time_point start = atlas_clock::now();
+
+	int page_size = stats.page_size;
+	int levels = page_log2 + 1;
+
+	size_t level_offset[PTEX_TILE_MAX_LOG2 + 1];
+	size_t total_texels = 0;
+	for (int level = 0; level < levels; level++)
+	{
+		level_offset[level] = total_texels;
+		total_texels += (size_t)(page_size >> level) * (page_size >> level) * stats.num_pages;
+	}
+
+	// Page texels that no face covers stay zero. The pages of all the arrays are
+	// consecutive in each level, so page p is at slice p of the level.
+	rgba8_t* pages = (rgba8_t*)calloc(total_texels, sizeof(rgba8_t));
+	assert(pages != NULL);
+
+	std::vector<ptex_face_texture*> faces;
+	faces.reserve(textures.num_faces);
+	for (int i = 0; i < textures.num_resolutions; i++)
+	{
+		for (int j = 0; j < textures.resolutions[i].num_textures; j++)
+			faces.push_back(&textures.resolutions[i].textures[j]);
+	}
+
+	jobs::parallel_for((int)faces.size(), [&](int i) {
+		int face = faces[i]->face_id;
+		const TexIndex* index = &face_indices[face];
+		Ptex::Res res = ptex->getFaceInfo(face).res;
+
+		rgba8_t* mips = (rgba8_t*)malloc(ptex_face_mips_size(res.u(), res.v()));
+		assert(mips != NULL || (res.u() == 1 && res.v() == 1));
+		build_ptex_face_mips(ptex, face, (const rgba8_t*)faces[i]->data, mips);
+
+		// Faces don't overlap so the jobs never write the same texels.
+		const rgba8_t* src = (const rgba8_t*)faces[i]->data;
+		int last_level = std::min(res.ulog2, res.vlog2);
+		for (int level = 0; level <= last_level; level++)
+		{
+			int level_size = page_size >> level;
+			int page_index = index->texIndex * max_layers + index->texSilce;
+			rgba8_t* page = pages + level_offset[level] + (size_t)page_index * level_size * level_size;
+
+			int x, y, width, height;
+			ptex_tile_rect(index->tile, page_size, page_size, level, &x, &y, &width, &height);
+
+			for (int row = 0; row < height; row++)
+				memcpy(page + (size_t)(y + row) * level_size + x, src + (size_t)row * width, width * sizeof(rgba8_t));
+
+			src = level == 0 ? mips : src + (size_t)width * height;
+		}
+
+		free(mips);
+	});
+
+	atlas_clock::time_point pack_end = atlas_clock::now();
+	stats.pack_seconds = atlas_seconds(pack_end - start).count();
+
+	// Converted in place once all the faces are in, the pages are tightly packed texels of the new format.
+	GLenum internal_format = ptex_array_format(ptex->dataType(), ptex->numChannels());
+	int texel_size = ptex_texel_size(internal_format);
+	for (int level = 0; level < levels; level++)
+	{
+		rgba8_t* texels = pages + level_offset[level];
+		convert_rgba8_texels(texels, (size_t)(page_size >> level) * (page_size >> level) * stats.num_pages, internal_format, texels);
+	}
+
+	GLenum transfer_format, transfer_type;
+	ptex_texel_transfer_format(internal_format, &transfer_format, &transfer_type);
+
+	GLuint* gl_textures = alloc_array(GLuint, stats.num_arrays);
+	glGenTextures(stats.num_arrays, gl_textures);
+
+	glActiveTexture(GL_TEXTURE0);
+
+	custom_arrays::array_t<array_texture_t>* array_textures = new custom_arrays::array_t<array_texture_t>(stats.num_arrays);
+
+	for (int i = 0; i < stats.num_arrays; i++)
+	{
+		int first_page = i * max_layers;
+		int slices = std::min(max_layers, stats.num_pages - first_page);
+
+		glBindTexture(GL_TEXTURE_2D_ARRAY, gl_textures[i]);
+
+		if (has_KHR_debug)
+		{
+			char label[256];
+			sprintf(label, "ARRTEX: ptex atlas%d %dx%d (%d pages)", i, page_size, page_size, slices);
+			glObjectLabel(GL_TEXTURE, gl_textures[i], -1, label);
+		}
+
+		for (int level = 0; level < levels; level++)
+		{
+			int level_size = page_size >> level;
+			const uint8_t* texels = (const uint8_t*)(pages + level_offset[level]) + (size_t)first_page * level_size * level_size * texel_size;
+			glTexImage3D(GL_TEXTURE_2D_ARRAY, level, internal_format, level_size, level_size, slices, 0,
+				transfer_format, transfer_type, texels);
+		}
+
+		set_ptex_array_texture_params(mag_filter, min_filter);
+		set_ptex_array_swizzle(internal_format);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, levels - 1);
+
+		array_texture_t tex;
+
+		tex.width = page_size;
+		tex.height = page_size;
+		tex.slices = slices;
+
+		tex.texture = gl_textures[i];
+		tex.internal_format = internal_format;
+
+		tex.wrap_s = GL_CLAMP_TO_BORDER;
+		tex.wrap_t = GL_CLAMP_TO_BORDER;
+
+		tex.mag_filter = mag_filter;
+		tex.min_filter = min_filter;
+
+		tex.is_sRGB = false;
+
+		array_textures->add(tex);
+	}
+
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+	free(gl_textures);
+	free(pages);
+
+	stats.upload_seconds = atlas_seconds(atlas_clock::now() - pack_end).count();
+
+	data->array_textures = array_textures;
+	data->face_tex_indices = new custom_arrays::array_t<TexIndex>(face_indices, textures.num_faces);
+	create_ptex_face_data_buffer(name, face_indices, textures.num_faces, &data->face_data_buffer, &data->face_data_texture);
+	data->face_placeholder_texture = 0;
+	data->gutter_array_textures = NULL;
+	data->gutter_face_data_buffer = 0;
+	data->gutter_face_data_texture = 0;
+	data->gutter_width = 0;
+
+	print_ptex_atlas_stats(name, &stats);
+
+	return true;
+}
+
+#define MEGABYTES(bytes) ((bytes) / (1024.0 * 1024.0))
+
+void print_ptex_atlas_stats(const char* name, ptex_atlas_stats* stats)
+{
+	printf("Packed %s into %d %dx%d atlas pages: %d arrays instead of %d, %d faces share a page, %.1f%% of the pages used (%.2fMB -> %.2fMB at level 0)\n",
+		name, stats->num_pages, stats->page_size, stats->page_size, stats->num_arrays, stats->resolution_arrays, stats->packed_faces,
+		100.0 * stats->face_texels / (double)stats->page_texels,
+		MEGABYTES(stats->face_texels * sizeof(rgba8_t)), MEGABYTES(stats->page_texels * sizeof(rgba8_t)));
+
+	printf("  Layout %.2fms, face mips and packing %.2fms on %d threads, upload %.2fms\n",
+		stats->layout_seconds * 1000.0, stats->pack_seconds * 1000.0, jobs::num_workers(), stats->upload_seconds * 1000.0);
+}
@@ -0,0 +1,54 @@
+#ifndef PTEX_ATLAS_H
+#define PTEX_ATLAS_H
+
+#include "ptex_utils.hh"
+
+// Optional packing mode that puts every face of a model into a single array of square pages
+// instead of one array per face resolution, so the number of sampler bindings doesn't grow with
+// the number of distinct resolutions in the file. Only models with more pages than the driver
+// allows array layers need more than one array. A page is as big as the largest face dimension
+// and the smaller faces are packed into power of two aligned sub rectangles by a 2d buddy allocator.
+// The alignment keeps every mip level of a face in its own rectangle of the page's mip level,
+// the page levels are built from the faces' cpu mips (see ptex_mips.hh). TexIndex::tile has the
+// position of each face.
+//
+// The shaders emulate the zero border of CLAMP_TO_BORDER inside the face's rectangle and limit
+// the lod to the levels where the face is at least a texel in both directions, the coarser page
+// texels mix faces and are never sampled. Packed faces are filtered trilinearly with an explicit
+// lod, so they don't get anisotropic filtering.
+
+extern bool g_ptex_atlas_faces;
+
+typedef struct {
+	int page_size;
+	int num_pages;
+	// Arrays the pages are split over, see ptex_max_array_layers.
+	int num_arrays;
+	// Arrays the faces would need without the atlas.
+	int resolution_arrays;
+	int packed_faces;
+
+	// Level 0 texels of all the faces and of all the pages.
+	uint64_t face_texels;
+	uint64_t page_texels;
+
+	double layout_seconds;
+	// Building the face mips and copying them into the pages, not including the upload.
+	double pack_seconds;
+	double upload_seconds;
+} ptex_atlas_stats;
+
+// Assigns every face a page and tile. Page p is slice p % max_layers of array p / max_layers.
+// Returns false if the largest face is bigger than the tile encoding allows.
+bool build_ptex_atlas_layout(Ptex::PtexTexture* ptex, int max_layers, TexIndex* face_indices, int* page_log2, ptex_atlas_stats* stats);
+
+// create_gl_texture_arrays for g_ptex_atlas_faces, returns false if the faces don't fit in an atlas.
+bool create_gl_atlas_arrays(const char* name, gl_ptex_textures textures, GLenum mag_filter, GLenum min_filter, gl_ptex_data* data);
+
+void print_ptex_atlas_stats(const char* name, ptex_atlas_stats* stats);
+
+// Checked before a model's textures are loaded. Returns false, printing why, if the faces need more
+// than PTEX_MAX_SAMPLED_ARRAYS arrays both with one array per resolution and in the atlas.
+bool ptex_arrays_fit(const char* name, Ptex::PtexTexture* ptex);
+
+#endif // !PTEX_ATLAS_H
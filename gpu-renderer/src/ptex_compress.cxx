@@ -0,0 +1,323 @@
+#include "ptex_compress.hh"
+
+#include "ptex_pack.hh"
+#include "jobs.hh"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <vector>
+
+block_format g_ptex_block_compression = BLOCK_FORMAT_NONE;
+
+using compress_clock = std::chrono::high_resolution_clock;
+using compress_seconds = std::chrono::duration<double>;
+
+const char* block_format_name(block_format format)
+{
+	switch (format)
+	{
+	case BLOCK_FORMAT_NONE: return "RGBA8";
+	case BLOCK_FORMAT_BC1: return "BC1";
+	case BLOCK_FORMAT_BC7: return "BC7";
+	default: assert(false); return "unknown";
+	}
+}
+
+GLenum block_format_internal_format(block_format format)
+{
+	switch (format)
+	{
+	case BLOCK_FORMAT_NONE: return GL_RGBA8;
+	// The RGBA variant so the border color keeps its zero alpha, the encoder only writes
+	// the 4 color mode so every texel is still opaque.
+	case BLOCK_FORMAT_BC1: return GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
+	case BLOCK_FORMAT_BC7: return GL_COMPRESSED_RGBA_BPTC_UNORM;
+	default: assert(false); return GL_NONE;
+	}
+}
+
+block_format internal_format_block_format(GLenum internal_format)
+{
+	switch (internal_format)
+	{
+	case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT: return BLOCK_FORMAT_BC1;
+	case GL_COMPRESSED_RGBA_BPTC_UNORM: return BLOCK_FORMAT_BC7;
+	default:
+		assert(ptex_texel_size(internal_format) != 0);
+		return BLOCK_FORMAT_NONE;
+	}
+}
+
+static bool is_block_format_supported(block_format format)
+{
+	switch (format)
+	{
+	case BLOCK_FORMAT_NONE: return true;
+	case BLOCK_FORMAT_BC1: return has_texture_compression_s3tc;
+	case BLOCK_FORMAT_BC7: return has_texture_compression_bptc;
+	default: return false;
+	}
+}
+
+bool is_ptex_array_format_supported(GLenum internal_format)
+{
+	switch (internal_format)
+	{
+	case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT: return has_texture_compression_s3tc;
+	case GL_COMPRESSED_RGBA_BPTC_UNORM: return has_texture_compression_bptc;
+	default: return ptex_texel_size(internal_format) != 0;
+	}
+}
+
+static void level_size(int width, int height, int level, int* level_width, int* level_height)
+{
+	*level_width = width >> level;
+	*level_height = height >> level;
+	if (*level_width < 1) *level_width = 1;
+	if (*level_height < 1) *level_height = 1;
+}
+
+void upload_ptex_array_level(GLenum internal_format, int level, int width, int height, int slices, const void* data)
+{
+	int level_width, level_height;
+	level_size(width, height, level, &level_width, &level_height);
+
+	if (ptex_texel_size(internal_format) != 0)
+	{
+		GLenum format, type;
+		ptex_texel_transfer_format(internal_format, &format, &type);
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, level, internal_format, level_width, level_height, slices, 0, format, type, data);
+	}
+	else
+	{
+		// Compressed formats can't be allocated without data, upload zeros instead.
+		GLsizei size = (GLsizei)ptex_pack_level_size(internal_format, width, height, slices, level);
+		void* zeros = NULL;
+		if (data == NULL)
+		{
+			zeros = calloc(1, size);
+			assert(zeros != NULL);
+			data = zeros;
+		}
+
+		glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, level, internal_format, level_width, level_height, slices, 0, size, data);
+
+		free(zeros);
+	}
+}
+
+void upload_ptex_array_slice(GLenum internal_format, int level, int width, int height, int slice, const void* data)
+{
+	int level_width, level_height;
+	level_size(width, height, level, &level_width, &level_height);
+
+	if (ptex_texel_size(internal_format) != 0)
+	{
+		GLenum format, type;
+		ptex_texel_transfer_format(internal_format, &format, &type);
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, slice, level_width, level_height, 1, format, type, data);
+	}
+	else
+	{
+		GLsizei size = (GLsizei)ptex_pack_level_size(internal_format, width, height, 1, level);
+		glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, slice, level_width, level_height, 1, internal_format, size, data);
+	}
+}
+
+void read_ptex_array_level(GLenum internal_format, int level, void* data)
+{
+	if (ptex_texel_size(internal_format) != 0)
+	{
+		GLenum format, type;
+		ptex_texel_transfer_format(internal_format, &format, &type);
+		glGetTexImage(GL_TEXTURE_2D_ARRAY, level, format, type, data);
+	}
+	else
+	{
+		glGetCompressedTexImage(GL_TEXTURE_2D_ARRAY, level, data);
+	}
+}
+
+static bool is_block_compressible(int width, int height)
+{
+	return width >= 4 && height >= 4 && width * height > 16;
+}
+
+static bool has_alpha(const rgba8_t* texels, uint64_t count)
+{
+	for (uint64_t i = 0; i < count; i++)
+	{
+		if (texels[i].a != 255)
+			return true;
+	}
+	return false;
+}
+
+bool compress_ptex_arrays(const char* name, gl_ptex_data* data, block_format format, ptex_compression_stats* stats)
+{
+	memset(stats, 0, sizeof(*stats));
+	stats->threads = jobs::num_workers();
+
+	if (format == BLOCK_FORMAT_NONE)
+		return false;
+
+	// Faces packed into atlas pages only have a few texels on a side at their coarse levels,
+	// a block would mix them with their neighbors so those arrays are kept as RGBA8.
+	std::vector<bool> has_packed_tiles(data->array_textures->size, false);
+	for (int face = 0; face < data->face_tex_indices->size; face++)
+	{
+		const TexIndex* index = &data->face_tex_indices->arr[face];
+		if (index->texIndex != PTEX_CONSTANT_FACE && index->tile != 0)
+			has_packed_tiles[index->texIndex] = true;
+	}
+
+	glActiveTexture(GL_TEXTURE0);
+
+	for (int i = 0; i < data->array_textures->size; i++)
+	{
+		array_texture_t* tex = &data->array_textures->arr[i];
+		int levels = ptex_num_mip_levels(tex->width, tex->height);
+
+		uint64_t array_size = 0;
+		for (int level = 0; level < levels; level++)
+		{
+			array_size += ptex_pack_level_size(tex->internal_format, tex->width, tex->height, tex->slices, level);
+		}
+
+		stats->uncompressed_bytes += array_size;
+
+		if (tex->internal_format != GL_RGBA8 || is_block_compressible(tex->width, tex->height) == false)
+		{
+			stats->compressed_bytes += array_size;
+			stats->arrays_skipped++;
+			continue;
+		}
+
+		if (has_packed_tiles[i])
+		{
+			printf("%dx%d textures of %s are atlas pages, keeping them as RGBA8 so the blocks don't bleed between faces.\n", tex->width, tex->height, name);
+
+			stats->compressed_bytes += array_size;
+			stats->arrays_skipped++;
+			continue;
+		}
+
+		glBindTexture(GL_TEXTURE_2D_ARRAY, tex->texture);
+
+		rgba8_t* level_texels[PTEX_PACK_MAX_LEVELS];
+		for (int level = 0; level < levels; level++)
+		{
+			level_texels[level] = (rgba8_t*)malloc(ptex_pack_level_size(GL_RGBA8, tex->width, tex->height, tex->slices, level));
+			assert(level_texels[level] != NULL);
+
+			read_ptex_array_level(GL_RGBA8, level, level_texels[level]);
+		}
+
+		block_format array_format = format;
+		if (array_format == BLOCK_FORMAT_BC1 && has_alpha(level_texels[0], (uint64_t)tex->width * tex->height * tex->slices))
+			array_format = BLOCK_FORMAT_BC7;
+
+		if (is_block_format_supported(array_format) == false)
+		{
+			printf("%s is not supported by the driver, keeping %dx%d textures of %s as RGBA8.\n", block_format_name(array_format), tex->width, tex->height, name);
+
+			for (int level = 0; level < levels; level++)
+			{
+				free(level_texels[level]);
+			}
+
+			stats->compressed_bytes += array_size;
+			stats->arrays_skipped++;
+			continue;
+		}
+
+		GLenum internal_format = block_format_internal_format(array_format);
+
+		uint8_t* level_blocks[PTEX_PACK_MAX_LEVELS];
+		for (int level = 0; level < levels; level++)
+		{
+			level_blocks[level] = (uint8_t*)malloc(ptex_pack_level_size(internal_format, tex->width, tex->height, tex->slices, level));
+			assert(level_blocks[level] != NULL);
+		}
+
+		compress_clock::time_point start = compress_clock::now();
+
+		jobs::parallel_for(tex->slices, [&](int slice) {
+			for (int level = 0; level < levels; level++)
+			{
+				int level_width, level_height;
+				level_size(tex->width, tex->height, level, &level_width, &level_height);
+
+				const rgba8_t* texels = level_texels[level] + (uint64_t)slice * level_width * level_height;
+				uint8_t* blocks = level_blocks[level] + slice * ptex_pack_level_size(internal_format, tex->width, tex->height, 1, level);
+
+				encode_image(array_format, texels, level_width, level_height, blocks);
+			}
+		});
+
+		stats->encode_seconds += compress_seconds(compress_clock::now() - start).count();
+
+		GLuint texture;
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+
+		if (has_KHR_debug)
+		{
+			char label[256];
+			sprintf(label, "ARRTEX: ptex%d %dx%d (%s)", i, tex->width, tex->height, block_format_name(array_format));
+			glObjectLabel(GL_TEXTURE, texture, -1, label);
+		}
+
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, levels - 1);
+
+		for (int level = 0; level < levels; level++)
+		{
+			upload_ptex_array_level(internal_format, level, tex->width, tex->height, tex->slices, level_blocks[level]);
+
+			int level_width, level_height;
+			level_size(tex->width, tex->height, level, &level_width, &level_height);
+
+			stats->encoded_texels += (uint64_t)level_width * level_height * tex->slices;
+			stats->encoded_bytes += ptex_pack_level_size(GL_RGBA8, tex->width, tex->height, tex->slices, level);
+			stats->compressed_bytes += ptex_pack_level_size(internal_format, tex->width, tex->height, tex->slices, level);
+
+			free(level_texels[level]);
+			free(level_blocks[level]);
+		}
+
+		set_ptex_array_texture_params(tex->mag_filter, tex->min_filter);
+
+		glDeleteTextures(1, &tex->texture);
+		tex->texture = texture;
+		tex->internal_format = internal_format;
+
+		stats->arrays_compressed++;
+	}
+
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+	return stats->arrays_compressed > 0;
+}
+
+#define MEGABYTES(bytes) ((bytes) / (1024.0 * 1024.0))
+
+void print_ptex_compression_stats(const char* name, block_format format, ptex_compression_stats* stats)
+{
+	printf("Compressed textures for %s to %s: %.2fMB -> %.2fMB of VRAM (%.2f:1), %d arrays compressed, %d kept as they were\n",
+		name, block_format_name(format),
+		MEGABYTES(stats->uncompressed_bytes), MEGABYTES(stats->compressed_bytes),
+		stats->uncompressed_bytes / (double)stats->compressed_bytes,
+		stats->arrays_compressed, stats->arrays_skipped);
+
+	if (stats->arrays_compressed > 0)
+	{
+		printf("  Encoded %.2fM texels in %.2fms on %d threads: %.2fMtexels/s, %.2fMB/s of RGBA8\n",
+			stats->encoded_texels / 1e6, stats->encode_seconds * 1000.0, stats->threads,
+			stats->encoded_texels / 1e6 / stats->encode_seconds,
+			MEGABYTES(stats->encoded_bytes) / stats->encode_seconds);
+	}
+}
@@ -0,0 +1,57 @@
+#ifndef PTEX_COMPRESS_H
+#define PTEX_COMPRESS_H
+
+#include "ptex_utils.hh"
+#include "block_compress.hh"
+
+// Optional packing step that re-encodes the RGBA8 texture arrays of a model
+// to BC1 or BC7 on the job threads. Every mip level is encoded, the results
+// are what the .ptexpack and .ptexlz caches store so the encode only happens once.
+//
+// Arrays whose faces are 4x4 or smaller are kept as RGBA8, a face that is a single
+// block only saves a few bytes and loses most of its detail to the block's end points.
+// Mip levels smaller than a block are padded by repeating their edge texels.
+// Atlas pages (see ptex_atlas.hh) are kept as RGBA8 too, their faces get smaller than a block
+// at the coarse levels and the blocks would mix neighboring faces.
+// BC1 is only used for opaque arrays, arrays with alpha are encoded as BC7 instead.
+
+typedef struct {
+	// VRAM used by all the arrays before and after compressing.
+	uint64_t uncompressed_bytes;
+	uint64_t compressed_bytes;
+
+	uint64_t encoded_texels;
+	uint64_t encoded_bytes;
+	// Wall clock time spent encoding, not including the readback and upload.
+	double encode_seconds;
+	int threads;
+
+	int arrays_compressed;
+	int arrays_skipped;
+} ptex_compression_stats;
+
+// BLOCK_FORMAT_NONE leaves the arrays as RGBA8.
+extern block_format g_ptex_block_compression;
+
+const char* block_format_name(block_format format);
+
+GLenum block_format_internal_format(block_format format);
+
+// BLOCK_FORMAT_NONE for the uncompressed formats.
+block_format internal_format_block_format(GLenum internal_format);
+
+// True for the uncompressed formats (see ptex_array_format) and the compressed formats the driver supports.
+bool is_ptex_array_format_supported(GLenum internal_format);
+
+// Uploads or reads back all slices of one mip level of the bound GL_TEXTURE_2D_ARRAY.
+// width and height are the size of level 0.
+void upload_ptex_array_level(GLenum internal_format, int level, int width, int height, int slices, const void* data);
+void upload_ptex_array_slice(GLenum internal_format, int level, int width, int height, int slice, const void* data);
+void read_ptex_array_level(GLenum internal_format, int level, void* data);
+
+// Returns true if any array was compressed. Only RGBA8 arrays are compressed, the others are left as they are.
+bool compress_ptex_arrays(const char* name, gl_ptex_data* data, block_format format, ptex_compression_stats* stats);
+
+void print_ptex_compression_stats(const char* name, block_format format, ptex_compression_stats* stats);
+
+#endif // !PTEX_COMPRESS_H
@@ -0,0 +1,138 @@
+#include "ptex_dedup.hh"
+
+#include "ptex_pack.hh"
+#include "jobs.hh"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <unordered_map>
+
+bool g_ptex_dedup_faces = true;
+
+using dedup_clock = std::chrono::high_resolution_clock;
+using dedup_seconds = std::chrono::duration<double>;
+
+bool is_constant_face(const rgba8_t* texels, int count)
+{
+	for (int i = 1; i < count; i++)
+	{
+		if (memcmp(&texels[i], &texels[0], sizeof(rgba8_t)) != 0)
+			return false;
+	}
+	return true;
+}
+
+void dedup_ptex_faces(gl_ptex_textures textures, GLenum internal_format, TexIndex* face_indices,
+	custom_arrays::array_t<ptex_duplicate_face>* duplicates, ptex_dedup_stats* stats)
+{
+	*stats = {};
+
+	if (g_ptex_dedup_faces == false || ptex_data_is_rgba8(textures.ptex->dataType()) == false)
+		return;
+
+	dedup_clock::time_point start = dedup_clock::now();
+
+	for (int i = 0; i < textures.num_resolutions; i++)
+	{
+		ptex_res_textures* res_textures = &textures.resolutions[i];
+		Ptex::Res res = res_textures->res;
+		int texels = res.size();
+		int count = res_textures->num_textures;
+
+		uint64_t slice_size = 0;
+		for (int level = 0; level < ptex_num_mip_levels(res.u(), res.v()); level++)
+			slice_size += ptex_pack_level_size(internal_format, res.u(), res.v(), 1, level);
+
+		uint64_t* hashes = alloc_array(uint64_t, count);
+		bool* constant = alloc_array(bool, count);
+		jobs::parallel_for(count, [&](int j) {
+			const ptex_face_texture* texture = &res_textures->textures[j];
+			const rgba8_t* data = (const rgba8_t*)texture->data;
+
+			constant[j] = textures.ptex->getFaceInfo(texture->face_id).isConstant() || is_constant_face(data, texels);
+			hashes[j] = constant[j] ? 0 : hash_fnv1a(data, texels * sizeof(rgba8_t));
+		});
+
+		// The first face with a hash keeps its slice. A different face with the same hash
+		// keeps its own slice too, it just doesn't get to be shared.
+		std::unordered_map<uint64_t, int> originals;
+
+		// Faces that keep their slice are moved to the front, in the order they were in.
+		int kept = 0;
+		for (int j = 0; j < count; j++)
+		{
+			ptex_face_texture* texture = &res_textures->textures[j];
+
+			if (constant[j])
+			{
+				face_indices[texture->face_id] = make_constant_tex_index(*(const rgba8_t*)texture->data, res, texture->neighbors, texture->edges);
+				free(texture->data);
+				texture->data = NULL;
+
+				stats->constant_faces++;
+				stats->saved_bytes += slice_size;
+				continue;
+			}
+
+			auto found = originals.find(hashes[j]);
+			if (found != originals.end())
+			{
+				const ptex_face_texture* original = &res_textures->textures[found->second];
+				if (memcmp(original->data, texture->data, texels * sizeof(rgba8_t)) == 0)
+				{
+					free(texture->data);
+					texture->data = NULL;
+
+					ptex_duplicate_face duplicate;
+					duplicate.texture = *texture;
+					duplicate.original = original->face_id;
+					duplicates->add(duplicate);
+
+					stats->duplicate_faces++;
+					stats->saved_bytes += slice_size;
+					continue;
+				}
+			}
+			else
+			{
+				originals[hashes[j]] = kept;
+			}
+
+			std::swap(res_textures->textures[kept], res_textures->textures[j]);
+			kept++;
+		}
+
+		// The removed faces stay behind the kept ones.
+		res_textures->num_textures = kept;
+
+		free(hashes);
+		free(constant);
+	}
+
+	stats->seconds = dedup_seconds(dedup_clock::now() - start).count();
+}
+
+void resolve_ptex_duplicates(custom_arrays::array_t<ptex_duplicate_face>* duplicates, TexIndex* face_indices)
+{
+	for (int i = 0; i < duplicates->size; i++)
+	{
+		ptex_duplicate_face* duplicate = &duplicates->arr[i];
+		const TexIndex* original = &face_indices[duplicate->original];
+
+		face_indices[duplicate->texture.face_id] = make_tex_index(original->texIndex, original->texSilce, duplicate->texture.neighbors, duplicate->texture.edges);
+	}
+}
+
+void print_ptex_dedup_stats(const char* name, ptex_dedup_stats* stats)
+{
+	if (stats->constant_faces == 0 && stats->duplicate_faces == 0)
+		return;
+
+	printf("%s has %d constant faces drawn without a texture fetch and %d faces sharing a slice, %.2fMB saved in %.2fms\n",
+		name, stats->constant_faces, stats->duplicate_faces, stats->saved_bytes / (1024.0 * 1024.0), stats->seconds * 1000.0);
+}
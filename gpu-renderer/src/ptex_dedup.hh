@@ -0,0 +1,42 @@
+#ifndef PTEX_DEDUP_H
+#define PTEX_DEDUP_H
+
+#include "ptex_utils.hh"
+
+// Faces that don't need a slice of their own. Constant faces (all texels the same, which is
+// what Ptex::FaceInfo::isConstant marks) become an inline color in the face table that the
+// shaders use without fetching a texel, see make_constant_tex_index. Faces with the same texels
+// as an earlier face of their resolution share its slice, found by content hash.
+// Only uint8 files are deduplicated, the inline color is RGBA8.
+
+extern bool g_ptex_dedup_faces;
+
+typedef struct {
+	int constant_faces;
+	int duplicate_faces;
+	// Memory the removed faces would have taken in the arrays, mip levels included.
+	uint64_t saved_bytes;
+	double seconds;
+} ptex_dedup_stats;
+
+typedef struct {
+	ptex_face_texture texture;
+	// The face with the same texels that keeps its slice.
+	int original;
+} ptex_duplicate_face;
+
+// True if all count texels are the same.
+bool is_constant_face(const rgba8_t* texels, int count);
+
+// Removes the constant and duplicate faces from the resolutions of textures, so they don't get slices,
+// and frees their data.
+// The face table entries of the constant faces are written to face_indices right away, the duplicates
+// are added to duplicates and get theirs from resolve_ptex_duplicates once the others have slices.
+void dedup_ptex_faces(gl_ptex_textures textures, GLenum internal_format, TexIndex* face_indices,
+	custom_arrays::array_t<ptex_duplicate_face>* duplicates, ptex_dedup_stats* stats);
+
+void resolve_ptex_duplicates(custom_arrays::array_t<ptex_duplicate_face>* duplicates, TexIndex* face_indices);
+
+void print_ptex_dedup_stats(const char* name, ptex_dedup_stats* stats);
+
+#endif // !PTEX_DEDUP_H
@@ -0,0 +1,375 @@
+#include "ptex_gutter.hh"
+
+#include "util.hh"
+#include "jobs.hh"
+
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+
+int g_ptex_gutter_width = 2;
+
+using gutter_clock = std::chrono::high_resolution_clock;
+using gutter_seconds = std::chrono::duration<double>;
+
+typedef struct {
+	int width, height;
+	rgba8_t* texels;
+} face_image_t;
+
+// Point on the edge of a face in normalized face coordinates. s runs along the edge
+// in counter clockwise order and depth goes into the face.
+static void edge_point(int edge, float s, float depth, float* u, float* v)
+{
+	switch (edge)
+	{
+	case 0: *u = s;            *v = depth;        break;
+	case 1: *u = 1.0f - depth; *v = s;            break;
+	case 2: *u = 1.0f - s;     *v = 1.0f - depth; break;
+	case 3: *u = depth;        *v = 1.0f - s;     break;
+	default: assert(false);
+	}
+}
+
+static int clamp_index(int i, int size)
+{
+	return i < 0 ? 0 : (i >= size ? size - 1 : i);
+}
+
+// Box filters the texels covered by the rectangle [u - du, u + du] x [v - dv, v + dv].
+// A rectangle smaller than a texel picks the texel it's in.
+static rgba8_t sample_box(const face_image_t* face, float u, float v, float du, float dv)
+{
+	int x0 = clamp_index((int)floorf((u - du) * face->width), face->width);
+	int x1 = clamp_index((int)ceilf((u + du) * face->width) - 1, face->width);
+	int y0 = clamp_index((int)floorf((v - dv) * face->height), face->height);
+	int y1 = clamp_index((int)ceilf((v + dv) * face->height) - 1, face->height);
+	if (x1 < x0) x1 = x0;
+	if (y1 < y0) y1 = y0;
+
+	uint32_t sum[4] = { 0, 0, 0, 0 };
+	for (int y = y0; y <= y1; y++)
+	{
+		for (int x = x0; x <= x1; x++)
+		{
+			rgba8_t texel = face->texels[y * face->width + x];
+			sum[0] += texel.r;
+			sum[1] += texel.g;
+			sum[2] += texel.b;
+			sum[3] += texel.a;
+		}
+	}
+
+	uint32_t count = (x1 - x0 + 1) * (y1 - y0 + 1);
+	rgba8_t result;
+	result.r = (uint8_t)((sum[0] + count / 2) / count);
+	result.g = (uint8_t)((sum[1] + count / 2) / count);
+	result.b = (uint8_t)((sum[2] + count / 2) / count);
+	result.a = (uint8_t)((sum[3] + count / 2) / count);
+	return result;
+}
+
+// Position in the padded slice of the border texel at index t along edge (counter clockwise)
+// and d texels out from it.
+static void gutter_position(int edge, int t, int d, int width, int height, int gutter, int* x, int* y)
+{
+	switch (edge)
+	{
+	case 0: *x = gutter + t;               *y = gutter - 1 - d;          break;
+	case 1: *x = gutter + width + d;       *y = gutter + t;              break;
+	case 2: *x = gutter + width - 1 - t;   *y = gutter + height + d;     break;
+	case 3: *x = gutter - 1 - d;           *y = gutter + height - 1 - t; break;
+	default: assert(false);
+	}
+}
+
+static void pad_face(const face_image_t* faces, const TexIndex* index, int face, int gutter, rgba8_t* out)
+{
+	const face_image_t* image = &faces[face];
+	int width = image->width;
+	int height = image->height;
+	int padded_width = width + 2 * gutter;
+	int padded_height = height + 2 * gutter;
+
+	for (int y = 0; y < height; y++)
+	{
+		memcpy(&out[(y + gutter) * padded_width + gutter], &image->texels[y * width], width * sizeof(rgba8_t));
+	}
+
+	for (int edge = 0; edge < 4; edge++)
+	{
+		int along_res = (edge & 1) ? height : width;
+		int across_res = (edge & 1) ? width : height;
+
+		// Half the size of one of this face's texels, in normalized units along and across the edge.
+		float half_along = 0.5f / along_res;
+		float half_across = 0.5f / across_res;
+
+		uint32_t neighbor = index->neighborIndexes[edge];
+		int adjedge = index->neighborTransforms[edge] & 3;
+
+		for (int d = 0; d < gutter; d++)
+		{
+			for (int t = 0; t < along_res; t++)
+			{
+				float s = (t + 0.5f) / along_res;
+
+				rgba8_t texel;
+				float u, v;
+				if (neighbor == NO_PTEX_NEIGHBOR)
+				{
+					// Mesh boundary, clamp to the face's own edge.
+					edge_point(edge, s, 0, &u, &v);
+					texel = sample_box(image, u, v, 0, 0);
+				}
+				else
+				{
+					// The shared edge runs the other way around the neighbor.
+					edge_point(adjedge, 1.0f - s, (d + 0.5f) / across_res, &u, &v);
+
+					float du = (adjedge & 1) ? half_across : half_along;
+					float dv = (adjedge & 1) ? half_along : half_across;
+					texel = sample_box(&faces[neighbor], u, v, du, dv);
+				}
+
+				int x, y;
+				gutter_position(edge, t, d, width, height, gutter, &x, &y);
+				out[y * padded_width + x] = texel;
+			}
+		}
+	}
+
+	// Corners average the nearest texel of the two borders they touch.
+	for (int y = 0; y < padded_height; y++)
+	{
+		bool outside_y = y < gutter || y >= gutter + height;
+		if (outside_y == false)
+			continue;
+
+		for (int x = 0; x < padded_width; x++)
+		{
+			bool outside_x = x < gutter || x >= gutter + width;
+			if (outside_x == false)
+				continue;
+
+			int inner_x = clamp_index(x - gutter, width) + gutter;
+			int inner_y = clamp_index(y - gutter, height) + gutter;
+
+			rgba8_t a = out[y * padded_width + inner_x];
+			rgba8_t b = out[inner_y * padded_width + x];
+
+			rgba8_t corner;
+			corner.r = (uint8_t)((a.r + b.r + 1) / 2);
+			corner.g = (uint8_t)((a.g + b.g + 1) / 2);
+			corner.b = (uint8_t)((a.b + b.b + 1) / 2);
+			corner.a = (uint8_t)((a.a + b.a + 1) / 2);
+			out[y * padded_width + x] = corner;
+		}
+	}
+}
+
+bool create_gutter_texture_arrays(const char* name, Ptex::PtexTexture* ptex, int gutter_width, GLenum mag_filter, GLenum min_filter, gl_ptex_data* data)
+{
+	assert(gutter_width >= 1 && gutter_width <= PTEX_GUTTER_MAX_WIDTH);
+	assert(data->gutter_array_textures == NULL);
+
+	if (ptex->dataType() != Ptex::DataType::dt_uint8 || ptex->meshType() != Ptex::MeshType::mt_quad)
+	{
+		printf("Gutter textures for %s need an 8 bit quad mesh ptex file.\n", name);
+		return false;
+	}
+
+	int gutter_arrays = ptex_resolution_array_count(ptex, ptex_max_array_layers());
+	if (gutter_arrays > PTEX_GUTTER_MAX_ARRAYS)
+	{
+		printf("Gutter textures for %s need %d arrays, the gutter shader samples at most %d.\n", name, gutter_arrays, PTEX_GUTTER_MAX_ARRAYS);
+		return false;
+	}
+
+	gutter_clock::time_point start = gutter_clock::now();
+
+	int num_faces = data->face_tex_indices->size;
+	int num_channels = ptex->numChannels();
+	const TexIndex* face_table = data->face_tex_indices->arr;
+
+	face_image_t* faces = alloc_array(face_image_t, num_faces);
+
+	jobs::parallel_for(num_faces, [&](int face) {
+		Ptex::Res res = ptex->getFaceInfo(face).res;
+
+		void* face_data = malloc(res.size() * num_channels);
+		assert(face_data != NULL);
+		ptex->getData(face, face_data, 0);
+
+		faces[face].width = res.u();
+		faces[face].height = res.v();
+		faces[face].texels = (rgba8_t*)data_to_rgba(face_data, res.u(), res.v(), num_channels);
+
+		free(face_data);
+	});
+
+	// One array per face resolution, in the order extract_textures uses. A full array
+	// starts a new one of the same resolution, so resolutions can be in the list more than once.
+	int max_layers = ptex_max_array_layers();
+	custom_arrays::array_t<Ptex::Res> resolutions(8);
+	custom_arrays::array_t<int> slices(8);
+
+	TexIndex* gutter_face_table = new TexIndex[num_faces];
+	for (int face = 0; face < num_faces; face++)
+	{
+		Ptex::Res res = ptex->getFaceInfo(face).res;
+
+		int res_index = -1;
+		for (int r = 0; r < resolutions.size; r++)
+		{
+			if (resolutions[r] == res && slices[r] < max_layers)
+			{
+				res_index = r;
+				break;
+			}
+		}
+
+		if (res_index == -1)
+		{
+			res_index = resolutions.size;
+			resolutions.add(res);
+			slices.add(0);
+		}
+
+		gutter_face_table[face] = face_table[face];
+		gutter_face_table[face].texIndex = res_index;
+		gutter_face_table[face].texSilce = slices[res_index]++;
+		gutter_face_table[face].tile = 0;
+	}
+
+	int num_arrays = resolutions.size;
+
+	rgba8_t** slabs = alloc_array(rgba8_t*, num_arrays);
+	for (int i = 0; i < num_arrays; i++)
+	{
+		uint64_t slice_texels = (uint64_t)(resolutions[i].u() + 2 * gutter_width) * (resolutions[i].v() + 2 * gutter_width);
+
+		slabs[i] = (rgba8_t*)malloc(slice_texels * slices[i] * sizeof(rgba8_t));
+		assert(slabs[i] != NULL);
+	}
+
+	jobs::parallel_for(num_faces, [&](int face) {
+		const TexIndex* index = &gutter_face_table[face];
+		Ptex::Res res = resolutions[index->texIndex];
+
+		uint64_t slice_texels = (uint64_t)(res.u() + 2 * gutter_width) * (res.v() + 2 * gutter_width);
+		pad_face(faces, index, face, gutter_width, slabs[index->texIndex] + index->texSilce * slice_texels);
+	});
+
+	double pad_seconds = gutter_seconds(gutter_clock::now() - start).count();
+
+	GLuint* gl_textures = alloc_array(GLuint, num_arrays);
+	glGenTextures(num_arrays, gl_textures);
+
+	glActiveTexture(GL_TEXTURE0);
+
+	custom_arrays::array_t<array_texture_t>* array_textures = new custom_arrays::array_t<array_texture_t>(num_arrays);
+
+	uint64_t bytes = 0;
+	for (int i = 0; i < num_arrays; i++)
+	{
+		int width = resolutions[i].u();
+		int height = resolutions[i].v();
+		int padded_width = width + 2 * gutter_width;
+		int padded_height = height + 2 * gutter_width;
+
+		glBindTexture(GL_TEXTURE_2D_ARRAY, gl_textures[i]);
+
+		if (has_KHR_debug)
+		{
+			char label[256];
+			sprintf(label, "ARRTEX: ptex%d %dx%d (gutter %d)", i, width, height, gutter_width);
+			glObjectLabel(GL_TEXTURE, gl_textures[i], -1, label);
+		}
+
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, padded_width, padded_height, slices[i], 0, GL_RGBA, GL_UNSIGNED_BYTE, slabs[i]);
+		glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+
+		set_ptex_array_texture_params(mag_filter, min_filter);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+		bytes += (uint64_t)padded_width * padded_height * slices[i] * sizeof(rgba8_t);
+
+		array_texture_t tex;
+
+		tex.width = padded_width;
+		tex.height = padded_height;
+		tex.slices = slices[i];
+
+		tex.texture = gl_textures[i];
+		tex.internal_format = GL_RGBA8;
+
+		tex.wrap_s = GL_CLAMP_TO_EDGE;
+		tex.wrap_t = GL_CLAMP_TO_EDGE;
+
+		tex.mag_filter = mag_filter;
+		tex.min_filter = min_filter;
+
+		tex.is_sRGB = false;
+
+		array_textures->add(tex);
+
+		free(slabs[i]);
+	}
+
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+	for (int i = 0; i < num_faces; i++)
+	{
+		free(faces[i].texels);
+	}
+	free(faces);
+	free(slabs);
+	free(gl_textures);
+	free(resolutions.arr);
+	free(slices.arr);
+
+	char table_name[128];
+	snprintf(table_name, sizeof(table_name), "%s gutter", name);
+	create_ptex_face_data_buffer(table_name, gutter_face_table, num_faces, &data->gutter_face_data_buffer, &data->gutter_face_data_texture);
+	delete[] gutter_face_table;
+
+	data->gutter_array_textures = array_textures;
+	data->gutter_width = gutter_width;
+
+	double total_seconds = gutter_seconds(gutter_clock::now() - start).count();
+
+	printf("Packed gutter textures for %s with a %d texel border in %.2fms (%.2fms uploading), %.2fMB\n",
+		name, gutter_width,
+		total_seconds * 1000.0, (total_seconds - pad_seconds) * 1000.0,
+		bytes / (1024.0 * 1024.0));
+
+	return true;
+}
+
+void destroy_gutter_texture_arrays(gl_ptex_data* data)
+{
+	if (data->gutter_array_textures == NULL)
+		return;
+
+	for (int i = 0; i < data->gutter_array_textures->size; i++)
+	{
+		glDeleteTextures(1, &data->gutter_array_textures->arr[i].texture);
+	}
+
+	free(data->gutter_array_textures->arr);
+	delete data->gutter_array_textures;
+
+	glDeleteTextures(1, &data->gutter_face_data_texture);
+	glDeleteBuffers(1, &data->gutter_face_data_buffer);
+
+	data->gutter_array_textures = NULL;
+	data->gutter_face_data_buffer = 0;
+	data->gutter_face_data_texture = 0;
+	data->gutter_width = 0;
+}
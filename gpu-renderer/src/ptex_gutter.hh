@@ -0,0 +1,31 @@
+#ifndef PTEX_GUTTER_H
+#define PTEX_GUTTER_H
+
+#include "ptex_utils.hh"
+
+// Texture arrays for the gutter method. Every face is stored with a border of
+// gutter_width texels on each side that is copied from the adjacent faces, so plain
+// hardware bilinear filtering is correct across edges without any neighbor lookups.
+//
+// The arrays have their own face table with one array per face resolution, since the
+// regular arrays can pack several faces into one slice (see ptex_atlas.hh). A slice is (width + 2 * gutter_width) x (height + 2 * gutter_width), the shader maps the face's
+// uv into the inner part. Border texels are resampled from the neighbor to this face's
+// resolution with the adjedge rotation applied. Corners are not traversed (their valence can be
+// anything but 4), they are the average of the two edge borders next to them.
+//
+// Mips are generated from the padded slices so the borders carry into them, but the border
+// halves with every level and coarse levels fall back to clamping to the edge of the slice.
+
+#define PTEX_GUTTER_MAX_WIDTH 2
+
+// NUM_TEX in ptex_gutter.frag, models whose faces need more arrays don't get gutter textures.
+#define PTEX_GUTTER_MAX_ARRAYS 32
+
+extern int g_ptex_gutter_width;
+
+// Reads every face through Ptex and builds data->gutter_array_textures.
+bool create_gutter_texture_arrays(const char* name, Ptex::PtexTexture* ptex, int gutter_width, GLenum mag_filter, GLenum min_filter, gl_ptex_data* data);
+
+void destroy_gutter_texture_arrays(gl_ptex_data* data);
+
+#endif // !PTEX_GUTTER_H
@@ -0,0 +1,236 @@
+#include "ptex_mips.hh"
+
+#include "jobs.hh"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PTEX_MIPS_SSE2 1
+#include <emmintrin.h>
+#else
+#define PTEX_MIPS_SSE2 0
+#endif
+
+bool g_cpu_ptex_mips = true;
+
+using mip_clock = std::chrono::high_resolution_clock;
+using mip_seconds = std::chrono::duration<double>;
+
+#define PTEX_MIPS_MAX_LEVELS 32
+
+static void next_level_size(int* width, int* height)
+{
+	*width = *width > 1 ? *width / 2 : 1;
+	*height = *height > 1 ? *height / 2 : 1;
+}
+
+size_t ptex_face_mips_size(int width, int height)
+{
+	size_t size = 0;
+	while (width > 1 || height > 1)
+	{
+		next_level_size(&width, &height);
+		size += (size_t)width * height * sizeof(rgba8_t);
+	}
+	return size;
+}
+
+// PtexUtils::reduce, the sum of the four texels divided by four rounding down.
+static void reduce_rows_2x2(const rgba8_t* row0, const rgba8_t* row1, int dst_width, rgba8_t* dst)
+{
+	int x = 0;
+
+#if PTEX_MIPS_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	for (; x + 4 <= dst_width; x += 4)
+	{
+		// 8 texels of each row make 4 destination texels.
+		__m128i a0 = _mm_loadu_si128((const __m128i*)(row0 + 2 * x));
+		__m128i a1 = _mm_loadu_si128((const __m128i*)(row0 + 2 * x + 4));
+		__m128i b0 = _mm_loadu_si128((const __m128i*)(row1 + 2 * x));
+		__m128i b1 = _mm_loadu_si128((const __m128i*)(row1 + 2 * x + 4));
+
+		// Add the rows as 16 bit, two texels per register.
+		__m128i s01 = _mm_add_epi16(_mm_unpacklo_epi8(a0, zero), _mm_unpacklo_epi8(b0, zero));
+		__m128i s23 = _mm_add_epi16(_mm_unpackhi_epi8(a0, zero), _mm_unpackhi_epi8(b0, zero));
+		__m128i s45 = _mm_add_epi16(_mm_unpacklo_epi8(a1, zero), _mm_unpacklo_epi8(b1, zero));
+		__m128i s67 = _mm_add_epi16(_mm_unpackhi_epi8(a1, zero), _mm_unpackhi_epi8(b1, zero));
+
+		// Then the two texels in each register, the sum ends up in the low half.
+		s01 = _mm_add_epi16(s01, _mm_srli_si128(s01, 8));
+		s23 = _mm_add_epi16(s23, _mm_srli_si128(s23, 8));
+		s45 = _mm_add_epi16(s45, _mm_srli_si128(s45, 8));
+		s67 = _mm_add_epi16(s67, _mm_srli_si128(s67, 8));
+
+		__m128i lo = _mm_srli_epi16(_mm_unpacklo_epi64(s01, s23), 2);
+		__m128i hi = _mm_srli_epi16(_mm_unpacklo_epi64(s45, s67), 2);
+
+		_mm_storeu_si128((__m128i*)(dst + x), _mm_packus_epi16(lo, hi));
+	}
+#endif
+
+	for (; x < dst_width; x++)
+	{
+		const uint8_t* a = &row0[2 * x].r;
+		const uint8_t* b = &row1[2 * x].r;
+		uint8_t* d = &dst[x].r;
+		for (int c = 0; c < 4; c++)
+			d[c] = (uint8_t)((a[c] + a[c + 4] + b[c] + b[c + 4]) >> 2);
+	}
+}
+
+void reduce_rgba8(const rgba8_t* src, int width, int height, rgba8_t* dst)
+{
+	assert(width > 1 && height > 1);
+
+	int dst_width = width / 2;
+	for (int y = 0; y < height / 2; y++)
+	{
+		const rgba8_t* row0 = src + (size_t)(2 * y) * width;
+		reduce_rows_2x2(row0, row0 + width, dst_width, dst + (size_t)y * dst_width);
+	}
+}
+
+// True if the reader returns the stored reduction for res, made from the level above by PtexUtils::reduce.
+// PtexWriter stops at MinReductionLog2 (4 texels) and premultiplies alpha while reducing.
+static bool is_stored_reduction(Ptex::PtexTexture* ptex, const Ptex::FaceInfo& info, Ptex::Res res)
+{
+	return ptex->hasMipMaps() && ptex->alphaChannel() == -1 && info.hasEdits() == false &&
+		res.ulog2 >= 2 && res.vlog2 >= 2;
+}
+
+static void build_level(Ptex::PtexTexture* ptex, int face, const Ptex::FaceInfo& info, const rgba8_t* src, Ptex::Res src_res, rgba8_t* dst)
+{
+	Ptex::Res res(
+		(int8_t)(src_res.ulog2 > 0 ? src_res.ulog2 - 1 : 0),
+		(int8_t)(src_res.vlog2 > 0 ? src_res.vlog2 - 1 : 0));
+
+	if (is_stored_reduction(ptex, info, res))
+	{
+		reduce_rgba8(src, src_res.u(), src_res.v(), dst);
+		return;
+	}
+
+	void* data = malloc(ptex->numChannels() * res.size());
+	assert(data != NULL);
+
+	ptex->getData(face, data, 0, res);
+
+	void* rgba = data_to_rgba(data, res.u(), res.v(), ptex->numChannels());
+	memcpy(dst, rgba, res.size() * sizeof(rgba8_t));
+
+	free(rgba);
+	free(data);
+}
+
+void build_ptex_face_mips(Ptex::PtexTexture* ptex, int face, const rgba8_t* level0, rgba8_t* mips)
+{
+	build_ptex_reduced_face_mips(ptex, face, ptex->getFaceInfo(face).res, level0, mips);
+}
+
+void build_ptex_reduced_face_mips(Ptex::PtexTexture* ptex, int face, Ptex::Res res, const rgba8_t* level0, rgba8_t* mips)
+{
+	const Ptex::FaceInfo& info = ptex->getFaceInfo(face);
+
+	const rgba8_t* src = level0;
+	while (res.ulog2 > 0 || res.vlog2 > 0)
+	{
+		build_level(ptex, face, info, src, res, mips);
+
+		if (res.ulog2 > 0) res.ulog2--;
+		if (res.vlog2 > 0) res.vlog2--;
+
+		src = mips;
+		mips += res.size();
+	}
+}
+
+void generate_ptex_array_mips(Ptex::PtexTexture* ptex, GLenum internal_format, int width, int height, int slices,
+	const int* slice_faces, const void* const* slice_data, ptex_mip_stats* stats)
+{
+	int levels = ptex_num_mip_levels(width, height);
+	assert(levels <= PTEX_MIPS_MAX_LEVELS);
+
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, levels - 1);
+
+	if (levels == 1)
+		return;
+
+	// Level major, so each level of all the slices is one upload.
+	int level_width[PTEX_MIPS_MAX_LEVELS];
+	int level_height[PTEX_MIPS_MAX_LEVELS];
+	size_t level_offset[PTEX_MIPS_MAX_LEVELS];
+
+	level_width[0] = width;
+	level_height[0] = height;
+	level_offset[0] = 0;
+
+	size_t total_texels = 0;
+	for (int level = 1; level < levels; level++)
+	{
+		level_width[level] = level_width[level - 1];
+		level_height[level] = level_height[level - 1];
+		next_level_size(&level_width[level], &level_height[level]);
+
+		level_offset[level] = total_texels;
+		total_texels += (size_t)level_width[level] * level_height[level] * slices;
+	}
+
+	rgba8_t* mips = alloc_array(rgba8_t, total_texels);
+	assert(mips != NULL);
+
+	mip_clock::time_point start = mip_clock::now();
+
+	jobs::parallel_for(slices, [&](int slice) {
+		int face = slice_faces[slice];
+		const Ptex::FaceInfo& info = ptex->getFaceInfo(face);
+		assert(info.res.u() == width && info.res.v() == height);
+
+		Ptex::Res res = info.res;
+		const rgba8_t* src = (const rgba8_t*)slice_data[slice];
+		for (int level = 1; level < levels; level++)
+		{
+			rgba8_t* dst = mips + level_offset[level] + (size_t)slice * level_width[level] * level_height[level];
+			build_level(ptex, face, info, src, res, dst);
+
+			if (res.ulog2 > 0) res.ulog2--;
+			if (res.vlog2 > 0) res.vlog2--;
+			src = dst;
+		}
+	});
+
+	stats->seconds += mip_seconds(mip_clock::now() - start).count();
+	stats->texels += total_texels;
+	stats->threads = jobs::num_workers();
+	stats->arrays++;
+
+	GLenum transfer_format, transfer_type;
+	ptex_texel_transfer_format(internal_format, &transfer_format, &transfer_type);
+
+	for (int level = 1; level < levels; level++)
+	{
+		// Converted in place, the levels are done being reduced from.
+		rgba8_t* texels = mips + level_offset[level];
+		convert_rgba8_texels(texels, (size_t)level_width[level] * level_height[level] * slices, internal_format, texels);
+
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, level, internal_format, level_width[level], level_height[level], slices, 0,
+			transfer_format, transfer_type, texels);
+	}
+
+	free(mips);
+}
+
+void print_ptex_mip_stats(const char* name, ptex_mip_stats* stats)
+{
+	if (stats->texels == 0)
+		return;
+
+	printf("Generated mips for %s on the cpu: %.2fM texels in %.2fms on %d threads (%.2fMtexels/s), %d arrays\n",
+		name, stats->texels / 1e6, stats->seconds * 1000.0, stats->threads,
+		stats->texels / 1e6 / stats->seconds, stats->arrays);
+}
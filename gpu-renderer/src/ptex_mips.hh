@@ -0,0 +1,52 @@
+#ifndef PTEX_MIPS_H
+#define PTEX_MIPS_H
+
+#include "ptex_utils.hh"
+#include "util.hh"
+
+// Mip levels of the ptex texture arrays built on the cpu instead of with glGenerateMipmap,
+// so level n of a face is exactly what PtexTexture::getData returns for the face at a Res
+// reduced n times, on every driver. Every slice is reduced on its own, so the zero border
+// of the array never gets filtered into a face.
+//
+// The reductions Ptex stores in the file (down to 4 texels on the smaller side) are made
+// with PtexUtils::reduce, the sum of 2x2 texels divided by four rounding down. Those levels
+// are box reduced from the level above with the same arithmetic. The smaller levels are
+// reduced by the reader one direction at a time and the 1x1 level is the face's stored
+// average, those few texels are read with getData instead.
+
+typedef struct {
+	// Texels written to levels 1 and up.
+	uint64_t texels;
+	// Time spent reducing, not including the upload.
+	double seconds;
+	int threads;
+	int arrays;
+} ptex_mip_stats;
+
+// false falls back to glGenerateMipmap.
+extern bool g_cpu_ptex_mips;
+
+// Size in bytes of levels 1 and up of a width x height RGBA8 face.
+size_t ptex_face_mips_size(int width, int height);
+
+// Writes the 2x2 box reduction of a width x height RGBA8 image to dst,
+// which is width / 2 x height / 2 texels.
+void reduce_rgba8(const rgba8_t* src, int width, int height, rgba8_t* dst);
+
+// Writes levels 1 and up of a face to mips, one level after the other.
+void build_ptex_face_mips(Ptex::PtexTexture* ptex, int face, const rgba8_t* level0, rgba8_t* mips);
+
+// build_ptex_face_mips for a level0 that is the face reduced to res, like getData returns it for res.
+void build_ptex_reduced_face_mips(Ptex::PtexTexture* ptex, int face, Ptex::Res res, const rgba8_t* level0, rgba8_t* mips);
+
+// Builds levels 1 and up of the bound width x height GL_TEXTURE_2D_ARRAY from the RGBA8 level 0
+// of each slice, the slices are reduced in parallel on the job threads and every level is
+// converted to internal_format (see ptex_array_format) and uploaded with a single glTexImage3D.
+// Sets GL_TEXTURE_MAX_LEVEL to the last level.
+void generate_ptex_array_mips(Ptex::PtexTexture* ptex, GLenum internal_format, int width, int height, int slices,
+	const int* slice_faces, const void* const* slice_data, ptex_mip_stats* stats);
+
+void print_ptex_mip_stats(const char* name, ptex_mip_stats* stats);
+
+#endif // !PTEX_MIPS_H
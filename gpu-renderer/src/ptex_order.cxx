@@ -0,0 +1,191 @@
+#include "ptex_order.hh"
+
+#include "ptex_pack.hh"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+
+ptex_slice_order g_ptex_slice_order = PTEX_SLICE_ORDER_FILE;
+
+void ptex_face_order(Ptex::PtexTexture* ptex, ptex_slice_order slice_order, int* order)
+{
+	int num_faces = ptex->numFaces();
+
+	if (slice_order == PTEX_SLICE_ORDER_FILE)
+	{
+		for (int i = 0; i < num_faces; i++)
+			order[i] = i;
+		return;
+	}
+
+	assert(slice_order == PTEX_SLICE_ORDER_ADJACENCY);
+
+	int num_edges = ptex->meshType() == Ptex::mt_triangle ? 3 : 4;
+
+	bool* visited = (bool*)calloc(num_faces, sizeof(bool));
+	assert(visited != NULL || num_faces == 0);
+
+	// order doubles as the queue, faces from start up to count are visited but not yet expanded.
+	int count = 0;
+	for (int seed = 0; seed < num_faces; seed++)
+	{
+		if (visited[seed])
+			continue;
+
+		visited[seed] = true;
+		int start = count;
+		order[count++] = seed;
+
+		while (start < count)
+		{
+			const Ptex::FaceInfo& face_info = ptex->getFaceInfo(order[start++]);
+			for (int e = 0; e < num_edges; e++)
+			{
+				int neighbor = face_info.adjface(e);
+				if (neighbor < 0 || neighbor >= num_faces || visited[neighbor])
+					continue;
+
+				visited[neighbor] = true;
+				order[count++] = neighbor;
+			}
+		}
+	}
+
+	assert(count == num_faces);
+	free(visited);
+}
+
+void sort_ptex_res_textures(gl_ptex_textures textures)
+{
+	if (g_ptex_slice_order == PTEX_SLICE_ORDER_FILE)
+		return;
+
+	int* order = alloc_array(int, textures.num_faces);
+	ptex_face_order(textures.ptex, g_ptex_slice_order, order);
+
+	int* rank = alloc_array(int, textures.num_faces);
+	for (int i = 0; i < textures.num_faces; i++)
+		rank[order[i]] = i;
+
+	for (int i = 0; i < textures.num_resolutions; i++)
+	{
+		ptex_res_textures* res_textures = &textures.resolutions[i];
+		std::sort(res_textures->textures, res_textures->textures + res_textures->num_textures,
+			[rank](const ptex_face_texture& a, const ptex_face_texture& b) {
+				return rank[a.face_id] < rank[b.face_id];
+			});
+	}
+
+	free(order);
+	free(rank);
+}
+
+typedef struct {
+	uint64_t page[PTEX_CACHE_SIM_PAGES];
+	uint64_t last_use[PTEX_CACHE_SIM_PAGES];
+	uint64_t time;
+} lru_cache_t;
+
+static bool touch_page(lru_cache_t* cache, uint64_t page)
+{
+	cache->time++;
+
+	int oldest = 0;
+	for (int i = 0; i < PTEX_CACHE_SIM_PAGES; i++)
+	{
+		if (cache->last_use[i] != 0 && cache->page[i] == page)
+		{
+			cache->last_use[i] = cache->time;
+			return true;
+		}
+
+		if (cache->last_use[i] < cache->last_use[oldest])
+			oldest = i;
+	}
+
+	cache->page[oldest] = page;
+	cache->last_use[oldest] = cache->time;
+	return false;
+}
+
+static void touch_face(lru_cache_t* cache, const uint64_t* array_base, const uint64_t* slice_size, const TexIndex* index, ptex_cache_sim_stats* stats)
+{
+	// Constant faces are never fetched.
+	if (index->texIndex == PTEX_CONSTANT_FACE)
+		return;
+
+	// Faces are assumed to fill their slice, which holds for everything but the atlas.
+	uint64_t begin = array_base[index->texIndex] + index->texSilce * slice_size[index->texIndex];
+	uint64_t end = begin + slice_size[index->texIndex];
+
+	for (uint64_t page = begin / PTEX_CACHE_SIM_PAGE_SIZE; page <= (end - 1) / PTEX_CACHE_SIM_PAGE_SIZE; page++)
+	{
+		stats->accesses++;
+		if (touch_page(cache, page) == false)
+		{
+			stats->misses++;
+			stats->miss_bytes += PTEX_CACHE_SIM_PAGE_SIZE;
+		}
+	}
+}
+
+void simulate_ptex_slice_cache(Ptex::PtexTexture* ptex, const TexIndex* face_indices, custom_arrays::array_t<array_texture_t>* array_textures, ptex_cache_sim_stats* stats)
+{
+	*stats = {};
+
+	int num_arrays = array_textures->size;
+	uint64_t* array_base = alloc_array(uint64_t, num_arrays);
+	uint64_t* slice_size = alloc_array(uint64_t, num_arrays);
+
+	uint64_t base = 0;
+	for (int i = 0; i < num_arrays; i++)
+	{
+		array_texture_t* tex = &array_textures->arr[i];
+		array_base[i] = base;
+		slice_size[i] = ptex_pack_level_size(tex->internal_format, tex->width, tex->height, 1, 0);
+		base += slice_size[i] * tex->slices;
+	}
+
+	lru_cache_t* cache = (lru_cache_t*)calloc(1, sizeof(lru_cache_t));
+	assert(cache != NULL);
+
+	int num_faces = ptex->numFaces();
+	for (int i = 0; i < num_faces; i++)
+	{
+		const TexIndex* index = &face_indices[i];
+		touch_face(cache, array_base, slice_size, index, stats);
+
+		for (int e = 0; e < 4; e++)
+		{
+			uint32_t neighbor = index->neighborIndexes[e];
+			if (neighbor != NO_PTEX_NEIGHBOR && neighbor < (uint32_t)num_faces)
+				touch_face(cache, array_base, slice_size, &face_indices[neighbor], stats);
+		}
+	}
+
+	free(cache);
+	free(array_base);
+	free(slice_size);
+}
+
+void print_ptex_cache_sim_stats(const char* name, ptex_slice_order slice_order, ptex_cache_sim_stats* file_stats, ptex_cache_sim_stats* stats)
+{
+	if (stats->accesses == 0)
+		return;
+
+	const char* order_name = slice_order == PTEX_SLICE_ORDER_ADJACENCY ? "adjacency" : "file";
+
+	printf("Simulated %d x %dKB page cache for %s: %.1f%% hits, %.2fMB read in %s order",
+		PTEX_CACHE_SIM_PAGES, PTEX_CACHE_SIM_PAGE_SIZE / 1024, name,
+		100.0 * (stats->accesses - stats->misses) / stats->accesses, stats->miss_bytes / (1024.0 * 1024.0), order_name);
+
+	if (slice_order != PTEX_SLICE_ORDER_FILE && file_stats->accesses != 0)
+	{
+		printf(" (%.1f%% hits, %.2fMB read in file order)",
+			100.0 * (file_stats->accesses - file_stats->misses) / file_stats->accesses, file_stats->miss_bytes / (1024.0 * 1024.0));
+	}
+
+	printf("\n");
+}
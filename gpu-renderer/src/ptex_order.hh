@@ -0,0 +1,48 @@
+#ifndef PTEX_ORDER_H
+#define PTEX_ORDER_H
+
+#include "ptex_utils.hh"
+
+// The order faces get their slices in. In file order faces that touch on the mesh can end up
+// far apart in an array, so the neighbor fetches of the nvidia and reduced traverse methods
+// hit memory all over the array. The adjacency order walks the ptex adjacency breadth first,
+// which keeps a face's neighbors in nearby slices of the arrays of their resolution.
+// Face centroids aren't known where the arrays are created, so there's no spatial curve order.
+//
+// The models in assets already store their faces in a coherent order and the meshes draw
+// faces in id order, so there the breadth first rings spread faces that are drawn together
+// over more pages than file order does (see simulate_ptex_slice_cache). It's off by default.
+
+typedef enum {
+	PTEX_SLICE_ORDER_FILE,
+	PTEX_SLICE_ORDER_ADJACENCY,
+} ptex_slice_order;
+
+extern ptex_slice_order g_ptex_slice_order;
+
+// Fills order with all the face ids in the order they should get slices.
+void ptex_face_order(Ptex::PtexTexture* ptex, ptex_slice_order slice_order, int* order);
+
+// Sorts the faces of every resolution into the order of g_ptex_slice_order.
+void sort_ptex_res_textures(gl_ptex_textures textures);
+
+// Simulated LRU cache of memory pages over level 0 of the arrays, laid out one after the other.
+// The faces are fetched in face id order, each with its neighbors like the nvidia method does.
+// The pages are 64KB like large GPU memory pages, so several small faces share a page
+// and the slice order decides which ones do.
+#define PTEX_CACHE_SIM_PAGE_SIZE 65536
+#define PTEX_CACHE_SIM_PAGES 32
+
+typedef struct {
+	uint64_t accesses;
+	uint64_t misses;
+	// Bytes brought in by the misses.
+	uint64_t miss_bytes;
+} ptex_cache_sim_stats;
+
+void simulate_ptex_slice_cache(Ptex::PtexTexture* ptex, const TexIndex* face_indices, custom_arrays::array_t<array_texture_t>* array_textures, ptex_cache_sim_stats* stats);
+
+// Prints the simulation of the file order next to the order the arrays were built with.
+void print_ptex_cache_sim_stats(const char* name, ptex_slice_order slice_order, ptex_cache_sim_stats* file_stats, ptex_cache_sim_stats* stats);
+
+#endif // !PTEX_ORDER_H
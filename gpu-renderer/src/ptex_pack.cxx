@@ -0,0 +1,369 @@
+#include "ptex_pack.hh"
+
+#include "ptex_compress.hh"
+#include "platform.hh"
+#include "util.hh"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+bool g_use_ptex_pack_cache = true;
+
+#define PACK_DATA_ALIGNMENT 16
+
+void ptex_pack_path(const char* ptex_path, const char* extension, char* pack_path, size_t pack_path_size)
+{
+	const char* old_extension = strrchr(ptex_path, '.');
+	const char* separator = strrchr(ptex_path, '/');
+
+	size_t length = strlen(ptex_path);
+	if (old_extension != NULL && (separator == NULL || old_extension > separator))
+		length = old_extension - ptex_path;
+
+	snprintf(pack_path, pack_path_size, "%.*s%s", (int)length, ptex_path, extension);
+}
+
+bool hash_ptex_source(const char* ptex_path, uint64_t* hash)
+{
+	mapped_file_t source;
+	if (map_file(ptex_path, &source) == false)
+		return false;
+
+	*hash = hash_fnv1a(source.data, source.size);
+
+	unmap_file(&source);
+	return true;
+}
+
+uint64_t ptex_pack_level_size(GLenum internal_format, int width, int height, int slices, int level)
+{
+	int level_width = width >> level;
+	int level_height = height >> level;
+	if (level_width < 1) level_width = 1;
+	if (level_height < 1) level_height = 1;
+
+	int texel_size = ptex_texel_size(internal_format);
+	if (texel_size != 0)
+		return (uint64_t)level_width * level_height * slices * texel_size;
+	else
+		return block_compressed_size(internal_format_block_format(internal_format), level_width, level_height) * slices;
+}
+
+void ptex_arrays_memory_size(custom_arrays::array_t<array_texture_t>* arrays, uint64_t* size, uint64_t* rgba8_size)
+{
+	*size = 0;
+	*rgba8_size = 0;
+	for (int i = 0; i < arrays->size; i++)
+	{
+		array_texture_t* tex = &arrays->arr[i];
+		int levels = ptex_num_mip_levels(tex->width, tex->height);
+		for (int level = 0; level < levels; level++)
+		{
+			*size += ptex_pack_level_size(tex->internal_format, tex->width, tex->height, tex->slices, level);
+			*rgba8_size += ptex_pack_level_size(GL_RGBA8, tex->width, tex->height, tex->slices, level);
+		}
+	}
+}
+
+uint64_t ptex_data_memory_size(const gl_ptex_data* data)
+{
+	if (data->array_textures == NULL)
+		return 0;
+
+	uint64_t size, rgba8_size;
+	ptex_arrays_memory_size(data->array_textures, &size, &rgba8_size);
+
+	if (data->gutter_array_textures != NULL)
+	{
+		uint64_t gutter_size;
+		ptex_arrays_memory_size(data->gutter_array_textures, &gutter_size, &rgba8_size);
+		size += gutter_size;
+	}
+
+	size += (uint64_t)data->face_tex_indices->size * sizeof(TexIndex);
+	if (data->face_placeholder_texture != 0)
+		size += (uint64_t)data->face_tex_indices->size * sizeof(rgba8_t);
+
+	return size;
+}
+
+static bool validate_pack(const mapped_file_t* pack, const char* ptex_path)
+{
+	if (pack->size < sizeof(ptex_pack_header))
+		return false;
+
+	const ptex_pack_header* header = (const ptex_pack_header*)pack->data;
+
+	if (header->magic != PTEX_PACK_MAGIC || header->version != PTEX_PACK_VERSION || header->tex_index_size != sizeof(TexIndex))
+		return false;
+
+	uint64_t source_size;
+	int64_t source_mtime;
+	if (get_file_info(ptex_path, &source_size, &source_mtime) == false)
+		return false;
+
+	if (header->source_size != source_size || header->source_mtime != source_mtime)
+		return false;
+
+	if (header->num_faces < 0 || header->num_resolutions < 0)
+		return false;
+
+	// Each resolution is an array and the shaders sample at most PTEX_MAX_SAMPLED_ARRAYS.
+	if (header->num_resolutions > PTEX_MAX_SAMPLED_ARRAYS)
+		return false;
+
+	// Make sure the pack wasn't truncated.
+	uint64_t resolutions_end = sizeof(ptex_pack_header) + header->num_resolutions * sizeof(ptex_pack_resolution);
+	if (resolutions_end > pack->size)
+		return false;
+
+	if (header->face_table_offset + header->num_faces * sizeof(TexIndex) > pack->size)
+		return false;
+
+	const ptex_pack_resolution* resolutions = (const ptex_pack_resolution*)(header + 1);
+	for (int i = 0; i < header->num_resolutions; i++)
+	{
+		const ptex_pack_resolution* res = &resolutions[i];
+		if (res->levels < 1 || res->levels > PTEX_PACK_MAX_LEVELS)
+			return false;
+
+		// Also rejects packs compressed to a format this driver can't sample.
+		if (is_ptex_array_format_supported(res->internal_format) == false)
+			return false;
+
+		for (int level = 0; level < res->levels; level++)
+		{
+			if (res->level_offsets[level] + ptex_pack_level_size(res->internal_format, res->width, res->height, res->slices, level) > pack->size)
+				return false;
+		}
+	}
+
+	// Only hash the source when everything else matches, this is the expensive check.
+	uint64_t source_hash;
+	if (hash_ptex_source(ptex_path, &source_hash) == false)
+		return false;
+
+	return header->source_hash == source_hash;
+}
+
+bool load_ptex_pack(const char* pack_path, const char* ptex_path, const char* name, GLenum mag_filter, GLenum min_filter, gl_ptex_data* data)
+{
+	mapped_file_t pack;
+	if (map_file(pack_path, &pack) == false)
+		return false;
+
+	if (validate_pack(&pack, ptex_path) == false)
+	{
+		printf("Ptex pack '%s' is out of date.\n", pack_path);
+		unmap_file(&pack);
+		return false;
+	}
+
+	const uint8_t* pack_data = (const uint8_t*)pack.data;
+	const ptex_pack_header* header = (const ptex_pack_header*)pack_data;
+	const ptex_pack_resolution* resolutions = (const ptex_pack_resolution*)(header + 1);
+
+	// Packs store the arrays as they were split when written, which might not fit this driver.
+	int max_layers = ptex_max_array_layers();
+	for (int i = 0; i < header->num_resolutions; i++)
+	{
+		if (resolutions[i].slices > max_layers)
+		{
+			printf("Ptex pack '%s' has arrays of %d layers, more than the %d supported.\n", pack_path, resolutions[i].slices, max_layers);
+			unmap_file(&pack);
+			return false;
+		}
+	}
+
+	GLuint* gl_textures = alloc_array(GLuint, header->num_resolutions);
+	glGenTextures(header->num_resolutions, gl_textures);
+
+	glActiveTexture(GL_TEXTURE0);
+
+	custom_arrays::array_t<array_texture_t>* array_textures = new custom_arrays::array_t<array_texture_t>(header->num_resolutions);
+
+	for (int i = 0; i < header->num_resolutions; i++)
+	{
+		const ptex_pack_resolution* res = &resolutions[i];
+
+		glBindTexture(GL_TEXTURE_2D_ARRAY, gl_textures[i]);
+
+		if (has_KHR_debug)
+		{
+			char label[256];
+			sprintf(label, "ARRTEX: ptex%d %dx%d (pack)", i, res->width, res->height);
+			glObjectLabel(GL_TEXTURE, gl_textures[i], -1, label);
+		}
+
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, res->levels - 1);
+
+		// Upload straight from the mapping, the driver does the only copy.
+		for (int level = 0; level < res->levels; level++)
+		{
+			upload_ptex_array_level(res->internal_format, level, res->width, res->height, res->slices, pack_data + res->level_offsets[level]);
+		}
+
+		set_ptex_array_texture_params(mag_filter, min_filter);
+		set_ptex_array_swizzle(res->internal_format);
+
+		array_texture_t tex;
+
+		tex.width = res->width;
+		tex.height = res->height;
+		tex.slices = res->slices;
+
+		tex.texture = gl_textures[i];
+		tex.internal_format = res->internal_format;
+
+		tex.wrap_s = GL_CLAMP_TO_BORDER;
+		tex.wrap_t = GL_CLAMP_TO_BORDER;
+
+		tex.mag_filter = mag_filter;
+		tex.min_filter = min_filter;
+
+		tex.is_sRGB = false;
+
+		array_textures->add(tex);
+	}
+
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+	free(gl_textures);
+
+	TexIndex* pack_face_indices = (TexIndex*)(pack_data + header->face_table_offset);
+
+	// The face table is small and we keep it on the cpu after the pack is unmapped.
+	TexIndex* face_indices = new TexIndex[header->num_faces];
+	memcpy(face_indices, pack_face_indices, header->num_faces * sizeof(TexIndex));
+
+	data->array_textures = array_textures;
+	data->face_tex_indices = new custom_arrays::array_t<TexIndex>(face_indices, header->num_faces);
+	create_ptex_face_data_buffer(name, pack_face_indices, header->num_faces, &data->face_data_buffer, &data->face_data_texture);
+	data->face_placeholder_texture = 0;
+	data->gutter_array_textures = NULL;
+	data->gutter_face_data_buffer = 0;
+	data->gutter_face_data_texture = 0;
+	data->gutter_width = 0;
+
+	unmap_file(&pack);
+
+	return true;
+}
+
+static bool write_padding(FILE* file, uint64_t* written, uint64_t offset)
+{
+	static const uint8_t zeros[PACK_DATA_ALIGNMENT] = { 0 };
+
+	assert(offset >= *written && offset - *written <= PACK_DATA_ALIGNMENT);
+
+	size_t padding = offset - *written;
+	if (padding != 0 && fwrite(zeros, 1, padding, file) != padding)
+		return false;
+
+	*written = offset;
+	return true;
+}
+
+bool write_ptex_pack(const char* pack_path, const char* ptex_path, gl_ptex_data data)
+{
+	ptex_pack_header header;
+	memset(&header, 0, sizeof(header));
+
+	header.magic = PTEX_PACK_MAGIC;
+	header.version = PTEX_PACK_VERSION;
+	header.num_faces = data.face_tex_indices->size;
+	header.num_resolutions = data.array_textures->size;
+	header.tex_index_size = sizeof(TexIndex);
+
+	if (get_file_info(ptex_path, &header.source_size, &header.source_mtime) == false ||
+		hash_ptex_source(ptex_path, &header.source_hash) == false)
+	{
+		printf("Could not read '%s' to write ptex pack.\n", ptex_path);
+		return false;
+	}
+
+	ptex_pack_resolution* resolutions = (ptex_pack_resolution*)calloc(header.num_resolutions, sizeof(ptex_pack_resolution));
+	assert(resolutions != NULL);
+
+	// Lay out the file before writing anything.
+	uint64_t offset = sizeof(ptex_pack_header) + header.num_resolutions * sizeof(ptex_pack_resolution);
+
+	header.face_table_offset = offset;
+	offset += header.num_faces * sizeof(TexIndex);
+
+	for (int i = 0; i < header.num_resolutions; i++)
+	{
+		array_texture_t* tex = &data.array_textures->arr[i];
+		ptex_pack_resolution* res = &resolutions[i];
+
+		res->width = tex->width;
+		res->height = tex->height;
+		res->slices = tex->slices;
+		res->levels = ptex_num_mip_levels(tex->width, tex->height);
+		res->internal_format = tex->internal_format;
+		assert(res->levels <= PTEX_PACK_MAX_LEVELS);
+
+		for (int level = 0; level < res->levels; level++)
+		{
+			offset = (offset + PACK_DATA_ALIGNMENT - 1) & ~(uint64_t)(PACK_DATA_ALIGNMENT - 1);
+			res->level_offsets[level] = offset;
+			offset += ptex_pack_level_size(res->internal_format, res->width, res->height, res->slices, level);
+		}
+	}
+
+	FILE* file = fopen(pack_path, "wb");
+	if (file == NULL)
+	{
+		printf("Could not open '%s' for writing.\n", pack_path);
+		free(resolutions);
+		return false;
+	}
+
+	bool success = true;
+	uint64_t written = 0;
+
+	success &= fwrite(&header, sizeof(header), 1, file) == 1;
+	success &= fwrite(resolutions, sizeof(ptex_pack_resolution), header.num_resolutions, file) == (size_t)header.num_resolutions;
+	success &= fwrite(data.face_tex_indices->arr, sizeof(TexIndex), header.num_faces, file) == (size_t)header.num_faces;
+	written = header.face_table_offset + header.num_faces * sizeof(TexIndex);
+
+	glActiveTexture(GL_TEXTURE0);
+
+	for (int i = 0; i < header.num_resolutions && success; i++)
+	{
+		ptex_pack_resolution* res = &resolutions[i];
+
+		glBindTexture(GL_TEXTURE_2D_ARRAY, data.array_textures->arr[i].texture);
+
+		for (int level = 0; level < res->levels && success; level++)
+		{
+			uint64_t level_size = ptex_pack_level_size(res->internal_format, res->width, res->height, res->slices, level);
+
+			void* level_data = malloc(level_size);
+			assert(level_data != NULL);
+
+			read_ptex_array_level(res->internal_format, level, level_data);
+
+			success &= write_padding(file, &written, res->level_offsets[level]);
+			success &= fwrite(level_data, 1, level_size, file) == level_size;
+			written += level_size;
+
+			free(level_data);
+		}
+	}
+
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+	fclose(file);
+	free(resolutions);
+
+	if (success == false)
+	{
+		printf("Failed to write ptex pack '%s'.\n", pack_path);
+		remove(pack_path);
+	}
+
+	return success;
+}
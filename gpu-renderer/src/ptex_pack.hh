@@ -0,0 +1,67 @@
+#ifndef PTEX_PACK_H
+#define PTEX_PACK_H
+
+#include "ptex_utils.hh"
+
+// A .ptexpack file is a cache of everything create_gl_texture_arrays produces
+// for one ptex file: the per-resolution texture array slabs with all their mip levels
+// and the TexIndex face table. It is keyed to the size, mtime and hash of the source
+// file, and on later runs it's mapped and uploaded straight from the mapping.
+
+#define PTEX_PACK_MAGIC 0x4B505450 // "PTPK"
+#define PTEX_PACK_VERSION 5
+#define PTEX_PACK_MAX_LEVELS 16
+
+#define PTEX_PACK_EXTENSION ".ptexpack"
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+
+	uint64_t source_size;
+	int64_t source_mtime;
+	uint64_t source_hash;
+
+	int32_t num_faces;
+	int32_t num_resolutions;
+	int32_t tex_index_size;
+	int32_t padding;
+
+	uint64_t face_table_offset;
+} ptex_pack_header;
+
+typedef struct {
+	int32_t width, height, slices, levels;
+	// One of the ptex array formats (see ptex_array_format) or a block compressed format, see ptex_compress.hh.
+	uint32_t internal_format;
+	int32_t padding;
+	// Offset from the start of the file to each mip level,
+	// a level contains all slices of that level.
+	uint64_t level_offsets[PTEX_PACK_MAX_LEVELS];
+} ptex_pack_resolution;
+
+extern bool g_use_ptex_pack_cache;
+
+// Replaces the extension of ptex_path with extension, e.g. PTEX_PACK_EXTENSION.
+void ptex_pack_path(const char* ptex_path, const char* extension, char* pack_path, size_t pack_path_size);
+
+// Hash of the whole source file, used to key packs to the ptex file they were made from.
+bool hash_ptex_source(const char* ptex_path, uint64_t* hash);
+
+// Size of one mip level of a width x height array with slices layers.
+uint64_t ptex_pack_level_size(GLenum internal_format, int width, int height, int slices, int level);
+
+// GPU memory of the arrays with full mip chains, and what the same arrays would take as GL_RGBA8.
+void ptex_arrays_memory_size(custom_arrays::array_t<array_texture_t>* arrays, uint64_t* size, uint64_t* rgba8_size);
+
+// GPU memory of everything in data: the arrays, the gutter copies if they are built, the face table
+// and the placeholder colors of a stream.
+uint64_t ptex_data_memory_size(const gl_ptex_data* data);
+
+// Returns false if there is no pack or it is out of date with the ptex file.
+bool load_ptex_pack(const char* pack_path, const char* ptex_path, const char* name, GLenum mag_filter, GLenum min_filter, gl_ptex_data* data);
+
+// Reads back the uploaded texture arrays and writes them to a pack.
+bool write_ptex_pack(const char* pack_path, const char* ptex_path, gl_ptex_data data);
+
+#endif // !PTEX_PACK_H
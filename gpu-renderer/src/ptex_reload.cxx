@@ -0,0 +1,309 @@
+#include "ptex_reload.hh"
+
+#include "ptex_mips.hh"
+#include "ptex_dedup.hh"
+#include "ptex_gutter.hh"
+#include "platform.hh"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unordered_map>
+#include <vector>
+
+bool g_watch_ptex_files = false;
+
+using reload_clock = std::chrono::steady_clock;
+using reload_seconds = std::chrono::duration<double>;
+
+static uint64_t hash_ptex_face(Ptex::PtexTexture* ptex, int face)
+{
+	Ptex::Res res = ptex->getFaceInfo(face).res;
+	size_t size = (size_t)Ptex::DataSize(ptex->dataType()) * ptex->numChannels() * res.size();
+
+	void* data = malloc(size);
+	assert(data != NULL);
+
+	ptex->getData(face, data, 0);
+	uint64_t hash = hash_fnv1a(data, size);
+
+	free(data);
+	return hash;
+}
+
+ptex_watch_t* begin_ptex_watch(Ptex::PtexTexture* ptex)
+{
+	ptex_watch_t* watch = new ptex_watch_t();
+	watch->path = strdup(ptex->path());
+	watch->file_size = 0;
+	watch->file_mtime = 0;
+	get_file_info(watch->path, &watch->file_size, &watch->file_mtime);
+	watch->next_check = reload_clock::now() + std::chrono::milliseconds(PTEX_WATCH_INTERVAL_MS);
+
+	watch->num_faces = ptex->numFaces();
+	watch->face_hashes = alloc_array(uint64_t, watch->num_faces);
+
+	jobs::run(&watch->hash_group, watch->num_faces, [watch, ptex](int face) {
+		watch->face_hashes[face] = hash_ptex_face(ptex, face);
+	});
+
+	return watch;
+}
+
+void destroy_ptex_watch(ptex_watch_t* watch)
+{
+	jobs::wait(&watch->hash_group);
+
+	free(watch->path);
+	free(watch->face_hashes);
+	delete watch;
+}
+
+static bool same_ptex_layout(Ptex::PtexTexture* a, Ptex::PtexTexture* b)
+{
+	if (a->numFaces() != b->numFaces() || a->dataType() != b->dataType() ||
+		a->numChannels() != b->numChannels() || a->meshType() != b->meshType())
+		return false;
+
+	for (int i = 0; i < a->numFaces(); i++)
+	{
+		if (!(a->getFaceInfo(i).res == b->getFaceInfo(i).res))
+			return false;
+	}
+
+	return true;
+}
+
+typedef struct {
+	int face;
+	// Texels in the format of the face's array, followed by the mip levels if they were built.
+	void* data;
+	bool constant;
+	rgba8_t color;
+} reloaded_face_t;
+
+static reloaded_face_t decode_reloaded_face(Ptex::PtexTexture* ptex, int face, GLenum internal_format, bool cpu_mips)
+{
+	Ptex::Res res = ptex->getFaceInfo(face).res;
+
+	reloaded_face_t result = {};
+	result.face = face;
+
+	void* data = malloc((size_t)Ptex::DataSize(ptex->dataType()) * ptex->numChannels() * res.size());
+	assert(data != NULL);
+	ptex->getData(face, data, 0);
+
+	// The other data types are uploaded as Ptex returns them.
+	if (ptex_data_is_rgba8(ptex->dataType()) == false)
+	{
+		result.data = data;
+		return result;
+	}
+
+	rgba8_t* texels = (rgba8_t*)data_to_rgba(data, res.u(), res.v(), ptex->numChannels());
+	free(data);
+
+	result.constant = is_constant_face(texels, res.size());
+	result.color = texels[0];
+
+	size_t count = res.size();
+	if (cpu_mips)
+	{
+		size_t mips_size = ptex_face_mips_size(res.u(), res.v());
+		texels = (rgba8_t*)realloc(texels, count * sizeof(rgba8_t) + mips_size);
+		assert(texels != NULL);
+
+		build_ptex_face_mips(ptex, face, texels, texels + count);
+		count += mips_size / sizeof(rgba8_t);
+	}
+
+	convert_rgba8_texels(texels, count, internal_format, texels);
+
+	result.data = texels;
+	return result;
+}
+
+// Uploads level 0 of the face, and the levels after it in pixels when there are any.
+static void upload_reloaded_face(const array_texture_t* tex, const TexIndex* index, const void* pixels, bool cpu_mips)
+{
+	GLenum format, type;
+	ptex_texel_transfer_format(tex->internal_format, &format, &type);
+	int texel_size = ptex_texel_size(tex->internal_format);
+
+	glBindTexture(GL_TEXTURE_2D_ARRAY, tex->texture);
+
+	int levels = cpu_mips ? ptex_num_mip_levels(tex->width, tex->height) : 1;
+	int level_width = tex->width, level_height = tex->height;
+	const uint8_t* level_pixels = (const uint8_t*)pixels;
+	for (int level = 0; level < levels; level++)
+	{
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, index->texSilce, level_width, level_height, 1, format, type, level_pixels);
+
+		level_pixels += (size_t)level_width * level_height * texel_size;
+		level_width = level_width > 1 ? level_width / 2 : 1;
+		level_height = level_height > 1 ? level_height / 2 : 1;
+	}
+}
+
+ptex_reload_result update_ptex_watch(const char* name, ptex_watch_t* watch, Ptex::PtexTexture** ptex, gl_ptex_data* data)
+{
+	reload_clock::time_point start = reload_clock::now();
+	if (start < watch->next_check)
+		return PTEX_RELOAD_NONE;
+
+	watch->next_check = start + std::chrono::milliseconds(PTEX_WATCH_INTERVAL_MS);
+
+	uint64_t file_size;
+	int64_t file_mtime;
+	if (get_file_info(watch->path, &file_size, &file_mtime) == false)
+		return PTEX_RELOAD_NONE;
+
+	if (file_size == watch->file_size && file_mtime == watch->file_mtime)
+		return PTEX_RELOAD_NONE;
+
+	// A file that is still being written fails to open, it's tried again when it changes next.
+	watch->file_size = file_size;
+	watch->file_mtime = file_mtime;
+
+	Ptex::String error_str;
+	Ptex::PtexTexture* new_ptex = Ptex::PtexTexture::open(watch->path, error_str);
+	if (new_ptex == NULL)
+	{
+		printf("Ptex Error reloading %s! %s\n", watch->path, error_str.c_str());
+		return PTEX_RELOAD_NONE;
+	}
+
+	if (same_ptex_layout(*ptex, new_ptex) == false)
+	{
+		printf("The layout of '%s' changed, loading %s again.\n", watch->path, name);
+		new_ptex->release();
+		return PTEX_RELOAD_FULL;
+	}
+
+	jobs::wait(&watch->hash_group);
+
+	uint64_t* new_hashes = alloc_array(uint64_t, watch->num_faces);
+	jobs::parallel_for(watch->num_faces, [new_hashes, new_ptex](int face) {
+		new_hashes[face] = hash_ptex_face(new_ptex, face);
+	});
+
+	std::vector<int> changed;
+	for (int i = 0; i < watch->num_faces; i++)
+	{
+		if (new_hashes[i] != watch->face_hashes[i])
+			changed.push_back(i);
+	}
+
+	// Faces sharing a slice (see ptex_dedup.hh) can't be written on their own.
+	std::unordered_map<uint64_t, int> slice_faces;
+	const TexIndex* face_table = data->face_tex_indices->arr;
+	for (int i = 0; i < watch->num_faces; i++)
+	{
+		if (face_table[i].texIndex != PTEX_CONSTANT_FACE)
+			slice_faces[(uint64_t)face_table[i].texIndex << 32 | face_table[i].texSilce]++;
+	}
+
+	GLenum internal_format = ptex_array_format(new_ptex->dataType(), new_ptex->numChannels());
+	bool cpu_mips = g_cpu_ptex_mips && ptex_data_is_rgba8(new_ptex->dataType());
+
+	// Block compressed arrays or arrays loaded from a cache made with other format options
+	// would need the whole array encoded again.
+	bool full = false;
+	for (size_t i = 0; i < changed.size() && full == false; i++)
+	{
+		const TexIndex* index = &face_table[changed[i]];
+		if (index->texIndex == PTEX_CONSTANT_FACE)
+			continue;
+
+		const array_texture_t* tex = &data->array_textures->arr[index->texIndex];
+		full |= index->tile != 0;
+		full |= tex->internal_format != internal_format;
+		full |= slice_faces[(uint64_t)index->texIndex << 32 | index->texSilce] > 1;
+	}
+
+	std::vector<reloaded_face_t> faces(changed.size());
+	if (full == false)
+	{
+		jobs::parallel_for((int)changed.size(), [&](int i) {
+			faces[i] = decode_reloaded_face(new_ptex, changed[i], internal_format, cpu_mips);
+		});
+
+		for (size_t i = 0; i < faces.size(); i++)
+		{
+			if (face_table[faces[i].face].texIndex == PTEX_CONSTANT_FACE && faces[i].constant == false)
+				full = true;
+		}
+	}
+
+	if (full)
+	{
+		printf("The edit of '%s' can't be uploaded in place, loading %s again.\n", watch->path, name);
+
+		for (size_t i = 0; i < faces.size(); i++)
+			free(faces[i].data);
+		free(new_hashes);
+		new_ptex->release();
+		return PTEX_RELOAD_FULL;
+	}
+
+	glActiveTexture(GL_TEXTURE0);
+
+	bool* regenerate = (bool*)calloc(data->array_textures->size, sizeof(bool));
+	assert(regenerate != NULL || data->array_textures->size == 0);
+
+	int recolored = 0;
+	for (size_t i = 0; i < faces.size(); i++)
+	{
+		int face = faces[i].face;
+		TexIndex* index = &data->face_tex_indices->arr[face];
+
+		if (index->texIndex == PTEX_CONSTANT_FACE)
+		{
+			// Only the color changes, the entry is written over in place.
+			rgba8_t color = faces[i].color;
+			index->texSilce = (uint32_t)color.r | (uint32_t)color.g << 8 | (uint32_t)color.b << 16 | (uint32_t)color.a << 24;
+
+			glBindBuffer(GL_TEXTURE_BUFFER, data->face_data_buffer);
+			glBufferSubData(GL_TEXTURE_BUFFER, face * sizeof(TexIndex), sizeof(TexIndex), index);
+			recolored++;
+		}
+		else
+		{
+			upload_reloaded_face(&data->array_textures->arr[index->texIndex], index, faces[i].data, cpu_mips);
+			regenerate[index->texIndex] |= cpu_mips == false;
+		}
+
+		free(faces[i].data);
+	}
+
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+	// Driver mips can only be made for whole arrays.
+	for (int i = 0; i < data->array_textures->size; i++)
+	{
+		if (regenerate[i])
+		{
+			glBindTexture(GL_TEXTURE_2D_ARRAY, data->array_textures->arr[i].texture);
+			glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+		}
+	}
+
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	free(regenerate);
+
+	// The gutter copies are built again the next time they're used.
+	destroy_gutter_texture_arrays(data);
+
+	free(watch->face_hashes);
+	watch->face_hashes = new_hashes;
+
+	(*ptex)->release();
+	*ptex = new_ptex;
+
+	printf("Reloaded %d changed faces of %s in %.2fms, %d of them constant faces with a new color\n",
+		(int)changed.size(), name, reload_seconds(reload_clock::now() - start).count() * 1000.0, recolored);
+
+	return PTEX_RELOAD_UPDATED;
+}
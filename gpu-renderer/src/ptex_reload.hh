@@ -0,0 +1,53 @@
+#ifndef PTEX_RELOAD_H
+#define PTEX_RELOAD_H
+
+#include "ptex_utils.hh"
+#include "jobs.hh"
+
+#include <chrono>
+
+// Watches the ptex file of a model for edits (e.g. made with PtexWriter::edit) and re-uploads
+// only the faces whose data changed. The faces are told apart by a hash of their data in the
+// file's own data type, taken once when the watch starts. Changed faces are decoded on the job
+// threads and written to their slices with their mip levels, constant faces that are still
+// constant get their new color written straight into the face table.
+//
+// Edits that change the layout need the model to be loaded again: a different face count,
+// resolution or format, faces in atlas pages, faces sharing a slice, a constant face that
+// isn't constant anymore and block compressed arrays.
+
+// A developer option, off by default since every watch hashes all the faces of its model
+// on the job threads when it starts and again when an evicted model is restored.
+extern bool g_watch_ptex_files;
+
+// How often the file's size and modification time are checked.
+#define PTEX_WATCH_INTERVAL_MS 500
+
+typedef struct {
+	char* path;
+	uint64_t file_size;
+	int64_t file_mtime;
+	std::chrono::steady_clock::time_point next_check;
+
+	int num_faces;
+	uint64_t* face_hashes;
+	// The hashes are taken on the job threads, they're waited for on the first change.
+	jobs::job_group hash_group;
+} ptex_watch_t;
+
+typedef enum {
+	PTEX_RELOAD_NONE,
+	// The changed faces were uploaded, *ptex is the reopened file.
+	PTEX_RELOAD_UPDATED,
+	// The edit can't be applied in place, the model's textures have to be loaded again.
+	PTEX_RELOAD_FULL,
+} ptex_reload_result;
+
+ptex_watch_t* begin_ptex_watch(Ptex::PtexTexture* ptex);
+
+// Checks the file at most every PTEX_WATCH_INTERVAL_MS and applies any edit to data.
+ptex_reload_result update_ptex_watch(const char* name, ptex_watch_t* watch, Ptex::PtexTexture** ptex, gl_ptex_data* data);
+
+void destroy_ptex_watch(ptex_watch_t* watch);
+
+#endif // !PTEX_RELOAD_H
@@ -0,0 +1,761 @@
+#include "ptex_residency.hh"
+
+#include "ptex_mips.hh"
+#include "ptex_stream.hh"
+
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+bool g_ptex_residency = false;
+uint64_t g_ptex_residency_budget = 16 * 1024 * 1024;
+
+// How many frames worth of faces the load jobs are allowed to get ahead of the uploads.
+#define LOAD_AHEAD_FRAMES 4
+
+static const int page_size = 1 << PTEX_RESIDENCY_PAGE_LOG2;
+
+// Shared by the models, only the current one is rendered.
+static GLuint feedback_program;
+static framebuffer_desc feedback_framebuffer_desc;
+static framebuffer_t feedback_framebuffer;
+
+static void init_feedback_framebuffer(int width, int height)
+{
+	feedback_program = compile_shader("program: ptex_feedback", "shaders/ptex.vert", "shaders/ptex_feedback.frag");
+
+	color_attachment_desc faceID_desc = {
+		"Attachment: ptex_feedback.faceID (R32UI)",
+		GL_R32UI,
+		GL_RED_INTEGER,
+		GL_UNSIGNED_INT,
+		GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE,
+		GL_NEAREST, GL_NEAREST
+	};
+
+	color_attachment_desc uv_log2_desc = {
+		"Attachment: ptex_feedback.uv_log2 (RG32F)",
+		GL_RG32F,
+		GL_RG,
+		GL_FLOAT,
+		GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE,
+		GL_NEAREST, GL_NEAREST
+	};
+
+	color_attachment_desc* color_descriptions = new color_attachment_desc[2];
+	color_descriptions[0] = faceID_desc;
+	color_descriptions[1] = uv_log2_desc;
+
+	depth_attachment_desc depth_desc = {
+		"Attachment: ptex_feedback.depth (DEPTH32F)",
+		GL_DEPTH_COMPONENT32F,
+		GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE,
+		GL_NEAREST, GL_NEAREST
+	};
+
+	depth_attachment_desc* depth_descriptions = new depth_attachment_desc[1];
+	depth_descriptions[0] = depth_desc;
+
+	feedback_framebuffer_desc = {
+		"FBO: ptex_feedback",
+		2,
+		color_descriptions,
+		depth_descriptions,
+		1 // number of samples
+	};
+
+	feedback_framebuffer = create_framebuffer(feedback_framebuffer_desc, width, height);
+}
+
+// The reductions Ptex can return for a face are limited by its smaller side, and a tile can't be bigger than a page.
+static int finest_level(Ptex::Res res)
+{
+	return std::max(0, std::max((int)res.ulog2, (int)res.vlog2) - PTEX_RESIDENCY_PAGE_LOG2);
+}
+
+static int coarsest_level(Ptex::Res res)
+{
+	return std::min(res.ulog2, res.vlog2);
+}
+
+// Faces with an aspect ratio above the page size have no reduction that fits in a page
+// and still has a texel on its short side.
+static bool fits_in_page(Ptex::Res res)
+{
+	return finest_level(res) <= coarsest_level(res);
+}
+
+static Ptex::Res level_res(Ptex::Res res, int level)
+{
+	return Ptex::Res((int8_t)(res.ulog2 - level), (int8_t)(res.vlog2 - level));
+}
+
+// Texels of a tile and of the page levels it has a rectangle in.
+static uint64_t tile_texels(Ptex::Res res)
+{
+	uint64_t texels = 0;
+	int width = res.u(), height = res.v();
+	for (int level = 0; level <= coarsest_level(res); level++)
+	{
+		texels += (uint64_t)width * height;
+		width /= 2;
+		height /= 2;
+	}
+	return texels;
+}
+
+static void mark_dirty(ptex_residency_t* residency, int face)
+{
+	if (face < residency->dirty_begin) residency->dirty_begin = face;
+	if (face + 1 > residency->dirty_end) residency->dirty_end = face + 1;
+}
+
+static void set_fallback_entry(ptex_residency_t* residency, gl_ptex_data* data, int face)
+{
+	rgba8_t color = residency->faces[face].color;
+	Ptex::Res res = residency->ptex->getFaceInfo(face).res;
+
+	TexIndex* index = &data->face_tex_indices->arr[face];
+	index->texIndex = PTEX_CONSTANT_FACE;
+	index->texSilce = (uint32_t)color.r | (uint32_t)color.g << 8 | (uint32_t)color.b << 16 | (uint32_t)color.a << 24;
+	index->tile = (uint32_t)res.ulog2 | (uint32_t)res.vlog2 << 4;
+
+	mark_dirty(residency, face);
+}
+
+static uint32_t page_tile(residency_page_t* page, int tile)
+{
+	int tiles_per_row = 1 << page->u_shift;
+	return make_ptex_tile(page->u_shift, page->v_shift, tile % tiles_per_row, tile / tiles_per_row);
+}
+
+static void free_tile(ptex_residency_t* residency, int page_index, int tile)
+{
+	residency_page_t* page = &residency->pages[page_index];
+	page->tile_faces[tile] = -1;
+	page->used_tiles--;
+
+	if (page->used_tiles == 0)
+	{
+		free(page->tile_faces);
+		page->tile_faces = NULL;
+		page->u_shift = -1;
+		page->v_shift = -1;
+		residency->stats.used_pages--;
+	}
+}
+
+static void evict_face(ptex_residency_t* residency, gl_ptex_data* data, int face)
+{
+	resident_face_t* resident = &residency->faces[face];
+	assert(resident->page != -1);
+
+	free_tile(residency, resident->page, resident->tile);
+	resident->page = -1;
+	resident->tile = -1;
+	resident->level = -1;
+
+	set_fallback_entry(residency, data, face);
+
+	residency->stats.resident_faces--;
+	residency->stats.evictions++;
+}
+
+static bool find_free_tile(ptex_residency_t* residency, int u_shift, int v_shift, int* page_index, int* tile)
+{
+	for (int p = 0; p < residency->num_pages; p++)
+	{
+		residency_page_t* page = &residency->pages[p];
+		if (page->u_shift != u_shift || page->v_shift != v_shift)
+			continue;
+
+		int num_tiles = 1 << (u_shift + v_shift);
+		if (page->used_tiles == num_tiles)
+			continue;
+
+		for (int t = 0; t < num_tiles; t++)
+		{
+			if (page->tile_faces[t] == -1)
+			{
+				*page_index = p;
+				*tile = t;
+				return true;
+			}
+		}
+	}
+
+	for (int p = 0; p < residency->num_pages; p++)
+	{
+		residency_page_t* page = &residency->pages[p];
+		if (page->u_shift != -1)
+			continue;
+
+		int num_tiles = 1 << (u_shift + v_shift);
+		page->u_shift = u_shift;
+		page->v_shift = v_shift;
+		page->used_tiles = 0;
+		page->tile_faces = alloc_array(int, num_tiles);
+		for (int t = 0; t < num_tiles; t++)
+			page->tile_faces[t] = -1;
+
+		residency->stats.used_pages++;
+
+		*page_index = p;
+		*tile = 0;
+		return true;
+	}
+
+	return false;
+}
+
+// Makes room by evicting faces the last feedback didn't see. A tile of the same size is freed by
+// evicting the least recently seen face in such a page, otherwise the page whose faces were seen
+// the longest ago is emptied.
+static bool allocate_tile(ptex_residency_t* residency, gl_ptex_data* data, int u_shift, int v_shift, int* page_index, int* tile)
+{
+	if (find_free_tile(residency, u_shift, v_shift, page_index, tile))
+		return true;
+
+	int lru_face = -1;
+	for (int i = 0; i < residency->num_faces; i++)
+	{
+		resident_face_t* face = &residency->faces[i];
+		if (face->page == -1 || face->last_seen == residency->feedback_frame)
+			continue;
+
+		residency_page_t* page = &residency->pages[face->page];
+		if (page->u_shift != u_shift || page->v_shift != v_shift)
+			continue;
+
+		if (lru_face == -1 || face->last_seen < residency->faces[lru_face].last_seen)
+			lru_face = i;
+	}
+
+	if (lru_face != -1)
+	{
+		evict_face(residency, data, lru_face);
+		return find_free_tile(residency, u_shift, v_shift, page_index, tile);
+	}
+
+	int lru_page = -1;
+	uint32_t lru_page_seen = 0;
+	for (int p = 0; p < residency->num_pages; p++)
+	{
+		residency_page_t* page = &residency->pages[p];
+		if (page->u_shift == -1)
+			continue;
+
+		uint32_t last_seen = 0;
+		int num_tiles = 1 << (page->u_shift + page->v_shift);
+		for (int t = 0; t < num_tiles; t++)
+		{
+			if (page->tile_faces[t] != -1)
+				last_seen = std::max(last_seen, residency->faces[page->tile_faces[t]].last_seen);
+		}
+
+		if (last_seen == residency->feedback_frame)
+			continue;
+
+		if (lru_page == -1 || last_seen < lru_page_seen)
+		{
+			lru_page = p;
+			lru_page_seen = last_seen;
+		}
+	}
+
+	// Everything resident is in view, the pool is too small for the view.
+	if (lru_page == -1)
+		return false;
+
+	residency_page_t* page = &residency->pages[lru_page];
+	int num_tiles = 1 << (page->u_shift + page->v_shift);
+	for (int t = num_tiles - 1; t >= 0 && page->tile_faces != NULL; t--)
+	{
+		if (page->tile_faces[t] != -1)
+			evict_face(residency, data, page->tile_faces[t]);
+	}
+
+	return find_free_tile(residency, u_shift, v_shift, page_index, tile);
+}
+
+ptex_residency_t* begin_ptex_residency(const char* name, Ptex::PtexTexture* ptex, GLenum mag_filter, GLenum min_filter, gl_ptex_data* data)
+{
+	if (ptex_data_is_rgba8(ptex->dataType()) == false)
+	{
+		printf("The residency pool is made of RGBA8 reductions, %s has %s data so it's loaded whole.\n", name, Ptex::DataTypeName(ptex->dataType()));
+		return NULL;
+	}
+
+	int num_channels = ptex->numChannels();
+	assert(num_channels == 4 || num_channels == 3 || num_channels == 1);
+
+	ptex_residency_t* residency = new ptex_residency_t();
+	residency->ptex = ptex;
+	residency->num_faces = ptex->numFaces();
+	residency->internal_format = ptex_array_format(ptex->dataType(), num_channels);
+	residency->readback_buffer = 0;
+	residency->readback_fence = NULL;
+	residency->readback_width = 0;
+	residency->readback_height = 0;
+	residency->feedback_frame = 0;
+	residency->next_request = 0;
+	residency->queued_bytes = 0;
+	residency->dirty_begin = residency->num_faces;
+	residency->dirty_end = 0;
+	residency->stats = {};
+
+	int texel_size = ptex_texel_size(residency->internal_format);
+	residency->page_bytes = (uint64_t)texel_size * (page_size * page_size + ptex_face_mips_size(page_size, page_size) / sizeof(rgba8_t));
+
+	int max_layers = ptex_max_array_layers();
+	residency->num_pages = (int)std::min<uint64_t>(g_ptex_residency_budget / residency->page_bytes, max_layers);
+	residency->num_pages = std::max(residency->num_pages, 1);
+
+	residency->pages = alloc_array(residency_page_t, residency->num_pages);
+	for (int i = 0; i < residency->num_pages; i++)
+	{
+		residency->pages[i].u_shift = -1;
+		residency->pages[i].v_shift = -1;
+		residency->pages[i].used_tiles = 0;
+		residency->pages[i].tile_faces = NULL;
+	}
+
+	TexIndex* face_indices = new TexIndex[residency->num_faces];
+
+	// The 1x1 reduction is stored in the ptex file, so this is cheap compared to the face data.
+	residency->faces = alloc_array(resident_face_t, residency->num_faces);
+	jobs::parallel_for(residency->num_faces, [residency, face_indices, num_channels](int i) {
+		const Ptex::FaceInfo& face_info = residency->ptex->getFaceInfo(i);
+
+		uint8_t texel[4];
+		residency->ptex->getData(i, texel, 0, Ptex::Res(0, 0));
+		rgba8_t* color = (rgba8_t*)data_to_rgba(texel, 1, 1, num_channels);
+
+		resident_face_t* face = &residency->faces[i];
+		face->page = -1;
+		face->tile = -1;
+		face->level = -1;
+		face->wanted_level = -1;
+		face->last_seen = 0;
+		face->loading = false;
+		face->constant = face_info.isConstant() || fits_in_page(face_info.res) == false;
+		face->color = *color;
+
+		int neighbors[4];
+		int edges[4];
+		for (int e = 0; e < 4; e++)
+		{
+			neighbors[e] = face_info.adjface(e);
+			edges[e] = face_info.adjedge(e);
+		}
+
+		face_indices[i] = make_constant_tex_index(*color, face_info.res, neighbors, edges);
+
+		free(color);
+	});
+
+	int num_unfit = 0;
+	for (int i = 0; i < residency->num_faces; i++)
+	{
+		if (fits_in_page(residency->ptex->getFaceInfo(i).res) == false)
+			num_unfit++;
+	}
+	if (num_unfit > 0)
+		printf("%d faces of %s are too narrow for a %dx%d page and are always drawn with their constant color.\n", num_unfit, name, page_size, page_size);
+
+	GLenum format, type;
+	ptex_texel_transfer_format(residency->internal_format, &format, &type);
+
+	GLuint texture;
+	glGenTextures(1, &texture);
+
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+
+	if (has_KHR_debug)
+	{
+		char label[256];
+		sprintf(label, "ARRTEX: ptex residency %dx%d (%d pages)", page_size, page_size, residency->num_pages);
+		glObjectLabel(GL_TEXTURE, texture, -1, label);
+	}
+
+	// The coarser page levels mix faces and are never sampled, see ptexture_tile.
+	int levels = ptex_num_mip_levels(page_size, page_size);
+	for (int level = 0; level < levels; level++)
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, level, residency->internal_format, page_size >> level, page_size >> level, residency->num_pages, 0, format, type, NULL);
+
+	set_ptex_array_texture_params(mag_filter, min_filter);
+	set_ptex_array_swizzle(residency->internal_format);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, levels - 1);
+
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+	array_texture_t tex;
+
+	tex.width = page_size;
+	tex.height = page_size;
+	tex.slices = residency->num_pages;
+
+	tex.texture = texture;
+	tex.internal_format = residency->internal_format;
+
+	tex.wrap_s = GL_CLAMP_TO_BORDER;
+	tex.wrap_t = GL_CLAMP_TO_BORDER;
+
+	tex.mag_filter = mag_filter;
+	tex.min_filter = min_filter;
+
+	tex.is_sRGB = false;
+
+	custom_arrays::array_t<array_texture_t>* array_textures = new custom_arrays::array_t<array_texture_t>(1);
+	array_textures->add(tex);
+
+	data->array_textures = array_textures;
+	data->face_tex_indices = new custom_arrays::array_t<TexIndex>(face_indices, residency->num_faces);
+	create_ptex_face_data_buffer(name, face_indices, residency->num_faces, &data->face_data_buffer, &data->face_data_texture);
+	data->face_placeholder_texture = 0;
+	data->gutter_array_textures = NULL;
+	data->gutter_face_data_buffer = 0;
+	data->gutter_face_data_texture = 0;
+	data->gutter_width = 0;
+
+	printf("Created a residency pool of %d %dx%d pages (%.1fMB) for %s\n",
+		residency->num_pages, page_size, page_size, residency->num_pages * residency->page_bytes / (1024.0 * 1024.0), name);
+
+	return residency;
+}
+
+void render_ptex_feedback(ptex_residency_t* residency, GLuint vao, const index_ranges_t* ranges, mat4_t mvp, int width, int height)
+{
+	// The last feedback is still being read back.
+	if (residency->readback_fence != NULL)
+		return;
+
+	int feedback_width = std::max(width / PTEX_FEEDBACK_SCALE, 1);
+	int feedback_height = std::max(height / PTEX_FEEDBACK_SCALE, 1);
+
+	if (feedback_program == 0)
+		init_feedback_framebuffer(feedback_width, feedback_height);
+	else if (feedback_framebuffer.width != feedback_width || feedback_framebuffer.height != feedback_height)
+		recreate_framebuffer(&feedback_framebuffer, feedback_framebuffer_desc, feedback_width, feedback_height);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, feedback_framebuffer.framebuffer);
+	glViewport(0, 0, feedback_width, feedback_height);
+
+	GLenum drawBuffers[] = {
+		GL_COLOR_ATTACHMENT0,
+		GL_COLOR_ATTACHMENT1,
+	};
+	glDrawBuffers(2, drawBuffers);
+
+	uint32_t faceClearValue[] = { 0, 0, 0, 0 };
+	float uvClearValue[] = { 0, 0, 0, 0 };
+	float depthClearValue = 1.0f;
+	glClearBufferuiv(GL_COLOR, 0, faceClearValue);
+	glClearBufferfv(GL_COLOR, 1, uvClearValue);
+	glClearBufferfv(GL_DEPTH, 0, &depthClearValue);
+
+	glBindVertexArray(vao);
+
+	uniform_mat4(feedback_program, "mvp", &mvp);
+	uniform_1i(feedback_program, "usePlaceholders", 0);
+
+	glUseProgram(feedback_program);
+
+	draw_index_ranges(ranges);
+
+	// Both attachments go into one pack buffer, the face ids first.
+	size_t buffer_size = (size_t)feedback_width * feedback_height * (sizeof(uint32_t) + 2 * sizeof(float));
+	if (residency->readback_buffer == 0)
+		glGenBuffers(1, &residency->readback_buffer);
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, residency->readback_buffer);
+	if (residency->readback_width != feedback_width || residency->readback_height != feedback_height)
+	{
+		glBufferData(GL_PIXEL_PACK_BUFFER, buffer_size, NULL, GL_STREAM_READ);
+		residency->readback_width = feedback_width;
+		residency->readback_height = feedback_height;
+	}
+
+	glReadBuffer(GL_COLOR_ATTACHMENT0);
+	glReadPixels(0, 0, feedback_width, feedback_height, GL_RED_INTEGER, GL_UNSIGNED_INT, (void*)0);
+
+	glReadBuffer(GL_COLOR_ATTACHMENT1);
+	glReadPixels(0, 0, feedback_width, feedback_height, GL_RG, GL_FLOAT, (void*)((size_t)feedback_width * feedback_height * sizeof(uint32_t)));
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	residency->readback_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(0, 0, width, height);
+}
+
+// Finds the finest level every face on screen is seen at and which faces need it loaded.
+static void read_feedback(ptex_residency_t* residency)
+{
+	if (residency->readback_fence == NULL)
+		return;
+
+	if (glClientWaitSync(residency->readback_fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+		return;
+
+	glDeleteSync(residency->readback_fence);
+	residency->readback_fence = NULL;
+
+	int pixels = residency->readback_width * residency->readback_height;
+	size_t buffer_size = (size_t)pixels * (sizeof(uint32_t) + 2 * sizeof(float));
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, residency->readback_buffer);
+	const uint8_t* mapped = (const uint8_t*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, buffer_size, GL_MAP_READ_BIT);
+	if (mapped == NULL)
+	{
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		return;
+	}
+
+	residency->feedback_frame++;
+	uint32_t frame = residency->feedback_frame;
+
+	const uint32_t* face_ids = (const uint32_t*)mapped;
+	const float* uv_log2 = (const float*)(mapped + (size_t)pixels * sizeof(uint32_t));
+
+	// The derivatives are PTEX_FEEDBACK_SCALE times bigger than at the full resolution.
+	const float scale_log2 = log2f((float)PTEX_FEEDBACK_SCALE);
+
+	for (int i = 0; i < pixels; i++)
+	{
+		// 0 is the background.
+		uint32_t id = face_ids[i];
+		if (id == 0 || id > (uint32_t)residency->num_faces)
+			continue;
+
+		int face = (int)id - 1;
+		Ptex::Res res = residency->ptex->getFaceInfo(face).res;
+
+		float lod = std::max(uv_log2[2 * i + 0] + res.ulog2, uv_log2[2 * i + 1] + res.vlog2) - scale_log2;
+		int level = std::min(std::max((int)floorf(lod), finest_level(res)), coarsest_level(res));
+
+		resident_face_t* resident = &residency->faces[face];
+		if (resident->last_seen != frame)
+		{
+			resident->last_seen = frame;
+			resident->wanted_level = level;
+		}
+		else if (level < resident->wanted_level)
+		{
+			resident->wanted_level = level;
+		}
+	}
+
+	glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	residency->requests.clear();
+	residency->next_request = 0;
+	for (int i = 0; i < residency->num_faces; i++)
+	{
+		resident_face_t* face = &residency->faces[i];
+		if (face->last_seen != frame || face->constant || face->loading)
+			continue;
+
+		if (face->page == -1 || face->level > face->wanted_level)
+			residency->requests.push_back(i);
+	}
+
+	// Faces without any texture first, then the ones furthest from the level they're seen at.
+	std::sort(residency->requests.begin(), residency->requests.end(), [residency](int a, int b) {
+		const resident_face_t* fa = &residency->faces[a];
+		const resident_face_t* fb = &residency->faces[b];
+		if ((fa->page == -1) != (fb->page == -1))
+			return fa->page == -1;
+
+		return fa->level - fa->wanted_level > fb->level - fb->wanted_level;
+	});
+}
+
+static void queue_load_jobs(ptex_residency_t* residency)
+{
+	uint64_t max_queued = LOAD_AHEAD_FRAMES * (uint64_t)g_ptex_stream_bytes_per_frame;
+	int texel_size = ptex_texel_size(residency->internal_format);
+
+	std::vector<residency_load_t> loads;
+	while (residency->next_request < residency->requests.size() && residency->queued_bytes < max_queued)
+	{
+		int face = residency->requests[residency->next_request++];
+		resident_face_t* resident = &residency->faces[face];
+
+		residency_load_t load;
+		load.face = face;
+		load.level = resident->wanted_level;
+		load.size = (int)(tile_texels(level_res(residency->ptex->getFaceInfo(face).res, load.level)) * texel_size);
+		load.data = NULL;
+		loads.push_back(load);
+
+		resident->loading = true;
+		residency->queued_bytes += load.size;
+	}
+
+	if (loads.empty())
+		return;
+
+	jobs::run(&residency->load_group, (int)loads.size(), [residency, loads](int i) {
+		residency_load_t load = loads[i];
+
+		Ptex::PtexTexture* ptex = residency->ptex;
+		Ptex::Res res = level_res(ptex->getFaceInfo(load.face).res, load.level);
+
+		void* data = malloc(ptex->numChannels() * res.size());
+		assert(data != NULL);
+
+		ptex->getData(load.face, data, 0, res);
+
+		rgba8_t* texels = (rgba8_t*)data_to_rgba(data, res.u(), res.v(), ptex->numChannels());
+		free(data);
+
+		size_t count = res.size();
+		size_t mips_size = ptex_face_mips_size(res.u(), res.v());
+		texels = (rgba8_t*)realloc(texels, count * sizeof(rgba8_t) + mips_size);
+		assert(texels != NULL);
+
+		build_ptex_reduced_face_mips(ptex, load.face, res, texels, texels + count);
+		count += mips_size / sizeof(rgba8_t);
+
+		convert_rgba8_texels(texels, count, residency->internal_format, texels);
+		load.data = texels;
+
+		std::lock_guard<std::mutex> lock(residency->loaded_mutex);
+		residency->loaded.push_back(load);
+	});
+}
+
+static void upload_tile(ptex_residency_t* residency, gl_ptex_data* data, int page_index, uint32_t tile, Ptex::Res res, const void* pixels)
+{
+	GLenum format, type;
+	ptex_texel_transfer_format(residency->internal_format, &format, &type);
+	int texel_size = ptex_texel_size(residency->internal_format);
+
+	glBindTexture(GL_TEXTURE_2D_ARRAY, data->array_textures->arr[0].texture);
+
+	// Only the levels where the face is at least a texel in both directions have a place in the page.
+	const uint8_t* level_pixels = (const uint8_t*)pixels;
+	for (int level = 0; level <= coarsest_level(res); level++)
+	{
+		int x, y, width, height;
+		ptex_tile_rect(tile, page_size, page_size, level, &x, &y, &width, &height);
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, x, y, page_index, width, height, 1, format, type, level_pixels);
+		level_pixels += (size_t)width * height * texel_size;
+	}
+}
+
+void update_ptex_residency(ptex_residency_t* residency, gl_ptex_data* data)
+{
+	read_feedback(residency);
+	queue_load_jobs(residency);
+
+	std::vector<residency_load_t> loads;
+	{
+		std::lock_guard<std::mutex> lock(residency->loaded_mutex);
+
+		uint64_t taken = 0;
+		while (residency->loaded.empty() == false)
+		{
+			residency_load_t load = residency->loaded.front();
+
+			// Always take at least one face so faces bigger than the budget still get through.
+			if (loads.empty() == false && taken + load.size > (uint64_t)g_ptex_stream_bytes_per_frame)
+				break;
+
+			loads.push_back(load);
+			residency->loaded.pop_front();
+			taken += load.size;
+		}
+	}
+
+	glActiveTexture(GL_TEXTURE0);
+
+	for (size_t i = 0; i < loads.size(); i++)
+	{
+		residency_load_t* load = &loads[i];
+		resident_face_t* resident = &residency->faces[load->face];
+		Ptex::Res res = level_res(residency->ptex->getFaceInfo(load->face).res, load->level);
+
+		int page_index, tile_index;
+		if (allocate_tile(residency, data, PTEX_RESIDENCY_PAGE_LOG2 - res.ulog2, PTEX_RESIDENCY_PAGE_LOG2 - res.vlog2, &page_index, &tile_index))
+		{
+			residency_page_t* page = &residency->pages[page_index];
+			uint32_t tile = page_tile(page, tile_index);
+
+			upload_tile(residency, data, page_index, tile, res, load->data);
+
+			// The coarser copy is drawn until the new one is uploaded.
+			if (resident->page != -1)
+				free_tile(residency, resident->page, resident->tile);
+			else
+				residency->stats.resident_faces++;
+
+			page->tile_faces[tile_index] = load->face;
+			page->used_tiles++;
+
+			resident->page = page_index;
+			resident->tile = tile_index;
+			resident->level = load->level;
+
+			TexIndex* index = &data->face_tex_indices->arr[load->face];
+			index->texIndex = 0;
+			index->texSilce = (uint32_t)page_index;
+			index->tile = tile;
+			mark_dirty(residency, load->face);
+
+			residency->stats.loads++;
+			residency->stats.uploaded_bytes += load->size;
+		}
+
+		resident->loading = false;
+		residency->queued_bytes -= load->size;
+		free(load->data);
+	}
+
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+	if (residency->dirty_begin < residency->dirty_end)
+	{
+		glBindBuffer(GL_TEXTURE_BUFFER, data->face_data_buffer);
+		glBufferSubData(GL_TEXTURE_BUFFER,
+			residency->dirty_begin * sizeof(TexIndex),
+			(residency->dirty_end - residency->dirty_begin) * sizeof(TexIndex),
+			&data->face_tex_indices->arr[residency->dirty_begin]);
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+		residency->dirty_begin = residency->num_faces;
+		residency->dirty_end = 0;
+	}
+}
+
+void destroy_ptex_residency(ptex_residency_t* residency)
+{
+	jobs::wait(&residency->load_group);
+
+	for (size_t i = 0; i < residency->loaded.size(); i++)
+	{
+		free(residency->loaded[i].data);
+	}
+
+	if (residency->readback_fence != NULL)
+		glDeleteSync(residency->readback_fence);
+	glDeleteBuffers(1, &residency->readback_buffer);
+
+	for (int i = 0; i < residency->num_pages; i++)
+	{
+		free(residency->pages[i].tile_faces);
+	}
+
+	free(residency->pages);
+	free(residency->faces);
+
+	delete residency;
+}
@@ -0,0 +1,125 @@
+#ifndef PTEX_RESIDENCY_H
+#define PTEX_RESIDENCY_H
+
+#include "ptex_utils.hh"
+#include "jobs.hh"
+#include "maths.hh"
+
+#include <deque>
+#include <mutex>
+#include <vector>
+
+// Optional loading mode where only the faces the camera sees are resident, at the mip level they're
+// seen at, in a pool of texture memory of a fixed size. The textures of a model can then be larger
+// than the memory the gpu has for them.
+//
+// Every frame a feedback pass renders the face id and the screen space uv derivatives of the model at
+// 1/PTEX_FEEDBACK_SCALE of the resolution (like the to_cpu pass of the cpu method), which is read back
+// through a pixel pack buffer a few frames later. Faces that are seen at a finer level than they have
+// are decoded at that level on the job threads and uploaded g_ptex_stream_bytes_per_frame at a time.
+//
+// The pool is a single array of square pages, the faces are tiles of the pages like in the atlas
+// (see ptex_atlas.hh), so the shaders need no changes. A page only holds tiles of one size. When the
+// pool is full the least recently seen faces are evicted, faces the last feedback saw are never evicted.
+// A face that isn't resident is drawn as a constant face (see PTEX_CONSTANT_FACE) with its 1x1
+// reduction, the coarsest mip level, and a face resident at a coarser level than it is seen at draws
+// that level until the finer one is loaded.
+//
+// Only uint8 files are supported, the rest are loaded whole. The gutter method builds its own copy of
+// all faces and the cpu method reads the file.
+
+extern bool g_ptex_residency;
+// Bytes of the page pool, mip levels included.
+extern uint64_t g_ptex_residency_budget;
+
+#define PTEX_RESIDENCY_PAGE_LOG2 8
+#define PTEX_FEEDBACK_SCALE 8
+
+typedef struct {
+	// Page of the resident copy and its tile in the page, page is -1 for faces that aren't resident.
+	int page;
+	int tile;
+	// How many times the resident copy is reduced from the face's resolution.
+	int level;
+	// The finest level the feedback that last saw the face asked for.
+	int wanted_level;
+	// Feedback the face was last seen in, the least recently seen faces are evicted first.
+	uint32_t last_seen;
+	bool loading;
+	// Constant faces in the file are exact with their 1x1 reduction and never loaded.
+	// Faces too narrow to have a reduction that fits a page are kept constant too.
+	bool constant;
+	rgba8_t color;
+} resident_face_t;
+
+typedef struct {
+	// Tiles are the page size >> u_shift by the page size >> v_shift, -1 while the page is free.
+	int u_shift, v_shift;
+	int used_tiles;
+	// Face in each tile, -1 for free tiles.
+	int* tile_faces;
+} residency_page_t;
+
+typedef struct {
+	int face;
+	int level;
+	int size;
+	// The tile's texels in the pool format, followed by its mip levels.
+	void* data;
+} residency_load_t;
+
+typedef struct {
+	int resident_faces;
+	int used_pages;
+	uint64_t loads;
+	uint64_t evictions;
+	uint64_t uploaded_bytes;
+} ptex_residency_stats;
+
+typedef struct {
+	Ptex::PtexTexture* ptex;
+	int num_faces;
+	GLenum internal_format;
+
+	int num_pages;
+	uint64_t page_bytes;
+
+	resident_face_t* faces;
+	residency_page_t* pages;
+
+	// The feedback of the last frame that didn't have one in flight.
+	GLuint readback_buffer;
+	GLsync readback_fence;
+	int readback_width, readback_height;
+	uint32_t feedback_frame;
+
+	// Faces the last feedback wants finer levels of, the coarsest faces first.
+	std::vector<int> requests;
+	size_t next_request;
+	uint64_t queued_bytes;
+
+	jobs::job_group load_group;
+	std::mutex loaded_mutex;
+	std::deque<residency_load_t> loaded;
+
+	// Face table entries changed since the last upload.
+	int dirty_begin, dirty_end;
+
+	ptex_residency_stats stats;
+} ptex_residency_t;
+
+// Creates the page pool and a face table where every face is drawn with its 1x1 reduction.
+// Returns NULL if ptex isn't a uint8 file.
+ptex_residency_t* begin_ptex_residency(const char* name, Ptex::PtexTexture* ptex, GLenum mag_filter, GLenum min_filter, gl_ptex_data* data);
+
+// Renders the feedback pass of the model into a width / PTEX_FEEDBACK_SCALE x height / PTEX_FEEDBACK_SCALE
+// framebuffer and starts reading it back, unless the last read back hasn't been used yet.
+void render_ptex_feedback(ptex_residency_t* residency, GLuint vao, const index_ranges_t* ranges, mat4_t mvp, int width, int height);
+
+// Uses the feedback once it's read back, queues the loads and uploads the loaded faces.
+void update_ptex_residency(ptex_residency_t* residency, gl_ptex_data* data);
+
+// Waits for the loads in flight and frees the residency, the pool and the face table are in data.
+void destroy_ptex_residency(ptex_residency_t* residency);
+
+#endif // !PTEX_RESIDENCY_H
@@ -0,0 +1,746 @@
+#include "ptex_stream.hh"
+
+#include "ptex_mips.hh"
+#include "ptex_atlas.hh"
+#include "ptex_order.hh"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+bool g_stream_ptex_textures = true;
+int g_ptex_stream_bytes_per_frame = 4 * 1024 * 1024;
+
+bool g_ptex_bounded_load = false;
+uint64_t g_ptex_upload_memory_limit = 64 * 1024 * 1024;
+
+// How many frames worth of faces the decode jobs are allowed to get ahead of the uploads.
+#define DECODE_AHEAD_FRAMES 4
+
+static double stream_time()
+{
+	using namespace std::chrono;
+	return duration<double>(high_resolution_clock::now().time_since_epoch()).count();
+}
+
+using mip_clock = std::chrono::high_resolution_clock;
+using mip_seconds = std::chrono::duration<double>;
+
+// Texels of the face including its mip levels when they are built by the decode jobs.
+static uint64_t face_texels(ptex_stream_t* stream, int face)
+{
+	Ptex::Res res = stream->ptex->getFaceInfo(face).res;
+
+	uint64_t texels = res.size();
+	if (stream->cpu_mips)
+		texels += ptex_face_mips_size(res.u(), res.v()) / sizeof(rgba8_t);
+
+	return texels;
+}
+
+// Size of the face as it's uploaded, in the format of the arrays.
+static uint64_t face_upload_size(ptex_stream_t* stream, int face)
+{
+	return face_texels(stream, face) * ptex_texel_size(stream->internal_format);
+}
+
+// Size of the face's buffer from decode to upload, RGBA8 faces are converted in place.
+static uint64_t face_staging_size(ptex_stream_t* stream, int face)
+{
+	if (ptex_data_is_rgba8(stream->ptex->dataType()))
+		return face_texels(stream, face) * sizeof(rgba8_t);
+
+	return face_upload_size(stream, face);
+}
+
+static void add_stream_array(custom_arrays::array_t<array_texture_t>* array_textures, GLuint texture, GLenum internal_format, int width, int height, int slices, GLenum mag_filter, GLenum min_filter)
+{
+	array_texture_t tex;
+
+	tex.width = width;
+	tex.height = height;
+	tex.slices = slices;
+
+	tex.texture = texture;
+	tex.internal_format = internal_format;
+
+	tex.wrap_s = GL_CLAMP_TO_BORDER;
+	tex.wrap_t = GL_CLAMP_TO_BORDER;
+
+	tex.mag_filter = mag_filter;
+	tex.min_filter = min_filter;
+
+	tex.is_sRGB = false;
+
+	array_textures->add(tex);
+}
+
+// Replaces the per resolution layout in face_indices with atlas pages and creates the arrays for them.
+static bool create_stream_atlas_arrays(const char* name, ptex_stream_t* stream, int max_layers, GLenum mag_filter, GLenum min_filter,
+	TexIndex* face_indices, custom_arrays::array_t<array_texture_t>* array_textures)
+{
+	if (ptex_data_is_rgba8(stream->ptex->dataType()) == false)
+	{
+		printf("The atlas is built from RGBA8 faces, %s has %s data so it streams one array per resolution.\n", name, Ptex::DataTypeName(stream->ptex->dataType()));
+		return false;
+	}
+
+	TexIndex* atlas_indices = new TexIndex[stream->num_faces];
+
+	ptex_atlas_stats stats;
+	int page_log2;
+	if (build_ptex_atlas_layout(stream->ptex, max_layers, atlas_indices, &page_log2, &stats) == false)
+	{
+		printf("The faces of %s are too big for an atlas, streaming one array per resolution.\n", name);
+		delete[] atlas_indices;
+		return false;
+	}
+
+	memcpy(face_indices, atlas_indices, stream->num_faces * sizeof(TexIndex));
+	delete[] atlas_indices;
+
+	int page_size = stats.page_size;
+
+	GLenum format, type;
+	ptex_texel_transfer_format(stream->internal_format, &format, &type);
+
+	GLuint* gl_textures = alloc_array(GLuint, stats.num_arrays);
+	glGenTextures(stats.num_arrays, gl_textures);
+
+	for (int i = 0; i < stats.num_arrays; i++)
+	{
+		int slices = std::min(max_layers, stats.num_pages - i * max_layers);
+
+		glBindTexture(GL_TEXTURE_2D_ARRAY, gl_textures[i]);
+
+		if (has_KHR_debug)
+		{
+			char label[256];
+			sprintf(label, "ARRTEX: ptex atlas%d %dx%d (%d pages, stream)", i, page_size, page_size, slices);
+			glObjectLabel(GL_TEXTURE, gl_textures[i], -1, label);
+		}
+
+		// Page texels no face covers are never written, so they can stay undefined.
+		for (int level = 0; level <= page_log2; level++)
+			glTexImage3D(GL_TEXTURE_2D_ARRAY, level, stream->internal_format, page_size >> level, page_size >> level, slices, 0, format, type, NULL);
+
+		set_ptex_array_texture_params(mag_filter, min_filter);
+		set_ptex_array_swizzle(stream->internal_format);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, page_log2);
+
+		add_stream_array(array_textures, gl_textures[i], stream->internal_format, page_size, page_size, slices, mag_filter, min_filter);
+	}
+
+	free(gl_textures);
+
+	print_ptex_atlas_stats(name, &stats);
+
+	return true;
+}
+
+ptex_stream_t* begin_ptex_stream(const char* name, Ptex::PtexTexture* ptex, GLenum mag_filter, GLenum min_filter, gl_ptex_data* data)
+{
+	int num_channels = ptex->numChannels();
+	assert(num_channels == 4 || num_channels == 3 || num_channels == 1);
+
+	ptex_stream_t* stream = new ptex_stream_t();
+	stream->ptex = ptex;
+	stream->num_faces = ptex->numFaces();
+	stream->next_face = 0;
+	stream->uploaded_faces = 0;
+	stream->queued_bytes = 0;
+	stream->uploaded_bytes = 0;
+	stream->total_bytes = 0;
+	stream->staged_bytes = 0;
+	stream->peak_staged_bytes = 0;
+	stream->blocking = false;
+	stream->current_pbo = 0;
+	stream->start_time = stream_time();
+	stream->end_time = 0;
+	stream->mip_stats = {};
+	stream->atlas = false;
+	// The cpu mips are built from RGBA8 reductions, the other data types use the driver's.
+	stream->cpu_mips = g_cpu_ptex_mips && ptex_data_is_rgba8(ptex->dataType());
+	stream->internal_format = ptex_array_format(ptex->dataType(), num_channels);
+
+	// Group the faces by resolution in the same order extract_textures does,
+	// so the layout matches what a .ptexpack written from this stream expects.
+	custom_arrays::array_t<Ptex::Res> resolutions(8);
+	custom_arrays::array_t<int> slices(8);
+
+	TexIndex* face_indices = new TexIndex[stream->num_faces];
+	int* face_res = alloc_array(int, stream->num_faces);
+
+	for (int i = 0; i < stream->num_faces; i++)
+	{
+		const Ptex::FaceInfo& face_info = ptex->getFaceInfo(i);
+
+		int res_index = -1;
+		for (int r = 0; r < resolutions.size; r++)
+		{
+			if (resolutions[r] == face_info.res)
+			{
+				res_index = r;
+				break;
+			}
+		}
+
+		if (res_index == -1)
+		{
+			res_index = resolutions.size;
+			resolutions.add(face_info.res);
+			slices.add(0);
+		}
+
+		face_res[i] = res_index;
+	}
+
+	// The faces of a resolution get their places in the same order sort_ptex_res_textures puts them in.
+	int* order = alloc_array(int, stream->num_faces);
+	ptex_face_order(ptex, g_ptex_slice_order, order);
+
+	for (int k = 0; k < stream->num_faces; k++)
+	{
+		int i = order[k];
+		const Ptex::FaceInfo& face_info = ptex->getFaceInfo(i);
+
+		int neighbors[4];
+		int edges[4];
+		for (int e = 0; e < 4; e++)
+		{
+			neighbors[e] = face_info.adjface(e);
+			edges[e] = face_info.adjedge(e);
+		}
+
+		// The resolution and the face's place in it, turned into an array and slice below.
+		int res_index = face_res[i];
+		face_indices[i] = make_tex_index(res_index, slices[res_index]++, neighbors, edges);
+	}
+
+	free(order);
+	free(face_res);
+
+	// Resolutions with more faces than the driver allows layers are split over several arrays.
+	int max_layers = ptex_max_array_layers();
+
+	int* first_array = alloc_array(int, resolutions.size);
+	int num_arrays = 0;
+	for (int r = 0; r < resolutions.size; r++)
+	{
+		first_array[r] = num_arrays;
+		num_arrays += ptex_num_array_parts(slices[r], max_layers);
+	}
+
+	for (int i = 0; i < stream->num_faces; i++)
+	{
+		TexIndex* index = &face_indices[i];
+		int place = index->texSilce;
+		index->texIndex = first_array[index->texIndex] + place / max_layers;
+		index->texSilce = place % max_layers;
+	}
+
+	glActiveTexture(GL_TEXTURE0);
+
+	custom_arrays::array_t<array_texture_t>* array_textures = new custom_arrays::array_t<array_texture_t>(num_arrays);
+
+	// Past the arrays the shaders can sample the faces go in the atlas, see PTEX_MAX_SAMPLED_ARRAYS.
+	if (g_ptex_atlas_faces || num_arrays > PTEX_MAX_SAMPLED_ARRAYS)
+	{
+		stream->atlas = create_stream_atlas_arrays(name, stream, max_layers, mag_filter, min_filter, face_indices, array_textures);
+		stream->cpu_mips |= stream->atlas;
+	}
+
+	for (int i = 0; i < stream->num_faces; i++)
+		stream->total_bytes += face_upload_size(stream, i);
+
+	if (stream->atlas == false)
+	{
+		GLenum format, type;
+		ptex_texel_transfer_format(stream->internal_format, &format, &type);
+
+		GLuint* gl_textures = alloc_array(GLuint, num_arrays);
+		glGenTextures(num_arrays, gl_textures);
+
+		for (int r = 0; r < resolutions.size; r++)
+		{
+			Ptex::Res res = resolutions[r];
+
+			int num_parts = ptex_num_array_parts(slices[r], max_layers);
+			for (int part = 0; part < num_parts; part++)
+			{
+				int i = first_array[r] + part;
+				int array_slices = std::min(max_layers, slices[r] - part * max_layers);
+
+				glBindTexture(GL_TEXTURE_2D_ARRAY, gl_textures[i]);
+
+				if (has_KHR_debug)
+				{
+					char label[256];
+					if (num_parts > 1)
+						sprintf(label, "ARRTEX: ptex%d %dx%d (%d/%d, stream)", r, res.u(), res.v(), part + 1, num_parts);
+					else
+						sprintf(label, "ARRTEX: ptex%d %dx%d (stream)", r, res.u(), res.v());
+					glObjectLabel(GL_TEXTURE, gl_textures[i], -1, label);
+				}
+
+				glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, stream->internal_format, res.u(), res.v(), array_slices, 0, format, type, NULL);
+
+				set_ptex_array_texture_params(mag_filter, min_filter);
+				set_ptex_array_swizzle(stream->internal_format);
+
+				if (stream->cpu_mips)
+				{
+					// Every face comes with its mip levels, faces without data yet use their placeholder.
+					int levels = ptex_num_mip_levels(res.u(), res.v());
+					int level_width = res.u(), level_height = res.v();
+					for (int level = 1; level < levels; level++)
+					{
+						level_width = level_width > 1 ? level_width / 2 : 1;
+						level_height = level_height > 1 ? level_height / 2 : 1;
+						glTexImage3D(GL_TEXTURE_2D_ARRAY, level, stream->internal_format, level_width, level_height, array_slices, 0, format, type, NULL);
+					}
+
+					glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, levels - 1);
+				}
+				else
+				{
+					// Only level 0 exists until every face in the array is uploaded,
+					// limiting the levels keeps the texture complete with mipmapped filtering.
+					glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, 0);
+				}
+
+				add_stream_array(array_textures, gl_textures[i], stream->internal_format, res.u(), res.v(), array_slices, mag_filter, min_filter);
+			}
+		}
+
+		free(gl_textures);
+	}
+
+	stream->num_arrays = array_textures->size;
+	stream->faces_left = alloc_array(int, stream->num_arrays);
+	for (int i = 0; i < stream->num_arrays; i++)
+		stream->faces_left[i] = array_textures->arr[i].slices;
+
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+	free(first_array);
+	free(resolutions.arr);
+	free(slices.arr);
+
+	// The 1x1 reduction is stored in the ptex file, so this is cheap compared to the face data.
+	stream->placeholders = alloc_array(rgba8_t, stream->num_faces);
+	jobs::parallel_for(stream->num_faces, [stream, num_channels](int face) {
+		// getPixel normalizes every data type to floats.
+		float texel[4];
+		stream->ptex->getPixel(face, 0, 0, texel, 0, std::min(num_channels, 3), Ptex::Res(0, 0));
+		if (num_channels == 1)
+			texel[1] = texel[2] = texel[0];
+
+		rgba8_t color;
+		color.r = (uint8_t)(std::min(std::max(texel[0], 0.0f), 1.0f) * 255.0f + 0.5f);
+		color.g = (uint8_t)(std::min(std::max(texel[1], 0.0f), 1.0f) * 255.0f + 0.5f);
+		color.b = (uint8_t)(std::min(std::max(texel[2], 0.0f), 1.0f) * 255.0f + 0.5f);
+		color.a = 0;
+
+		// Alpha is the "face has data" flag, see ptex.vert.
+		stream->placeholders[face] = color;
+	});
+
+	glGenBuffers(1, &stream->placeholder_buffer);
+	glBindBuffer(GL_TEXTURE_BUFFER, stream->placeholder_buffer);
+	glBufferData(GL_TEXTURE_BUFFER, stream->num_faces * sizeof(rgba8_t), stream->placeholders, GL_DYNAMIC_DRAW);
+
+	glGenTextures(1, &stream->placeholder_texture);
+	glBindTexture(GL_TEXTURE_BUFFER, stream->placeholder_texture);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA8, stream->placeholder_buffer);
+
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+	if (has_KHR_debug)
+	{
+		char label[128];
+		sprintf(label, "TBO: %s placeholders", name);
+		glObjectLabel(GL_BUFFER, stream->placeholder_buffer, -1, label);
+		glObjectLabel(GL_TEXTURE, stream->placeholder_texture, -1, label);
+	}
+
+	stream->dirty_begin = stream->num_faces;
+	stream->dirty_end = 0;
+
+	for (int i = 0; i < PTEX_STREAM_PBO_COUNT; i++)
+	{
+		stream_pbo_t* pbo = &stream->pbos[i];
+
+		glGenBuffers(1, &pbo->buffer);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo->buffer);
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, PTEX_STREAM_PBO_SIZE, NULL, GL_STREAM_DRAW);
+
+		if (has_KHR_debug)
+		{
+			char label[128];
+			sprintf(label, "PBO: %s stream %d", name, i);
+			glObjectLabel(GL_BUFFER, pbo->buffer, -1, label);
+		}
+
+		pbo->fence = NULL;
+	}
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	data->array_textures = array_textures;
+	data->face_tex_indices = new custom_arrays::array_t<TexIndex>(face_indices, stream->num_faces);
+	create_ptex_face_data_buffer(name, face_indices, stream->num_faces, &data->face_data_buffer, &data->face_data_texture);
+	data->face_placeholder_texture = stream->placeholder_texture;
+	data->gutter_array_textures = NULL;
+	data->gutter_face_data_buffer = 0;
+	data->gutter_face_data_texture = 0;
+	data->gutter_width = 0;
+
+	return stream;
+}
+
+static void queue_decode_jobs(ptex_stream_t* stream)
+{
+	uint64_t max_queued = DECODE_AHEAD_FRAMES * (uint64_t)g_ptex_stream_bytes_per_frame;
+
+	int begin = stream->next_face;
+	while (stream->next_face < stream->num_faces)
+	{
+		uint64_t staging_size = face_staging_size(stream, stream->next_face);
+
+		if (stream->blocking)
+		{
+			// Always let one face through so faces bigger than the limit still get loaded.
+			if (stream->staged_bytes > 0 && stream->staged_bytes + staging_size > g_ptex_upload_memory_limit)
+				break;
+		}
+		else if (stream->queued_bytes >= max_queued)
+		{
+			break;
+		}
+
+		stream->queued_bytes += face_upload_size(stream, stream->next_face);
+		stream->staged_bytes += staging_size;
+		stream->next_face++;
+	}
+
+	stream->peak_staged_bytes = std::max(stream->peak_staged_bytes, stream->staged_bytes);
+
+	int count = stream->next_face - begin;
+	if (count == 0)
+		return;
+
+	jobs::run(&stream->decode_group, count, [stream, begin](int i) {
+		int face = begin + i;
+
+		Ptex::PtexTexture* ptex = stream->ptex;
+		Ptex::Res res = ptex->getFaceInfo(face).res;
+
+		void* data = malloc(Ptex::DataSize(ptex->dataType()) * ptex->numChannels() * res.size());
+		assert(data != NULL);
+
+		ptex->getData(face, data, 0);
+
+		streamed_face_t result;
+		result.face = face;
+		result.size = (int)face_upload_size(stream, face);
+
+		// The other data types are uploaded as Ptex returns them.
+		if (ptex_data_is_rgba8(ptex->dataType()) == false)
+		{
+			result.data = data;
+
+			std::lock_guard<std::mutex> lock(stream->decoded_mutex);
+			stream->decoded.push_back(result);
+			return;
+		}
+
+		result.data = data_to_rgba(data, res.u(), res.v(), ptex->numChannels());
+
+		free(data);
+
+		// The mip levels go right after level 0 so the face is uploaded from one block of memory.
+		size_t mips_size = 0;
+		double seconds = 0;
+		if (stream->cpu_mips)
+		{
+			mips_size = ptex_face_mips_size(res.u(), res.v());
+			result.data = realloc(result.data, face_texels(stream, face) * sizeof(rgba8_t));
+			assert(result.data != NULL);
+
+			mip_clock::time_point start = mip_clock::now();
+			rgba8_t* level0 = (rgba8_t*)result.data;
+			build_ptex_face_mips(ptex, face, level0, level0 + res.size());
+			seconds = mip_seconds(mip_clock::now() - start).count();
+		}
+
+		convert_rgba8_texels((rgba8_t*)result.data, face_texels(stream, face), stream->internal_format, result.data);
+
+		std::lock_guard<std::mutex> lock(stream->decoded_mutex);
+		stream->decoded.push_back(result);
+
+		stream->mip_stats.texels += mips_size / sizeof(rgba8_t);
+		stream->mip_stats.seconds += seconds;
+	});
+}
+
+static void upload_face(ptex_stream_t* stream, gl_ptex_data* data, int face, const void* pixels)
+{
+	TexIndex* index = &data->face_tex_indices->arr[face];
+	array_texture_t* tex = &data->array_textures->arr[index->texIndex];
+
+	glBindTexture(GL_TEXTURE_2D_ARRAY, tex->texture);
+
+	GLenum format, type;
+	ptex_texel_transfer_format(tex->internal_format, &format, &type);
+	int texel_size = ptex_texel_size(tex->internal_format);
+
+	if (stream->atlas)
+	{
+		// Only the levels where the face is at least a texel in both directions have a place in the page.
+		Ptex::Res res = stream->ptex->getFaceInfo(face).res;
+		int last_level = std::min(res.ulog2, res.vlog2);
+
+		// pixels is either a client pointer or an offset into the bound unpack buffer.
+		const uint8_t* level_pixels = (const uint8_t*)pixels;
+		for (int level = 0; level <= last_level; level++)
+		{
+			int x, y, width, height;
+			ptex_tile_rect(index->tile, tex->width, tex->height, level, &x, &y, &width, &height);
+			glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, x, y, index->texSilce, width, height, 1, format, type, level_pixels);
+			level_pixels += (size_t)width * height * texel_size;
+		}
+	}
+	else
+	{
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, index->texSilce, tex->width, tex->height, 1, format, type, pixels);
+	}
+
+	if (stream->atlas)
+	{
+		// The levels were uploaded with level 0.
+	}
+	else if (stream->cpu_mips)
+	{
+		// pixels is either a client pointer or an offset into the bound unpack buffer.
+		const uint8_t* level_pixels = (const uint8_t*)pixels + (size_t)tex->width * tex->height * texel_size;
+
+		int levels = ptex_num_mip_levels(tex->width, tex->height);
+		int level_width = tex->width, level_height = tex->height;
+		for (int level = 1; level < levels; level++)
+		{
+			level_width = level_width > 1 ? level_width / 2 : 1;
+			level_height = level_height > 1 ? level_height / 2 : 1;
+			glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, index->texSilce, level_width, level_height, 1, format, type, level_pixels);
+			level_pixels += (size_t)level_width * level_height * texel_size;
+		}
+	}
+	else if (--stream->faces_left[index->texIndex] == 0)
+	{
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, ptex_num_mip_levels(tex->width, tex->height) - 1);
+		glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+	}
+
+	stream->placeholders[face].a = 255;
+	if (face < stream->dirty_begin) stream->dirty_begin = face;
+	if (face + 1 > stream->dirty_end) stream->dirty_end = face + 1;
+}
+
+bool update_ptex_stream(ptex_stream_t* stream, gl_ptex_data* data)
+{
+	if (stream->uploaded_faces == stream->num_faces)
+		return true;
+
+	queue_decode_jobs(stream);
+
+	stream_pbo_t* pbo = &stream->pbos[stream->current_pbo];
+	if (pbo->fence != NULL)
+	{
+		// Rather skip a frame than wait for the gpu to finish reading this buffer.
+		if (glClientWaitSync(pbo->fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+			return false;
+
+		glDeleteSync(pbo->fence);
+		pbo->fence = NULL;
+	}
+
+	uint64_t budget = stream->blocking ? PTEX_STREAM_PBO_SIZE : g_ptex_stream_bytes_per_frame;
+	if (budget > PTEX_STREAM_PBO_SIZE) budget = PTEX_STREAM_PBO_SIZE;
+
+	std::vector<streamed_face_t> faces;
+	{
+		std::lock_guard<std::mutex> lock(stream->decoded_mutex);
+
+		uint64_t taken = 0;
+		while (stream->decoded.empty() == false)
+		{
+			streamed_face_t face = stream->decoded.front();
+
+			// Always take at least one face so faces bigger than the budget still get through.
+			if (faces.empty() == false && taken + face.size > budget)
+				break;
+
+			faces.push_back(face);
+			stream->decoded.pop_front();
+			taken += face.size;
+		}
+	}
+
+	if (faces.empty())
+		return false;
+
+	glActiveTexture(GL_TEXTURE0);
+
+	// Copy everything that fits into the buffer, faces bigger than the buffer are uploaded from client memory.
+	std::vector<size_t> offsets(faces.size(), SIZE_MAX);
+	size_t pbo_used = 0;
+	for (size_t i = 0; i < faces.size(); i++)
+	{
+		if (pbo_used + faces[i].size <= PTEX_STREAM_PBO_SIZE)
+		{
+			offsets[i] = pbo_used;
+			pbo_used += faces[i].size;
+		}
+	}
+
+	bool pbo_valid = false;
+	if (pbo_used > 0)
+	{
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo->buffer);
+
+		// The fence guarantees the gpu is done with this buffer, so we can skip synchronization.
+		uint8_t* mapped = (uint8_t*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, PTEX_STREAM_PBO_SIZE,
+			GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+
+		if (mapped != NULL)
+		{
+			for (size_t i = 0; i < faces.size(); i++)
+			{
+				if (offsets[i] != SIZE_MAX)
+					memcpy(mapped + offsets[i], faces[i].data, faces[i].size);
+			}
+
+			// Unmapping can fail if the buffer contents got lost, then upload from client memory instead.
+			pbo_valid = glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) == GL_TRUE;
+		}
+
+		if (pbo_valid)
+		{
+			for (size_t i = 0; i < faces.size(); i++)
+			{
+				if (offsets[i] != SIZE_MAX)
+					upload_face(stream, data, faces[i].face, (const void*)offsets[i]);
+			}
+
+			pbo->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			stream->current_pbo = (stream->current_pbo + 1) % PTEX_STREAM_PBO_COUNT;
+		}
+
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	}
+
+	for (size_t i = 0; i < faces.size(); i++)
+	{
+		if (offsets[i] == SIZE_MAX || pbo_valid == false)
+			upload_face(stream, data, faces[i].face, faces[i].data);
+
+		free(faces[i].data);
+
+		stream->queued_bytes -= faces[i].size;
+		stream->staged_bytes -= face_staging_size(stream, faces[i].face);
+		stream->uploaded_bytes += faces[i].size;
+		stream->uploaded_faces++;
+	}
+
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+	if (stream->dirty_begin < stream->dirty_end)
+	{
+		glBindBuffer(GL_TEXTURE_BUFFER, stream->placeholder_buffer);
+		glBufferSubData(GL_TEXTURE_BUFFER,
+			stream->dirty_begin * sizeof(rgba8_t),
+			(stream->dirty_end - stream->dirty_begin) * sizeof(rgba8_t),
+			&stream->placeholders[stream->dirty_begin]);
+		glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+		stream->dirty_begin = stream->num_faces;
+		stream->dirty_end = 0;
+	}
+
+	if (stream->uploaded_faces == stream->num_faces)
+	{
+		jobs::wait(&stream->decode_group);
+
+		stream->end_time = stream_time();
+		stream->mip_stats.threads = jobs::num_workers();
+		stream->mip_stats.arrays = stream->num_arrays;
+		data->face_placeholder_texture = 0;
+		return true;
+	}
+
+	return false;
+}
+
+float ptex_stream_progress(ptex_stream_t* stream)
+{
+	if (stream->total_bytes == 0)
+		return 1.0f;
+
+	return stream->uploaded_bytes / (float)stream->total_bytes;
+}
+
+gl_ptex_data load_ptex_stream(const char* name, Ptex::PtexTexture* ptex, GLenum mag_filter, GLenum min_filter)
+{
+	gl_ptex_data data;
+	ptex_stream_t* stream = begin_ptex_stream(name, ptex, mag_filter, min_filter, &data);
+	stream->blocking = true;
+
+	while (update_ptex_stream(stream, &data) == false)
+	{
+		// Nothing swaps buffers while loading, the upload fences only signal once the uploads are flushed.
+		glFlush();
+		std::this_thread::yield();
+	}
+
+	printf("Loaded textures for %s with at most %.1fMB of decoded faces in memory (limit %.1fMB) in %.2fms\n",
+		name, stream->peak_staged_bytes / (1024.0 * 1024.0), g_ptex_upload_memory_limit / (1024.0 * 1024.0),
+		(stream->end_time - stream->start_time) * 1000.0);
+	print_ptex_mip_stats(name, &stream->mip_stats);
+
+	destroy_ptex_stream(stream);
+
+	return data;
+}
+
+void destroy_ptex_stream(ptex_stream_t* stream)
+{
+	jobs::wait(&stream->decode_group);
+
+	for (size_t i = 0; i < stream->decoded.size(); i++)
+	{
+		free(stream->decoded[i].data);
+	}
+
+	for (int i = 0; i < PTEX_STREAM_PBO_COUNT; i++)
+	{
+		if (stream->pbos[i].fence != NULL)
+			glDeleteSync(stream->pbos[i].fence);
+
+		glDeleteBuffers(1, &stream->pbos[i].buffer);
+	}
+
+	glDeleteTextures(1, &stream->placeholder_texture);
+	glDeleteBuffers(1, &stream->placeholder_buffer);
+
+	free(stream->placeholders);
+	free(stream->faces_left);
+
+	delete stream;
+}
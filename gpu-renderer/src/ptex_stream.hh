@@ -0,0 +1,112 @@
+#ifndef PTEX_STREAM_H
+#define PTEX_STREAM_H
+
+#include "ptex_utils.hh"
+#include "util.hh"
+#include "jobs.hh"
+#include "ptex_mips.hh"
+
+#include <deque>
+#include <mutex>
+
+// Streaming is the alternative to create_gl_texture_arrays(extract_textures(...)) that doesn't
+// stall the first frame. begin_ptex_stream only reads the face layout and the 1x1 reduction
+// of every face, which is used as a placeholder color until the face's data is uploaded.
+// The face data is decoded on the job threads and uploaded a few megabytes per frame
+// through a ring of pixel unpack buffers by update_ptex_stream.
+
+#define PTEX_STREAM_PBO_COUNT 3
+#define PTEX_STREAM_PBO_SIZE (8 * 1024 * 1024)
+
+typedef struct {
+	GLuint buffer;
+	// Signaled when the uploads sourcing this buffer have completed.
+	GLsync fence;
+} stream_pbo_t;
+
+typedef struct {
+	int face;
+	int size;
+	void* data;
+} streamed_face_t;
+
+typedef struct {
+	Ptex::PtexTexture* ptex;
+
+	int num_faces;
+	int num_arrays;
+
+	// The next face to hand to a decode job, faces are decoded in order.
+	int next_face;
+	int uploaded_faces;
+	uint64_t queued_bytes;
+	uint64_t uploaded_bytes;
+	uint64_t total_bytes;
+
+	// Memory held by the faces from their decode job until their upload, RGBA8 faces
+	// keep the size of their RGBA8 copy after they're converted to the array format.
+	uint64_t staged_bytes;
+	uint64_t peak_staged_bytes;
+
+	// Loaded by load_ptex_stream: the decode jobs are limited by g_ptex_upload_memory_limit
+	// instead of the frame budget, and every update uploads as much as fits the upload buffer.
+	bool blocking;
+
+	// Faces left to upload for each texture array, it's mipmapped when this hits zero
+	// unless the decode jobs build the mip levels (g_cpu_ptex_mips).
+	int* faces_left;
+
+	// The faces are packed into a single array of atlas pages (see ptex_atlas.hh),
+	// which always gets its mip levels from the decode jobs.
+	bool atlas;
+	bool cpu_mips;
+
+	// The faces are converted to it by the decode jobs, see ptex_array_format.
+	GLenum internal_format;
+
+	rgba8_t* placeholders;
+	GLuint placeholder_buffer;
+	GLuint placeholder_texture;
+	int dirty_begin, dirty_end;
+
+	stream_pbo_t pbos[PTEX_STREAM_PBO_COUNT];
+	int current_pbo;
+
+	jobs::job_group decode_group;
+	std::mutex decoded_mutex;
+	std::deque<streamed_face_t> decoded;
+
+	double start_time;
+	double end_time;
+
+	// Time is summed over the decode jobs, which also read and convert the faces.
+	ptex_mip_stats mip_stats;
+} ptex_stream_t;
+
+extern bool g_stream_ptex_textures;
+extern int g_ptex_stream_bytes_per_frame;
+
+// Loads the textures that aren't streamed with load_ptex_stream instead of
+// create_gl_texture_arrays(extract_textures(...)), which has every face in memory at once.
+// Duplicate faces aren't shared and constant faces aren't inlined this way (see ptex_dedup.hh).
+extern bool g_ptex_bounded_load;
+// The most decoded face data load_ptex_stream keeps in memory, a face bigger than this is still loaded.
+extern uint64_t g_ptex_upload_memory_limit;
+
+// Creates the (empty) texture arrays, face table and placeholder colors for ptex.
+ptex_stream_t* begin_ptex_stream(const char* name, Ptex::PtexTexture* ptex, GLenum mag_filter, GLenum min_filter, gl_ptex_data* data);
+
+// Queues decode jobs and uploads the decoded faces, up to g_ptex_stream_bytes_per_frame.
+// Returns true once every face is uploaded, from then on data doesn't use placeholders.
+bool update_ptex_stream(ptex_stream_t* stream, gl_ptex_data* data);
+
+float ptex_stream_progress(ptex_stream_t* stream);
+
+// Streams every face of ptex before returning, with at most g_ptex_upload_memory_limit of
+// decoded faces in memory. Each face is freed as soon as it's uploaded.
+gl_ptex_data load_ptex_stream(const char* name, Ptex::PtexTexture* ptex, GLenum mag_filter, GLenum min_filter);
+
+// Waits for any decode jobs still running and frees the stream.
+void destroy_ptex_stream(ptex_stream_t* stream);
+
+#endif // !PTEX_STREAM_H
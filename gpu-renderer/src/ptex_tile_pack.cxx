@@ -0,0 +1,610 @@
+#include "ptex_tile_pack.hh"
+
+#include "ptex_pack.hh"
+#include "ptex_compress.hh"
+#include "platform.hh"
+#include "util.hh"
+#include "jobs.hh"
+#include "lz4.hh"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+bool g_use_ptex_tile_pack = false;
+bool g_compare_ptex_read = false;
+
+// Caps the decoded tiles waiting for upload so the job threads
+// can't decode a big file into memory faster than the driver takes it.
+#define MAX_IN_FLIGHT_BYTES (64 * 1024 * 1024)
+
+using tile_clock = std::chrono::high_resolution_clock;
+using tile_seconds = std::chrono::duration<double>;
+
+// A tile is the face's slice of every mip level, one after the other.
+static uint64_t tile_raw_size(const ptex_tile_pack_resolution* res)
+{
+	uint64_t size = 0;
+	for (int level = 0; level < res->levels; level++)
+	{
+		size += ptex_pack_level_size(res->internal_format, res->width, res->height, 1, level);
+	}
+	return size;
+}
+
+static bool validate_tile_pack(const mapped_file_t* pack, const char* ptex_path)
+{
+	if (pack->size < sizeof(ptex_tile_pack_header))
+		return false;
+
+	const uint8_t* pack_data = (const uint8_t*)pack->data;
+	const ptex_tile_pack_header* header = (const ptex_tile_pack_header*)pack_data;
+
+	if (header->magic != PTEX_TILE_PACK_MAGIC || header->version != PTEX_TILE_PACK_VERSION ||
+		header->tex_index_size != sizeof(TexIndex) || header->codec != PTEX_TILE_CODEC_LZ4)
+		return false;
+
+	uint64_t source_size;
+	int64_t source_mtime;
+	if (get_file_info(ptex_path, &source_size, &source_mtime) == false)
+		return false;
+
+	if (header->source_size != source_size || header->source_mtime != source_mtime)
+		return false;
+
+	if (header->num_faces < 0 || header->num_resolutions < 0)
+		return false;
+
+	// Each resolution is an array and the shaders sample at most PTEX_MAX_SAMPLED_ARRAYS.
+	if (header->num_resolutions > PTEX_MAX_SAMPLED_ARRAYS)
+		return false;
+
+	uint64_t resolutions_end = sizeof(ptex_tile_pack_header) + header->num_resolutions * sizeof(ptex_tile_pack_resolution);
+	if (resolutions_end > pack->size)
+		return false;
+
+	if (header->face_table_offset + header->num_faces * sizeof(TexIndex) > pack->size)
+		return false;
+
+	if (header->tile_index_offset + header->num_faces * sizeof(ptex_tile_entry) > pack->size)
+		return false;
+
+	const ptex_tile_pack_resolution* resolutions = (const ptex_tile_pack_resolution*)(header + 1);
+	for (int i = 0; i < header->num_resolutions; i++)
+	{
+		const ptex_tile_pack_resolution* res = &resolutions[i];
+		if (res->width < 1 || res->height < 1 || res->slices < 1)
+			return false;
+
+		if (res->levels < 1 || res->levels > ptex_num_mip_levels(res->width, res->height))
+			return false;
+
+		if (is_ptex_array_format_supported(res->internal_format) == false)
+			return false;
+	}
+
+	// Every tile has to be inside the file and decode to its face's mip chain.
+	const TexIndex* face_table = (const TexIndex*)(pack_data + header->face_table_offset);
+	const ptex_tile_entry* tiles = (const ptex_tile_entry*)(pack_data + header->tile_index_offset);
+	for (int i = 0; i < header->num_faces; i++)
+	{
+		const TexIndex* index = &face_table[i];
+		const ptex_tile_entry* tile = &tiles[i];
+
+		// Constant faces have no slice and an empty tile.
+		if (index->texIndex == PTEX_CONSTANT_FACE)
+		{
+			if (tile->raw_size != 0)
+				return false;
+			continue;
+		}
+
+		if (index->texIndex >= (uint32_t)header->num_resolutions || index->texSilce >= (uint32_t)resolutions[index->texIndex].slices)
+			return false;
+
+		if (tile->raw_size != tile_raw_size(&resolutions[index->texIndex]) || tile->compressed_size > tile->raw_size)
+			return false;
+
+		if (tile->offset + tile->compressed_size > pack->size)
+			return false;
+	}
+
+	// Only hash the source when everything else matches, this is the expensive check.
+	uint64_t source_hash;
+	if (hash_ptex_source(ptex_path, &source_hash) == false)
+		return false;
+
+	return header->source_hash == source_hash;
+}
+
+typedef struct {
+	int face;
+	// NULL if the tile failed to decode.
+	const uint8_t* data;
+	// Uncompressed tiles point straight into the mapping.
+	bool owned;
+} decoded_tile_t;
+
+bool load_ptex_tile_pack(const char* pack_path, const char* ptex_path, const char* name, GLenum mag_filter, GLenum min_filter, gl_ptex_data* data, ptex_tile_pack_stats* stats)
+{
+	mapped_file_t pack;
+	if (map_file(pack_path, &pack) == false)
+		return false;
+
+	if (validate_tile_pack(&pack, ptex_path) == false)
+	{
+		printf("Ptex tile pack '%s' is out of date.\n", pack_path);
+		unmap_file(&pack);
+		return false;
+	}
+
+	const uint8_t* pack_data = (const uint8_t*)pack.data;
+	const ptex_tile_pack_header* header = (const ptex_tile_pack_header*)pack_data;
+	const ptex_tile_pack_resolution* resolutions = (const ptex_tile_pack_resolution*)(header + 1);
+	const TexIndex* face_table = (const TexIndex*)(pack_data + header->face_table_offset);
+	const ptex_tile_entry* tiles = (const ptex_tile_entry*)(pack_data + header->tile_index_offset);
+
+	// Packs store the arrays as they were split when written, which might not fit this driver.
+	int max_layers = ptex_max_array_layers();
+	for (int i = 0; i < header->num_resolutions; i++)
+	{
+		if (resolutions[i].slices > max_layers)
+		{
+			printf("Ptex tile pack '%s' has arrays of %d layers, more than the %d supported.\n", pack_path, resolutions[i].slices, max_layers);
+			unmap_file(&pack);
+			return false;
+		}
+	}
+
+	GLuint* gl_textures = alloc_array(GLuint, header->num_resolutions);
+	glGenTextures(header->num_resolutions, gl_textures);
+
+	glActiveTexture(GL_TEXTURE0);
+
+	// Allocate every level up front, the tiles are uploaded into them in whatever order they finish.
+	for (int i = 0; i < header->num_resolutions; i++)
+	{
+		const ptex_tile_pack_resolution* res = &resolutions[i];
+
+		glBindTexture(GL_TEXTURE_2D_ARRAY, gl_textures[i]);
+
+		if (has_KHR_debug)
+		{
+			char label[256];
+			sprintf(label, "ARRTEX: ptex%d %dx%d (tile pack)", i, res->width, res->height);
+			glObjectLabel(GL_TEXTURE, gl_textures[i], -1, label);
+		}
+
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, res->levels - 1);
+
+		for (int level = 0; level < res->levels; level++)
+		{
+			upload_ptex_array_level(res->internal_format, level, res->width, res->height, res->slices, NULL);
+		}
+
+		set_ptex_array_texture_params(mag_filter, min_filter);
+		set_ptex_array_swizzle(res->internal_format);
+	}
+
+	std::mutex mutex;
+	std::condition_variable tile_ready;
+	std::condition_variable space_available;
+	std::deque<decoded_tile_t> decoded;
+	uint64_t in_flight = 0;
+
+	std::atomic<int64_t> decode_nanoseconds(0);
+
+	tile_clock::time_point start = tile_clock::now();
+
+	jobs::job_group group;
+	jobs::run(&group, header->num_faces, [&](int face) {
+		const ptex_tile_entry* tile = &tiles[face];
+
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			space_available.wait(lock, [&] { return in_flight == 0 || in_flight + tile->raw_size <= MAX_IN_FLIGHT_BYTES; });
+			in_flight += tile->raw_size;
+		}
+
+		tile_clock::time_point decode_start = tile_clock::now();
+
+		decoded_tile_t result;
+		result.face = face;
+
+		if (tile->compressed_size == tile->raw_size)
+		{
+			// Also the empty tiles of constant faces, they're skipped when uploading.
+			result.data = pack_data + tile->offset;
+			result.owned = false;
+		}
+		else
+		{
+			uint8_t* raw = (uint8_t*)malloc(tile->raw_size);
+			assert(raw != NULL);
+
+			if (lz4_decompress(pack_data + tile->offset, tile->compressed_size, raw, tile->raw_size) == false)
+			{
+				free(raw);
+				raw = NULL;
+			}
+
+			result.data = raw;
+			result.owned = true;
+		}
+
+		decode_nanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(tile_clock::now() - decode_start).count();
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			decoded.push_back(result);
+		}
+		tile_ready.notify_one();
+	});
+
+	// GL calls have to happen here, so this thread only uploads what the jobs hand over.
+	bool success = true;
+	for (int uploaded = 0; uploaded < header->num_faces; uploaded++)
+	{
+		decoded_tile_t tile;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			tile_ready.wait(lock, [&] { return decoded.empty() == false; });
+			tile = decoded.front();
+			decoded.pop_front();
+		}
+
+		if (tile.data == NULL)
+		{
+			success = false;
+		}
+		else if (success && face_table[tile.face].texIndex != PTEX_CONSTANT_FACE)
+		{
+			const TexIndex* index = &face_table[tile.face];
+			const ptex_tile_pack_resolution* res = &resolutions[index->texIndex];
+
+			glBindTexture(GL_TEXTURE_2D_ARRAY, gl_textures[index->texIndex]);
+
+			const uint8_t* level_data = tile.data;
+			for (int level = 0; level < res->levels; level++)
+			{
+				upload_ptex_array_slice(res->internal_format, level, res->width, res->height, index->texSilce, level_data);
+				level_data += ptex_pack_level_size(res->internal_format, res->width, res->height, 1, level);
+			}
+		}
+
+		if (tile.owned)
+			free((void*)tile.data);
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			in_flight -= tiles[tile.face].raw_size;
+		}
+		space_available.notify_all();
+	}
+
+	jobs::wait(&group);
+
+	double wall_seconds = tile_seconds(tile_clock::now() - start).count();
+
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+	if (success == false)
+	{
+		printf("Ptex tile pack '%s' has corrupt tiles.\n", pack_path);
+		glDeleteTextures(header->num_resolutions, gl_textures);
+		free(gl_textures);
+		unmap_file(&pack);
+		return false;
+	}
+
+	custom_arrays::array_t<array_texture_t>* array_textures = new custom_arrays::array_t<array_texture_t>(header->num_resolutions);
+
+	for (int i = 0; i < header->num_resolutions; i++)
+	{
+		array_texture_t tex;
+
+		tex.width = resolutions[i].width;
+		tex.height = resolutions[i].height;
+		tex.slices = resolutions[i].slices;
+
+		tex.texture = gl_textures[i];
+		tex.internal_format = resolutions[i].internal_format;
+
+		tex.wrap_s = GL_CLAMP_TO_BORDER;
+		tex.wrap_t = GL_CLAMP_TO_BORDER;
+
+		tex.mag_filter = mag_filter;
+		tex.min_filter = min_filter;
+
+		tex.is_sRGB = false;
+
+		array_textures->add(tex);
+	}
+
+	free(gl_textures);
+
+	TexIndex* face_indices = new TexIndex[header->num_faces];
+	memcpy(face_indices, face_table, header->num_faces * sizeof(TexIndex));
+
+	data->array_textures = array_textures;
+	data->face_tex_indices = new custom_arrays::array_t<TexIndex>(face_indices, header->num_faces);
+	create_ptex_face_data_buffer(name, face_indices, header->num_faces, &data->face_data_buffer, &data->face_data_texture);
+	data->face_placeholder_texture = 0;
+	data->gutter_array_textures = NULL;
+	data->gutter_face_data_buffer = 0;
+	data->gutter_face_data_texture = 0;
+	data->gutter_width = 0;
+
+	if (stats != NULL)
+	{
+		memset(stats, 0, sizeof(*stats));
+
+		stats->file_size = pack.size;
+		stats->source_size = header->source_size;
+
+		for (int i = 0; i < header->num_faces; i++)
+		{
+			stats->compressed_bytes += tiles[i].compressed_size;
+			stats->raw_bytes += tiles[i].raw_size;
+		}
+
+		stats->threads = jobs::num_workers();
+		stats->decode_seconds = decode_nanoseconds / 1e9;
+		stats->wall_seconds = wall_seconds;
+	}
+
+	unmap_file(&pack);
+
+	return true;
+}
+
+bool write_ptex_tile_pack(const char* pack_path, const char* ptex_path, gl_ptex_data data)
+{
+	// Tiles are whole slices, faces packed into atlas pages share theirs.
+	for (int i = 0; i < data.face_tex_indices->size; i++)
+	{
+		if (data.face_tex_indices->arr[i].tile != 0)
+		{
+			printf("Can't write a ptex tile pack of atlas pages, '%s' is not written.\n", pack_path);
+			return false;
+		}
+	}
+
+	ptex_tile_pack_header header;
+	memset(&header, 0, sizeof(header));
+
+	header.magic = PTEX_TILE_PACK_MAGIC;
+	header.version = PTEX_TILE_PACK_VERSION;
+	header.num_faces = data.face_tex_indices->size;
+	header.num_resolutions = data.array_textures->size;
+	header.tex_index_size = sizeof(TexIndex);
+	header.codec = PTEX_TILE_CODEC_LZ4;
+
+	if (get_file_info(ptex_path, &header.source_size, &header.source_mtime) == false ||
+		hash_ptex_source(ptex_path, &header.source_hash) == false)
+	{
+		printf("Could not read '%s' to write ptex tile pack.\n", ptex_path);
+		return false;
+	}
+
+	ptex_tile_pack_resolution* resolutions = (ptex_tile_pack_resolution*)calloc(header.num_resolutions, sizeof(ptex_tile_pack_resolution));
+	assert(resolutions != NULL);
+
+	// Read back every level of every array, the tiles are cut out of these.
+	uint8_t** level_data = (uint8_t**)calloc(header.num_resolutions * PTEX_PACK_MAX_LEVELS, sizeof(uint8_t*));
+	assert(level_data != NULL);
+
+	glActiveTexture(GL_TEXTURE0);
+
+	for (int i = 0; i < header.num_resolutions; i++)
+	{
+		array_texture_t* tex = &data.array_textures->arr[i];
+		ptex_tile_pack_resolution* res = &resolutions[i];
+
+		res->width = tex->width;
+		res->height = tex->height;
+		res->slices = tex->slices;
+		res->levels = ptex_num_mip_levels(tex->width, tex->height);
+		res->internal_format = tex->internal_format;
+		assert(res->levels <= PTEX_PACK_MAX_LEVELS);
+
+		glBindTexture(GL_TEXTURE_2D_ARRAY, tex->texture);
+
+		for (int level = 0; level < res->levels; level++)
+		{
+			uint8_t* level_buffer = (uint8_t*)malloc(ptex_pack_level_size(res->internal_format, res->width, res->height, res->slices, level));
+			assert(level_buffer != NULL);
+
+			read_ptex_array_level(res->internal_format, level, level_buffer);
+			level_data[i * PTEX_PACK_MAX_LEVELS + level] = level_buffer;
+		}
+	}
+
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+	ptex_tile_entry* tiles = (ptex_tile_entry*)calloc(header.num_faces, sizeof(ptex_tile_entry));
+	uint8_t** tile_data = (uint8_t**)calloc(header.num_faces, sizeof(uint8_t*));
+	assert(tiles != NULL && tile_data != NULL);
+
+	const TexIndex* face_table = data.face_tex_indices->arr;
+
+	jobs::parallel_for(header.num_faces, [&](int face) {
+		const TexIndex* index = &face_table[face];
+
+		// Constant faces have their color in the face table, tiles and tile_data are zeroed.
+		if (index->texIndex == PTEX_CONSTANT_FACE)
+			return;
+
+		const ptex_tile_pack_resolution* res = &resolutions[index->texIndex];
+
+		uint64_t raw_size = tile_raw_size(res);
+		assert(raw_size <= UINT32_MAX);
+
+		uint8_t* raw = (uint8_t*)malloc(raw_size);
+		assert(raw != NULL);
+
+		uint8_t* dst = raw;
+		for (int level = 0; level < res->levels; level++)
+		{
+			uint64_t slice_size = ptex_pack_level_size(res->internal_format, res->width, res->height, 1, level);
+			memcpy(dst, level_data[index->texIndex * PTEX_PACK_MAX_LEVELS + level] + index->texSilce * slice_size, slice_size);
+			dst += slice_size;
+		}
+
+		size_t bound = lz4_compress_bound(raw_size);
+		uint8_t* compressed = (uint8_t*)malloc(bound);
+		assert(compressed != NULL);
+
+		size_t compressed_size = lz4_compress(raw, raw_size, compressed, bound);
+
+		// Keep tiles that don't compress (noise, tiny faces) as they are.
+		if (compressed_size == 0 || compressed_size >= raw_size)
+		{
+			free(compressed);
+			tile_data[face] = raw;
+			tiles[face].compressed_size = (uint32_t)raw_size;
+		}
+		else
+		{
+			free(raw);
+			tile_data[face] = compressed;
+			tiles[face].compressed_size = (uint32_t)compressed_size;
+		}
+
+		tiles[face].raw_size = (uint32_t)raw_size;
+	});
+
+	for (int i = 0; i < header.num_resolutions * PTEX_PACK_MAX_LEVELS; i++)
+	{
+		free(level_data[i]);
+	}
+	free(level_data);
+
+	// Lay out the file before writing anything.
+	uint64_t offset = sizeof(ptex_tile_pack_header) + header.num_resolutions * sizeof(ptex_tile_pack_resolution);
+
+	header.face_table_offset = offset;
+	offset += header.num_faces * sizeof(TexIndex);
+
+	header.tile_index_offset = offset;
+	offset += header.num_faces * sizeof(ptex_tile_entry);
+
+	for (int i = 0; i < header.num_faces; i++)
+	{
+		tiles[i].offset = offset;
+		offset += tiles[i].compressed_size;
+	}
+
+	bool success = true;
+
+	FILE* file = fopen(pack_path, "wb");
+	if (file == NULL)
+	{
+		printf("Could not open '%s' for writing.\n", pack_path);
+		success = false;
+	}
+	else
+	{
+		success &= fwrite(&header, sizeof(header), 1, file) == 1;
+		success &= fwrite(resolutions, sizeof(ptex_tile_pack_resolution), header.num_resolutions, file) == (size_t)header.num_resolutions;
+		success &= fwrite(face_table, sizeof(TexIndex), header.num_faces, file) == (size_t)header.num_faces;
+		success &= fwrite(tiles, sizeof(ptex_tile_entry), header.num_faces, file) == (size_t)header.num_faces;
+
+		for (int i = 0; i < header.num_faces && success; i++)
+		{
+			success &= fwrite(tile_data[i], 1, tiles[i].compressed_size, file) == tiles[i].compressed_size;
+		}
+
+		fclose(file);
+
+		if (success == false)
+		{
+			printf("Failed to write ptex tile pack '%s'.\n", pack_path);
+			remove(pack_path);
+		}
+	}
+
+	for (int i = 0; i < header.num_faces; i++)
+	{
+		free(tile_data[i]);
+	}
+	free(tile_data);
+	free(tiles);
+	free(resolutions);
+
+	return success;
+}
+
+bool read_ptex_for_comparison(const char* ptex_path, ptex_read_stats* stats)
+{
+	memset(stats, 0, sizeof(*stats));
+
+	int64_t mtime;
+	if (get_file_info(ptex_path, &stats->file_size, &mtime) == false)
+		return false;
+
+	tile_clock::time_point start = tile_clock::now();
+
+	Ptex::String error_str;
+	Ptex::PtexTexture* tex = Ptex::PtexTexture::open(ptex_path, error_str);
+	if (tex == NULL)
+	{
+		printf("Ptex Error reading %s! %s\n", ptex_path, error_str.c_str());
+		return false;
+	}
+
+	void* face_data = NULL;
+	size_t face_data_capacity = 0;
+
+	int num_faces = tex->numFaces();
+	for (int i = 0; i < num_faces; i++)
+	{
+		size_t size = Ptex::DataSize(tex->dataType()) * tex->numChannels() * tex->getFaceInfo(i).res.size();
+		if (size > face_data_capacity)
+		{
+			free(face_data);
+			face_data = malloc(size);
+			face_data_capacity = size;
+			assert(face_data != NULL);
+		}
+
+		tex->getData(i, face_data, 0);
+		stats->bytes += size;
+	}
+
+	free(face_data);
+	tex->release();
+
+	stats->seconds = tile_seconds(tile_clock::now() - start).count();
+
+	return true;
+}
+
+#define MEGABYTES(bytes) ((bytes) / (1024.0 * 1024.0))
+#define GIGABYTES(bytes) ((bytes) / (1024.0 * 1024.0 * 1024.0))
+
+void print_ptex_tile_pack_stats(const char* name, ptex_tile_pack_stats* stats, ptex_read_stats* ptex_stats)
+{
+	printf("Tile pack for %s: %.2fMB on disk (%.2fx the ptex file), %.2fMB of tiles decode to %.2fMB (%.2f:1)\n",
+		name,
+		MEGABYTES(stats->file_size), stats->file_size / (double)stats->source_size,
+		MEGABYTES(stats->compressed_bytes), MEGABYTES(stats->raw_bytes), stats->raw_bytes / (double)stats->compressed_bytes);
+
+	printf("  Decoded and uploaded in %.2fms on %d threads: %.2fGB/s, %.2fGB/s per thread decoding\n",
+		stats->wall_seconds * 1000.0, stats->threads,
+		GIGABYTES(stats->raw_bytes) / stats->wall_seconds,
+		GIGABYTES(stats->raw_bytes) / stats->decode_seconds);
+
+	if (ptex_stats != NULL)
+	{
+		printf("  Ptex: %.2fMB on disk, read %.2fMB in %.2fms: %.2fGB/s\n",
+			MEGABYTES(ptex_stats->file_size), MEGABYTES(ptex_stats->bytes),
+			ptex_stats->seconds * 1000.0, GIGABYTES(ptex_stats->bytes) / ptex_stats->seconds);
+	}
+}
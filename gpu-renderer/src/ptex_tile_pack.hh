@@ -0,0 +1,87 @@
+#ifndef PTEX_TILE_PACK_H
+#define PTEX_TILE_PACK_H
+
+#include "ptex_utils.hh"
+
+// A .ptexlz file holds the same data as a .ptexpack but every face is stored
+// as its own independently compressed tile (the face's slice of every mip level),
+// with an index of tile offsets so any face can be found and decoded on its own.
+// Loading decodes the tiles on the job threads and uploads them on the main thread
+// as they come in.
+
+#define PTEX_TILE_PACK_MAGIC 0x5A4C5450 // "PTLZ"
+#define PTEX_TILE_PACK_VERSION 5
+
+#define PTEX_TILE_PACK_EXTENSION ".ptexlz"
+
+enum ptex_tile_codec {
+	PTEX_TILE_CODEC_RAW = 0,
+	PTEX_TILE_CODEC_LZ4 = 1,
+};
+
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+
+	uint64_t source_size;
+	int64_t source_mtime;
+	uint64_t source_hash;
+
+	int32_t num_faces;
+	int32_t num_resolutions;
+	int32_t tex_index_size;
+	int32_t codec;
+
+	uint64_t face_table_offset;
+	uint64_t tile_index_offset;
+} ptex_tile_pack_header;
+
+typedef struct {
+	int32_t width, height, slices, levels;
+	// GL_RGBA8 or a block compressed format, see ptex_compress.hh.
+	uint32_t internal_format;
+	int32_t padding;
+} ptex_tile_pack_resolution;
+
+typedef struct {
+	uint64_t offset;
+	// A tile that didn't get smaller is stored as is, then compressed_size == raw_size.
+	uint32_t compressed_size;
+	uint32_t raw_size;
+} ptex_tile_entry;
+
+typedef struct {
+	uint64_t file_size;
+	uint64_t source_size;
+	uint64_t compressed_bytes;
+	uint64_t raw_bytes;
+
+	int threads;
+	// Time spent decompressing summed over all threads.
+	double decode_seconds;
+	// Time from the first tile being queued to the last tile being uploaded.
+	double wall_seconds;
+} ptex_tile_pack_stats;
+
+typedef struct {
+	uint64_t file_size;
+	uint64_t bytes;
+	double seconds;
+} ptex_read_stats;
+
+extern bool g_use_ptex_tile_pack;
+// Also time reading the .ptx through Ptex when loading from a tile pack.
+extern bool g_compare_ptex_read;
+
+// Returns false if there is no tile pack or it is out of date with the ptex file.
+bool load_ptex_tile_pack(const char* pack_path, const char* ptex_path, const char* name, GLenum mag_filter, GLenum min_filter, gl_ptex_data* data, ptex_tile_pack_stats* stats);
+
+// Reads back the uploaded texture arrays and writes them as a tile pack.
+bool write_ptex_tile_pack(const char* pack_path, const char* ptex_path, gl_ptex_data data);
+
+// Times opening ptex_path and reading the data of every face.
+bool read_ptex_for_comparison(const char* ptex_path, ptex_read_stats* stats);
+
+void print_ptex_tile_pack_stats(const char* name, ptex_tile_pack_stats* stats, ptex_read_stats* ptex_stats);
+
+#endif // !PTEX_TILE_PACK_H
@@ -2,38 +2,33 @@
 #include "ptex_utils.hh"
 
 #include "util.hh"
+#include "ptex_mips.hh"
+#include "ptex_atlas.hh"
+#include "ptex_order.hh"
+#include "ptex_dedup.hh"
+#include "ptex_gutter.hh"
+#include "pixel_convert.hh"
 
 #include <assert.h>
 #include <stb_image_write.h>
+#include <algorithm>
 #include <vector>
 
+int g_ptex_max_array_layers = 0;
+
+GLenum g_ptex_gray_format = GL_RG8;
+GLenum g_ptex_rgb_format = GL_RGBA8;
+
 void* data_to_rgba(void* _data, int width, int height, int num_channels)
 {
 	rgba8_t* result = (rgba8_t*)malloc(width * height * 4 * sizeof(uint8_t));
+	size_t count = (size_t)width * height;
 
 	if (num_channels == 1) {
-		uint8_t* data = (uint8_t*)_data;
-		for (size_t y = 0; y < height; y++)
-		{
-			for (size_t x = 0; x < width; x++)
-			{
-				int index = y * width + x;
-				uint8_t gray = data[index];
-				result[index] = { gray, gray, gray, 255 };
-			}
-		}
+		convert_gray8_to_rgba8((const uint8_t*)_data, result, count);
 	}
 	else if (num_channels == 3) {
-		rgb8_t* data = (rgb8_t*)_data;
-		for (size_t y = 0; y < height; y++)
-		{
-			for (size_t x = 0; x < width; x++)
-			{
-				int index = y * width + x;
-				rgb8_t color = data[index];
-				result[index] = { color.r, color.g, color.b, 255 };
-			}
-		}
+		convert_rgb8_to_rgba8((const rgb8_t*)_data, result, count);
 	}
 	else if (num_channels == 4) {
 		memcpy(result, _data, width * height * 4 * sizeof(uint8_t));
@@ -43,6 +38,167 @@ void* data_to_rgba(void* _data, int width, int height, int num_channels)
 	return result;
 }
 
+GLenum ptex_array_format(Ptex::DataType data_type, int num_channels)
+{
+	switch (data_type)
+	{
+	case Ptex::dt_uint16:
+		return num_channels == 1 ? GL_R16 : num_channels == 3 ? GL_RGB16 : GL_RGBA16;
+	case Ptex::dt_half:
+		return num_channels == 1 ? GL_R16F : num_channels == 3 ? GL_RGB16F : GL_RGBA16F;
+	case Ptex::dt_float:
+		return num_channels == 1 ? GL_R32F : num_channels == 3 ? GL_RGB32F : GL_RGBA32F;
+	default:
+		break;
+	}
+
+	switch (num_channels)
+	{
+	case 1: return g_ptex_gray_format;
+	case 3: return g_ptex_rgb_format;
+	default: return GL_RGBA8;
+	}
+}
+
+int ptex_texel_size(GLenum internal_format)
+{
+	switch (internal_format)
+	{
+	case GL_R8: return 1;
+	case GL_RG8: return 2;
+	case GL_RGB5_A1: return 2;
+	case GL_RGBA8: return 4;
+	case GL_R16: return 2;
+	case GL_RGB16: return 6;
+	case GL_RGBA16: return 8;
+	case GL_R16F: return 2;
+	case GL_RGB16F: return 6;
+	case GL_RGBA16F: return 8;
+	case GL_R32F: return 4;
+	case GL_RGB32F: return 12;
+	case GL_RGBA32F: return 16;
+	default: return 0;
+	}
+}
+
+void ptex_texel_transfer_format(GLenum internal_format, GLenum* format, GLenum* type)
+{
+	switch (internal_format)
+	{
+	case GL_R8: *format = GL_RED; *type = GL_UNSIGNED_BYTE; break;
+	case GL_RG8: *format = GL_RG; *type = GL_UNSIGNED_BYTE; break;
+	case GL_RGB5_A1: *format = GL_RGBA; *type = GL_UNSIGNED_SHORT_5_5_5_1; break;
+	case GL_RGBA8: *format = GL_RGBA; *type = GL_UNSIGNED_BYTE; break;
+	case GL_R16: *format = GL_RED; *type = GL_UNSIGNED_SHORT; break;
+	case GL_RGB16: *format = GL_RGB; *type = GL_UNSIGNED_SHORT; break;
+	case GL_RGBA16: *format = GL_RGBA; *type = GL_UNSIGNED_SHORT; break;
+	case GL_R16F: *format = GL_RED; *type = GL_HALF_FLOAT; break;
+	case GL_RGB16F: *format = GL_RGB; *type = GL_HALF_FLOAT; break;
+	case GL_RGBA16F: *format = GL_RGBA; *type = GL_HALF_FLOAT; break;
+	case GL_R32F: *format = GL_RED; *type = GL_FLOAT; break;
+	case GL_RGB32F: *format = GL_RGB; *type = GL_FLOAT; break;
+	case GL_RGBA32F: *format = GL_RGBA; *type = GL_FLOAT; break;
+	default: assert(false); break;
+	}
+}
+
+bool ptex_data_is_rgba8(Ptex::DataType data_type)
+{
+	return data_type == Ptex::dt_uint8;
+}
+
+uint64_t ptex_data_size(Ptex::PtexTexture* ptex)
+{
+	uint64_t texels = 0;
+	for (int i = 0; i < ptex->numFaces(); i++)
+		texels += ptex->getFaceInfo(i).res.size();
+
+	return texels * Ptex::DataSize(ptex->dataType()) * ptex->numChannels();
+}
+
+void convert_rgba8_texels(const rgba8_t* src, size_t count, GLenum internal_format, void* dst)
+{
+	switch (internal_format)
+	{
+	case GL_R8:
+	{
+		uint8_t* texels = (uint8_t*)dst;
+		for (size_t i = 0; i < count; i++)
+			texels[i] = src[i].r;
+		break;
+	}
+	case GL_RG8:
+	{
+		uint8_t* texels = (uint8_t*)dst;
+		for (size_t i = 0; i < count; i++)
+		{
+			rgba8_t texel = src[i];
+			texels[2 * i + 0] = texel.r;
+			texels[2 * i + 1] = texel.a;
+		}
+		break;
+	}
+	case GL_RGB5_A1:
+	{
+		// Rounded to the nearest 5 bit value, the alpha of ptex data is either 0 or 255.
+		uint16_t* texels = (uint16_t*)dst;
+		for (size_t i = 0; i < count; i++)
+		{
+			rgba8_t texel = src[i];
+			texels[i] = (uint16_t)(
+				((texel.r * 31 + 127) / 255) << 11 |
+				((texel.g * 31 + 127) / 255) << 6 |
+				((texel.b * 31 + 127) / 255) << 1 |
+				(texel.a >= 128 ? 1 : 0));
+		}
+		break;
+	}
+	case GL_RGBA8:
+		if (dst != src)
+			memcpy(dst, src, count * sizeof(rgba8_t));
+		break;
+	default:
+		assert(false);
+		break;
+	}
+}
+
+void set_ptex_array_swizzle(GLenum internal_format)
+{
+	GLint swizzle[4] = { GL_RED, GL_GREEN, GL_BLUE, GL_ALPHA };
+	if (internal_format == GL_R8 || internal_format == GL_R16 || internal_format == GL_R16F || internal_format == GL_R32F)
+	{
+		GLint gray[4] = { GL_RED, GL_RED, GL_RED, GL_ONE };
+		memcpy(swizzle, gray, sizeof(swizzle));
+	}
+	else if (internal_format == GL_RG8)
+	{
+		GLint gray_coverage[4] = { GL_RED, GL_RED, GL_RED, GL_GREEN };
+		memcpy(swizzle, gray_coverage, sizeof(swizzle));
+	}
+
+	glTexParameteriv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+}
+
+bool ptex_format_has_coverage(GLenum internal_format)
+{
+	switch (internal_format)
+	{
+	case GL_R8:
+	case GL_R16:
+	case GL_RGB16:
+	case GL_R16F:
+	case GL_RGB16F:
+	case GL_R32F:
+	case GL_RGB32F:
+	// The border of an RGB DXT1 array reads back with alpha 1, BC1 arrays use the RGBA variant.
+	case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+		return false;
+	default:
+		return true;
+	}
+}
+
 gl_ptex_textures extract_textures(Ptex::PtexTexture* tex) {
 
 	int num_faces = tex->numFaces();
@@ -58,7 +214,6 @@ gl_ptex_textures extract_textures(Ptex::PtexTexture* tex) {
 	{
 		auto face_info = tex->getFaceInfo(i);
 		
-		assert(tex->dataType() == Ptex::DataType::dt_uint8);
 		assert(tex->numChannels() == 4  || tex->numChannels() == 3 || tex->numChannels() == 1);
 
 		// DataSize(dataType()) * numChannels() * getFaceInfo(faceid).res.size()
@@ -67,8 +222,13 @@ gl_ptex_textures extract_textures(Ptex::PtexTexture* tex) {
 
 		tex->getData(i, data, 0);
 
-		void* rgba_data = data_to_rgba(data, face_info.res.u(), face_info.res.v(), tex->numChannels());
-		free(data);
+		// The other data types are uploaded as Ptex returns them.
+		void* rgba_data = data;
+		if (ptex_data_is_rgba8(tex->dataType()))
+		{
+			rgba_data = data_to_rgba(data, face_info.res.u(), face_info.res.v(), tex->numChannels());
+			free(data);
+		}
 
 		int width = face_info.res.u();
 		int height = face_info.res.v();
@@ -130,6 +290,7 @@ gl_ptex_textures extract_textures(Ptex::PtexTexture* tex) {
 
 	gl_ptex_textures result;
 
+	result.ptex = tex;
 	result.num_faces = tex->numFaces();
 
 	result.num_resolutions = res_textures.size();
@@ -163,133 +324,404 @@ gl_ptex_textures extract_textures(Ptex::PtexTexture* tex) {
 	return result;
 }
 
-gl_ptex_data create_gl_texture_arrays(const char* name, gl_ptex_textures textures, GLenum mag_filter, GLenum min_filter) {
-	GLuint* gl_textures = alloc_array(GLuint, textures.num_resolutions);
-	glGenTextures(textures.num_resolutions, gl_textures);
+void free_ptex_textures(gl_ptex_textures textures)
+{
+	for (int i = 0; i < textures.num_resolutions; i++)
+	{
+		ptex_res_textures* res_textures = &textures.resolutions[i];
+		for (int j = 0; j < res_textures->num_textures; j++)
+			free(res_textures->textures[j].data);
 
-	glActiveTexture(GL_TEXTURE0);
+		free(res_textures->textures);
+	}
 
-	TexIndex* face_indices = new TexIndex[textures.num_faces];
+	free(textures.resolutions);
+}
 
-	for (int i = 0; i < textures.num_resolutions; i++)
+TexIndex make_tex_index(int tex_index, int slice, const int neighbors[4], const int edges[4])
+{
+	TexIndex index;
+	index.texIndex = (uint32_t)tex_index;
+	index.texSilce = (uint32_t)slice;
+	index.tile = 0;
+
+	for (int i = 0; i < 4; i++)
 	{
-		ptex_res_textures* res_textures = &textures.resolutions[i];
+		// Ptex uses -1 for a missing neighbor, which is NO_PTEX_NEIGHBOR.
+		index.neighborIndexes[i] = (uint32_t)neighbors[i];
+		index.neighborTransforms[i] = (uint8_t)(i << 2 | edges[i]);
+	}
 
-		Ptex::Res res = res_textures->res;
+	return index;
+}
+
+TexIndex make_constant_tex_index(rgba8_t color, Ptex::Res res, const int neighbors[4], const int edges[4])
+{
+	TexIndex index = make_tex_index(0, 0, neighbors, edges);
+	index.texIndex = PTEX_CONSTANT_FACE;
+	index.texSilce = (uint32_t)color.r | (uint32_t)color.g << 8 | (uint32_t)color.b << 16 | (uint32_t)color.a << 24;
+	index.tile = (uint32_t)res.ulog2 | (uint32_t)res.vlog2 << 4;
+	return index;
+}
+
+uint32_t make_ptex_tile(int u_shift, int v_shift, int x, int y)
+{
+	assert(u_shift >= 0 && u_shift <= PTEX_TILE_MAX_LOG2 && v_shift >= 0 && v_shift <= PTEX_TILE_MAX_LOG2);
+	assert(x >= 0 && x < (1 << u_shift) && y >= 0 && y < (1 << v_shift));
+
+	return (uint32_t)u_shift | (uint32_t)v_shift << 4 | (uint32_t)x << 8 | (uint32_t)y << 20;
+}
+
+void ptex_tile_rect(uint32_t tile, int width, int height, int level, int* x, int* y, int* tile_width, int* tile_height)
+{
+	int u_shift = tile & 0xF;
+	int v_shift = (tile >> 4) & 0xF;
 
-		glBindTexture(GL_TEXTURE_2D_ARRAY, gl_textures[i]);
+	*tile_width = (width >> u_shift) >> level;
+	*tile_height = (height >> v_shift) >> level;
+	assert(*tile_width >= 1 && *tile_height >= 1);
+
+	*x = (int)((tile >> 8) & 0xFFF) * *tile_width;
+	*y = (int)(tile >> 20) * *tile_height;
+}
+
+int ptex_num_mip_levels(int width, int height)
+{
+	int levels = 1;
+	while (width > 1 || height > 1)
+	{
+		width = width > 1 ? width / 2 : 1;
+		height = height > 1 ? height / 2 : 1;
+		levels++;
+	}
+	return levels;
+}
+
+int ptex_max_array_layers()
+{
+	int max_layers;
+	glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &max_layers);
+
+	if (g_ptex_max_array_layers > 0 && g_ptex_max_array_layers < max_layers)
+		max_layers = g_ptex_max_array_layers;
+
+	return max_layers;
+}
 
-		if (has_KHR_debug)
+int ptex_num_array_parts(int slices, int max_layers)
+{
+	return (slices + max_layers - 1) / max_layers;
+}
+
+int ptex_resolution_array_count(Ptex::PtexTexture* ptex, int max_layers)
+{
+	std::vector<Ptex::Res> resolutions;
+	std::vector<int> resolution_faces;
+	for (int i = 0; i < ptex->numFaces(); i++)
+	{
+		Ptex::Res res = ptex->getFaceInfo(i).res;
+
+		size_t r = std::find(resolutions.begin(), resolutions.end(), res) - resolutions.begin();
+		if (r == resolutions.size())
 		{
-			char name[256];
-			sprintf(name, "ARRTEX: ptex%d %dx%d", i, res.u(), res.v());
-			glObjectLabel(GL_TEXTURE, gl_textures[i], -1, name);
+			resolutions.push_back(res);
+			resolution_faces.push_back(0);
 		}
+		resolution_faces[r]++;
+	}
 
-		int max_layers;
-		glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &max_layers);
+	int num_arrays = 0;
+	for (size_t r = 0; r < resolutions.size(); r++)
+		num_arrays += ptex_num_array_parts(resolution_faces[r], max_layers);
+	return num_arrays;
+}
 
-		assert(res_textures->num_textures < max_layers);
+void set_ptex_array_texture_params(GLenum mag_filter, GLenum min_filter)
+{
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
 
-		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, res.u(), res.v(), res_textures->num_textures, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	vec4_t border = { 0, 0, 0, 0 };
+	glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, (float*)&border);
 
-		for (int j = 0; j < res_textures->num_textures; j++)
-		{
-			assert(i < UINT16_MAX);
-			assert(j < UINT16_MAX);
-
-			ptex_face_texture* texture = &res_textures->textures[j];
-			uint16_t neighbor0 = texture->neighbors[0];
-			uint16_t neighbor1 = texture->neighbors[1];
-			uint16_t neighbor2 = texture->neighbors[2];
-			uint16_t neighbor3 = texture->neighbors[3];
-
-			uint8_t n0_transform = 0 << 2 | texture->edges[0];
-			uint8_t n1_transform = 1 << 2 | texture->edges[1];
-			uint8_t n2_transform = 2 << 2 | texture->edges[2];
-			uint8_t n3_transform = 3 << 2 | texture->edges[3];
-
-			// texIndex, texSilce
-			/*printf("alignof(TexIndex) = %zd, sizeof(TexIndex) = %zd\n", alignof(TexIndex), sizeof(TexIndex));
-			printf("offsetof(TexIndex.texIndex) = %zd\n", offsetof(TexIndex, texIndex));
-			printf("offsetof(TexIndex.texSilced) = %zd\n", offsetof(TexIndex, texSilce));
-			printf("offsetof(TexIndex.neighborIndexes) = %zd\n", offsetof(TexIndex, neighborIndexes));
-			printf("offsetof(TexIndex.neighborTransforms) = %zd\n", offsetof(TexIndex, neighborTransforms));
-
-			if (res_textures->textures[j].face_id == 0)
-			{
-				printf("\n");
-			}*/
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, mag_filter);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, min_filter);
 
-			face_indices[res_textures->textures[j].face_id] = { 
-				(uint16_t)i, (uint16_t)j,
-				neighbor0,neighbor1,neighbor2,neighbor3, // neihgbor indices
-				n0_transform, n1_transform, n2_transform, n3_transform, // neighbor transforms
-			};
-			//face_indices->add({ (uint16_t)i, (uint16_t)j });
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BASE_LEVEL, 0);
+}
+
+bool ptex_face_table_fits(const char* name, int num_faces)
+{
+	static_assert(sizeof(TexIndex) == 2 * 4 * sizeof(uint32_t), "TexIndex must be two RGBA32UI texels");
+
+	GLint max_texels;
+	glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &max_texels);
+	if ((int64_t)num_faces * 2 > max_texels)
+	{
+		printf("The face table of %s needs %lld texels, the driver only supports buffer textures of %d texels!\n", name, (long long)num_faces * 2, max_texels);
+		return false;
+	}
+
+	return true;
+}
+
+bool create_ptex_face_data_buffer(const char* name, TexIndex* face_indices, int num_faces, GLuint* buffer, GLuint* texture)
+{
+	*buffer = 0;
+	*texture = 0;
+	if (ptex_face_table_fits(name, num_faces) == false)
+		return false;
+
+	glGenBuffers(1, buffer);
+	glBindBuffer(GL_TEXTURE_BUFFER, *buffer);
+	glBufferData(GL_TEXTURE_BUFFER, num_faces * sizeof(TexIndex), face_indices, GL_STATIC_DRAW);
+
+	glGenTextures(1, texture);
+	glBindTexture(GL_TEXTURE_BUFFER, *texture);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32UI, *buffer);
+
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
 
-			glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, j, res.u(), res.v(), 1, GL_RGBA, GL_UNSIGNED_BYTE, res_textures->textures[j].data);
+	if (has_KHR_debug)
+	{
+		char label[128];
+		sprintf(label, "TBO: %s faces", name);
+		glObjectLabel(GL_BUFFER, *buffer, -1, label);
+		glObjectLabel(GL_TEXTURE, *texture, -1, label);
+	}
+
+	return true;
+}
+
+gl_ptex_data create_gl_texture_arrays(const char* name, gl_ptex_textures textures, GLenum mag_filter, GLenum min_filter) {
+	int resolution_arrays = ptex_resolution_array_count(textures.ptex, ptex_max_array_layers());
+	bool too_many_arrays = resolution_arrays > PTEX_MAX_SAMPLED_ARRAYS;
+	if (too_many_arrays && g_ptex_atlas_faces == false)
+		printf("%s needs %d arrays with one per resolution, the shaders sample at most %d so it uses the atlas.\n", name, resolution_arrays, PTEX_MAX_SAMPLED_ARRAYS);
+
+	if (g_ptex_atlas_faces || too_many_arrays)
+	{
+		gl_ptex_data data;
+		if (create_gl_atlas_arrays(name, textures, mag_filter, min_filter, &data))
+		{
+			free_ptex_textures(textures);
+			return data;
 		}
+	}
 
-		glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
-		
-		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+	// Resolutions with more faces than the driver allows layers are split over several arrays,
+	// the face table has the array of each face.
+	int max_layers = ptex_max_array_layers();
 
-		vec4_t border = { 0, 0, 0, 0 };
-		glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, (float*)&border);
+	GLenum internal_format = ptex_array_format(textures.ptex->dataType(), textures.ptex->numChannels());
+	bool rgba8_faces = ptex_data_is_rgba8(textures.ptex->dataType());
 
-		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, mag_filter);
-		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, min_filter);
+	TexIndex* face_indices = new TexIndex[textures.num_faces];
+
+	// Constant and duplicate faces don't get slices, the counts below are of the faces left.
+	custom_arrays::array_t<ptex_duplicate_face> duplicates(16);
+	ptex_dedup_stats dedup_stats;
+	dedup_ptex_faces(textures, internal_format, face_indices, &duplicates, &dedup_stats);
+
+	// The layout the faces would get in file order, to compare against in the cache simulation.
+	TexIndex* file_indices = NULL;
+	if (g_ptex_slice_order != PTEX_SLICE_ORDER_FILE)
+	{
+		file_indices = new TexIndex[textures.num_faces];
+		memcpy(file_indices, face_indices, textures.num_faces * sizeof(TexIndex));
+
+		int first_array = 0;
+		for (int i = 0; i < textures.num_resolutions; i++)
+		{
+			ptex_res_textures* res_textures = &textures.resolutions[i];
+			for (int j = 0; j < res_textures->num_textures; j++)
+			{
+				ptex_face_texture* texture = &res_textures->textures[j];
+				file_indices[texture->face_id] = make_tex_index(first_array + j / max_layers, j % max_layers, texture->neighbors, texture->edges);
+			}
 
-		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BASE_LEVEL, 0);
+			first_array += ptex_num_array_parts(res_textures->num_textures, max_layers);
+		}
 	}
 
-	custom_arrays::array_t<array_texture_t>* array_textures = new custom_arrays::array_t<array_texture_t>(textures.num_resolutions);
+	sort_ptex_res_textures(textures);
+
+	int num_arrays = 0;
+	for (int i = 0; i < textures.num_resolutions; i++)
+		num_arrays += ptex_num_array_parts(textures.resolutions[i].num_textures, max_layers);
+
+	GLenum transfer_format, transfer_type;
+	ptex_texel_transfer_format(internal_format, &transfer_format, &transfer_type);
+
+	GLuint* gl_textures = alloc_array(GLuint, num_arrays);
+	glGenTextures(num_arrays, gl_textures);
+
+	glActiveTexture(GL_TEXTURE0);
+
+	ptex_mip_stats mip_stats = {};
+
+	custom_arrays::array_t<array_texture_t>* array_textures = new custom_arrays::array_t<array_texture_t>(num_arrays);
 
 	for (int i = 0; i < textures.num_resolutions; i++)
 	{
-		array_texture_t tex;
+		ptex_res_textures* res_textures = &textures.resolutions[i];
 
-		tex.width = textures.resolutions[i].res.u();
-		tex.height = textures.resolutions[i].res.v();
-		tex.slices = textures.resolutions[i].num_textures;
-		
-		tex.texture = gl_textures[i];
+		Ptex::Res res = res_textures->res;
 
-		tex.wrap_s = GL_CLAMP_TO_BORDER;
-		tex.wrap_t = GL_CLAMP_TO_BORDER;
-		
-		tex.mag_filter = mag_filter;
-		tex.min_filter = min_filter;
-		
-		tex.is_sRGB = false;
+		int num_parts = ptex_num_array_parts(res_textures->num_textures, max_layers);
+		for (int part = 0; part < num_parts; part++)
+		{
+			int array_index = array_textures->size;
+			int first = part * max_layers;
+			int slices = std::min(max_layers, res_textures->num_textures - first);
+
+			glBindTexture(GL_TEXTURE_2D_ARRAY, gl_textures[array_index]);
+
+			if (has_KHR_debug)
+			{
+				char name[256];
+				if (num_parts > 1)
+					sprintf(name, "ARRTEX: ptex%d %dx%d (%d/%d)", i, res.u(), res.v(), part + 1, num_parts);
+				else
+					sprintf(name, "ARRTEX: ptex%d %dx%d", i, res.u(), res.v());
+				glObjectLabel(GL_TEXTURE, gl_textures[array_index], -1, name);
+			}
+
+			glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, internal_format, res.u(), res.v(), slices, 0, transfer_format, transfer_type, NULL);
+
+			// The faces stay RGBA8 for the mips, each one is converted on its way to the driver.
+			void* texels = NULL;
+			if (rgba8_faces && internal_format != GL_RGBA8)
+				texels = malloc(res.size() * ptex_texel_size(internal_format));
+
+			for (int j = 0; j < slices; j++)
+			{
+				ptex_face_texture* texture = &res_textures->textures[first + j];
+
+				face_indices[texture->face_id] = make_tex_index(array_index, j, texture->neighbors, texture->edges);
 
-		array_textures->add(tex);
+				const void* face_texels = texture->data;
+				if (texels != NULL)
+				{
+					convert_rgba8_texels((const rgba8_t*)texture->data, res.size(), internal_format, texels);
+					face_texels = texels;
+				}
+
+				glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, j, res.u(), res.v(), 1, transfer_format, transfer_type, face_texels);
+			}
+
+			free(texels);
+
+			// The cpu mips are built from RGBA8 reductions, the other data types use the driver's.
+			if (g_cpu_ptex_mips && rgba8_faces)
+			{
+				int* slice_faces = alloc_array(int, slices);
+				const void** slice_data = alloc_array(const void*, slices);
+				for (int j = 0; j < slices; j++)
+				{
+					slice_faces[j] = res_textures->textures[first + j].face_id;
+					slice_data[j] = res_textures->textures[first + j].data;
+				}
+
+				generate_ptex_array_mips(textures.ptex, internal_format, res.u(), res.v(), slices, slice_faces, slice_data, &mip_stats);
+
+				free(slice_faces);
+				free(slice_data);
+			}
+			else
+			{
+				glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+			}
+
+			// Nothing reads the faces of this array after the upload.
+			for (int j = 0; j < slices; j++)
+			{
+				free(res_textures->textures[first + j].data);
+				res_textures->textures[first + j].data = NULL;
+			}
+
+			set_ptex_array_texture_params(mag_filter, min_filter);
+			set_ptex_array_swizzle(internal_format);
+
+			array_texture_t tex;
+
+			tex.width = res.u();
+			tex.height = res.v();
+			tex.slices = slices;
+			
+			tex.texture = gl_textures[array_index];
+			tex.internal_format = internal_format;
+
+			tex.wrap_s = GL_CLAMP_TO_BORDER;
+			tex.wrap_t = GL_CLAMP_TO_BORDER;
+			
+			tex.mag_filter = mag_filter;
+			tex.min_filter = min_filter;
+			
+			tex.is_sRGB = false;
+
+			array_textures->add(tex);
+		}
 	}
 
+	if (num_arrays > textures.num_resolutions)
+		printf("Split the %d resolutions of %s into %d arrays of at most %d layers\n", textures.num_resolutions, name, num_arrays, max_layers);
+
 	free(gl_textures);
 
-	GLuint face_data_buffer;
-	glGenBuffers(1, &face_data_buffer);
-	glBindBuffer(GL_UNIFORM_BUFFER, face_data_buffer);
+	print_ptex_mip_stats(name, &mip_stats);
 
-	if (has_KHR_debug)
+	resolve_ptex_duplicates(&duplicates, face_indices);
+	print_ptex_dedup_stats(name, &dedup_stats);
+
+	ptex_cache_sim_stats file_stats = {};
+	if (file_indices != NULL)
 	{
-		char label[128];
-		sprintf(label, "UBO: %s", name);
-		glObjectLabel(GL_BUFFER, face_data_buffer, -1, label);
+		resolve_ptex_duplicates(&duplicates, file_indices);
+		simulate_ptex_slice_cache(textures.ptex, file_indices, array_textures, &file_stats);
 	}
 
-	glBufferData(GL_UNIFORM_BUFFER, textures.num_faces * sizeof(TexIndex), face_indices, GL_STATIC_DRAW);
+	ptex_cache_sim_stats cache_stats;
+	simulate_ptex_slice_cache(textures.ptex, face_indices, array_textures, &cache_stats);
+	print_ptex_cache_sim_stats(name, g_ptex_slice_order, &file_stats, &cache_stats);
 
-	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	delete[] file_indices;
+	free(duplicates.arr);
+	free_ptex_textures(textures);
 
 	gl_ptex_data data;
 	data.array_textures = array_textures;
 	data.face_tex_indices = new custom_arrays::array_t<TexIndex>(face_indices, textures.num_faces);
 
-	data.face_data_buffer = face_data_buffer;
+	create_ptex_face_data_buffer(name, face_indices, textures.num_faces, &data.face_data_buffer, &data.face_data_texture);
+	data.face_placeholder_texture = 0;
+	data.gutter_array_textures = NULL;
+	data.gutter_face_data_buffer = 0;
+	data.gutter_face_data_texture = 0;
+	data.gutter_width = 0;
 
 	return data;
 }
+
+void destroy_gl_ptex_data(gl_ptex_data* data)
+{
+	destroy_gutter_texture_arrays(data);
+
+	for (int i = 0; i < data->array_textures->size; i++)
+	{
+		glDeleteTextures(1, &data->array_textures->arr[i].texture);
+	}
+
+	free(data->array_textures->arr);
+	delete data->array_textures;
+
+	delete[] data->face_tex_indices->arr;
+	delete data->face_tex_indices;
+
+	glDeleteTextures(1, &data->face_data_texture);
+	glDeleteBuffers(1, &data->face_data_buffer);
+	glDeleteTextures(1, &data->face_placeholder_texture);
+
+	*data = {};
+}
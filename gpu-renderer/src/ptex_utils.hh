@@ -3,6 +3,7 @@
 
 #include "array.hh"
 #include "gl_utils.hh"
+#include "util.hh"
 
 #include <stdint.h>
 #include <Ptexture.h>
@@ -21,6 +22,7 @@ typedef struct {
 } ptex_res_textures;
 
 typedef struct {
+	Ptex::PtexTexture* ptex;
 	int num_faces;
 	int num_resolutions;
 	ptex_res_textures* resolutions;
@@ -33,21 +35,139 @@ typedef struct {
 	uint16_t texSlice;
 } PTexParameters;
 
+// One entry of the face table, it's read in the shaders as two RGBA32UI texels
+// of a buffer texture. NO_PTEX_NEIGHBOR marks an edge without an adjacent face.
 typedef struct {
-	uint16_t texIndex, texSilce;
-	uint16_t neighborIndexes[4];
+	uint32_t texIndex, texSilce;
 	uint8_t neighborTransforms[4];
+	// 0 if the face fills its slice, otherwise where it's packed in the slice (see make_ptex_tile).
+	uint32_t tile;
+	uint32_t neighborIndexes[4];
 } TexIndex;
 
+#define NO_PTEX_NEIGHBOR 0xFFFFFFFFu
+
+// texIndex of a constant face, it has no slice. texSilce is its RGBA8 color and tile is
+// ulog2 | vlog2 << 4, so the shaders can still compute its coverage (see ptex_dedup.hh).
+#define PTEX_CONSTANT_FACE 0xFFFFFFFFu
+
+// A face of (slice width >> u_shift) x (slice height >> v_shift) texels at
+// (x << u_shift, y << v_shift) is packed as 4 bits per shift and 12 bits per position,
+// which covers faces down to a texel in slices up to PTEX_TILE_MAX_LOG2.
+#define PTEX_TILE_MAX_LOG2 12
+
+uint32_t make_ptex_tile(int u_shift, int v_shift, int x, int y);
+
+// The texels a face covers in mip level of its width x height slice. Only valid for
+// the levels where the face is at least a texel in both directions.
+void ptex_tile_rect(uint32_t tile, int width, int height, int level, int* x, int* y, int* tile_width, int* tile_height);
+
 typedef struct {
 	custom_arrays::array_t<array_texture_t>* array_textures;
 	custom_arrays::array_t<TexIndex>* face_tex_indices;
 
+	// The TexIndex face table and the RGBA32UI buffer texture the shaders read it through.
 	GLuint face_data_buffer;
+	GLuint face_data_texture;
+
+	// Per face RGBA8 buffer texture of placeholder colors, only set while
+	// the textures are streaming in (see ptex_stream.hh). Alpha is 0 until the face has data.
+	GLuint face_placeholder_texture;
+
+	// Copies of the arrays with a border around every face for the gutter method,
+	// NULL until they are built (see ptex_gutter.hh).
+	custom_arrays::array_t<array_texture_t>* gutter_array_textures;
+	GLuint gutter_face_data_buffer;
+	GLuint gutter_face_data_texture;
+	int gutter_width;
 } gl_ptex_data;
 
+// Storage formats of the arrays of 1 and 3 channel uint8 files, the faces are converted from RGBA8
+// as they're uploaded. GL_RG8 keeps the coverage in green and GL_RGB5_A1 in its 1 bit alpha,
+// so the border still filters to zero coverage like the alpha of GL_RGBA8 does. GL_R8 has
+// nowhere to keep it, the shaders compute the coverage instead (see alphaCoverage).
+extern GLenum g_ptex_gray_format; // GL_RGBA8, GL_RG8 or GL_R8
+extern GLenum g_ptex_rgb_format; // GL_RGBA8 or GL_RGB5_A1
+
+// The array format for the faces of a file with num_channels channels of data_type.
+// uint16, half and float data map directly to the GL_R16, GL_RGB16F, GL_RGBA32F etc. formats
+// of the same channel count. Only their 4 channel formats have coverage in alpha.
+GLenum ptex_array_format(Ptex::DataType data_type, int num_channels);
+
+// True if the faces are expanded to RGBA8 on the cpu (see data_to_rgba), which is what the cpu mips,
+// atlas and gutter textures work on. The faces of the other data types stay in the layout Ptex returns.
+bool ptex_data_is_rgba8(Ptex::DataType data_type);
+
+// Bytes of level 0 face data in the file's own data type.
+uint64_t ptex_data_size(Ptex::PtexTexture* ptex);
+
+// Bytes per texel of an uncompressed array format, 0 for block compressed formats.
+int ptex_texel_size(GLenum internal_format);
+
+// The format and type the texels of an uncompressed array format are uploaded and read back as.
+void ptex_texel_transfer_format(GLenum internal_format, GLenum* format, GLenum* type);
+
+// Converts RGBA8 texels to the texel layout of an uncompressed array format.
+// The texels never get bigger, so dst can be src to convert in place.
+void convert_rgba8_texels(const rgba8_t* src, size_t count, GLenum internal_format, void* dst);
+
+// Sets the swizzle of the bound GL_TEXTURE_2D_ARRAY so 1 channel and GL_RG8 arrays sample as gray RGBA.
+void set_ptex_array_swizzle(GLenum internal_format);
+
+// False if the alpha of the format doesn't fall off to zero at the border.
+bool ptex_format_has_coverage(GLenum internal_format);
+
+// Returns a newly allocated RGBA8 copy of 1, 3 or 4 channel uint8 data.
+void* data_to_rgba(void* data, int width, int height, int num_channels);
+
+// Decodes every face of tex, grouped by resolution. The whole texture is in memory at once,
+// see load_ptex_stream for a load that isn't.
 gl_ptex_textures extract_textures(Ptex::PtexTexture* tex);
 
+// Frees the face data left in textures and the resolution lists.
+void free_ptex_textures(gl_ptex_textures textures);
+
+// Takes ownership of textures, the face data of each array is freed as soon as it's uploaded.
 gl_ptex_data create_gl_texture_arrays(const char* name, gl_ptex_textures textures, GLenum mag_filter, GLenum min_filter);
 
+// Deletes the arrays, the face table and the gutter copies of data, so a model's textures can be loaded again.
+void destroy_gl_ptex_data(gl_ptex_data* data);
+
+// Packs a face's array texture, slice and ptex adjacency into the face table format, the face fills the slice.
+TexIndex make_tex_index(int tex_index, int slice, const int neighbors[4], const int edges[4]);
+
+TexIndex make_constant_tex_index(rgba8_t color, Ptex::Res res, const int neighbors[4], const int edges[4]);
+
+// Number of levels in a full mip chain for a width x height texture.
+int ptex_num_mip_levels(int width, int height);
+
+// Lowers the layer limit below the driver's GL_MAX_ARRAY_TEXTURE_LAYERS when > 0,
+// which makes it possible to test splitting arrays with small models.
+extern int g_ptex_max_array_layers;
+
+// The most faces an array texture can hold, resolutions with more faces are split over several arrays.
+int ptex_max_array_layers();
+
+// Number of arrays slices faces of one resolution are split into.
+int ptex_num_array_parts(int slices, int max_layers);
+
+// The most arrays a model's faces can be in, the intel and hybrid shaders have NUM_TEX 24
+// samplers of each kind. Models that need more with one array per resolution use the atlas.
+#define PTEX_MAX_SAMPLED_ARRAYS 24
+
+// Arrays the faces of ptex need with one array per resolution, counting the constant and
+// duplicate faces that may not get a slice.
+int ptex_resolution_array_count(Ptex::PtexTexture* ptex, int max_layers);
+
+// Sets wrap, border and filter parameters on the currently bound GL_TEXTURE_2D_ARRAY.
+void set_ptex_array_texture_params(GLenum mag_filter, GLenum min_filter);
+
+// The face table is two texels per face and GL 3.3 only guarantees buffer textures of 65536 texels,
+// texelFetch past GL_MAX_TEXTURE_BUFFER_SIZE returns 0. Prints why when it doesn't fit.
+bool ptex_face_table_fits(const char* name, int num_faces);
+
+// Uploads a face table to a buffer and creates the RGBA32UI buffer texture for it.
+// Returns false and leaves both at 0 if the table doesn't fit, see ptex_face_table_fits.
+bool create_ptex_face_data_buffer(const char* name, TexIndex* face_indices, int num_faces, GLuint* buffer, GLuint* texture);
+
 #endif // !PTEX_UTILS_H
\ No newline at end of file
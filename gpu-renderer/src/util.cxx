@@ -22,3 +22,17 @@ char* read_file(const char* filepath) {
 
     return file_buffer;
 }
+
+uint64_t hash_fnv1a(const void* data, size_t size, uint64_t seed)
+{
+    const uint8_t* bytes = (const uint8_t*)data;
+
+    uint64_t hash = seed;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+
+    return hash;
+}
@@ -1,6 +1,7 @@
 #ifndef UTIL_H
 #define UTIL_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 typedef struct {
@@ -13,4 +14,9 @@ typedef struct {
 
 char* read_file(const char* filepath);
 
+#define FNV1A_64_OFFSET 0xcbf29ce484222325ull
+
+// 64-bit FNV-1a, pass a previous hash as seed to continue hashing.
+uint64_t hash_fnv1a(const void* data, size_t size, uint64_t seed = FNV1A_64_OFFSET);
+
 #endif // !UTIL_H
\ No newline at end of file